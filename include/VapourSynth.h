@@ -24,7 +24,7 @@
 #include <stdint.h>
 
 #define VAPOURSYNTH_API_MAJOR 3
-#define VAPOURSYNTH_API_MINOR 2
+#define VAPOURSYNTH_API_MINOR 3
 #define VAPOURSYNTH_API_VERSION ((VAPOURSYNTH_API_MAJOR << 16) | (VAPOURSYNTH_API_MINOR))
 
 /* Convenience for C++ users. */
@@ -181,6 +181,9 @@ typedef struct VSCoreInfo {
     int numThreads;
     int64_t maxFramebufferSize;
     int64_t usedFramebufferSize;
+    /* added in API R3.3 */
+    int64_t framebufferPoolHits;
+    int64_t framebufferPoolMisses;
 } VSCoreInfo;
 
 typedef struct VSVideoInfo {
@@ -223,6 +226,8 @@ typedef void (VS_CC *VSFilterFree)(void *instanceData, VSCore *core, const VSAPI
 /* other */
 typedef void (VS_CC *VSFrameDoneCallback)(void *userData, const VSFrameRef *f, int n, VSNodeRef *, const char *errorMsg);
 typedef void (VS_CC *VSMessageHandler)(int msgType, const char *msg, void *userData);
+typedef void (VS_CC *VSParallelTask)(int index, void *userData);
+typedef void (VS_CC *VSFrameBufferFree)(void *userData);
 
 struct VSAPI {
     VSCore *(VS_CC *createCore)(int threads);
@@ -317,6 +322,14 @@ struct VSAPI {
 
     int (VS_CC *propSetIntArray)(VSMap *map, const char *key, const int64_t *i, int size);
     int (VS_CC *propSetFloatArray)(VSMap *map, const char *key, const double *d, int size);
+
+    /* added in API R3.3 */
+    void (VS_CC *setProfiling)(int enable, VSCore *core);
+    void (VS_CC *getProfile)(VSMap *out, VSCore *core);
+    void (VS_CC *parallelFor)(int count, VSParallelTask task, void *userData, VSCore *core);
+    /* the planes must be aligned to 32 bytes and the strides must be the ones newVideoFrame() would use for the same format and width,
+       returns NULL without calling free otherwise */
+    VSFrameRef *(VS_CC *newVideoFrameExternal)(const VSFormat *format, int width, int height, uint8_t * const *planes, const int *strides, VSFrameBufferFree free, void *userData, const VSFrameRef *propSrc, VSCore *core);
 };
 
 VS_API(const VSAPI *) getVapourSynthAPI(int version);
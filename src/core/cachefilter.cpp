@@ -21,6 +21,7 @@
 #include "cachefilter.h"
 #include "VSHelper.h"
 #include <string>
+#include <vector>
 #include <algorithm>
 
 
@@ -122,35 +123,83 @@ void VSCache::trim(int max, int maxHistory) {
     }
 }
 
-void VSCache::adjustSize(bool needMemory) {
-    if (!fixedSize) {
-        if (!needMemory) {
-            switch (recommendSize()) {
+void CacheInstance::getSizeInfo(CacheSizeInfo &info) {
+    info.node = node;
+    info.fixed = cache.isFixedSize();
+    info.action = info.fixed ? VSCache::caNoChange : cache.recommendSize();
+    info.maxFrames = cache.getMaxFrames();
+    info.frameSize = frameSize;
+    info.frameCost = clip->clip->getFrameCost();
+}
+
+void CacheInstance::setSize(int maxFrames, bool clear) {
+    if (clear)
+        cache.clear();
+    cache.setMaxFrames(maxFrames);
+}
+
+void adjustCacheSizes(const std::set<VSNode *> &caches, MemoryUse &memory, bool needMemory) {
+    std::vector<CacheSizeInfo> infos;
+    infos.reserve(caches.size());
+    for (VSNode *node : caches) {
+        CacheSizeInfo info;
+        node->getCacheInfo(info);
+        if (!info.fixed)
+            infos.push_back(info);
+    }
+
+    // the caches holding the frames that are most expensive to recreate come first
+    std::sort(infos.begin(), infos.end(), [](const CacheSizeInfo &a, const CacheSizeInfo &b) { return a.getValue() > b.getValue(); });
+
+    if (!needMemory) {
+        // growing is limited to the memory that's still available, the most valuable caches get it first
+        int64_t available = static_cast<int64_t>(memory.getLimit()) - static_cast<int64_t>(memory.memoryUse());
+
+        for (const auto &info : infos) {
+            switch (info.action) {
             case VSCache::caClear:
-                clear();
+                info.node->setCacheSize(info.maxFrames, true);
                 break;
             case VSCache::caGrow:
-                setMaxFrames(getMaxFrames() + 2);
+                if (available >= static_cast<int64_t>(2 * info.frameSize)) {
+                    available -= static_cast<int64_t>(2 * info.frameSize);
+                    info.node->setCacheSize(info.maxFrames + 2, false);
+                }
                 break;
             case VSCache::caShrink:
-                setMaxFrames(std::max(getMaxFrames() - 1, 1));
+                info.node->setCacheSize(std::max(info.maxFrames - 1, 1), false);
+                break;
+            default:
                 break;
             }
-        } else {
-            switch (recommendSize()) {
+        }
+    } else {
+        // take memory from the caches with the cheapest frames first and only as much as needed
+        int64_t excess = static_cast<int64_t>(memory.memoryUse()) - static_cast<int64_t>(memory.getLimit());
+
+        for (auto iter = infos.rbegin(); iter != infos.rend(); ++iter) {
+            const CacheSizeInfo &info = *iter;
+            int shrinkBy = 0;
+
+            switch (info.action) {
             case VSCache::caClear:
-                clear();
+                info.node->setCacheSize(info.maxFrames, true);
+                excess -= static_cast<int64_t>(info.maxFrames * info.frameSize);
                 break;
             case VSCache::caShrink:
-                if (getMaxFrames() <= 2)
-                    clear();
-                setMaxFrames(std::max(getMaxFrames() - 2, 1));
+                shrinkBy = 2;
                 break;
             case VSCache::caNoChange:
-                if (getMaxFrames() <= 1)
-                    clear();
-                setMaxFrames(std::max(getMaxFrames() - 1, 1));
-                break;;
+                shrinkBy = 1;
+                break;
+            default:
+                break;
+            }
+
+            if (shrinkBy && excess > 0) {
+                bool clear = (info.maxFrames <= shrinkBy);
+                info.node->setCacheSize(std::max(info.maxFrames - shrinkBy, 1), clear);
+                excess -= static_cast<int64_t>((clear ? info.maxFrames : shrinkBy) * info.frameSize);
             }
         }
     }
@@ -187,6 +236,7 @@ static const VSFrameRef *VS_CC cacheGetframe(int n, int activationReason, void *
     } else if (activationReason == arAllFramesReady) {
         const VSFrameRef *r = vsapi->getFrameFilter(n, c->clip, frameCtx);
         c->cache.insert(n, r->frame);
+        c->frameSize = r->frame->getFrameSize();
         return r;
     }
 
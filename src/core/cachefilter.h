@@ -169,6 +169,10 @@ public:
         return hash.size();
     }
 
+    inline bool isFixedSize() const {
+        return fixedSize;
+    }
+
     inline void clear() {
         hash.clear();
         first = nullptr;
@@ -197,20 +201,33 @@ public:
 
 
     CacheAction recommendSize();
-
-    void adjustSize(bool needMemory);
 private:
     void trim(int max, int maxHistory);
 
 };
 
+struct CacheSizeInfo {
+    VSNode *node;
+    bool fixed;
+    VSCache::CacheAction action;
+    int maxFrames;
+    size_t frameSize;
+    int64_t frameCost;
+
+    // nanoseconds it takes to recreate a byte of a lost frame
+    double getValue() const {
+        return frameSize ? static_cast<double>(frameCost) / frameSize : 0;
+    }
+};
+
 class CacheInstance {
 public:
     VSCache cache;
     VSNodeRef *clip;
     VSNode *node;
     VSCore *core;
-    CacheInstance(VSNodeRef *clip, VSNode *node, VSCore *core, bool fixedSize) : cache(20, 20, fixedSize), clip(clip), node(node), core(core) { }
+    size_t frameSize;
+    CacheInstance(VSNodeRef *clip, VSNode *node, VSCore *core, bool fixedSize) : cache(20, 20, fixedSize), clip(clip), node(node), core(core), frameSize(0) { }
     void addCache() {
         std::lock_guard<std::mutex> lock(core->cacheLock);
         core->caches.insert(node);
@@ -219,8 +236,14 @@ public:
         std::lock_guard<std::mutex> lock(core->cacheLock);
         core->caches.erase(node);
     }
+    void getSizeInfo(CacheSizeInfo &info);
+    void setSize(int maxFrames, bool clear);
 };
 
+// redistributes the memory between all caches based on their recent hit statistics and how expensive
+// the cached frames are to recreate, must be called with the core's cache lock held
+void adjustCacheSizes(const std::set<VSNode *> &caches, MemoryUse &memory, bool needMemory);
+
 void VS_CC cacheInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin);
 
 #endif // CACHEFILTER_H
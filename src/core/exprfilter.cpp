@@ -27,10 +27,24 @@
 #include <stdexcept>
 #include <memory>
 #include <cmath>
+#include <map>
+#include <cstring>
 #include "VapourSynth.h"
 #include "VSHelper.h"
 #include "exprfilter.h"
 
+#if defined(VS_TARGET_CPU_X86) && (defined(__x86_64__) || defined(_M_X64))
+#define VS_EXPR_JIT
+#include "cpufeatures.h"
+#ifdef VS_TARGET_OS_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
 struct split1 {
     enum empties_t { empties_ok, no_empties };
 };
@@ -84,6 +98,656 @@ struct ExprOp {
     }
 };
 
+#ifdef VS_EXPR_JIT
+
+// Compiles the expression of a plane into machine code once at filter creation so no
+// time is spent dispatching operations while processing pixels. Every value on the
+// expression stack is held in two vector registers, the first five stack positions
+// live in registers and deeper ones are spilled to memory. With AVX2 16 pixels are
+// processed per iteration and 8 with SSE2.
+
+typedef void (*ExprProc)(uint8_t * const *rwptrs, intptr_t niterations);
+
+class ExprCompiler {
+    enum { rax = 0, rcx = 1, rdx = 2, rsp = 4, rbp = 5, rsi = 6, rdi = 7, r12 = 12, r13 = 13 };
+    enum { cmpEQ = 0, cmpLT = 1, cmpLE = 2, cmpNLT = 5, cmpNLE = 6 };
+    // xmm/ymm 10-15 are scratch registers, the rest hold the top of the stack
+    enum { T0 = 10, T1, T2, T3, T4, T5 };
+    enum { numRegSlots = 5 };
+
+    struct Operand {
+        bool mem;
+        int reg;
+        int32_t disp;
+        Operand(bool mem, int reg, int32_t disp) : mem(mem), reg(reg), disp(disp) {}
+    };
+
+    static Operand R(int reg) {
+        return Operand(false, reg, 0);
+    }
+
+    static Operand M(int base, int32_t disp) {
+        return Operand(true, base, disp);
+    }
+
+    bool avx2;
+    int vecSize;
+    std::vector<uint8_t> code;
+    std::vector<uint32_t> constants;
+    std::map<uint32_t, int32_t> constantOffsets;
+    size_t constantsPatch;
+
+    void emit8(int v) {
+        code.push_back(static_cast<uint8_t>(v));
+    }
+
+    void emit32(int32_t v) {
+        for (int i = 0; i < 4; i++)
+            emit8((v >> (i * 8)) & 0xFF);
+    }
+
+    void emitModRM(int reg, const Operand &rm) {
+        if (rm.mem) {
+            emit8(0x80 | ((reg & 7) << 3) | (rm.reg & 7));
+            if ((rm.reg & 7) == rsp)
+                emit8(0x24);
+            emit32(rm.disp);
+        } else {
+            emit8(0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+        }
+    }
+
+    // 64 bit general purpose register instructions
+    void emitGPR(int opcode, int reg, const Operand &rm) {
+        emit8(0x48 | ((reg & 8) ? 4 : 0) | ((rm.reg & 8) ? 1 : 0));
+        emit8(opcode);
+        emitModRM(reg, rm);
+    }
+
+    void emitPush(int reg) {
+        if (reg & 8)
+            emit8(0x41);
+        emit8(0x50 | (reg & 7));
+    }
+
+    void emitPop(int reg) {
+        if (reg & 8)
+            emit8(0x41);
+        emit8(0x58 | (reg & 7));
+    }
+
+    // pp selects the 66/F3/F2 prefix, map the 0F/0F38/0F3A opcode map and vvvv is only used with VEX encoding
+    void emitVec(int pp, int map, int opcode, int reg, int vvvv, const Operand &rm, int L = -1, int w = 0) {
+        if (avx2) {
+            emit8(0xC4);
+            emit8(((reg & 8) ? 0 : 0x80) | 0x40 | ((rm.reg & 8) ? 0 : 0x20) | map);
+            emit8((w << 7) | ((~vvvv & 15) << 3) | ((L < 0 ? 1 : L) << 2) | pp);
+        } else {
+            static const uint8_t prefixes[] = { 0, 0x66, 0xF3, 0xF2 };
+            if (pp)
+                emit8(prefixes[pp]);
+            if ((reg & 8) || (rm.reg & 8))
+                emit8(0x40 | ((reg & 8) ? 4 : 0) | ((rm.reg & 8) ? 1 : 0));
+            emit8(0x0F);
+            if (map == 2)
+                emit8(0x38);
+            else if (map == 3)
+                emit8(0x3A);
+        }
+        emit8(opcode);
+        emitModRM(reg, rm);
+    }
+
+    // dst = dst op src
+    void op(int pp, int opcode, int dst, const Operand &src) {
+        emitVec(pp, 1, opcode, dst, dst, src);
+    }
+
+    void addps(int dst, const Operand &src) { op(0, 0x58, dst, src); }
+    void mulps(int dst, const Operand &src) { op(0, 0x59, dst, src); }
+    void subps(int dst, const Operand &src) { op(0, 0x5C, dst, src); }
+    void minps(int dst, const Operand &src) { op(0, 0x5D, dst, src); }
+    void divps(int dst, const Operand &src) { op(0, 0x5E, dst, src); }
+    void maxps(int dst, const Operand &src) { op(0, 0x5F, dst, src); }
+    void andps(int dst, const Operand &src) { op(0, 0x54, dst, src); }
+    void andnps(int dst, const Operand &src) { op(0, 0x55, dst, src); }
+    void orps(int dst, const Operand &src) { op(0, 0x56, dst, src); }
+    void xorps(int dst, const Operand &src) { op(0, 0x57, dst, src); }
+    void paddd(int dst, const Operand &src) { op(1, 0xFE, dst, src); }
+    void psubd(int dst, const Operand &src) { op(1, 0xFA, dst, src); }
+    void pxor(int dst, const Operand &src) { op(1, 0xEF, dst, src); }
+    void packssdw(int dst, const Operand &src) { op(1, 0x6B, dst, src); }
+    void packuswb(int dst, const Operand &src) { op(1, 0x67, dst, src); }
+    void punpcklbw(int dst, const Operand &src) { op(1, 0x60, dst, src); }
+    void punpcklwd(int dst, const Operand &src) { op(1, 0x61, dst, src); }
+    void punpckhwd(int dst, const Operand &src) { op(1, 0x69, dst, src); }
+
+    void cmpps(int dst, const Operand &src, int predicate) {
+        op(0, 0xC2, dst, src);
+        emit8(predicate);
+    }
+
+    void sqrtps(int dst, const Operand &src) { emitVec(0, 1, 0x51, dst, 0, src); }
+    void cvtdq2ps(int dst, const Operand &src) { emitVec(0, 1, 0x5B, dst, 0, src); }
+    void cvttps2dq(int dst, const Operand &src) { emitVec(2, 1, 0x5B, dst, 0, src); }
+    void cvtps2dq(int dst, const Operand &src) { emitVec(1, 1, 0x5B, dst, 0, src); }
+
+    void movaps(int dst, const Operand &src) {
+        if (src.mem || src.reg != dst)
+            emitVec(0, 1, 0x28, dst, 0, src);
+    }
+
+    void movaps(const Operand &dst, int src) {
+        if (dst.mem)
+            emitVec(0, 1, 0x29, src, 0, dst);
+        else
+            movaps(dst.reg, R(src));
+    }
+
+    void movups(int dst, const Operand &src) { emitVec(0, 1, 0x10, dst, 0, src); }
+    void movups(const Operand &dst, int src, int L = -1) { emitVec(0, 1, 0x11, src, 0, dst, L); }
+    void movdqu(int dst, const Operand &src) { emitVec(2, 1, 0x6F, dst, 0, src); }
+    void movdqu(const Operand &dst, int src, int L = -1) { emitVec(2, 1, 0x7F, src, 0, dst, L); }
+
+    void shiftImm(int ext, int dst, int imm) {
+        emitVec(1, 1, 0x72, ext, avx2 ? dst : 0, R(dst));
+        emit8(imm);
+    }
+
+    void pslld(int dst, int imm) { shiftImm(6, dst, imm); }
+    void psrld(int dst, int imm) { shiftImm(2, dst, imm); }
+
+    // AVX2 only
+    void vpermq(int dst, int src, int imm) {
+        emitVec(1, 3, 0x00, dst, 0, R(src), 1, 1);
+        emit8(imm);
+    }
+
+    void vpmovzxbd(int dst, const Operand &src) { emitVec(1, 2, 0x31, dst, 0, src); }
+    void vpmovzxwd(int dst, const Operand &src) { emitVec(1, 2, 0x33, dst, 0, src); }
+    void vpackusdw(int dst, const Operand &src) { emitVec(1, 2, 0x2B, dst, dst, src); }
+
+    Operand constant(uint32_t value) {
+        auto iter = constantOffsets.find(value);
+        if (iter != constantOffsets.end())
+            return M(rcx, iter->second);
+        int32_t offset = static_cast<int32_t>(constants.size() * sizeof(uint32_t));
+        constants.insert(constants.end(), 8, value);
+        constantOffsets[value] = offset;
+        return M(rcx, offset);
+    }
+
+    Operand constant(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return constant(bits);
+    }
+
+    Operand slot(int index, int half) {
+        if (index < numRegSlots)
+            return R(index * 2 + half);
+        return M(rsp, ((index - numRegSlots) * 2 + half) * vecSize);
+    }
+
+    // the register to do calculations for a stack position in, has to be followed by finish() with the same arguments
+    int begin(int index, int half, int tmp) {
+        Operand s = slot(index, half);
+        if (!s.mem)
+            return s.reg;
+        movaps(tmp, s);
+        return tmp;
+    }
+
+    void finish(int index, int half, int tmp) {
+        Operand s = slot(index, half);
+        if (s.mem)
+            movaps(s, tmp);
+    }
+
+    void copy(int dstIndex, int srcIndex, int half) {
+        Operand d = slot(dstIndex, half);
+        Operand s = slot(srcIndex, half);
+        if (d.mem && s.mem) {
+            movaps(T0, s);
+            movaps(d, T0);
+        } else if (d.mem) {
+            movaps(d, s.reg);
+        } else {
+            movaps(d.reg, s);
+        }
+    }
+
+    void expPS(int x) {
+        const int fx = T1, emm0 = T2, etmp = T3, y = T3, mask = T4, z = T5;
+        minps(x, constant(88.3762626647949f));
+        maxps(x, constant(-88.3762626647949f));
+        movaps(fx, R(x));
+        mulps(fx, constant(1.44269504088896341f));
+        addps(fx, constant(0.5f));
+        cvttps2dq(emm0, R(fx));
+        cvtdq2ps(etmp, R(emm0));
+        movaps(mask, R(etmp));
+        cmpps(mask, R(fx), cmpNLE);
+        andps(mask, constant(1.0f));
+        movaps(fx, R(etmp));
+        subps(fx, R(mask));
+        movaps(etmp, R(fx));
+        mulps(etmp, constant(0.693359375f));
+        movaps(z, R(fx));
+        mulps(z, constant(-2.12194440e-4f));
+        subps(x, R(etmp));
+        subps(x, R(z));
+        movaps(z, R(x));
+        mulps(z, R(z));
+        movaps(y, constant(1.9875691500E-4f));
+        const float p[] = { 1.3981999507E-3f, 8.3334519073E-3f, 4.1665795894E-2f, 1.6666665459E-1f, 5.0000001201E-1f };
+        for (int i = 0; i < 5; i++) {
+            mulps(y, R(x));
+            addps(y, constant(p[i]));
+        }
+        mulps(y, R(z));
+        addps(y, R(x));
+        addps(y, constant(1.0f));
+        cvttps2dq(emm0, R(fx));
+        paddd(emm0, constant(0x7Fu));
+        pslld(emm0, 23);
+        mulps(y, R(emm0));
+        movaps(x, R(y));
+    }
+
+    void logPS(int x) {
+        const int emm0 = T1, invalidMask = T2, mask = T3, y = T3, etmp = T4, z = T5;
+        xorps(invalidMask, R(invalidMask));
+        cmpps(invalidMask, R(x), cmpNLE);
+        maxps(x, constant(0x00800000u));
+        movaps(emm0, R(x));
+        psrld(emm0, 23);
+        andps(x, constant(~0x7f800000u));
+        orps(x, constant(0.5f));
+        psubd(emm0, constant(0x7Fu));
+        cvtdq2ps(emm0, R(emm0));
+        addps(emm0, constant(1.0f));
+        movaps(mask, R(x));
+        cmpps(mask, constant(0.707106781186547524f), cmpLT);
+        movaps(etmp, R(x));
+        andps(etmp, R(mask));
+        subps(x, constant(1.0f));
+        andps(mask, constant(1.0f));
+        subps(emm0, R(mask));
+        addps(x, R(etmp));
+        movaps(z, R(x));
+        mulps(z, R(z));
+        movaps(y, constant(7.0376836292E-2f));
+        const float p[] = { -1.1514610310E-1f, 1.1676998740E-1f, -1.2420140846E-1f, 1.4249322787E-1f, -1.6668057665E-1f, 2.0000714765E-1f, -2.4999993993E-1f, 3.3333331174E-1f };
+        for (int i = 0; i < 8; i++) {
+            mulps(y, R(x));
+            addps(y, constant(p[i]));
+        }
+        mulps(y, R(x));
+        mulps(y, R(z));
+        movaps(etmp, R(emm0));
+        mulps(etmp, constant(-2.12194440e-4f));
+        addps(y, R(etmp));
+        mulps(z, constant(0.5f));
+        subps(y, R(z));
+        mulps(emm0, constant(0.693359375f));
+        addps(x, R(y));
+        addps(x, R(emm0));
+        orps(x, R(invalidMask));
+    }
+
+    void loadSrc(const ExprOp &e, int sp) {
+        int base = r13 + e.e.ival;
+        if (e.op == opLoadSrcF) {
+            for (int h = 0; h < 2; h++) {
+                int r = begin(sp, h, T0);
+                movups(r, M(base, h * vecSize));
+                finish(sp, h, T0);
+            }
+            return;
+        }
+
+        if (avx2) {
+            for (int h = 0; h < 2; h++) {
+                if (e.op == opLoadSrc8)
+                    vpmovzxbd(T0 + h, M(base, h * 8));
+                else
+                    vpmovzxwd(T0 + h, M(base, h * 16));
+            }
+        } else {
+            if (e.op == opLoadSrc8) {
+                emitVec(2, 1, 0x7E, T0, 0, M(base, 0)); // movq
+                punpcklbw(T0, constant(0u));
+            } else {
+                movdqu(T0, M(base, 0));
+            }
+            movaps(T1, R(T0));
+            punpcklwd(T0, constant(0u));
+            punpckhwd(T1, constant(0u));
+        }
+
+        // T0 and T1 hold the integers so a spilled slot has to be converted into other scratch registers
+        for (int h = 0; h < 2; h++) {
+            int r = begin(sp, h, T2 + h);
+            cvtdq2ps(r, R(T0 + h));
+            finish(sp, h, T2 + h);
+        }
+    }
+
+    void store(const ExprOp &e) {
+        if (e.op == opStoreF) {
+            for (int h = 0; h < 2; h++) {
+                Operand s = slot(0, h);
+                movups(M(r12, h * vecSize), s.reg);
+            }
+            return;
+        }
+
+        Operand maxValue = constant(e.op == opStore8 ? 255.0f : 65535.0f);
+        for (int h = 0; h < 2; h++) {
+            movaps(T0 + h, slot(0, h));
+            maxps(T0 + h, constant(0u));
+            minps(T0 + h, maxValue);
+            cvtps2dq(T0 + h, R(T0 + h));
+        }
+
+        if (e.op == opStore8) {
+            packssdw(T0, R(T1));
+            if (avx2) {
+                vpermq(T0, T0, 0xD8);
+                packuswb(T0, R(T0));
+                vpermq(T0, T0, 0x08);
+                movdqu(M(r12, 0), T0, 0);
+            } else {
+                packuswb(T0, R(T0));
+                emitVec(1, 1, 0xD6, T0, 0, M(r12, 0)); // movq
+            }
+        } else {
+            if (avx2) {
+                vpackusdw(T0, R(T1));
+                vpermq(T0, T0, 0xD8);
+            } else {
+                // no packusdw in SSE2 so go through the signed range
+                psubd(T0, constant(0x8000u));
+                psubd(T1, constant(0x8000u));
+                packssdw(T0, R(T1));
+                pxor(T0, constant(0x80008000u));
+            }
+            movdqu(M(r12, 0), T0);
+        }
+    }
+
+    bool compileOp(const ExprOp &e, int &sp) {
+        switch (e.op) {
+        case opLoadSrc8:
+        case opLoadSrc16:
+        case opLoadSrcF:
+            loadSrc(e, sp++);
+            break;
+        case opLoadConst:
+            for (int h = 0; h < 2; h++) {
+                int r = begin(sp, h, T0);
+                movaps(r, constant(e.e.fval));
+                finish(sp, h, T0);
+            }
+            sp++;
+            break;
+        case opDup:
+            for (int h = 0; h < 2; h++)
+                copy(sp, sp - 1, h);
+            sp++;
+            break;
+        case opSwap:
+            for (int h = 0; h < 2; h++) {
+                movaps(T0, slot(sp - 1, h));
+                movaps(T1, slot(sp - 2, h));
+                movaps(slot(sp - 1, h), T1);
+                movaps(slot(sp - 2, h), T0);
+            }
+            break;
+        case opAdd:
+        case opSub:
+        case opMul:
+        case opDiv:
+            for (int h = 0; h < 2; h++) {
+                int r = begin(sp - 2, h, T0);
+                Operand b = slot(sp - 1, h);
+                if (e.op == opAdd)
+                    addps(r, b);
+                else if (e.op == opSub)
+                    subps(r, b);
+                else if (e.op == opMul)
+                    mulps(r, b);
+                else
+                    divps(r, b);
+                finish(sp - 2, h, T0);
+            }
+            sp--;
+            break;
+        case opMax:
+        case opMin:
+        case opGt:
+        case opLt:
+        case opEq:
+        case opLE:
+        case opGE:
+            // the operands are in the same order as in the interpreter so nan and signed zero handling matches
+            for (int h = 0; h < 2; h++) {
+                movaps(T0, slot(sp - 1, h));
+                Operand a = slot(sp - 2, h);
+                switch (e.op) {
+                case opMax: maxps(T0, a); break;
+                case opMin: minps(T0, a); break;
+                case opGt: cmpps(T0, a, cmpLT); break;
+                case opLt: cmpps(T0, a, cmpNLE); break;
+                case opEq: cmpps(T0, a, cmpEQ); break;
+                case opLE: cmpps(T0, a, cmpNLT); break;
+                case opGE: cmpps(T0, a, cmpLE); break;
+                }
+                if (e.op != opMax && e.op != opMin)
+                    andps(T0, constant(1.0f));
+                movaps(a, T0);
+            }
+            sp--;
+            break;
+        case opSqrt:
+        case opAbs:
+        case opNeg:
+            for (int h = 0; h < 2; h++) {
+                int r = begin(sp - 1, h, T0);
+                if (e.op == opSqrt) {
+                    maxps(r, constant(0u));
+                    sqrtps(r, R(r));
+                } else if (e.op == opAbs) {
+                    andps(r, constant(0x7FFFFFFFu));
+                } else {
+                    cmpps(r, constant(0u), cmpLE);
+                    andps(r, constant(1.0f));
+                }
+                finish(sp - 1, h, T0);
+            }
+            break;
+        case opAnd:
+        case opOr:
+        case opXor:
+            for (int h = 0; h < 2; h++) {
+                movaps(T0, slot(sp - 1, h));
+                cmpps(T0, constant(0u), cmpNLE);
+                movaps(T1, slot(sp - 2, h));
+                cmpps(T1, constant(0u), cmpNLE);
+                if (e.op == opAnd)
+                    andps(T0, R(T1));
+                else if (e.op == opOr)
+                    orps(T0, R(T1));
+                else
+                    xorps(T0, R(T1));
+                andps(T0, constant(1.0f));
+                movaps(slot(sp - 2, h), T0);
+            }
+            sp--;
+            break;
+        case opTernary:
+            for (int h = 0; h < 2; h++) {
+                xorps(T0, R(T0));
+                cmpps(T0, slot(sp - 3, h), cmpLT);
+                movaps(T1, slot(sp - 2, h));
+                andps(T1, R(T0));
+                andnps(T0, slot(sp - 1, h));
+                orps(T0, R(T1));
+                movaps(slot(sp - 3, h), T0);
+            }
+            sp -= 2;
+            break;
+        case opExp:
+        case opLog:
+            for (int h = 0; h < 2; h++) {
+                movaps(T0, slot(sp - 1, h));
+                if (e.op == opExp)
+                    expPS(T0);
+                else
+                    logPS(T0);
+                movaps(slot(sp - 1, h), T0);
+            }
+            break;
+        case opStore8:
+        case opStore16:
+        case opStoreF:
+            store(e);
+            break;
+        default:
+            return false;
+        }
+        return true;
+    }
+
+public:
+    explicit ExprCompiler(bool avx2) : avx2(avx2), vecSize(avx2 ? 32 : 16), constantsPatch(0) {}
+
+    int pixelsPerIteration() const {
+        return vecSize / 2;
+    }
+
+    // bytesPerSample holds the output followed by the three inputs, 0 for absent inputs
+    bool compile(const std::vector<ExprOp> &ops, int maxStack, const int bytesPerSample[4]) {
+#ifdef _WIN64
+        // xmm6-xmm15 are callee saved on windows
+        const int saveSize = 10 * 16;
+        const int arg0 = rcx;
+        const int arg1 = rdx;
+#else
+        const int saveSize = 0;
+        const int arg0 = rdi;
+        const int arg1 = rsi;
+#endif
+        const int spillSize = std::max(maxStack - static_cast<int>(numRegSlots), 0) * 2 * vecSize;
+
+        emitPush(rbp);
+        emitGPR(0x89, rsp, R(rbp)); // mov rbp, rsp
+        for (int i = 0; i < 4; i++)
+            emitPush(r12 + i);
+        emitGPR(0x81, 5, R(rsp)); // sub rsp, imm32
+        emit32(spillSize + saveSize);
+        emitGPR(0x83, 4, R(rsp)); // and rsp, -32
+        emit8(0xE0);
+        for (int i = 0; i < saveSize / 16; i++)
+            movups(M(rsp, spillSize + i * 16), 6 + i, 0);
+
+        emitGPR(0x89, arg1, R(rax)); // mov rax, niterations
+        for (int i = 0; i < 4; i++)
+            emitGPR(0x8B, r12 + i, M(arg0, i * 8)); // mov r12+i, rwptrs[i]
+        emit8(0x48 | 0); // mov rcx, imm64
+        emit8(0xB8 | rcx);
+        constantsPatch = code.size();
+        for (int i = 0; i < 8; i++)
+            emit8(0);
+
+        emitGPR(0x85, rax, R(rax)); // test rax, rax
+        emit8(0x0F); // jle end
+        emit8(0x8E);
+        size_t skipPatch = code.size();
+        emit32(0);
+
+        size_t loopStart = code.size();
+        int sp = 0;
+        for (const auto &e : ops)
+            if (!compileOp(e, sp))
+                return false;
+
+        for (int i = 0; i < 4; i++) {
+            if (bytesPerSample[i]) {
+                emitGPR(0x81, 0, R(r12 + i)); // add r12+i, imm32
+                emit32(bytesPerSample[i] * pixelsPerIteration());
+            }
+        }
+        emitGPR(0x83, 5, R(rax)); // sub rax, 1
+        emit8(1);
+        emit8(0x0F); // jnz loop
+        emit8(0x85);
+        emit32(static_cast<int32_t>(loopStart - (code.size() + 4)));
+
+        int32_t skip = static_cast<int32_t>(code.size() - (skipPatch + 4));
+        memcpy(code.data() + skipPatch, &skip, sizeof(skip));
+
+        for (int i = 0; i < saveSize / 16; i++)
+            emitVec(0, 1, 0x10, 6 + i, 0, M(rsp, spillSize + i * 16), 0);
+        if (avx2) {
+            emit8(0xC5); // vzeroupper
+            emit8(0xF8);
+            emit8(0x77);
+        }
+        emitGPR(0x8D, rsp, M(rbp, -32)); // lea rsp, [rbp - 32]
+        for (int i = 3; i >= 0; i--)
+            emitPop(r12 + i);
+        emitPop(rbp);
+        emit8(0xC3);
+        return true;
+    }
+
+    // copies the constants and code to executable memory, the block has to be released with freeCode()
+    ExprProc getCode(void **block, size_t *size) {
+        size_t constantsSize = (constants.size() * sizeof(uint32_t) + 31) & ~31;
+        *size = constantsSize + code.size();
+#ifdef VS_TARGET_OS_WINDOWS
+        uint8_t *mem = static_cast<uint8_t *>(VirtualAlloc(nullptr, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!mem)
+            return nullptr;
+#else
+        uint8_t *mem = static_cast<uint8_t *>(mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mem == MAP_FAILED)
+            return nullptr;
+#endif
+        uint64_t constantsAddress = reinterpret_cast<uintptr_t>(mem);
+        memcpy(code.data() + constantsPatch, &constantsAddress, sizeof(constantsAddress));
+        memcpy(mem, constants.data(), constants.size() * sizeof(uint32_t));
+        memcpy(mem + constantsSize, code.data(), code.size());
+
+#ifdef VS_TARGET_OS_WINDOWS
+        DWORD oldProtect;
+        if (!VirtualProtect(mem, *size, PAGE_EXECUTE_READ, &oldProtect)) {
+            freeCode(mem, *size);
+            return nullptr;
+        }
+#else
+        if (mprotect(mem, *size, PROT_READ | PROT_EXEC)) {
+            freeCode(mem, *size);
+            return nullptr;
+        }
+#endif
+        *block = mem;
+        return reinterpret_cast<ExprProc>(mem + constantsSize);
+    }
+
+    static void freeCode(void *block, size_t size) {
+#ifdef VS_TARGET_OS_WINDOWS
+        VirtualFree(block, 0, MEM_RELEASE);
+#else
+        munmap(block, size);
+#endif
+    }
+};
+
+#endif
+
 enum PlaneOp {
     poProcess, poCopy, poUndefined
 };
@@ -94,6 +758,12 @@ typedef struct {
     std::vector<ExprOp> ops[3];
     int plane[3];
     size_t maxStackSize;
+#ifdef VS_EXPR_JIT
+    ExprProc proc[3];
+    int pixelsPerIteration;
+    void *procBlock[3];
+    size_t procSize[3];
+#endif
 } ExprData;
 
 #ifdef VS_TARGET_CPU_X86
@@ -156,6 +826,31 @@ static const VSFrameRef *VS_CC exprGetFrame(int n, int activationReason, void **
 
                 int niterations = (w + 7)/8;
                 const ExprOp *ops = d->ops[plane].data();
+#ifdef VS_EXPR_JIT
+                if (d->proc[plane]) {
+                    // the compiled code may process more pixels per iteration than fit in the
+                    // stride padding so the remainder is done by the interpreter
+                    int ppi = d->pixelsPerIteration;
+                    int jitIterations = w / ppi;
+                    int done = jitIterations * ppi;
+                    niterations = (w - done + 7) / 8;
+                    for (int y = 0; y < h; y++) {
+                        uint8_t *rwptrs[4] = { dstp + dst_stride * y, nullptr, nullptr, nullptr };
+                        for (int i = 0; i < 3; i++)
+                            if (srcp[i])
+                                rwptrs[i + 1] = const_cast<uint8_t *>(srcp[i]) + src_stride[i] * y;
+                        if (jitIterations)
+                            d->proc[plane](rwptrs, jitIterations);
+                        if (niterations) {
+                            const uint8_t *tailptrs[4];
+                            for (int i = 0; i < 4; i++)
+                                tailptrs[i] = rwptrs[i] + (ptroffsets[i] / 8) * done;
+                            vs_evaluate_expr_sse2(ops, tailptrs, ptroffsets, niterations, stack);
+                        }
+                    }
+                    continue;
+                }
+#endif
                 for (int y = 0; y < h; y++) {
                     const uint8_t *rwptrs[4] = { dstp + dst_stride * y, srcp[0] + src_stride[0] * y, srcp[1] + src_stride[1] * y, srcp[2] + src_stride[2] * y };
                     vs_evaluate_expr_sse2(ops, rwptrs, ptroffsets, niterations, stack);
@@ -336,6 +1031,11 @@ static void VS_CC exprFree(void *instanceData, VSCore *core, const VSAPI *vsapi)
     ExprData *d = static_cast<ExprData *>(instanceData);
     for (int i = 0; i < 3; i++)
         vsapi->freeNode(d->node[i]);
+#ifdef VS_EXPR_JIT
+    for (int i = 0; i < 3; i++)
+        if (d->procBlock[i])
+            ExprCompiler::freeCode(d->procBlock[i], d->procSize[i]);
+#endif
     delete d;
 }
 
@@ -751,12 +1451,32 @@ static void VS_CC exprCreate(const VSMap *in, VSMap *out, void *userData, VSCore
         }
 
         const SOperation sop[3] = { getLoadOp(vi[0]), getLoadOp(vi[1]), getLoadOp(vi[2]) };
+        size_t stackSize[3] = {};
         d.maxStackSize = 0;
         for (int i = 0; i < d.vi.format->numPlanes; i++) {
-            d.maxStackSize = std::max(parseExpression(expr[i], d.ops[i], sop, getStoreOp(&d.vi)), d.maxStackSize);
+            stackSize[i] = parseExpression(expr[i], d.ops[i], sop, getStoreOp(&d.vi));
+            d.maxStackSize = std::max(stackSize[i], d.maxStackSize);
             foldConstants(d.ops[i]);
         }
 
+#ifdef VS_EXPR_JIT
+        CPUFeatures cpu;
+        getCPUFeatures(&cpu);
+        d.pixelsPerIteration = cpu.avx2 ? 16 : 8;
+        const int bytesPerSample[4] = { d.vi.format->bytesPerSample, vi[0]->format->bytesPerSample, vi[1] ? vi[1]->format->bytesPerSample : 0, vi[2] ? vi[2]->format->bytesPerSample : 0 };
+        for (int i = 0; i < 3; i++) {
+            d.proc[i] = nullptr;
+            d.procBlock[i] = nullptr;
+            d.procSize[i] = 0;
+            if (d.plane[i] == poProcess && i < d.vi.format->numPlanes) {
+                // failing to compile isn't fatal, the interpreter is used instead
+                ExprCompiler compiler(!!cpu.avx2);
+                if (compiler.compile(d.ops[i], static_cast<int>(stackSize[i]), bytesPerSample))
+                    d.proc[i] = compiler.getCode(&d.procBlock[i], &d.procSize[i]);
+            }
+        }
+#endif
+
     } catch (std::runtime_error &e) {
         for (int i = 0; i < 3; i++)
             vsapi->freeNode(d.node[i]);
@@ -22,10 +22,19 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <locale>
+#include <sstream>
 #include <string>
 #include <array>
+#include <vector>
 
 #include "VSHelper.h"
+#include "genericfilters.h"
+
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "cpufeatures.h"
+#endif
 
 
 #ifdef VS_TARGET_OS_WINDOWS
@@ -34,26 +43,7 @@
 #define FORCE_INLINE inline __attribute__((always_inline))
 #endif
 
-
-enum GenericOperations {
-    GenericPrewitt,
-    GenericSobel,
-
-    GenericMinimum,
-    GenericMaximum,
-
-    GenericMedian,
-
-    GenericDeflate,
-    GenericInflate,
-
-    GenericConvolution,
-
-    GenericInvert,
-    GenericLimiter,
-    GenericLevels,
-    GenericBinarize
-};
+#include "genericfilters_simd.h"
 
 
 enum ConvolutionTypes {
@@ -63,40 +53,11 @@ enum ConvolutionTypes {
 };
 
 
-struct GenericParams {
-    // Used by all.
-    int max_value;
-
-    // Prewitt, Sobel, Limiter.
-    int thresh_low;
-    int thresh_high;
-
-    // Prewitt, Sobel.
-    int rshift;
-
-    // Minimum, Maximum, Deflate, Inflate, Binarize.
-    int th;
-
-    // Binarize.
-    int v0;
-    int v1;
-
-    // Minimum, Maximum.
-    int enable[8];
-
-    // Convolution.
-    int matrix[25];
-    int matrix_elements;
-    float rdiv;
-    float bias;
-    bool saturate;
+struct GenericStage {
+    GenericOperations op;
+    int process[3];
 
-    // Levels.
-    int min_in;
-    int max_in;
-    float gamma;
-    int min_out;
-    int max_out;
+    GenericParams params;
 };
 
 
@@ -105,14 +66,27 @@ struct GenericData {
     const VSVideoInfo *vi;
     int process[3];
 
-    GenericParams params;
+    // Normal filters have a single stage, FilterChain has one for each
+    // operation and they are applied one after another.
+    std::vector<GenericStage> stages;
 
-    ConvolutionTypes convolution_type;
+    bool avx2;
 
     const char *filter_name;
 };
 
 
+static bool genericUseAVX2() {
+#ifdef VS_TARGET_CPU_X86
+    CPUFeatures cpu;
+    getCPUFeatures(&cpu);
+    return !!cpu.avx2;
+#else
+    return false;
+#endif
+}
+
+
 template <GenericOperations op>
 static FORCE_INLINE int min_max(int a, int b) {
     if (op == GenericMinimum || op == GenericDeflate)
@@ -139,7 +113,7 @@ template <typename PixelType, GenericOperations op>
 static FORCE_INLINE PixelType generic_3x3(
         PixelType a11, PixelType a21, PixelType a31,
         PixelType a12, PixelType a22, PixelType a32,
-        PixelType a13, PixelType a23, PixelType a33, GenericParams *params) {
+        PixelType a13, PixelType a23, PixelType a33, const GenericParams *params) {
 
     if (op == GenericPrewitt || op == GenericSobel) {
 
@@ -171,7 +145,7 @@ static FORCE_INLINE PixelType generic_3x3(
     } else if (op == GenericMinimum || op == GenericMaximum) {
 
         int th = params->th;
-        int *enable = params->enable;
+        const int *enable = params->enable;
 
         int lower_or_upper_bound;
 
@@ -235,7 +209,7 @@ static FORCE_INLINE PixelType generic_3x3(
 
     } else if (op == GenericConvolution) {
 
-        int *matrix = params->matrix;
+        const int *matrix = params->matrix;
         float rdiv = params->rdiv;
         float bias = params->bias;
         bool saturate = params->saturate;
@@ -265,75 +239,47 @@ static FORCE_INLINE PixelType generic_3x3(
 }
 
 
-template <typename PixelType, GenericOperations op>
-static void process_plane_3x3(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params) {
-    stride /= sizeof(PixelType);
+// Reflects coordinates outside the image back inside, without repeating the edge.
+static FORCE_INLINE int mirror(int i, int size) {
+    if (i < 0)
+        i = -i;
+    if (i >= size)
+        i = 2 * (size - 1) - i;
 
+    return std::max(0, std::min(i, size - 1));
+}
+
+
+// The 3x3, 5x5 and separable operations work on one row at a time, so that FilterChain
+// can hand them rows from a ring buffer instead of whole frames. The middle of
+// the row is done by simd when available, the mirrored edges are always done here.
+template <typename PixelType, GenericOperations op>
+static void process_row_3x3(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, GenericSimdRow simd, int32_t *scratch) {
     PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
-    const PixelType *srcp = reinterpret_cast<const PixelType *>(srcp8);
 
-    const PixelType *above = srcp - stride;
-    const PixelType *below = srcp + stride;
+    const PixelType *above = reinterpret_cast<const PixelType *>(rows[0]);
+    const PixelType *srcp = reinterpret_cast<const PixelType *>(rows[1]);
+    const PixelType *below = reinterpret_cast<const PixelType *>(rows[2]);
 
-    dstp[0] = generic_3x3<PixelType, op>(
-            below[1], below[0], below[1],
-             srcp[1],  srcp[0],  srcp[1],
-            below[1], below[0], below[1], params);
+    int x = simd ? simd(dstp8, rows, width, params, scratch) : 1;
 
-    for (int x = 1; x < width - 1; x++)
+    for (; x < width - 1; x++)
         dstp[x] = generic_3x3<PixelType, op>(
-                below[x-1], below[x], below[x+1],
+                above[x-1], above[x], above[x+1],
                  srcp[x-1],  srcp[x],  srcp[x+1],
                 below[x-1], below[x], below[x+1], params);
 
-    dstp[width-1] = generic_3x3<PixelType, op>(
-            below[width-2], below[width-1], below[width-2],
-             srcp[width-2],  srcp[width-1],  srcp[width-2],
-            below[width-2], below[width-1], below[width-2], params);
-
-    dstp += stride;
-    srcp += stride;
-    above += stride;
-    below += stride;
-
-    for (int y = 1; y < height - 1; y++) {
-        dstp[0] = generic_3x3<PixelType, op>(
-                above[1], above[0], above[1],
-                 srcp[1],  srcp[0],  srcp[1],
-                below[1], below[0], below[1], params);
-
-        for (int x = 1; x < width - 1; x++)
-            dstp[x] = generic_3x3<PixelType, op>(
-                    above[x-1], above[x], above[x+1],
-                     srcp[x-1],  srcp[x],  srcp[x+1],
-                    below[x-1], below[x], below[x+1], params);
-
-        dstp[width-1] = generic_3x3<PixelType, op>(
-                above[width-2], above[width-1], above[width-2],
-                 srcp[width-2],  srcp[width-1],  srcp[width-2],
-                below[width-2], below[width-1], below[width-2], params);
-
-        dstp += stride;
-        srcp += stride;
-        above += stride;
-        below += stride;
-    }
+    for (int i = 0; i < 2; i++) {
+        x = i ? width - 1 : 0;
 
-    dstp[0] = generic_3x3<PixelType, op>(
-            above[1], above[0], above[1],
-             srcp[1],  srcp[0],  srcp[1],
-            above[1], above[0], above[1], params);
+        int l = mirror(x - 1, width);
+        int r = mirror(x + 1, width);
 
-    for (int x = 1; x < width - 1; x++)
         dstp[x] = generic_3x3<PixelType, op>(
-                above[x-1], above[x], above[x+1],
-                 srcp[x-1],  srcp[x],  srcp[x+1],
-                above[x-1], above[x], above[x+1], params);
-
-    dstp[width-1] = generic_3x3<PixelType, op>(
-            above[width-2], above[width-1], above[width-2],
-             srcp[width-2],  srcp[width-1],  srcp[width-2],
-            above[width-2], above[width-1], above[width-2], params);
+                above[l], above[x], above[r],
+                 srcp[l],  srcp[x],  srcp[r],
+                below[l], below[x], below[r], params);
+    }
 }
 
 
@@ -343,9 +289,9 @@ static FORCE_INLINE PixelType generic_5x5(
         PixelType a12, PixelType a22, PixelType a32, PixelType a42, PixelType a52,
         PixelType a13, PixelType a23, PixelType a33, PixelType a43, PixelType a53,
         PixelType a14, PixelType a24, PixelType a34, PixelType a44, PixelType a54,
-        PixelType a15, PixelType a25, PixelType a35, PixelType a45, PixelType a55, GenericParams *params) {
+        PixelType a15, PixelType a25, PixelType a35, PixelType a45, PixelType a55, const GenericParams *params) {
 
-    int *matrix = params->matrix;
+    const int *matrix = params->matrix;
     float rdiv = params->rdiv;
     float bias = params->bias;
     bool saturate = params->saturate;
@@ -374,397 +320,362 @@ static FORCE_INLINE PixelType generic_5x5(
 
 
 template <typename PixelType>
-static void process_plane_convolution_horizontal(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params) {
-    stride /= sizeof(PixelType);
+static FORCE_INLINE PixelType convolution_result(int sum, const GenericParams *params) {
+    sum = static_cast<int>(sum * params->rdiv + params->bias + 0.5f);
 
+    if (!params->saturate)
+        sum = std::abs(sum);
+
+    return std::min(params->max_value, std::max(sum, 0));
+}
+
+
+// The sums of the vertical pass are kept exact in scratch so the result is the
+// same as when the whole matrix is applied at once.
+template <typename PixelType>
+static void process_row_separable(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, GenericSimdRow simd, int32_t *scratch) {
     PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
-    const PixelType *srcp = reinterpret_cast<const PixelType *>(srcp8);
 
-    int *matrix = params->matrix;
-    int matrix_elements = params->matrix_elements;
-    float rdiv = params->rdiv;
-    float bias = params->bias;
-    bool saturate = params->saturate;
-    int max_value = params->max_value;
+    const int *matrix_h = params->matrix_h;
+    int taps_h = params->matrix_h_elements;
+    int border = taps_h / 2;
 
-    int border = matrix_elements / 2;
+    int x;
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < border; x++) {
+    if (simd) {
+        x = simd(dstp8, rows, width, params, scratch);
+    } else {
+        for (x = 0; x < width; x++) {
             int sum = 0;
 
-            for (int i = 0; i < matrix_elements; i++)
-                sum += srcp[std::abs(x + i - border)] * matrix[i];
+            for (int i = 0; i < params->matrix_v_elements; i++)
+                sum += reinterpret_cast<const PixelType *>(rows[i])[x] * params->matrix_v[i];
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
+            scratch[x] = sum;
+        }
 
-            if (!saturate)
-                sum = std::abs(sum);
+        x = border;
+    }
 
-            dstp[x] = std::min(max_value, std::max(sum, 0));
-        }
+    for (; x < width - border; x++) {
+        int sum = 0;
 
-        for (int x = border; x < width - border; x++) {
-            int sum = 0;
+        for (int i = 0; i < taps_h; i++)
+            sum += scratch[x + i - border] * matrix_h[i];
 
-            for (int i = 0; i < matrix_elements; i++)
-                sum += srcp[x + i - border] * matrix[i];
+        dstp[x] = convolution_result<PixelType>(sum, params);
+    }
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
+    for (x = 0; x < width; x++) {
+        if (x == border)
+            x = std::max(border, width - border);
 
-            if (!saturate)
-                sum = std::abs(sum);
+        // Without horizontal taps there are no edge columns at all.
+        if (x == width)
+            break;
 
-            dstp[x] = std::min(max_value, std::max(sum, 0));
-        }
+        int sum = 0;
 
-        for (int x = width - border; x < width; x++) {
-            int sum = 0;
+        for (int i = 0; i < taps_h; i++)
+            sum += scratch[mirror(x + i - border, width)] * matrix_h[i];
 
-            for (int i = 0; i < matrix_elements; i++) {
-                int idx = x + i - border;
-                int diff = width - 1 - idx;
-                idx = idx + std::min(diff*2, 0);
-                sum += srcp[idx] * matrix[i];
-            }
+        dstp[x] = convolution_result<PixelType>(sum, params);
+    }
+}
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
 
-            if (!saturate)
-                sum = std::abs(sum);
+template <typename PixelType, GenericOperations op>
+static FORCE_INLINE PixelType generic_5x5_at(const PixelType * const *r, const int *c, const GenericParams *params) {
+    return generic_5x5<PixelType, op>(
+            r[0][c[0]], r[0][c[1]], r[0][c[2]], r[0][c[3]], r[0][c[4]],
+            r[1][c[0]], r[1][c[1]], r[1][c[2]], r[1][c[3]], r[1][c[4]],
+            r[2][c[0]], r[2][c[1]], r[2][c[2]], r[2][c[3]], r[2][c[4]],
+            r[3][c[0]], r[3][c[1]], r[3][c[2]], r[3][c[3]], r[3][c[4]],
+            r[4][c[0]], r[4][c[1]], r[4][c[2]], r[4][c[3]], r[4][c[4]], params);
+}
 
-            dstp[x] = std::min(max_value, std::max(sum, 0));
-        }
 
-        dstp += stride;
-        srcp += stride;
+template <typename PixelType, GenericOperations op>
+static void process_row_5x5(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, GenericSimdRow simd, int32_t *scratch) {
+    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
+
+    const PixelType *r[5];
+    for (int i = 0; i < 5; i++)
+        r[i] = reinterpret_cast<const PixelType *>(rows[i]);
+
+    int x = simd ? simd(dstp8, rows, width, params, scratch) : 2;
+
+    for (; x < width - 2; x++) {
+        const int c[5] = { x - 2, x - 1, x, x + 1, x + 2 };
+
+        dstp[x] = generic_5x5_at<PixelType, op>(r, c, params);
+    }
+
+    for (x = 0; x < width; x++) {
+        if (x == 2)
+            x = std::max(2, width - 2);
+
+        int c[5];
+        for (int i = 0; i < 5; i++)
+            c[i] = mirror(x + i - 2, width);
+
+        dstp[x] = generic_5x5_at<PixelType, op>(r, c, params);
     }
 }
 
 
-template <typename PixelType>
-static void process_plane_convolution_vertical(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params) {
+template <typename PixelType, GenericOperations op>
+static void process_plane_1x1(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, const GenericParams *params) {
     stride /= sizeof(PixelType);
 
     PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
     const PixelType *srcp = reinterpret_cast<const PixelType *>(srcp8);
 
-    int *matrix = params->matrix;
-    int matrix_elements = params->matrix_elements;
-    float rdiv = params->rdiv;
-    float bias = params->bias;
-    bool saturate = params->saturate;
-    int max_value = params->max_value;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (op == GenericInvert) {
 
-    int border = matrix_elements / 2;
+                dstp[x] = params->max_value - srcp[x];
 
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < border; y++) {
-            int sum = 0;
+            } else if (op == GenericLimiter) {
+
+                dstp[x] = std::min(params->thresh_high, std::max<int>(params->thresh_low, srcp[x]));
+
+            } else if (op == GenericLevels) {
 
-            for (int i = 0; i < matrix_elements; i++)
-                sum += srcp[x + std::abs(y + i - border) * stride] * matrix[i];
+                dstp[x] = static_cast<int>(std::pow(static_cast<float>(srcp[x] - params->min_in) / (params->max_in - params->min_in), 1.0f / params->gamma) * (params->max_out - params->min_out) + params->min_out + 0.5f);
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
+            } else if (op == GenericBinarize) {
 
-            if (!saturate)
-                sum = std::abs(sum);
+                if (srcp[x] < params->th)
+                    dstp[x] = params->v0;
+                else
+                    dstp[x] = params->v1;
 
-            dstp[x + y * stride] = std::min(max_value, std::max(sum, 0));
+            }
         }
 
-        for (int y = border; y < height - border; y++) {
-            int sum = 0;
+        srcp += stride;
+        dstp += stride;
+    }
+}
 
-            for (int i = 0; i < matrix_elements; i++)
-                sum += srcp[x + (y + i - border) * stride] * matrix[i];
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
+#ifdef VS_TARGET_CPU_X86
+namespace {
 
-            if (!saturate)
-                sum = std::abs(sum);
+struct GenericSSE2 {
+    typedef __m128i I;
 
-            dstp[x + y * stride] = std::min(max_value, std::max(sum, 0));
-        }
+    enum { words = 8 };
 
-        for (int y = height - border; y < height; y++) {
-            int sum = 0;
+    static FORCE_INLINE I load(const uint8_t *p) {
+        return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+    }
 
-            for (int i = 0; i < matrix_elements; i++) {
-                int idx = y + i - border;
-                int diff = height - 1 - idx;
-                idx = idx + std::min(diff*2, 0);
-                sum += srcp[x + idx * stride] * matrix[i];
-            }
+    static FORCE_INLINE I load(const uint16_t *p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    }
 
-            sum = static_cast<int>(sum * rdiv + bias + 0.5f);
+    static FORCE_INLINE void store(uint8_t *p, I v) {
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(p), _mm_packus_epi16(v, v));
+    }
 
-            if (!saturate)
-                sum = std::abs(sum);
+    static FORCE_INLINE void store(uint16_t *p, I v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+    }
 
-            dstp[x + y * stride] = std::min(max_value, std::max(sum, 0));
-        }
+    static FORCE_INLINE I set1w(int v) { return _mm_set1_epi16(static_cast<short>(v)); }
+    static FORCE_INLINE I set1d(int v) { return _mm_set1_epi32(v); }
+
+    // SSE2 only has signed word min and max.
+    static FORCE_INLINE I minu(I a, I b) { return _mm_sub_epi16(a, _mm_subs_epu16(a, b)); }
+    static FORCE_INLINE I maxu(I a, I b) { return _mm_add_epi16(b, _mm_subs_epu16(a, b)); }
+
+    static FORCE_INLINE I addsu(I a, I b) { return _mm_adds_epu16(a, b); }
+    static FORCE_INLINE I subsu(I a, I b) { return _mm_subs_epu16(a, b); }
+    static FORCE_INLINE I add16(I a, I b) { return _mm_add_epi16(a, b); }
+    static FORCE_INLINE I srli16(I a, int n) { return _mm_srli_epi16(a, n); }
+
+    static FORCE_INLINE I unpacklo16(I a, I b) { return _mm_unpacklo_epi16(a, b); }
+    static FORCE_INLINE I unpackhi16(I a, I b) { return _mm_unpackhi_epi16(a, b); }
+    static FORCE_INLINE I lo32(I a) { return _mm_unpacklo_epi16(a, _mm_setzero_si128()); }
+    static FORCE_INLINE I hi32(I a) { return _mm_unpackhi_epi16(a, _mm_setzero_si128()); }
+
+    static FORCE_INLINE I add32(I a, I b) { return _mm_add_epi32(a, b); }
+    static FORCE_INLINE I sub32(I a, I b) { return _mm_sub_epi32(a, b); }
+    static FORCE_INLINE I slli32(I a, int n) { return _mm_slli_epi32(a, n); }
+    static FORCE_INLINE I srli32(I a, int n) { return _mm_srli_epi32(a, n); }
+    static FORCE_INLINE I srl32(I a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static FORCE_INLINE I cmpgt32(I a, I b) { return _mm_cmpgt_epi32(a, b); }
+    static FORCE_INLINE I madd(I a, I b) { return _mm_madd_epi16(a, b); }
+
+    static FORCE_INLINE I and_(I a, I b) { return _mm_and_si128(a, b); }
+    static FORCE_INLINE I andnot(I a, I b) { return _mm_andnot_si128(a, b); }
+    static FORCE_INLINE I or_(I a, I b) { return _mm_or_si128(a, b); }
+    static FORCE_INLINE I xor_(I a, I b) { return _mm_xor_si128(a, b); }
+
+    static FORCE_INLINE I abs32(I a) {
+        I sign = _mm_srai_epi32(a, 31);
+        return _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
     }
-}
 
+    // There is no packus_epi32 either, so clamp first and pack with a bias.
+    static FORCE_INLINE I packus32(I a, I b) {
+        const I bias = _mm_set1_epi32(32768);
+        const I max = _mm_set1_epi32(65535);
 
-template <typename PixelType, GenericOperations op>
-static void process_plane_5x5(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params) {
-    stride /= sizeof(PixelType);
+        a = _mm_and_si128(a, _mm_cmpgt_epi32(a, _mm_setzero_si128()));
+        b = _mm_and_si128(b, _mm_cmpgt_epi32(b, _mm_setzero_si128()));
 
-    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
-    const PixelType *srcp = reinterpret_cast<const PixelType *>(srcp8);
+        I ga = _mm_cmpgt_epi32(a, max);
+        I gb = _mm_cmpgt_epi32(b, max);
+        a = _mm_or_si128(_mm_and_si128(ga, max), _mm_andnot_si128(ga, a));
+        b = _mm_or_si128(_mm_and_si128(gb, max), _mm_andnot_si128(gb, b));
 
-    const PixelType *above2 = srcp - stride * 2;
-    const PixelType *above1 = srcp - stride;
-    const PixelType *below1 = srcp + stride;
-    const PixelType *below2 = srcp + stride * 2;
-
-    dstp[0] = generic_5x5<PixelType, op>(
-            below2[2], below2[1], below2[0], below2[1], below2[2],
-            below1[2], below1[1], below1[0], below1[1], below1[2],
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-            below1[2], below1[1], below1[0], below1[1], below1[2],
-            below2[2], below2[1], below2[0], below2[1], below2[2], params);
-
-    dstp[1] = generic_5x5<PixelType, op>(
-            below2[1], below2[0], below2[1], below2[2], below2[3],
-            below1[1], below1[0], below1[1], below1[2], below1[3],
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-            below1[1], below1[0], below1[1], below1[2], below1[3],
-            below2[1], below2[0], below2[1], below2[2], below2[3], params);
-
-    for (int x = 2; x < width - 2; x++)
-        dstp[x] = generic_5x5<PixelType, op>(
-                below2[x-2], below2[x-1], below2[x], below2[x+1], below2[x+2],
-                below1[x-2], below1[x-1], below1[x], below1[x+1], below1[x+2],
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                below1[x-2], below1[x-1], below1[x], below1[x+1], below1[x+2],
-                below2[x-2], below2[x-1], below2[x], below2[x+1], below2[x+2], params);
-
-    dstp[width-2] = generic_5x5<PixelType, op>(
-            below2[width-4], below2[width-3], below2[width-2], below2[width-1], below2[width-2],
-            below1[width-4], below1[width-3], below1[width-2], below1[width-1], below1[width-2],
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-            below1[width-4], below1[width-3], below1[width-2], below1[width-1], below1[width-2],
-            below2[width-4], below2[width-3], below2[width-2], below2[width-1], below2[width-2], params);
-
-    dstp[width-1] = generic_5x5<PixelType, op>(
-            below2[width-3], below2[width-2], below2[width-1], below2[width-2], below2[width-3],
-            below1[width-3], below1[width-2], below1[width-1], below1[width-2], below1[width-3],
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-            below1[width-3], below1[width-2], below1[width-1], below1[width-2], below1[width-3],
-            below2[width-3], below2[width-2], below2[width-1], below2[width-2], below2[width-3], params);
-
-    srcp += stride;
-    dstp += stride;
-    above2 += stride;
-    above1 += stride;
-    below1 += stride;
-    below2 += stride;
-
-    dstp[0] = generic_5x5<PixelType, op>(
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-            above1[2], above1[1], above1[0], above1[1], above1[2],
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-            below1[2], below1[1], below1[0], below1[1], below1[2],
-            below2[2], below2[1], below2[0], below2[1], below2[2], params);
-
-    dstp[1] = generic_5x5<PixelType, op>(
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-            above1[1], above1[0], above1[1], above1[2], above1[3],
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-            below1[1], below1[0], below1[1], below1[2], below1[3],
-            below2[1], below2[0], below2[1], below2[2], below2[3], params);
-
-    for (int x = 2; x < width - 2; x++)
-        dstp[x] = generic_5x5<PixelType, op>(
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                above1[x-2], above1[x-1], above1[x], above1[x+1], above1[x+2],
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                below1[x-2], below1[x-1], below1[x], below1[x+1], below1[x+2],
-                below2[x-2], below2[x-1], below2[x], below2[x+1], below2[x+2], params);
-
-    dstp[width-2] = generic_5x5<PixelType, op>(
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-            above1[width-4], above1[width-3], above1[width-2], above1[width-1], above1[width-2],
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-            below1[width-4], below1[width-3], below1[width-2], below1[width-1], below1[width-2],
-            below2[width-4], below2[width-3], below2[width-2], below2[width-1], below2[width-2], params);
-
-    dstp[width-1] = generic_5x5<PixelType, op>(
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-            above1[width-3], above1[width-2], above1[width-1], above1[width-2], above1[width-3],
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-            below1[width-3], below1[width-2], below1[width-1], below1[width-2], below1[width-3],
-            below2[width-3], below2[width-2], below2[width-1], below2[width-2], below2[width-3], params);
-
-    srcp += stride;
-    dstp += stride;
-    above2 += stride;
-    above1 += stride;
-    below1 += stride;
-    below2 += stride;
-
-    for (int y = 2; y < height - 2; y++) {
-        dstp[0] = generic_5x5<PixelType, op>(
-                above2[2], above2[1], above2[0], above2[1], above2[2],
-                above1[2], above1[1], above1[0], above1[1], above1[2],
-                  srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-                below1[2], below1[1], below1[0], below1[1], below1[2],
-                below2[2], below2[1], below2[0], below2[1], below2[2], params);
-
-        dstp[1] = generic_5x5<PixelType, op>(
-                above2[1], above2[0], above2[1], above2[2], above2[3],
-                above1[1], above1[0], above1[1], above1[2], above1[3],
-                  srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-                below1[1], below1[0], below1[1], below1[2], below1[3],
-                below2[1], below2[0], below2[1], below2[2], below2[3], params);
-
-        for (int x = 2; x < width - 2; x++)
-            dstp[x] = generic_5x5<PixelType, op>(
-                    above2[x-2], above2[x-1], above2[x], above2[x+1], above2[x+2],
-                    above1[x-2], above1[x-1], above1[x], above1[x+1], above1[x+2],
-                      srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                    below1[x-2], below1[x-1], below1[x], below1[x+1], below1[x+2],
-                    below2[x-2], below2[x-1], below2[x], below2[x+1], below2[x+2], params);
-
-        dstp[width-2] = generic_5x5<PixelType, op>(
-                above2[width-4], above2[width-3], above2[width-2], above2[width-1], above2[width-2],
-                above1[width-4], above1[width-3], above1[width-2], above1[width-1], above1[width-2],
-                  srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-                below1[width-4], below1[width-3], below1[width-2], below1[width-1], below1[width-2],
-                below2[width-4], below2[width-3], below2[width-2], below2[width-1], below2[width-2], params);
-
-        dstp[width-1] = generic_5x5<PixelType, op>(
-                above2[width-3], above2[width-2], above2[width-1], above2[width-2], above2[width-3],
-                above1[width-3], above1[width-2], above1[width-1], above1[width-2], above1[width-3],
-                  srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-                below1[width-3], below1[width-2], below1[width-1], below1[width-2], below1[width-3],
-                below2[width-3], below2[width-2], below2[width-1], below2[width-2], below2[width-3], params);
+        return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias)), _mm_set1_epi16(static_cast<short>(0x8000)));
+    }
 
-        srcp += stride;
-        dstp += stride;
-        above2 += stride;
-        above1 += stride;
-        below1 += stride;
-        below2 += stride;
+    static FORCE_INLINE I convolve(I sum, float rdiv, float bias) {
+        __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(rdiv));
+        f = _mm_add_ps(_mm_add_ps(f, _mm_set1_ps(bias)), _mm_set1_ps(0.5f));
+        return _mm_cvttps_epi32(f);
+    }
+
+    static FORCE_INLINE __m128i magnitude2(I gx, I gy) {
+        __m128d x = _mm_cvtepi32_pd(gx);
+        __m128d y = _mm_cvtepi32_pd(gy);
+        __m128d g = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+        return _mm_cvttpd_epi32(_mm_add_pd(g, _mm_set1_pd(0.5)));
     }
 
-    dstp[0] = generic_5x5<PixelType, op>(
-            above2[2], above2[1], above2[0], above2[1], above2[2],
-            above1[2], above1[1], above1[0], above1[1], above1[2],
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-            below1[2], below1[1], below1[0], below1[1], below1[2],
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2], params);
-
-    dstp[1] = generic_5x5<PixelType, op>(
-            above2[1], above2[0], above2[1], above2[2], above2[3],
-            above1[1], above1[0], above1[1], above1[2], above1[3],
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-            below1[1], below1[0], below1[1], below1[2], below1[3],
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3], params);
-
-    for (int x = 2; x < width - 2; x++)
-        dstp[x] = generic_5x5<PixelType, op>(
-                above2[x-2], above2[x-1], above2[x], above2[x+1], above2[x+2],
-                above1[x-2], above1[x-1], above1[x], above1[x+1], above1[x+2],
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                below1[x-2], below1[x-1], below1[x], below1[x+1], below1[x+2],
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2], params);
-
-    dstp[width-2] = generic_5x5<PixelType, op>(
-            above2[width-4], above2[width-3], above2[width-2], above2[width-1], above2[width-2],
-            above1[width-4], above1[width-3], above1[width-2], above1[width-1], above1[width-2],
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-            below1[width-4], below1[width-3], below1[width-2], below1[width-1], below1[width-2],
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2], params);
-
-    dstp[width-1] = generic_5x5<PixelType, op>(
-            above2[width-3], above2[width-2], above2[width-1], above2[width-2], above2[width-3],
-            above1[width-3], above1[width-2], above1[width-1], above1[width-2], above1[width-3],
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-            below1[width-3], below1[width-2], below1[width-1], below1[width-2], below1[width-3],
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3], params);
-
-    srcp += stride;
-    dstp += stride;
-    above2 += stride;
-    above1 += stride;
-    below1 += stride;
-    below2 += stride;
-
-    dstp[0] = generic_5x5<PixelType, op>(
-            above2[2], above2[1], above2[0], above2[1], above2[2],
-            above1[2], above1[1], above1[0], above1[1], above1[2],
-              srcp[2],   srcp[1],   srcp[0],   srcp[1],   srcp[2],
-            above1[2], above1[1], above1[0], above1[1], above1[2],
-            above2[2], above2[1], above2[0], above2[1], above2[2], params);
-
-    dstp[1] = generic_5x5<PixelType, op>(
-            above2[1], above2[0], above2[1], above2[2], above2[3],
-            above1[1], above1[0], above1[1], above1[2], above1[3],
-              srcp[1],   srcp[0],   srcp[1],   srcp[2],   srcp[3],
-            above1[1], above1[0], above1[1], above1[2], above1[3],
-            above2[1], above2[0], above2[1], above2[2], above2[3], params);
-
-    for (int x = 2; x < width - 2; x++)
-        dstp[x] = generic_5x5<PixelType, op>(
-                above2[x-2], above2[x-1], above2[x], above2[x+1], above2[x+2],
-                above1[x-2], above1[x-1], above1[x], above1[x+1], above1[x+2],
-                  srcp[x-2],   srcp[x-1],   srcp[x],   srcp[x+1],   srcp[x+2],
-                above1[x-2], above1[x-1], above1[x], above1[x+1], above1[x+2],
-                above2[x-2], above2[x-1], above2[x], above2[x+1], above2[x+2], params);
-
-    dstp[width-2] = generic_5x5<PixelType, op>(
-            above2[width-4], above2[width-3], above2[width-2], above2[width-1], above2[width-2],
-            above1[width-4], above1[width-3], above1[width-2], above1[width-1], above1[width-2],
-              srcp[width-4],   srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],
-            above1[width-4], above1[width-3], above1[width-2], above1[width-1], above1[width-2],
-            above2[width-4], above2[width-3], above2[width-2], above2[width-1], above2[width-2], params);
-
-    dstp[width-1] = generic_5x5<PixelType, op>(
-            above2[width-3], above2[width-2], above2[width-1], above2[width-2], above2[width-3],
-            above1[width-3], above1[width-2], above1[width-1], above1[width-2], above1[width-3],
-              srcp[width-3],   srcp[width-2],   srcp[width-1],   srcp[width-2],   srcp[width-3],
-            above1[width-3], above1[width-2], above1[width-1], above1[width-2], above1[width-3],
-            above2[width-3], above2[width-2], above2[width-1], above2[width-2], above2[width-3], params);
+    static FORCE_INLINE I magnitude(I gx, I gy) {
+        I lo = magnitude2(gx, gy);
+        I hi = magnitude2(_mm_srli_si128(gx, 8), _mm_srli_si128(gy, 8));
+        return _mm_unpacklo_epi64(lo, hi);
+    }
+
+    static FORCE_INLINE I mullo32(I a, I b) {
+        I even = _mm_mul_epu32(a, b);
+        I odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    static FORCE_INLINE I loadd(const int32_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+    static FORCE_INLINE void stored(int32_t *p, I v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+
+    static FORCE_INLINE void sequence(I &lo, I &hi) { }
+    static FORCE_INLINE I packus32_seq(I a, I b) { return packus32(a, b); }
+};
+
+} // namespace
+#endif
+
+
+typedef void (*GenericRowFunction)(uint8_t *dstp, const uint8_t * const *rows, int width, const GenericParams *params, GenericSimdRow simd, int32_t *scratch);
+typedef void (*GenericPlaneFunction)(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, const GenericParams *params);
+
+
+static bool isRowOperation(const GenericStage &stage) {
+    switch (stage.op) {
+    case GenericMinimum:
+    case GenericMaximum:
+    case GenericMedian:
+    case GenericDeflate:
+    case GenericInflate:
+    case GenericConvolution:
+    case GenericPrewitt:
+    case GenericSobel:
+        return true;
+    default:
+        return false;
+    }
 }
 
 
-template <typename PixelType, GenericOperations op>
-static void process_plane_1x1(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params) {
-    stride /= sizeof(PixelType);
+static int stageRadius(const GenericStage &stage) {
+    if (stage.op != GenericConvolution)
+        return 1;
+    else if (stage.params.separable)
+        return stage.params.matrix_v_elements / 2;
+    else
+        return stage.params.matrix_elements == 25 ? 2 : 1;
+}
 
-    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
-    const PixelType *srcp = reinterpret_cast<const PixelType *>(srcp8);
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            if (op == GenericInvert) {
+static GenericRowFunction getRowFunction(GenericOperations op, int bits, const GenericParams *params) {
+    switch (op) {
+    case GenericMinimum: return bits == 8 ? process_row_3x3<uint8_t, GenericMinimum> : process_row_3x3<uint16_t, GenericMinimum>;
+    case GenericMaximum: return bits == 8 ? process_row_3x3<uint8_t, GenericMaximum> : process_row_3x3<uint16_t, GenericMaximum>;
+    case GenericMedian: return bits == 8 ? process_row_3x3<uint8_t, GenericMedian> : process_row_3x3<uint16_t, GenericMedian>;
+    case GenericDeflate: return bits == 8 ? process_row_3x3<uint8_t, GenericDeflate> : process_row_3x3<uint16_t, GenericDeflate>;
+    case GenericInflate: return bits == 8 ? process_row_3x3<uint8_t, GenericInflate> : process_row_3x3<uint16_t, GenericInflate>;
+    case GenericConvolution:
+        if (params->separable)
+            return bits == 8 ? process_row_separable<uint8_t> : process_row_separable<uint16_t>;
+        else if (params->matrix_elements == 25)
+            return bits == 8 ? process_row_5x5<uint8_t, GenericConvolution> : process_row_5x5<uint16_t, GenericConvolution>;
+        else
+            return bits == 8 ? process_row_3x3<uint8_t, GenericConvolution> : process_row_3x3<uint16_t, GenericConvolution>;
+    case GenericPrewitt: return bits == 8 ? process_row_3x3<uint8_t, GenericPrewitt> : process_row_3x3<uint16_t, GenericPrewitt>;
+    case GenericSobel: return bits == 8 ? process_row_3x3<uint8_t, GenericSobel> : process_row_3x3<uint16_t, GenericSobel>;
+    default: return nullptr;
+    }
+}
 
-                dstp[x] = params->max_value - srcp[x];
 
-            } else if (op == GenericLimiter) {
+static GenericPlaneFunction getPlaneFunction(const GenericStage &stage, int bits) {
+    switch (stage.op) {
+    case GenericInvert: return bits == 8 ? process_plane_1x1<uint8_t, GenericInvert> : process_plane_1x1<uint16_t, GenericInvert>;
+    case GenericLimiter: return bits == 8 ? process_plane_1x1<uint8_t, GenericLimiter> : process_plane_1x1<uint16_t, GenericLimiter>;
+    case GenericLevels: return bits == 8 ? process_plane_1x1<uint8_t, GenericLevels> : process_plane_1x1<uint16_t, GenericLevels>;
+    case GenericBinarize: return bits == 8 ? process_plane_1x1<uint8_t, GenericBinarize> : process_plane_1x1<uint16_t, GenericBinarize>;
+    default: return nullptr;
+    }
+}
 
-                dstp[x] = std::min(params->thresh_high, std::max<int>(params->thresh_low, srcp[x]));
 
-            } else if (op == GenericLevels) {
+// One operation applied to a plane. Its output rows go to a ring buffer that
+// is just big enough for the next operation, or to the output frame if it's the last.
+struct GenericPass {
+    GenericRowFunction process_row;
+    GenericSimdRow simd;
+    const GenericParams *params;
+    int radius;
 
-                dstp[x] = static_cast<int>(std::pow(static_cast<float>(srcp[x] - params->min_in) / (params->max_in - params->min_in), 1.0f / params->gamma) * (params->max_out - params->min_out) + params->min_out + 0.5f);
+    uint8_t *dstp;
+    int stride;
+    int ring_rows; // 0 when dstp is the output frame.
 
-            } else if (op == GenericBinarize) {
+    int done;
+};
 
-                if (srcp[x] < params->th)
-                    dstp[x] = params->v0;
-                else
-                    dstp[x] = params->v1;
 
-            }
+static void runPass(GenericPass *passes, int i, int y, const uint8_t *srcp, int src_stride, int width, int height, int32_t *scratch) {
+    GenericPass &pass = passes[i];
+
+    while (pass.done <= y) {
+        int row = pass.done;
+
+        if (i > 0)
+            runPass(passes, i - 1, std::min(row + pass.radius, height - 1), srcp, src_stride, width, height, scratch);
+
+        const uint8_t *rows[25];
+
+        for (int j = -pass.radius; j <= pass.radius; j++) {
+            int yy = mirror(row + j, height);
+
+            if (i > 0)
+                rows[j + pass.radius] = passes[i - 1].dstp + (yy % passes[i - 1].ring_rows) * passes[i - 1].stride;
+            else
+                rows[j + pass.radius] = srcp + yy * src_stride;
         }
 
-        srcp += stride;
-        dstp += stride;
+        uint8_t *dstp = pass.dstp + (pass.ring_rows ? row % pass.ring_rows : row) * pass.stride;
+
+        pass.process_row(dstp, rows, width, pass.params, pass.simd, scratch);
+
+        pass.done++;
     }
 }
 
@@ -775,7 +686,6 @@ static void VS_CC genericInit(VSMap *in, VSMap *out, void **instanceData, VSNode
 }
 
 
-template <GenericOperations op>
 static const VSFrameRef *VS_CC genericGetframe(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     GenericData *d = static_cast<GenericData *>(*instanceData);
 
@@ -805,56 +715,127 @@ static const VSFrameRef *VS_CC genericGetframe(int n, int activationReason, void
 
         VSFrameRef *dst = vsapi->newVideoFrame2(fi, vsapi->getFrameWidth(src, 0), vsapi->getFrameHeight(src, 0), fr, pl, src, core);
 
-        void (*process_plane)(uint8_t *dstp8, const uint8_t *srcp8, int width, int height, int stride, GenericParams *params);
-
         int bits = fi->bitsPerSample;
 
-        if (op == GenericConvolution && d->params.matrix_elements == 25)
+        size_t num_stages = d->stages.size();
 
-            process_plane = bits == 8 ? process_plane_5x5<uint8_t, op> : process_plane_5x5<uint16_t, op>;
+        std::vector<GenericParams> params(num_stages);
 
-        else if (op == GenericConvolution && d->convolution_type == ConvolutionHorizontal)
+        for (size_t i = 0; i < num_stages; i++) {
+            params[i] = d->stages[i].params;
+            params[i].max_value = (1 << bits) - 1;
 
-            process_plane = bits == 8 ? process_plane_convolution_horizontal<uint8_t> : process_plane_convolution_horizontal<uint16_t>;
+            params[i].thresh_low = std::min(params[i].thresh_low, params[i].max_value);
+            params[i].thresh_high = std::min(params[i].thresh_high, params[i].max_value);
+        }
 
-        else if (op == GenericConvolution && d->convolution_type == ConvolutionVertical)
+        if (!isRowOperation(d->stages[0])) {
+            GenericPlaneFunction process_plane = getPlaneFunction(d->stages[0], bits);
 
-            process_plane = bits == 8 ? process_plane_convolution_vertical<uint8_t> : process_plane_convolution_vertical<uint16_t>;
+            for (int plane = 0; plane < fi->numPlanes; plane++) {
+                if (d->process[plane]) {
+                    uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+                    const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+                    int width = vsapi->getFrameWidth(src, plane);
+                    int height = vsapi->getFrameHeight(src, plane);
+                    int stride = vsapi->getStride(src, plane);
 
-        else if (op == GenericMinimum ||
-                 op == GenericMaximum ||
-                 op == GenericMedian ||
-                 op == GenericDeflate ||
-                 op == GenericInflate ||
-                 op == GenericConvolution ||
-                 op == GenericPrewitt ||
-                 op == GenericSobel)
+                    process_plane(dstp, srcp, width, height, stride, &params[0]);
+                }
+            }
 
-            process_plane = bits == 8 ? process_plane_3x3<uint8_t, op> : process_plane_3x3<uint16_t, op>;
+            vsapi->freeFrame(src);
 
-        else
+            return dst;
+        }
 
-            process_plane = bits == 8 ? process_plane_1x1<uint8_t, op> : process_plane_1x1<uint16_t, op>;
+        // Every stage but the last of a plane needs a ring buffer with as
+        // many rows as the next one looks at. The first plane is the widest.
+        int ring_stride = vsapi->getStride(src, 0);
+        size_t ring_size = 0;
+        for (size_t i = 1; i < num_stages; i++)
+            ring_size += (2 * stageRadius(d->stages[i]) + 1) * ring_stride;
+
+        uint8_t *rings = nullptr;
+        if (ring_size) {
+            rings = vs_aligned_malloc<uint8_t>(ring_size, 32);
+            if (!rings) {
+                vsapi->setFilterError(std::string(d->filter_name).append(": failed to allocate the ring buffers").c_str(), frameCtx);
+                vsapi->freeFrame(src);
+                vsapi->freeFrame(dst);
+                return nullptr;
+            }
+        }
 
+        // Separable convolutions keep the vertical pass of one row here.
+        int32_t *scratch = nullptr;
+        for (size_t i = 0; i < num_stages && !scratch; i++) {
+            if (d->stages[i].op == GenericConvolution && d->stages[i].params.separable) {
+                scratch = vs_aligned_malloc<int32_t>(vsapi->getFrameWidth(src, 0) * sizeof(int32_t), 32);
+                if (!scratch) {
+                    vs_aligned_free(rings);
+                    vsapi->setFilterError(std::string(d->filter_name).append(": failed to allocate the separable convolution buffer").c_str(), frameCtx);
+                    vsapi->freeFrame(src);
+                    vsapi->freeFrame(dst);
+                    return nullptr;
+                }
+            }
+        }
 
-        GenericParams params = d->params;
-        params.max_value = (1 << bits) - 1;
+        std::vector<GenericPass> passes(num_stages);
 
-        params.thresh_low = std::min(params.thresh_low, params.max_value);
-        params.thresh_high = std::min(params.thresh_high, params.max_value);
-        
         for (int plane = 0; plane < fi->numPlanes; plane++) {
-            if (d->process[plane]) {
-                uint8_t *dstp = vsapi->getWritePtr(dst, plane);
-                const uint8_t *srcp = vsapi->getReadPtr(src, plane);
-                int width = vsapi->getFrameWidth(src, plane);
-                int height = vsapi->getFrameHeight(src, plane);
-                int stride = vsapi->getStride(src, plane);
-
-                process_plane(dstp, srcp, width, height, stride, &params);
+            if (!d->process[plane])
+                continue;
+
+            uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+            const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+            int width = vsapi->getFrameWidth(src, plane);
+            int height = vsapi->getFrameHeight(src, plane);
+            int stride = vsapi->getStride(src, plane);
+
+            int num_passes = 0;
+
+            for (size_t i = 0; i < num_stages; i++) {
+                const GenericStage &stage = d->stages[i];
+
+                if (!stage.process[plane])
+                    continue;
+
+                GenericPass &pass = passes[num_passes++];
+
+                pass.radius = stageRadius(stage);
+                pass.process_row = getRowFunction(stage.op, bits, &stage.params);
+#ifdef VS_TARGET_CPU_X86
+                pass.simd = d->avx2 ? genericGetSimdRowAVX2(stage.op, fi->bytesPerSample, &stage.params) : getSimdRow<GenericSSE2>(stage.op, fi->bytesPerSample, &stage.params);
+#else
+                pass.simd = nullptr;
+#endif
+                pass.params = &params[i];
+                pass.done = 0;
+            }
+
+            uint8_t *ring = rings;
+
+            for (int i = 0; i < num_passes - 1; i++) {
+                passes[i].dstp = ring;
+                passes[i].stride = stride;
+                passes[i].ring_rows = 2 * passes[i + 1].radius + 1;
+
+                ring += passes[i].ring_rows * stride;
             }
+
+            passes[num_passes - 1].dstp = dstp;
+            passes[num_passes - 1].stride = stride;
+            passes[num_passes - 1].ring_rows = 0;
+
+            for (int y = 0; y < height; y++)
+                runPass(passes.data(), num_passes - 1, y, srcp, stride, width, height, scratch);
         }
 
+        vs_aligned_free(rings);
+        vs_aligned_free(scratch);
+
         vsapi->freeFrame(src);
 
         return dst;
@@ -872,221 +853,449 @@ static void VS_CC genericFree(void *instanceData, VSCore *core, const VSAPI *vsa
 }
 
 
-template <GenericOperations op>
-static void VS_CC genericCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
-    GenericData d;
-    GenericData *data;
+static void genericCheckFormat(const VSVideoInfo *vi) {
+    if (vi->format && vi->format->colorFamily == cmCompat)
+        throw std::string("Cannot process compat formats.");
 
-    d.filter_name = static_cast<const char *>(userData);
+    if (vi->format && (vi->format->sampleType != stInteger || vi->format->bitsPerSample > 16))
+        throw std::string("Only clips with integer samples and 8..16 bits per sample supported.");
+}
 
-    d.node = vsapi->propGetNode(in, "clip", 0, nullptr);
-    d.vi = vsapi->getVideoInfo(d.node);
 
-    try {
-        if (d.vi->format && d.vi->format->colorFamily == cmCompat)
-            throw std::string("Cannot process compat formats.");
+static int gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
 
-        if (d.vi->format && (d.vi->format->sampleType != stInteger || d.vi->format->bitsPerSample > 16))
-            throw std::string("Only clips with integer samples and 8..16 bits per sample supported.");
 
-        int m = vsapi->propNumElements(in, "planes");
+// Finds h and v such that matrix[y * size + x] == v[y] * h[x], which is
+// possible when all the rows are multiples of a single row.
+static bool splitMatrix(const int *matrix, int size, int *h, int *v) {
+    int row = -1;
+    int column = -1;
 
-        for (int i = 0; i < 3; i++)
-            d.process[i] = (m <= 0);
+    for (int i = 0; i < size * size && row < 0; i++) {
+        if (matrix[i]) {
+            row = i / size;
+            column = i % size;
+        }
+    }
 
-        for (int i = 0; i < m; i++) {
-            int o = int64ToIntS(vsapi->propGetInt(in, "planes", i, nullptr));
+    if (row < 0)
+        return false;
 
-            if (o < 0 || o >= 3)
-                throw std::string("plane index out of range");
+    int divisor = 0;
+    for (int x = 0; x < size; x++)
+        divisor = gcd(divisor, std::abs(matrix[row * size + x]));
 
-            if (d.process[o])
-                throw std::string("plane specified twice");
+    for (int x = 0; x < size; x++)
+        h[x] = matrix[row * size + x] / divisor;
 
-            d.process[o] = 1;
-        }
+    for (int y = 0; y < size; y++) {
+        if (matrix[y * size + column] % h[column])
+            return false;
+
+        v[y] = matrix[y * size + column] / h[column];
 
+        for (int x = 0; x < size; x++)
+            if (matrix[y * size + x] != v[y] * h[x])
+                return false;
+    }
 
-        int err;
+    return true;
+}
 
-        if (op == GenericMinimum || op == GenericMaximum || op == GenericDeflate || op == GenericInflate) {
-            d.params.th = int64ToIntS(vsapi->propGetInt(in, "threshold", 0, &err));
-            if (err)
-                d.params.th = 65535;
 
-            if (d.params.th < 0 || d.params.th > 65535)
-                throw std::string("threshold must be between 0 and 65535.");
-        }
+static void genericParseStage(GenericOperations op, const VSMap *in, const VSVideoInfo *vi, GenericStage &stage, const VSAPI *vsapi) {
+    stage.op = op;
 
+    int m = vsapi->propNumElements(in, "planes");
 
-        if (op == GenericMinimum || op == GenericMaximum) {
-            int enable_elements = vsapi->propNumElements(in, "coordinates");
-            if (enable_elements == -1) {
-                for (int i = 0; i < 8; i++)
-                    d.params.enable[i] = 1;
-            } else if (enable_elements == 8) {
-                const int64_t *enable = vsapi->propGetIntArray(in, "coordinates", &err);
-                for (int i = 0; i < 8; i++)
-                    d.params.enable[i] = !!enable[i];
-            } else {
-                throw std::string("coordinates must contain exactly 8 numbers.");
-            }
+    for (int i = 0; i < 3; i++)
+        stage.process[i] = (m <= 0);
+
+    for (int i = 0; i < m; i++) {
+        int o = int64ToIntS(vsapi->propGetInt(in, "planes", i, nullptr));
+
+        if (o < 0 || o >= 3)
+            throw std::string("plane index out of range");
+
+        if (stage.process[o])
+            throw std::string("plane specified twice");
+
+        stage.process[o] = 1;
+    }
+
+
+    int err;
+
+    if (op == GenericMinimum || op == GenericMaximum || op == GenericDeflate || op == GenericInflate) {
+        stage.params.th = int64ToIntS(vsapi->propGetInt(in, "threshold", 0, &err));
+        if (err)
+            stage.params.th = 65535;
+
+        if (stage.params.th < 0 || stage.params.th > 65535)
+            throw std::string("threshold must be between 0 and 65535.");
+    }
+
+
+    if (op == GenericMinimum || op == GenericMaximum) {
+        int enable_elements = vsapi->propNumElements(in, "coordinates");
+        if (enable_elements == -1) {
+            for (int i = 0; i < 8; i++)
+                stage.params.enable[i] = 1;
+        } else if (enable_elements == 8) {
+            const int64_t *enable = vsapi->propGetIntArray(in, "coordinates", &err);
+            for (int i = 0; i < 8; i++)
+                stage.params.enable[i] = !!enable[i];
+        } else {
+            throw std::string("coordinates must contain exactly 8 numbers.");
         }
+    }
+
+
+    if (op == GenericPrewitt || op == GenericSobel || op == GenericLimiter) {
+        stage.params.thresh_low = int64ToIntS(vsapi->propGetInt(in, "min", 0, &err));
+
+        stage.params.thresh_high = int64ToIntS(vsapi->propGetInt(in, "max", 0, &err));
+        if (err)
+            stage.params.thresh_high = 65535;
+
+        if (stage.params.thresh_low < 0 || stage.params.thresh_low > 65535)
+            throw std::string("min must be between 0 and 65535.");
+
+        if (stage.params.thresh_high < 0 || stage.params.thresh_high > 65535)
+            throw std::string("max must be between 0 and 65535.");
+    }
+
 
+    if (op == GenericPrewitt || op == GenericSobel) {
+        stage.params.rshift = int64ToIntS(vsapi->propGetInt(in, "rshift", 0, &err));
+
+        if (stage.params.rshift < 0)
+            throw std::string("rshift must not be negative.");
+    }
+
+
+    if (op == GenericConvolution) {
+        stage.params.bias = static_cast<float>(vsapi->propGetFloat(in, "bias", 0, &err));
 
-        if (op == GenericPrewitt || op == GenericSobel || op == GenericLimiter) {
-            d.params.thresh_low = int64ToIntS(vsapi->propGetInt(in, "min", 0, &err));
+        stage.params.saturate = !!vsapi->propGetInt(in, "saturate", 0, &err);
+        if (err)
+            stage.params.saturate = true;
 
-            d.params.thresh_high = int64ToIntS(vsapi->propGetInt(in, "max", 0, &err));
-            if (err)
-                d.params.thresh_high = 65535;
+        stage.params.matrix_elements = vsapi->propNumElements(in, "matrix");
 
-            if (d.params.thresh_low < 0 || d.params.thresh_low > 65535)
-                throw std::string("min must be between 0 and 65535.");
+        ConvolutionTypes convolution_type;
 
-            if (d.params.thresh_high < 0 || d.params.thresh_high > 65535)
-                throw std::string("max must be between 0 and 65535.");
+        const char *mode = vsapi->propGetData(in, "mode", 0, &err);
+        if (err || mode[0] == 's') {
+            convolution_type = ConvolutionSquare;
+
+            if (stage.params.matrix_elements != 9 && stage.params.matrix_elements != 25)
+                throw std::string("When mode starts with 's', matrix must contain exactly 9 or exactly 25 numbers.");
+        } else if (mode[0] == 'h' || mode[0] == 'v') {
+            if (mode[0] == 'h')
+                convolution_type = ConvolutionHorizontal;
+            else
+                convolution_type = ConvolutionVertical;
+
+            if (stage.params.matrix_elements < 3 || stage.params.matrix_elements > 25)
+                throw std::string("When mode starts with 'h' or 'v', matrix must contain between 3 and 25 numbers.");
+
+            if (stage.params.matrix_elements % 2 == 0)
+                throw std::string("matrix must contain an odd number of numbers.");
+        } else {
+            throw std::string("mode must start with 's', 'h', or 'v'.");
         }
 
+        int64_t matrix_sum = 0;
+        const int64_t *matrix = vsapi->propGetIntArray(in, "matrix", nullptr);
+        for (int i = 0; i < stage.params.matrix_elements; i++) {
+            // Supporting coefficients outside this range would probably require int64_t accumulator.
+            if (matrix[i] < -1024 || matrix[i] > 1023)
+                throw std::string("The numbers in matrix must be between -1024 and 1023.");
 
-        if (op == GenericPrewitt || op == GenericSobel) {
-            d.params.rshift = int64ToIntS(vsapi->propGetInt(in, "rshift", 0, &err));
+            stage.params.matrix[i] = int64ToIntS(matrix[i]);
+            matrix_sum += matrix[i];
+        }
 
-            if (d.params.rshift < 0)
-                throw std::string("rshift must not be negative.");
+        if (matrix_sum == 0)
+            matrix_sum = 1;
+
+        stage.params.rdiv = static_cast<float>(vsapi->propGetFloat(in, "divisor", 0, &err));
+        if (stage.params.rdiv == 0.0f)
+            stage.params.rdiv = static_cast<float>(matrix_sum);
+
+        stage.params.rdiv = 1.0f / stage.params.rdiv;
+
+        GenericParams &p = stage.params;
+
+        if (convolution_type == ConvolutionHorizontal) {
+            p.separable = true;
+            p.matrix_h_elements = p.matrix_elements;
+            std::copy(p.matrix, p.matrix + p.matrix_elements, p.matrix_h);
+            p.matrix_v_elements = 1;
+            p.matrix_v[0] = 1;
+        } else if (convolution_type == ConvolutionVertical) {
+            p.separable = true;
+            p.matrix_h_elements = 1;
+            p.matrix_h[0] = 1;
+            p.matrix_v_elements = p.matrix_elements;
+            std::copy(p.matrix, p.matrix + p.matrix_elements, p.matrix_v);
+        } else if (p.matrix_elements == 25) {
+            // A 3x3 matrix isn't any faster this way once it's vectorized.
+            p.separable = splitMatrix(p.matrix, 5, p.matrix_h, p.matrix_v);
+            p.matrix_h_elements = 5;
+            p.matrix_v_elements = 5;
         }
+    }
 
 
-        if (op == GenericConvolution) {
-            d.params.bias = static_cast<float>(vsapi->propGetFloat(in, "bias", 0, &err));
+    if (op == GenericBinarize) {
+        if (!vi->format)
+            throw std::string("Can only process clips with constant format."); // Constant bit depth, really.
 
-            d.params.saturate = !!vsapi->propGetInt(in, "saturate", 0, &err);
-            if (err)
-                d.params.saturate = true;
+        stage.params.th = int64ToIntS(vsapi->propGetInt(in, "threshold", 0, &err));
+        if (err)
+            stage.params.th = 1 << (vi->format->bitsPerSample - 1);
 
-            d.params.matrix_elements = vsapi->propNumElements(in, "matrix");
+        int max_value = (1 << vi->format->bitsPerSample) - 1;
 
-            const char *mode = vsapi->propGetData(in, "mode", 0, &err);
-            if (err || mode[0] == 's') {
-                d.convolution_type = ConvolutionSquare;
+        stage.params.v0 = int64ToIntS(vsapi->propGetInt(in, "v0", 0, &err));
 
-                if (d.params.matrix_elements != 9 && d.params.matrix_elements != 25)
-                    throw std::string("When mode starts with 's', matrix must contain exactly 9 or exactly 25 numbers.");
-            } else if (mode[0] == 'h' || mode[0] == 'v') {
-                if (mode[0] == 'h')
-                    d.convolution_type = ConvolutionHorizontal;
-                else
-                    d.convolution_type = ConvolutionVertical;
+        stage.params.v1 = int64ToIntS(vsapi->propGetInt(in, "v1", 0, &err));
+        if (err)
+            stage.params.v1 = max_value;
 
-                if (d.params.matrix_elements < 3 || d.params.matrix_elements > 17)
-                    throw std::string("When mode starts with 'h' or 'v', matrix must contain between 3 and 17 numbers.");
+        std::string tmp = " must be between 0 and " + std::to_string(max_value) + ".";
 
-                if (d.params.matrix_elements % 2 == 0)
-                    throw std::string("matrix must contain an odd number of numbers.");
-            } else {
-                throw std::string("mode must start with 's', 'h', or 'v'.");
-            }
+        if (stage.params.th < 0 || stage.params.th > max_value)
+            throw "threshold" + tmp;
 
-            int64_t matrix_sum = 0;
-            const int64_t *matrix = vsapi->propGetIntArray(in, "matrix", nullptr);
-            for (int i = 0; i < d.params.matrix_elements; i++) {
-                // Supporting coefficients outside this range would probably require int64_t accumulator.
-                if (matrix[i] < -1024 || matrix[i] > 1023)
-                    throw std::string("The numbers in matrix must be between -1024 and 1023.");
+        if (stage.params.v0 < 0 || stage.params.v0 > max_value)
+            throw "v0" + tmp;
 
-                d.params.matrix[i] = int64ToIntS(matrix[i]);
-                matrix_sum += matrix[i];
-            }
+        if (stage.params.v1 < 0 || stage.params.v1 > max_value)
+            throw "v1" + tmp;
+    }
 
-            if (matrix_sum == 0)
-                matrix_sum = 1;
 
-            d.params.rdiv = static_cast<float>(vsapi->propGetFloat(in, "divisor", 0, &err));
-            if (d.params.rdiv == 0.0f)
-                d.params.rdiv = static_cast<float>(matrix_sum);
+    if (op == GenericLevels) {
+        if (!vi->format)
+            throw std::string("Can only process clips with constant format."); // Constant bit depth, really.
 
-            d.params.rdiv = 1.0f / d.params.rdiv;
-        }
+        int max_value = (1 << vi->format->bitsPerSample) - 1;
+
+        stage.params.min_in = int64ToIntS(vsapi->propGetInt(in, "min_in", 0, &err));
+        
+        stage.params.max_in = int64ToIntS(vsapi->propGetInt(in, "max_in", 0, &err));
+        if (err)
+            stage.params.max_in = max_value;
+
+        stage.params.min_out = int64ToIntS(vsapi->propGetInt(in, "min_out", 0, &err));
+
+        stage.params.max_out = int64ToIntS(vsapi->propGetInt(in, "max_out", 0, &err));
+        if (err)
+            stage.params.max_out = max_value;
+
+        stage.params.gamma = static_cast<float>(vsapi->propGetFloat(in, "gamma", 0, &err));
+        if (err)
+            stage.params.gamma = 1.0f;
+
+        std::string tmp = " must be between 0 and " + std::to_string(max_value) + ".";
+
+        if (stage.params.min_in < 0 || stage.params.min_in > max_value)
+            throw "min_in" + tmp;
+
+        if (stage.params.max_in < 0 || stage.params.max_in > max_value)
+            throw "max_in" + tmp;
+
+        if (stage.params.min_out < 0 || stage.params.min_out > max_value)
+            throw "min_out" + tmp;
+
+        if (stage.params.max_out < 0 || stage.params.max_out > max_value)
+            throw "max_out" + tmp;
+
+        if (stage.params.gamma <= 0.0f)
+            throw std::string("gamma must be greater than 0.");
+    }
+}
+
+
+template <GenericOperations op>
+static void VS_CC genericCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    GenericData d;
+    GenericData *data;
+
+    d.filter_name = static_cast<const char *>(userData);
+
+    d.node = vsapi->propGetNode(in, "clip", 0, nullptr);
+    d.vi = vsapi->getVideoInfo(d.node);
 
+    GenericStage stage = GenericStage();
 
-        if (op == GenericBinarize) {
-            if (!d.vi->format)
-                throw std::string("Can only process clips with constant format."); // Constant bit depth, really.
+    try {
+        genericCheckFormat(d.vi);
+
+        genericParseStage(op, in, d.vi, stage, vsapi);
+    } catch (std::string &error) {
+        vsapi->freeNode(d.node);
+        vsapi->setError(out, std::string(d.filter_name).append(": ").append(error).c_str());
+        return;
+    }
+
+    for (int i = 0; i < 3; i++)
+        d.process[i] = stage.process[i];
+
+    d.stages.push_back(stage);
+
+    d.avx2 = genericUseAVX2();
+
+    data = new GenericData(d);
+
+    vsapi->createFilter(in, out, d.filter_name, genericInit, genericGetframe, genericFree, fmParallel, 0, data, core);
+}
+
+
+static const struct {
+    const char *name;
+    GenericOperations op;
+    const char *args;
+} chainOperations[] = {
+    { "Minimum", GenericMinimum, " planes threshold coordinates " },
+    { "Maximum", GenericMaximum, " planes threshold coordinates " },
+    { "Median", GenericMedian, " planes " },
+    { "Deflate", GenericDeflate, " planes threshold " },
+    { "Inflate", GenericInflate, " planes threshold " },
+    { "Convolution", GenericConvolution, " matrix bias divisor planes saturate mode " },
+    { "Prewitt", GenericPrewitt, " min max planes rshift " },
+    { "Sobel", GenericSobel, " min max planes rshift " }
+};
+
+
+// Turns something like "Convolution matrix=1,2,1,2,4,2,1,2,1 planes=0" into
+// the same arguments the filter itself would get.
+static int parseChainEntry(const std::string &entry, VSMap *args, const VSAPI *vsapi) {
+    std::istringstream tokens(entry);
+    tokens.imbue(std::locale("C"));
+
+    std::string name;
+    if (!(tokens >> name))
+        throw std::string("empty filter in filters.");
 
-            d.params.th = int64ToIntS(vsapi->propGetInt(in, "threshold", 0, &err));
-            if (err)
-                d.params.th = 1 << (d.vi->format->bitsPerSample - 1);
+    int index = -1;
+    for (size_t i = 0; i < sizeof(chainOperations) / sizeof(chainOperations[0]); i++)
+        if (name == chainOperations[i].name)
+            index = static_cast<int>(i);
 
-            int max_value = (1 << d.vi->format->bitsPerSample) - 1;
+    if (index < 0)
+        throw "'" + name + "' can't be chained. Only Minimum, Maximum, Median, Deflate, Inflate, Convolution, Prewitt and Sobel can.";
 
-            d.params.v0 = int64ToIntS(vsapi->propGetInt(in, "v0", 0, &err));
+    std::string token;
+    while (tokens >> token) {
+        size_t equals = token.find('=');
+        std::string key = token.substr(0, equals);
 
-            d.params.v1 = int64ToIntS(vsapi->propGetInt(in, "v1", 0, &err));
-            if (err)
-                d.params.v1 = max_value;
+        if (equals == std::string::npos || equals + 1 == token.size())
+            throw name + ": '" + token + "' must have the form name=value.";
 
-            std::string tmp = " must be between 0 and " + std::to_string(max_value) + ".";
+        if (std::string(chainOperations[index].args).find(" " + key + " ") == std::string::npos)
+            throw name + ": unknown argument '" + key + "'.";
 
-            if (d.params.th < 0 || d.params.th > max_value)
-                throw "threshold" + tmp;
+        if (vsapi->propNumElements(args, key.c_str()) >= 0)
+            throw name + ": " + key + " specified twice.";
 
-            if (d.params.v0 < 0 || d.params.v0 > max_value)
-                throw "v0" + tmp;
+        std::string values = token.substr(equals + 1);
 
-            if (d.params.v1 < 0 || d.params.v1 > max_value)
-                throw "v1" + tmp;
+        if (key == "mode") {
+            vsapi->propSetData(args, key.c_str(), values.c_str(), static_cast<int>(values.size()), paAppend);
+            continue;
         }
 
+        std::istringstream numbers(values);
+        numbers.imbue(std::locale("C"));
 
-        if (op == GenericLevels) {
-            if (!d.vi->format)
-                throw std::string("Can only process clips with constant format."); // Constant bit depth, really.
+        std::string number;
+        while (std::getline(numbers, number, ',')) {
+            std::istringstream numStream(number);
+            numStream.imbue(std::locale("C"));
+            std::string rest;
 
-            int max_value = (1 << d.vi->format->bitsPerSample) - 1;
+            if (key == "bias" || key == "divisor") {
+                double f;
+                if (!(numStream >> f) || numStream >> rest)
+                    throw name + ": failed to convert '" + number + "' to float.";
+                vsapi->propSetFloat(args, key.c_str(), f, paAppend);
+            } else {
+                int64_t i;
+                if (!(numStream >> i) || numStream >> rest)
+                    throw name + ": failed to convert '" + number + "' to int.";
+                vsapi->propSetInt(args, key.c_str(), i, paAppend);
+            }
+        }
+    }
+
+    return index;
+}
+
+
+static void VS_CC filterChainCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    GenericData d;
+    GenericData *data;
 
-            d.params.min_in = int64ToIntS(vsapi->propGetInt(in, "min_in", 0, &err));
-            
-            d.params.max_in = int64ToIntS(vsapi->propGetInt(in, "max_in", 0, &err));
-            if (err)
-                d.params.max_in = max_value;
+    d.filter_name = "FilterChain";
 
-            d.params.min_out = int64ToIntS(vsapi->propGetInt(in, "min_out", 0, &err));
+    d.node = vsapi->propGetNode(in, "clip", 0, nullptr);
+    d.vi = vsapi->getVideoInfo(d.node);
 
-            d.params.max_out = int64ToIntS(vsapi->propGetInt(in, "max_out", 0, &err));
-            if (err)
-                d.params.max_out = max_value;
+    VSMap *args = vsapi->createMap();
 
-            d.params.gamma = static_cast<float>(vsapi->propGetFloat(in, "gamma", 0, &err));
-            if (err)
-                d.params.gamma = 1.0f;
+    try {
+        genericCheckFormat(d.vi);
 
-            std::string tmp = " must be between 0 and " + std::to_string(max_value) + ".";
+        int num_filters = vsapi->propNumElements(in, "filters");
 
-            if (d.params.min_in < 0 || d.params.min_in > max_value)
-                throw "min_in" + tmp;
+        for (int i = 0; i < num_filters; i++) {
+            vsapi->clearMap(args);
 
-            if (d.params.max_in < 0 || d.params.max_in > max_value)
-                throw "max_in" + tmp;
+            int index = parseChainEntry(vsapi->propGetData(in, "filters", i, nullptr), args, vsapi);
 
-            if (d.params.min_out < 0 || d.params.min_out > max_value)
-                throw "min_out" + tmp;
+            GenericStage stage = GenericStage();
 
-            if (d.params.max_out < 0 || d.params.max_out > max_value)
-                throw "max_out" + tmp;
+            try {
+                genericParseStage(chainOperations[index].op, args, d.vi, stage, vsapi);
+            } catch (std::string &error) {
+                throw std::string(chainOperations[index].name).append(": ").append(error);
+            }
 
-            if (d.params.gamma <= 0.0f)
-                throw std::string("gamma must be greater than 0.");
+            d.stages.push_back(stage);
         }
     } catch (std::string &error) {
+        vsapi->freeMap(args);
         vsapi->freeNode(d.node);
         vsapi->setError(out, std::string(d.filter_name).append(": ").append(error).c_str());
         return;
     }
 
-    
+    vsapi->freeMap(args);
+
+    for (int i = 0; i < 3; i++) {
+        d.process[i] = 0;
+        for (size_t j = 0; j < d.stages.size(); j++)
+            d.process[i] |= d.stages[j].process[i];
+    }
+
+    d.avx2 = genericUseAVX2();
+
     data = new GenericData(d);
 
-    vsapi->createFilter(in, out, d.filter_name, genericInit, genericGetframe<op>, genericFree, fmParallel, 0, data, core);
+    vsapi->createFilter(in, out, d.filter_name, genericInit, genericGetframe, genericFree, fmParallel, 0, data, core);
 }
 
 
@@ -1179,4 +1388,9 @@ void VS_CC genericInitialize(VSConfigPlugin configFunc, VSRegisterFunction regis
             "v1:int:opt;"
             "planes:int[]:opt;"
             , genericCreate<GenericBinarize>, const_cast<char *>("Binarize"), plugin);
+
+    registerFunc("FilterChain",
+            "clip:clip;"
+            "filters:data[];"
+            , filterChainCreate, nullptr, plugin);
 }
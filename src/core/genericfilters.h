@@ -22,8 +22,87 @@
 #ifndef GENERICFILTERS_H
 #define GENERICFILTERS_H
 
+#include <stdint.h>
 #include "VapourSynth.h"
 
 void VS_CC genericInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin);
 
+
+enum GenericOperations {
+    GenericPrewitt,
+    GenericSobel,
+
+    GenericMinimum,
+    GenericMaximum,
+
+    GenericMedian,
+
+    GenericDeflate,
+    GenericInflate,
+
+    GenericConvolution,
+
+    GenericInvert,
+    GenericLimiter,
+    GenericLevels,
+    GenericBinarize
+};
+
+
+struct GenericParams {
+    // Used by all.
+    int max_value;
+
+    // Prewitt, Sobel, Limiter.
+    int thresh_low;
+    int thresh_high;
+
+    // Prewitt, Sobel.
+    int rshift;
+
+    // Minimum, Maximum, Deflate, Inflate, Binarize.
+    int th;
+
+    // Binarize.
+    int v0;
+    int v1;
+
+    // Minimum, Maximum.
+    int enable[8];
+
+    // Convolution.
+    int matrix[25];
+    int matrix_elements;
+    float rdiv;
+    float bias;
+    bool saturate;
+
+    // Convolution done as a vertical and then a horizontal pass, for the
+    // horizontal and vertical modes and for square matrices that can be split.
+    bool separable;
+    int matrix_h[25];
+    int matrix_h_elements;
+    int matrix_v[25];
+    int matrix_v_elements;
+
+    // Levels.
+    int min_in;
+    int max_in;
+    float gamma;
+    int min_out;
+    int max_out;
+};
+
+
+// Processes one row of a 3x3, 5x5 or separable operation, rows points to the
+// source rows from above to below the current one. The vectorized versions
+// only do the pixels that don't need mirroring and return where they stopped.
+// Separable convolutions also leave the vertical pass of the whole row in
+// scratch, which has room for width values.
+typedef int (*GenericSimdRow)(uint8_t *dstp, const uint8_t * const *rows, int width, const GenericParams *params, int32_t *scratch);
+
+#ifdef VS_TARGET_CPU_X86
+GenericSimdRow genericGetSimdRowAVX2(GenericOperations op, int bytesPerSample, const GenericParams *params);
+#endif
+
 #endif // GENERICFILTERS_H
@@ -0,0 +1,117 @@
+/*
+* Copyright (c) 2015 John Smith
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <immintrin.h>
+#include "genericfilters_simd.h"
+
+namespace {
+
+struct GenericAVX2 {
+    typedef __m256i I;
+
+    enum { words = 16 };
+
+    static FORCE_INLINE I load(const uint8_t *p) {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    }
+
+    static FORCE_INLINE I load(const uint16_t *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+
+    // packus works within each 128 bit lane, the permute puts the two halves next to each other.
+    static FORCE_INLINE void store(uint8_t *p, I v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8)));
+    }
+
+    static FORCE_INLINE void store(uint16_t *p, I v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+
+    static FORCE_INLINE I set1w(int v) { return _mm256_set1_epi16(static_cast<short>(v)); }
+    static FORCE_INLINE I set1d(int v) { return _mm256_set1_epi32(v); }
+
+    static FORCE_INLINE I minu(I a, I b) { return _mm256_min_epu16(a, b); }
+    static FORCE_INLINE I maxu(I a, I b) { return _mm256_max_epu16(a, b); }
+
+    static FORCE_INLINE I addsu(I a, I b) { return _mm256_adds_epu16(a, b); }
+    static FORCE_INLINE I subsu(I a, I b) { return _mm256_subs_epu16(a, b); }
+    static FORCE_INLINE I add16(I a, I b) { return _mm256_add_epi16(a, b); }
+    static FORCE_INLINE I srli16(I a, int n) { return _mm256_srli_epi16(a, n); }
+
+    // The unpacks also work within each lane, which packus32 undoes.
+    static FORCE_INLINE I unpacklo16(I a, I b) { return _mm256_unpacklo_epi16(a, b); }
+    static FORCE_INLINE I unpackhi16(I a, I b) { return _mm256_unpackhi_epi16(a, b); }
+    static FORCE_INLINE I lo32(I a) { return _mm256_unpacklo_epi16(a, _mm256_setzero_si256()); }
+    static FORCE_INLINE I hi32(I a) { return _mm256_unpackhi_epi16(a, _mm256_setzero_si256()); }
+
+    static FORCE_INLINE I add32(I a, I b) { return _mm256_add_epi32(a, b); }
+    static FORCE_INLINE I sub32(I a, I b) { return _mm256_sub_epi32(a, b); }
+    static FORCE_INLINE I slli32(I a, int n) { return _mm256_slli_epi32(a, n); }
+    static FORCE_INLINE I srli32(I a, int n) { return _mm256_srli_epi32(a, n); }
+    static FORCE_INLINE I srl32(I a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static FORCE_INLINE I cmpgt32(I a, I b) { return _mm256_cmpgt_epi32(a, b); }
+    static FORCE_INLINE I madd(I a, I b) { return _mm256_madd_epi16(a, b); }
+    static FORCE_INLINE I abs32(I a) { return _mm256_abs_epi32(a); }
+    static FORCE_INLINE I packus32(I a, I b) { return _mm256_packus_epi32(a, b); }
+    static FORCE_INLINE I mullo32(I a, I b) { return _mm256_mullo_epi32(a, b); }
+
+    static FORCE_INLINE I loadd(const int32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+    static FORCE_INLINE void stored(int32_t *p, I v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+
+    static FORCE_INLINE void sequence(I &lo, I &hi) {
+        I t = lo;
+        lo = _mm256_permute2x128_si256(t, hi, 0x20);
+        hi = _mm256_permute2x128_si256(t, hi, 0x31);
+    }
+
+    static FORCE_INLINE I packus32_seq(I a, I b) { return _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8); }
+
+    static FORCE_INLINE I and_(I a, I b) { return _mm256_and_si256(a, b); }
+    static FORCE_INLINE I andnot(I a, I b) { return _mm256_andnot_si256(a, b); }
+    static FORCE_INLINE I or_(I a, I b) { return _mm256_or_si256(a, b); }
+    static FORCE_INLINE I xor_(I a, I b) { return _mm256_xor_si256(a, b); }
+
+    static FORCE_INLINE I convolve(I sum, float rdiv, float bias) {
+        __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(rdiv));
+        f = _mm256_add_ps(_mm256_add_ps(f, _mm256_set1_ps(bias)), _mm256_set1_ps(0.5f));
+        return _mm256_cvttps_epi32(f);
+    }
+
+    static FORCE_INLINE __m128i magnitude4(__m128i gx, __m128i gy) {
+        __m256d x = _mm256_cvtepi32_pd(gx);
+        __m256d y = _mm256_cvtepi32_pd(gy);
+        __m256d g = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)));
+        return _mm256_cvttpd_epi32(_mm256_add_pd(g, _mm256_set1_pd(0.5)));
+    }
+
+    static FORCE_INLINE I magnitude(I gx, I gy) {
+        __m128i lo = magnitude4(_mm256_castsi256_si128(gx), _mm256_castsi256_si128(gy));
+        __m128i hi = magnitude4(_mm256_extracti128_si256(gx, 1), _mm256_extracti128_si256(gy, 1));
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+};
+
+} // namespace
+
+
+GenericSimdRow genericGetSimdRowAVX2(GenericOperations op, int bytesPerSample, const GenericParams *params) {
+    return getSimdRow<GenericAVX2>(op, bytesPerSample, params);
+}
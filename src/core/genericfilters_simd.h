@@ -0,0 +1,403 @@
+/*
+* Copyright (c) 2015 John Smith
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// The vectorized 3x3 and 5x5 operations. They are written once against a set
+// of primitives V that work on vectors of 16 bit words and are instantiated
+// with SSE2 in genericfilters.cpp and with AVX2 in genericfilters_avx2.cpp.
+// Everything here must stay static so the two versions are never mixed up by
+// the linker. The results are identical to the C versions.
+//
+// V has to provide:
+//  I                   the vector type
+//  words               the number of pixels per vector
+//  load, store         pixels to and from words for uint8_t and uint16_t
+//  set1w, set1d        broadcast a word or a dword
+//  minu, maxu          unsigned word min and max
+//  addsu, subsu        unsigned saturating word add and subtract
+//  add16, srli16       word add and logical right shift
+//  lo32, hi32          zero extend half of the words to dwords, the order only
+//                      has to match packus32 and unpacklo16/unpackhi16
+//  add32, sub32, slli32, srli32, srl32, cmpgt32, abs32
+//  and_, andnot, or_, xor_
+//  unpacklo16, unpackhi16, madd
+//  packus32            dwords to words with unsigned saturation
+//  convolve            (int)(sum * rdiv + bias + 0.5f) for dwords
+//  magnitude           (int)(sqrt((double)(gx * gx + gy * gy)) + 0.5) for dwords
+//  loadd, stored       words / 2 dwords in memory order
+//  mullo32             the low 32 bits of a dword multiplication
+//  sequence            reorders the results of madd on unpacklo16/unpackhi16
+//                      into memory order
+//  packus32_seq        packus32 for dwords in memory order
+
+#ifndef GENERICFILTERS_SIMD_H
+#define GENERICFILTERS_SIMD_H
+
+#include <algorithm>
+#include "genericfilters.h"
+
+#ifndef FORCE_INLINE
+#ifdef VS_TARGET_OS_WINDOWS
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+#endif
+
+
+template <typename V>
+static FORCE_INLINE void sort_simd(typename V::I &a, typename V::I &b) {
+    typename V::I t = a;
+    a = V::minu(a, b);
+    b = V::maxu(t, b);
+}
+
+
+template <typename V>
+static FORCE_INLINE typename V::I median_simd(typename V::I *p) {
+    sort_simd<V>(p[1], p[2]); sort_simd<V>(p[4], p[5]); sort_simd<V>(p[7], p[8]);
+    sort_simd<V>(p[0], p[1]); sort_simd<V>(p[3], p[4]); sort_simd<V>(p[6], p[7]);
+    sort_simd<V>(p[1], p[2]); sort_simd<V>(p[4], p[5]); sort_simd<V>(p[7], p[8]);
+    sort_simd<V>(p[0], p[3]); sort_simd<V>(p[5], p[8]); sort_simd<V>(p[4], p[7]);
+    sort_simd<V>(p[3], p[6]); sort_simd<V>(p[1], p[4]); sort_simd<V>(p[2], p[5]);
+    sort_simd<V>(p[4], p[7]); sort_simd<V>(p[4], p[2]); sort_simd<V>(p[6], p[4]);
+    sort_simd<V>(p[4], p[2]);
+    return p[4];
+}
+
+
+// The multiplications are done with madd on pairs of pixels. 16 bit pixels
+// don't fit in signed words so they are biased by 32768, which is added back
+// as 32768 times the sum of the matrix.
+template <typename V, typename PixelType, int taps>
+static FORCE_INLINE void convolution_setup_simd(typename V::I *coeffs, typename V::I &offset, const GenericParams *params) {
+    int sum = 0;
+    for (int i = 0; i < taps; i++)
+        sum += params->matrix[i];
+
+    for (int i = 0; i < taps / 2; i++)
+        // unsigned since the coefficients can be negative
+        coeffs[i] = V::set1d((int)(((unsigned)params->matrix[i * 2 + 1] << 16) | ((unsigned)params->matrix[i * 2] & 0xFFFF)));
+    if (taps % 2)
+        coeffs[taps / 2] = V::set1d(params->matrix[taps - 1] & 0xFFFF);
+
+    offset = V::set1d(sizeof(PixelType) == 2 ? sum * 32768 : 0);
+}
+
+
+template <typename V, typename PixelType, int taps>
+static FORCE_INLINE typename V::I convolution_simd(const typename V::I *t, const typename V::I *coeffs, typename V::I offset, const GenericParams *params) {
+    typedef typename V::I I;
+
+    const I bias = V::set1w(sizeof(PixelType) == 2 ? 0x8000 : 0);
+    const I zero = V::set1w(0);
+
+    I lo = offset;
+    I hi = offset;
+
+    for (int i = 0; i < taps / 2; i++) {
+        I a = V::xor_(t[i * 2], bias);
+        I b = V::xor_(t[i * 2 + 1], bias);
+        lo = V::add32(lo, V::madd(V::unpacklo16(a, b), coeffs[i]));
+        hi = V::add32(hi, V::madd(V::unpackhi16(a, b), coeffs[i]));
+    }
+
+    if (taps % 2) {
+        I a = V::xor_(t[taps - 1], bias);
+        lo = V::add32(lo, V::madd(V::unpacklo16(a, zero), coeffs[taps / 2]));
+        hi = V::add32(hi, V::madd(V::unpackhi16(a, zero), coeffs[taps / 2]));
+    }
+
+    lo = V::convolve(lo, params->rdiv, params->bias);
+    hi = V::convolve(hi, params->rdiv, params->bias);
+
+    if (!params->saturate) {
+        lo = V::abs32(lo);
+        hi = V::abs32(hi);
+    }
+
+    return V::minu(V::packus32(lo, hi), V::set1w(params->max_value));
+}
+
+
+// Prewitt and Sobel for half of the pixels, the taps are already widened to dwords.
+template <typename V, GenericOperations op>
+static FORCE_INLINE typename V::I edge_simd(const typename V::I *t, const GenericParams *params) {
+    typedef typename V::I I;
+
+    I gx, gy;
+
+    if (op == GenericPrewitt) {
+        gx = V::sub32(V::add32(V::add32(t[2], t[5]), t[8]), V::add32(V::add32(t[0], t[3]), t[6]));
+        gy = V::sub32(V::add32(V::add32(t[6], t[7]), t[8]), V::add32(V::add32(t[0], t[1]), t[2]));
+    } else {
+        gx = V::sub32(V::add32(V::add32(t[2], V::slli32(t[5], 1)), t[8]), V::add32(V::add32(t[0], V::slli32(t[3], 1)), t[6]));
+        gy = V::sub32(V::add32(V::add32(t[6], V::slli32(t[7], 1)), t[8]), V::add32(V::add32(t[0], V::slli32(t[1], 1)), t[2]));
+    }
+
+    I g = V::srl32(V::magnitude(gx, gy), params->rshift);
+
+    I high = V::cmpgt32(g, V::set1d(params->thresh_high - 1));
+    g = V::or_(V::and_(high, V::set1d(params->max_value)), V::andnot(high, g));
+    return V::and_(g, V::cmpgt32(g, V::set1d(params->thresh_low)));
+}
+
+
+template <typename V, typename PixelType, GenericOperations op>
+static int process_row_3x3_simd(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, int32_t *scratch) {
+    typedef typename V::I I;
+
+    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
+    const PixelType *above = reinterpret_cast<const PixelType *>(rows[0]);
+    const PixelType *srcp = reinterpret_cast<const PixelType *>(rows[1]);
+    const PixelType *below = reinterpret_cast<const PixelType *>(rows[2]);
+
+    const I max_value = V::set1w(params->max_value);
+    const I th = V::set1w(std::min(params->th, 65535));
+
+    int enable[8];
+    for (int i = 0; i < 8; i++)
+        enable[i] = params->enable[i];
+
+    I coeffs[5];
+    I offset = V::set1d(0);
+    if (op == GenericConvolution)
+        convolution_setup_simd<V, PixelType, 9>(coeffs, offset, params);
+
+    int x;
+
+    for (x = 1; x + V::words + 1 <= width; x += V::words) {
+        // In the same order as the pixels of generic_3x3().
+        I t[9] = {
+            V::load(above + x - 1), V::load(above + x), V::load(above + x + 1),
+            V::load(srcp + x - 1), V::load(srcp + x), V::load(srcp + x + 1),
+            V::load(below + x - 1), V::load(below + x), V::load(below + x + 1)
+        };
+
+        I result;
+
+        if (op == GenericMinimum || op == GenericMaximum) {
+            static const int index[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+
+            result = t[4];
+
+            for (int i = 0; i < 8; i++) {
+                if (enable[i]) {
+                    if (op == GenericMinimum)
+                        result = V::minu(result, t[index[i]]);
+                    else
+                        result = V::maxu(result, t[index[i]]);
+                }
+            }
+
+            if (op == GenericMinimum)
+                result = V::maxu(V::subsu(t[4], th), result);
+            else
+                result = V::minu(V::minu(V::addsu(t[4], th), max_value), result);
+
+        } else if (op == GenericDeflate || op == GenericInflate) {
+
+            I average;
+
+            if (sizeof(PixelType) == 1) {
+                I sum = V::add16(V::add16(V::add16(t[0], t[1]), V::add16(t[2], t[3])), V::add16(V::add16(t[5], t[6]), V::add16(t[7], t[8])));
+                average = V::srli16(sum, 3);
+            } else {
+                I lo = V::add32(V::add32(V::add32(V::lo32(t[0]), V::lo32(t[1])), V::add32(V::lo32(t[2]), V::lo32(t[3]))),
+                                V::add32(V::add32(V::lo32(t[5]), V::lo32(t[6])), V::add32(V::lo32(t[7]), V::lo32(t[8]))));
+                I hi = V::add32(V::add32(V::add32(V::hi32(t[0]), V::hi32(t[1])), V::add32(V::hi32(t[2]), V::hi32(t[3]))),
+                                V::add32(V::add32(V::hi32(t[5]), V::hi32(t[6])), V::add32(V::hi32(t[7]), V::hi32(t[8]))));
+                average = V::packus32(V::srli32(lo, 3), V::srli32(hi, 3));
+            }
+
+            if (op == GenericDeflate)
+                result = V::maxu(V::minu(average, t[4]), V::subsu(t[4], th));
+            else
+                result = V::minu(V::maxu(average, t[4]), V::minu(V::addsu(t[4], th), max_value));
+
+        } else if (op == GenericMedian) {
+
+            result = median_simd<V>(t);
+
+        } else if (op == GenericConvolution) {
+
+            result = convolution_simd<V, PixelType, 9>(t, coeffs, offset, params);
+
+        } else if (op == GenericPrewitt || op == GenericSobel) {
+
+            I lo[9], hi[9];
+            for (int i = 0; i < 9; i++) {
+                lo[i] = V::lo32(t[i]);
+                hi[i] = V::hi32(t[i]);
+            }
+
+            result = V::packus32(edge_simd<V, op>(lo, params), edge_simd<V, op>(hi, params));
+
+        }
+
+        V::store(dstp + x, result);
+    }
+
+    return x;
+}
+
+
+template <typename V, typename PixelType>
+static int process_row_5x5_simd(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, int32_t *scratch) {
+    typedef typename V::I I;
+
+    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
+    const PixelType *r[5];
+    for (int i = 0; i < 5; i++)
+        r[i] = reinterpret_cast<const PixelType *>(rows[i]);
+
+    I coeffs[13];
+    I offset;
+    convolution_setup_simd<V, PixelType, 25>(coeffs, offset, params);
+
+    int x;
+
+    for (x = 2; x + V::words + 2 <= width; x += V::words) {
+        I t[25];
+        for (int i = 0; i < 5; i++)
+            for (int j = 0; j < 5; j++)
+                t[i * 5 + j] = V::load(r[i] + x + j - 2);
+
+        V::store(dstp + x, convolution_simd<V, PixelType, 25>(t, coeffs, offset, params));
+    }
+
+    return x;
+}
+
+
+// The vertical pass goes to scratch as exact sums, so the result is the same as
+// with the full matrix.
+template <typename V, typename PixelType>
+static int process_row_separable_simd(uint8_t *dstp8, const uint8_t * const *rows, int width, const GenericParams *params, int32_t *scratch) {
+    typedef typename V::I I;
+
+    PixelType *dstp = reinterpret_cast<PixelType *>(dstp8);
+
+    const int taps_v = params->matrix_v_elements;
+    const int taps_h = params->matrix_h_elements;
+    const int *matrix_v = params->matrix_v;
+    const int *matrix_h = params->matrix_h;
+
+    const I bias = V::set1w(sizeof(PixelType) == 2 ? 0x8000 : 0);
+    const I zero = V::set1w(0);
+
+    int sum_v = 0;
+    for (int i = 0; i < taps_v; i++)
+        sum_v += matrix_v[i];
+
+    const I offset = V::set1d(sizeof(PixelType) == 2 ? sum_v * 32768 : 0);
+
+    I coeffs[13];
+    for (int i = 0; i < taps_v / 2; i++)
+        coeffs[i] = V::set1d((int)(((unsigned)matrix_v[i * 2 + 1] << 16) | ((unsigned)matrix_v[i * 2] & 0xFFFF)));
+    if (taps_v % 2)
+        coeffs[taps_v / 2] = V::set1d(matrix_v[taps_v - 1] & 0xFFFF);
+
+    int x;
+
+    for (x = 0; x + V::words <= width; x += V::words) {
+        I lo = offset;
+        I hi = offset;
+
+        for (int i = 0; i < taps_v / 2; i++) {
+            I a = V::xor_(V::load(reinterpret_cast<const PixelType *>(rows[i * 2]) + x), bias);
+            I b = V::xor_(V::load(reinterpret_cast<const PixelType *>(rows[i * 2 + 1]) + x), bias);
+            lo = V::add32(lo, V::madd(V::unpacklo16(a, b), coeffs[i]));
+            hi = V::add32(hi, V::madd(V::unpackhi16(a, b), coeffs[i]));
+        }
+
+        if (taps_v % 2) {
+            I a = V::xor_(V::load(reinterpret_cast<const PixelType *>(rows[taps_v - 1]) + x), bias);
+            lo = V::add32(lo, V::madd(V::unpacklo16(a, zero), coeffs[taps_v / 2]));
+            hi = V::add32(hi, V::madd(V::unpackhi16(a, zero), coeffs[taps_v / 2]));
+        }
+
+        V::sequence(lo, hi);
+        V::stored(scratch + x, lo);
+        V::stored(scratch + x + V::words / 2, hi);
+    }
+
+    for (; x < width; x++) {
+        int sum = 0;
+        for (int i = 0; i < taps_v; i++)
+            sum += reinterpret_cast<const PixelType *>(rows[i])[x] * matrix_v[i];
+        scratch[x] = sum;
+    }
+
+    const int border = taps_h / 2;
+    const I max_value = V::set1w(params->max_value);
+
+    I coeffs_h[25];
+    for (int i = 0; i < taps_h; i++)
+        coeffs_h[i] = V::set1d(matrix_h[i]);
+
+    for (x = border; x + V::words + border <= width; x += V::words) {
+        I lo = V::set1d(0);
+        I hi = V::set1d(0);
+
+        for (int i = 0; i < taps_h; i++) {
+            const int32_t *t = scratch + x + i - border;
+            lo = V::add32(lo, V::mullo32(V::loadd(t), coeffs_h[i]));
+            hi = V::add32(hi, V::mullo32(V::loadd(t + V::words / 2), coeffs_h[i]));
+        }
+
+        lo = V::convolve(lo, params->rdiv, params->bias);
+        hi = V::convolve(hi, params->rdiv, params->bias);
+
+        if (!params->saturate) {
+            lo = V::abs32(lo);
+            hi = V::abs32(hi);
+        }
+
+        V::store(dstp + x, V::minu(V::packus32_seq(lo, hi), max_value));
+    }
+
+    return x;
+}
+
+
+template <typename V>
+static GenericSimdRow getSimdRow(GenericOperations op, int bytesPerSample, const GenericParams *params) {
+    bool words = bytesPerSample == 2;
+
+    switch (op) {
+    case GenericMinimum: return words ? process_row_3x3_simd<V, uint16_t, GenericMinimum> : process_row_3x3_simd<V, uint8_t, GenericMinimum>;
+    case GenericMaximum: return words ? process_row_3x3_simd<V, uint16_t, GenericMaximum> : process_row_3x3_simd<V, uint8_t, GenericMaximum>;
+    case GenericMedian: return words ? process_row_3x3_simd<V, uint16_t, GenericMedian> : process_row_3x3_simd<V, uint8_t, GenericMedian>;
+    case GenericDeflate: return words ? process_row_3x3_simd<V, uint16_t, GenericDeflate> : process_row_3x3_simd<V, uint8_t, GenericDeflate>;
+    case GenericInflate: return words ? process_row_3x3_simd<V, uint16_t, GenericInflate> : process_row_3x3_simd<V, uint8_t, GenericInflate>;
+    case GenericConvolution:
+        if (params->separable)
+            return words ? process_row_separable_simd<V, uint16_t> : process_row_separable_simd<V, uint8_t>;
+        else if (params->matrix_elements == 25)
+            return words ? process_row_5x5_simd<V, uint16_t> : process_row_5x5_simd<V, uint8_t>;
+        else
+            return words ? process_row_3x3_simd<V, uint16_t, GenericConvolution> : process_row_3x3_simd<V, uint8_t, GenericConvolution>;
+    case GenericPrewitt: return words ? process_row_3x3_simd<V, uint16_t, GenericPrewitt> : process_row_3x3_simd<V, uint8_t, GenericPrewitt>;
+    case GenericSobel: return words ? process_row_3x3_simd<V, uint16_t, GenericSobel> : process_row_3x3_simd<V, uint8_t, GenericSobel>;
+    default: return nullptr;
+    }
+}
+
+#endif // GENERICFILTERS_SIMD_H
@@ -0,0 +1,824 @@
+/*
+* Copyright (c) 2012-2014 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "lutfilters.h"
+#include "VSHelper.h"
+#include "filtershared.h"
+#ifdef VS_TARGET_CPU_X86
+#include "cpufeatures.h"
+#endif
+
+//////////////////////////////////////////
+// Shared
+
+// The functions given to Lut and Lut2 are evaluated in parallel. Every task
+// uses its own maps and only the first error is kept.
+struct LutFuncCall {
+    VSFuncRef *func;
+    VSCore *core;
+    const VSAPI *vsapi;
+    std::atomic<bool> failed;
+    std::mutex errorLock;
+    std::string error;
+
+    LutFuncCall(VSFuncRef *func, VSCore *core, const VSAPI *vsapi) : func(func), core(core), vsapi(vsapi), failed(false) {}
+
+    void setError(const std::string &msg) {
+        std::lock_guard<std::mutex> l(errorLock);
+        if (!failed) {
+            error = msg;
+            failed = true;
+        }
+    }
+
+    bool call(const VSMap *in, VSMap *out) {
+        vsapi->callFunc(func, in, out, core, vsapi);
+        const char *ret = vsapi->getError(out);
+        if (ret) {
+            setError(ret);
+            return false;
+        }
+        return true;
+    }
+};
+
+// The integer tables get 4 bytes of padding since the AVX2 version always reads 4 bytes per entry
+static const size_t lutPadding = 4;
+
+static bool lutUseAVX2() {
+#ifdef VS_TARGET_CPU_X86
+    CPUFeatures cpu;
+    getCPUFeatures(&cpu);
+    return !!cpu.avx2;
+#else
+    return false;
+#endif
+}
+
+//////////////////////////////////////////
+// Lut
+
+// A piecewise linear table covering the nominal range of a float plane
+struct FloatLut {
+    std::vector<float> values;
+    std::vector<float> slopes;
+    double lo;
+    float scale;
+    float offset;
+    float last;
+
+    void setRange(double lo, double hi, size_t n) {
+        this->lo = lo;
+        scale = static_cast<float>((n - 1) / (hi - lo));
+        offset = static_cast<float>(-lo * scale);
+        last = static_cast<float>(n - 2);
+        values.resize(n);
+    }
+
+    double input(int i) const {
+        return lo + i / static_cast<double>(scale);
+    }
+
+    void finish() {
+        slopes.resize(values.size() - 1);
+        for (size_t i = 0; i < slopes.size(); i++)
+            slopes[i] = values[i + 1] - values[i];
+    }
+};
+
+// Float tables made from a function have as many segments as a 16 bit lut has entries
+static const int floatLutEntries = (1 << 16) + 1;
+static const int lutEntriesPerTask = 256;
+
+struct LutData {
+    VSNodeRef *node;
+    const VSVideoInfo *vi;
+    std::vector<uint8_t> lut;
+    // [0] is for 0-1 planes and [1] for -0.5-0.5 chroma planes
+    FloatLut flut[2];
+    int process[3];
+    bool avx2;
+};
+
+static inline int isFloatChromaPlane(const VSFormat *fi, int plane) {
+    return plane > 0 && (fi->colorFamily == cmYUV || fi->colorFamily == cmYCoCg);
+}
+
+template<typename T>
+static void lutRow(const T *srcp, T *dstp, int width, const T *lut) {
+    for (int x = 0; x < width; x++)
+        dstp[x] = lut[srcp[x]];
+}
+
+static void VS_CC lutInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
+    LutData *d = reinterpret_cast<LutData *>(*instanceData);
+    vsapi->setVideoInfo(d->vi, 1, node);
+}
+
+static const VSFrameRef *VS_CC lutGetframe(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    LutData *d = reinterpret_cast<LutData *>(*instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrameRef *src = vsapi->getFrameFilter(n, d->node, frameCtx);
+        const VSFormat *fi = vsapi->getFrameFormat(src);
+        const int pl[] = {0, 1, 2};
+        const VSFrameRef *fr[] = {d->process[0] ? 0 : src, d->process[1] ? 0 : src, d->process[2] ? 0 : src};
+        VSFrameRef *dst = vsapi->newVideoFrame2(fi, vsapi->getFrameWidth(src, 0), vsapi->getFrameHeight(src, 0), fr, pl, src, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+
+            if (d->process[plane]) {
+                const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+                int src_stride = vsapi->getStride(src, plane);
+                uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+                int dst_stride = vsapi->getStride(dst, plane);
+                int h = vsapi->getFrameHeight(src, plane);
+                int w = vsapi->getFrameWidth(src, plane);
+
+                if (fi->sampleType == stFloat) {
+                    const FloatLut &lut = d->flut[isFloatChromaPlane(fi, plane)];
+
+                    for (int hl = 0; hl < h; hl++) {
+                        const float *s = reinterpret_cast<const float *>(srcp);
+                        float *dd = reinterpret_cast<float *>(dstp);
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_lut_float_avx2(s, dd, w, lut.values.data(), lut.slopes.data(), lut.scale, lut.offset, lut.last);
+                        else
+#endif
+                        for (int x = 0; x < w; x++)
+                            dd[x] = lutLookupFloat(s[x], lut.values.data(), lut.slopes.data(), lut.scale, lut.offset, lut.last);
+
+                        dstp += dst_stride;
+                        srcp += src_stride;
+                    }
+                } else {
+                    for (int hl = 0; hl < h; hl++) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_lut_avx2(srcp, dstp, fi->bytesPerSample, w, d->lut.data());
+                        else
+#endif
+                        if (fi->bytesPerSample == 1)
+                            lutRow<uint8_t>(srcp, dstp, w, d->lut.data());
+                        else
+                            lutRow<uint16_t>(reinterpret_cast<const uint16_t *>(srcp), reinterpret_cast<uint16_t *>(dstp), w, reinterpret_cast<const uint16_t *>(d->lut.data()));
+
+                        dstp += dst_stride;
+                        srcp += src_stride;
+                    }
+                }
+            }
+        }
+
+        vsapi->freeFrame(src);
+        return dst;
+    }
+
+    return 0;
+}
+
+static void VS_CC lutFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    LutData *d = reinterpret_cast<LutData *>(instanceData);
+    vsapi->freeNode(d->node);
+    delete d;
+}
+
+struct LutTableTask {
+    LutFuncCall *call;
+    // integer tables
+    uint8_t *lut;
+    int bytesPerSample;
+    // float tables
+    FloatLut *flut;
+    int n;
+};
+
+static void VS_CC funcToLutTask(int index, void *userData) {
+    LutTableTask *t = reinterpret_cast<LutTableTask *>(userData);
+    const VSAPI *vsapi = t->call->vsapi;
+    VSMap *in = vsapi->createMap();
+    VSMap *out = vsapi->createMap();
+    int end = std::min((index + 1) * lutEntriesPerTask, t->n);
+    int err;
+
+    for (int i = index * lutEntriesPerTask; i < end && !t->call->failed; i++) {
+        if (t->flut) {
+            double x = t->flut->input(i);
+            vsapi->propSetFloat(in, "x", x, paReplace);
+            if (!t->call->call(in, out))
+                break;
+
+            double v = vsapi->propGetFloat(out, "val", 0, &err);
+            if (err)
+                v = static_cast<double>(vsapi->propGetInt(out, "val", 0, &err));
+            vsapi->clearMap(out);
+
+            if (err) {
+                t->call->setError("Lut: function(" + std::to_string(x) + ") didn't return a number");
+                break;
+            }
+
+            t->flut->values[i] = static_cast<float>(v);
+        } else {
+            vsapi->propSetInt(in, "x", i, paReplace);
+            if (!t->call->call(in, out))
+                break;
+
+            int64_t v = vsapi->propGetInt(out, "val", 0, &err);
+            vsapi->clearMap(out);
+
+            if (v < 0 || v >= t->n) {
+                t->call->setError("Lut: function(" + std::to_string(i) + ") returned invalid value " + std::to_string(v));
+                break;
+            }
+
+            if (t->bytesPerSample == 1)
+                t->lut[i] = static_cast<uint8_t>(v);
+            else
+                reinterpret_cast<uint16_t *>(t->lut)[i] = static_cast<uint16_t>(v);
+        }
+    }
+
+    vsapi->freeMap(in);
+    vsapi->freeMap(out);
+}
+
+static void funcToLut(std::string &error, LutTableTask &task, VSFuncRef *func, VSCore *core, const VSAPI *vsapi) {
+    LutFuncCall call(func, core, vsapi);
+    task.call = &call;
+    vsapi->parallelFor((task.n + lutEntriesPerTask - 1) / lutEntriesPerTask, funcToLutTask, &task, core);
+    if (call.failed)
+        error = call.error;
+}
+
+static void VS_CC lutCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    std::unique_ptr<LutData> d(new LutData());
+    VSFuncRef *func;
+    int n, m, o;
+    int err;
+
+    d->node = vsapi->propGetNode(in, "clip", 0, 0);
+    d->vi = vsapi->getVideoInfo(d->node);
+
+    if (!isConstantFormat(d->vi) || isCompatFormat(d->vi)
+            || (d->vi->format->sampleType == stInteger && d->vi->format->bitsPerSample > 16)
+            || (d->vi->format->sampleType == stFloat && d->vi->format->bitsPerSample != 32)) {
+        vsapi->freeNode(d->node);
+        RETERROR("Lut: only clips with integer samples and up to 16 bit per channel precision or 32 bit float samples supported");
+    }
+
+    bool isFloat = d->vi->format->sampleType == stFloat;
+    n = d->vi->format->numPlanes;
+    m = vsapi->propNumElements(in, "planes");
+
+    for (int i = 0; i < 3; i++)
+        d->process[i] = (m <= 0);
+
+    for (int i = 0; i < m; i++) {
+        o = int64ToIntS(vsapi->propGetInt(in, "planes", i, 0));
+
+        if (o < 0 || o >= n) {
+            vsapi->freeNode(d->node);
+            RETERROR("Lut: plane index out of range");
+        }
+
+        if (d->process[o]) {
+            vsapi->freeNode(d->node);
+            RETERROR("Lut: plane specified twice");
+        }
+
+        d->process[o] = 1;
+    }
+
+    if (vsapi->propNumElements(in, isFloat ? "lut" : "lutf") > 0) {
+        vsapi->freeNode(d->node);
+        RETERROR(isFloat ? "Lut: float clips need lutf instead of lut" : "Lut: integer clips need lut instead of lutf");
+    }
+
+    func = vsapi->propGetFunc(in, "function", 0, &err);
+    m = vsapi->propNumElements(in, isFloat ? "lutf" : "lut");
+
+    if (m <= 0 && !func) {
+        vsapi->freeNode(d->node);
+        RETERROR("Lut: Both lut and function are not set");
+    }
+
+    if (m > 0 && func) {
+        vsapi->freeFunc(func);
+        vsapi->freeNode(d->node);
+        RETERROR("Lut: Both lut and function are set");
+    }
+
+    d->avx2 = lutUseAVX2();
+
+    if (isFloat) {
+        // the chroma planes of yuv are centered around 0 so they get their own table
+        bool used[2] = { false, false };
+        for (int plane = 0; plane < d->vi->format->numPlanes; plane++)
+            if (d->process[plane])
+                used[isFloatChromaPlane(d->vi->format, plane)] = true;
+
+        if (m > 0 && m < 2) {
+            vsapi->freeNode(d->node);
+            RETERROR("Lut: lutf must have at least 2 values");
+        }
+
+        for (int i = 0; i < 2; i++) {
+            if (!used[i])
+                continue;
+
+            FloatLut &lut = d->flut[i];
+            lut.setRange(i ? -0.5 : 0.0, i ? 0.5 : 1.0, func ? floatLutEntries : m);
+
+            if (func) {
+                std::string errMsg;
+                LutTableTask task = {};
+                task.flut = &lut;
+                task.n = floatLutEntries;
+                funcToLut(errMsg, task, func, core, vsapi);
+
+                if (!errMsg.empty()) {
+                    vsapi->freeFunc(func);
+                    vsapi->freeNode(d->node);
+                    RETERROR(errMsg.c_str());
+                }
+            } else {
+                const double *arr = vsapi->propGetFloatArray(in, "lutf", NULL);
+                for (int j = 0; j < m; j++)
+                    lut.values[j] = static_cast<float>(arr[j]);
+            }
+
+            lut.finish();
+        }
+
+        if (func)
+            vsapi->freeFunc(func);
+    } else {
+        n = (1 << d->vi->format->bitsPerSample);
+
+        if (m > 0 && m != n) {
+            vsapi->freeNode(d->node);
+            RETERROR("Lut: bad lut length");
+        }
+
+        d->lut.resize(d->vi->format->bytesPerSample * n + lutPadding);
+
+        if (func) {
+            std::string errMsg;
+            LutTableTask task = {};
+            task.lut = d->lut.data();
+            task.bytesPerSample = d->vi->format->bytesPerSample;
+            task.n = n;
+            funcToLut(errMsg, task, func, core, vsapi);
+            vsapi->freeFunc(func);
+
+            if (!errMsg.empty()) {
+                vsapi->freeNode(d->node);
+                RETERROR(errMsg.c_str());
+            }
+        } else {
+            const int64_t *arr = vsapi->propGetIntArray(in, "lut", NULL);
+
+            for (int i = 0; i < n; i++) {
+                int64_t v = arr[i];
+                if (v < 0 || v >= n) {
+                    vsapi->freeNode(d->node);
+                    RETERROR("Lut: lut value out of range");
+                }
+
+                if (d->vi->format->bytesPerSample == 1)
+                    d->lut[i] = static_cast<uint8_t>(v);
+                else
+                    reinterpret_cast<uint16_t *>(d->lut.data())[i] = static_cast<uint16_t>(v);
+            }
+        }
+    }
+
+    vsapi->createFilter(in, out, "Lut", lutInit, lutGetframe, lutFree, fmParallel, 0, d.release(), core);
+}
+
+//////////////////////////////////////////
+// Lut2
+
+// The table is indexed by (y << xbits) + x. When it's made from a function
+// that has to be called more than 2^16 times the rows are only made when a
+// frame first needs them. Up to a total of 20 bits all rows are stored in a
+// single block, above that every row is allocated separately. A row is
+// published in rows once it's completely filled in and never changes after
+// that.
+struct Lut2Data {
+    VSNodeRef *node[2];
+    const VSVideoInfo *vi[2];
+    VSVideoInfo vi_out;
+    std::vector<uint8_t> lut;
+    VSFuncRef *func;
+    std::unique_ptr<std::atomic<uint8_t *>[]> rows;
+    std::mutex rowLock;
+    int64_t maximum;
+    int xbits;
+    int ybits;
+    int outBytes;
+    int process[3];
+    bool avx2;
+
+    ~Lut2Data() {
+        if (rows && lut.empty())
+            for (int i = 0; i < (1 << ybits); i++)
+                free(rows[i]);
+    }
+};
+
+static const int lut2LazyBits = 16;
+static const int lut2SingleBlockBits = 20;
+
+struct Lut2RowTask {
+    Lut2Data *d;
+    LutFuncCall *call;
+    const int *rows;
+};
+
+static void VS_CC lut2RowTask(int index, void *userData) {
+    Lut2RowTask *t = reinterpret_cast<Lut2RowTask *>(userData);
+    Lut2Data *d = t->d;
+    const VSAPI *vsapi = t->call->vsapi;
+    int y = t->rows[index];
+    int width = 1 << d->xbits;
+    int err;
+
+    if (t->call->failed)
+        return;
+
+    uint8_t *row;
+    if (d->lut.empty())
+        row = reinterpret_cast<uint8_t *>(malloc(width * d->outBytes));
+    else
+        row = d->lut.data() + (static_cast<size_t>(y) << d->xbits) * d->outBytes;
+
+    VSMap *in = vsapi->createMap();
+    VSMap *out = vsapi->createMap();
+    vsapi->propSetInt(in, "y", y, paReplace);
+
+    int x;
+    for (x = 0; x < width; x++) {
+        vsapi->propSetInt(in, "x", x, paReplace);
+        if (!t->call->call(in, out))
+            break;
+
+        int64_t v = vsapi->propGetInt(out, "val", 0, &err);
+        vsapi->clearMap(out);
+
+        if (v < 0 || v > d->maximum) {
+            t->call->setError("Lut2: function(" + std::to_string(x) + ", " + std::to_string(y) + ") returned invalid value " + std::to_string(v));
+            break;
+        }
+
+        if (d->outBytes == 1)
+            row[x] = static_cast<uint8_t>(v);
+        else
+            reinterpret_cast<uint16_t *>(row)[x] = static_cast<uint16_t>(v);
+    }
+
+    vsapi->freeMap(in);
+    vsapi->freeMap(out);
+
+    if (x == width)
+        d->rows[y].store(row, std::memory_order_release);
+    else if (d->lut.empty())
+        free(row);
+}
+
+static void funcToLut2Rows(std::string &error, Lut2Data *d, const std::vector<int> &rows, VSCore *core, const VSAPI *vsapi) {
+    LutFuncCall call(d->func, core, vsapi);
+    Lut2RowTask task = { d, &call, rows.data() };
+    vsapi->parallelFor(static_cast<int>(rows.size()), lut2RowTask, &task, core);
+    if (call.failed)
+        error = call.error;
+}
+
+template<typename T>
+static void markUsedRows(const uint8_t *srcp, int stride, int w, int h, std::vector<uint8_t> &used) {
+    for (int hl = 0; hl < h; hl++) {
+        const T *s = reinterpret_cast<const T *>(srcp);
+        for (int x = 0; x < w; x++)
+            used[s[x]] = 1;
+        srcp += stride;
+    }
+}
+
+// Makes the rows needed by the y values of a frame that don't exist yet
+static void lut2MakeRows(std::string &error, Lut2Data *d, const VSFrameRef *srcy, VSCore *core, const VSAPI *vsapi) {
+    std::vector<uint8_t> used(static_cast<size_t>(1) << d->ybits);
+
+    for (int plane = 0; plane < d->vi[1]->format->numPlanes; plane++) {
+        if (d->process[plane]) {
+            if (d->vi[1]->format->bytesPerSample == 1)
+                markUsedRows<uint8_t>(vsapi->getReadPtr(srcy, plane), vsapi->getStride(srcy, plane), vsapi->getFrameWidth(srcy, plane), vsapi->getFrameHeight(srcy, plane), used);
+            else
+                markUsedRows<uint16_t>(vsapi->getReadPtr(srcy, plane), vsapi->getStride(srcy, plane), vsapi->getFrameWidth(srcy, plane), vsapi->getFrameHeight(srcy, plane), used);
+        }
+    }
+
+    std::vector<int> missing;
+    for (int y = 0; y < static_cast<int>(used.size()); y++)
+        if (used[y] && !d->rows[y].load(std::memory_order_acquire))
+            missing.push_back(y);
+
+    if (missing.empty())
+        return;
+
+    std::lock_guard<std::mutex> l(d->rowLock);
+    // other frames may have made some of the rows while waiting for the lock
+    missing.erase(std::remove_if(missing.begin(), missing.end(), [d](int y) { return d->rows[y].load(std::memory_order_acquire) != nullptr; }), missing.end());
+    funcToLut2Rows(error, d, missing, core, vsapi);
+}
+
+template<typename X, typename Y, typename D>
+static void lut2Plane(const Lut2Data *d, const uint8_t *srcpx, int srcx_stride, const uint8_t *srcpy, int srcy_stride, uint8_t *dstp, int dst_stride, int w, int h) {
+    for (int hl = 0; hl < h; hl++) {
+        const X *sx = reinterpret_cast<const X *>(srcpx);
+        const Y *sy = reinterpret_cast<const Y *>(srcpy);
+        D *dd = reinterpret_cast<D *>(dstp);
+
+        if (!d->lut.empty()) {
+#ifdef VS_TARGET_CPU_X86
+            if (d->avx2) {
+                vs_lut2_avx2(sx, sizeof(X), sy, sizeof(Y), d->xbits, dd, sizeof(D), w, d->lut.data());
+            } else
+#endif
+            {
+                const D *lut = reinterpret_cast<const D *>(d->lut.data());
+                for (int x = 0; x < w; x++)
+                    dd[x] = lut[(sy[x] << d->xbits) + sx[x]];
+            }
+        } else {
+            for (int x = 0; x < w; x++)
+                dd[x] = reinterpret_cast<const D *>(d->rows[sy[x]].load(std::memory_order_relaxed))[sx[x]];
+        }
+
+        dstp += dst_stride;
+        srcpx += srcx_stride;
+        srcpy += srcy_stride;
+    }
+}
+
+template<typename D>
+static void lut2PlaneOut(const Lut2Data *d, const uint8_t *srcpx, int srcx_stride, const uint8_t *srcpy, int srcy_stride, uint8_t *dstp, int dst_stride, int w, int h) {
+    int xbytes = d->vi[0]->format->bytesPerSample;
+    int ybytes = d->vi[1]->format->bytesPerSample;
+
+    if (xbytes == 1 && ybytes == 1)
+        lut2Plane<uint8_t, uint8_t, D>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+    else if (xbytes == 1)
+        lut2Plane<uint8_t, uint16_t, D>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+    else if (ybytes == 1)
+        lut2Plane<uint16_t, uint8_t, D>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+    else
+        lut2Plane<uint16_t, uint16_t, D>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+}
+
+static void VS_CC lut2Init(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
+    Lut2Data *d = reinterpret_cast<Lut2Data *>(*instanceData);
+    vsapi->setVideoInfo(&d->vi_out, 1, node);
+}
+
+static const VSFrameRef *VS_CC lut2Getframe(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    Lut2Data *d = reinterpret_cast<Lut2Data *>(*instanceData);
+
+    if (activationReason == arInitial) {
+        vsapi->requestFrameFilter(n, d->node[0], frameCtx);
+        vsapi->requestFrameFilter(n, d->node[1], frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrameRef *srcx = vsapi->getFrameFilter(n, d->node[0], frameCtx);
+        const VSFrameRef *srcy = vsapi->getFrameFilter(n, d->node[1], frameCtx);
+
+        if (d->func) {
+            std::string error;
+            lut2MakeRows(error, d, srcy, core, vsapi);
+
+            if (!error.empty()) {
+                vsapi->setFilterError(error.c_str(), frameCtx);
+                vsapi->freeFrame(srcx);
+                vsapi->freeFrame(srcy);
+                return 0;
+            }
+        }
+
+        const VSFormat *fi = d->vi_out.format;
+        const int pl[] = {0, 1, 2};
+        const VSFrameRef *fr[] = {d->process[0] ? 0 : srcx, d->process[1] ? 0 : srcx, d->process[2] ? 0 : srcx};
+        VSFrameRef *dst = vsapi->newVideoFrame2(fi, vsapi->getFrameWidth(srcx, 0), vsapi->getFrameHeight(srcx, 0), fr, pl, srcx, core);
+
+        for (int plane = 0; plane < fi->numPlanes; plane++) {
+
+            if (d->process[plane]) {
+                const uint8_t *srcpx = vsapi->getReadPtr(srcx, plane);
+                const uint8_t *srcpy = vsapi->getReadPtr(srcy, plane);
+                int srcx_stride = vsapi->getStride(srcx, plane);
+                int srcy_stride = vsapi->getStride(srcy, plane);
+                uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+                int dst_stride = vsapi->getStride(dst, plane);
+                int h = vsapi->getFrameHeight(srcx, plane);
+                int w = vsapi->getFrameWidth(srcx, plane);
+
+                if (fi->bytesPerSample == 1)
+                    lut2PlaneOut<uint8_t>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+                else
+                    lut2PlaneOut<uint16_t>(d, srcpx, srcx_stride, srcpy, srcy_stride, dstp, dst_stride, w, h);
+            }
+        }
+
+        vsapi->freeFrame(srcx);
+        vsapi->freeFrame(srcy);
+        return dst;
+    }
+
+    return 0;
+}
+
+static void VS_CC lut2Free(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    Lut2Data *d = reinterpret_cast<Lut2Data *>(instanceData);
+    vsapi->freeNode(d->node[0]);
+    vsapi->freeNode(d->node[1]);
+    if (d->func)
+        vsapi->freeFunc(d->func);
+    delete d;
+}
+
+static void VS_CC lut2Create(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+    std::unique_ptr<Lut2Data> d(new Lut2Data());
+    int n, m, o;
+    int err;
+    int bits;
+
+    d->node[0] = vsapi->propGetNode(in, "clipa", 0, 0);
+    d->node[1] = vsapi->propGetNode(in, "clipb", 0, 0);
+    d->vi[0] = vsapi->getVideoInfo(d->node[0]);
+    d->vi[1] = vsapi->getVideoInfo(d->node[1]);
+
+    if (!isConstantFormat(d->vi[0]) || !isConstantFormat(d->vi[1])
+            || d->vi[0]->format->sampleType != stInteger || d->vi[1]->format->sampleType != stInteger
+            || d->vi[0]->format->bitsPerSample > 16 || d->vi[1]->format->bitsPerSample > 16
+            || d->vi[0]->format->subSamplingH != d->vi[1]->format->subSamplingH
+            || d->vi[0]->format->subSamplingW != d->vi[1]->format->subSamplingW
+            || d->vi[0]->width != d->vi[1]->width || d->vi[0]->height != d->vi[1]->height || isCompatFormat(d->vi[0]) || isCompatFormat(d->vi[1])) {
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: only clips with integer samples, same dimensions, same subsampling and up to 16 bit per channel precision supported");
+    }
+
+    d->xbits = d->vi[0]->format->bitsPerSample;
+    d->ybits = d->vi[1]->format->bitsPerSample;
+
+    n = d->vi[0]->format->numPlanes;
+    m = vsapi->propNumElements(in, "planes");
+
+    for (int i = 0; i < 3; i++)
+        d->process[i] = (m <= 0);
+
+    for (int i = 0; i < m; i++) {
+        o = int64ToIntS(vsapi->propGetInt(in, "planes", i, 0));
+
+        if (o < 0 || o >= n) {
+            vsapi->freeNode(d->node[0]);
+            vsapi->freeNode(d->node[1]);
+            RETERROR("Lut2: plane index out of range");
+        }
+
+        if (d->process[o]) {
+            vsapi->freeNode(d->node[0]);
+            vsapi->freeNode(d->node[1]);
+            RETERROR("Lut2: plane specified twice");
+        }
+
+        d->process[o] = 1;
+    }
+
+    m = vsapi->propNumElements(in, "lut");
+
+    if (m > 0 && d->xbits + d->ybits > lut2SingleBlockBits) {
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: lut can only be used with up to a total of 20 indexing bits, use function instead");
+    }
+
+    bits = int64ToIntS(vsapi->propGetInt(in, "bits", 0, &err));
+    if (bits == 0) {
+        bits = d->vi[0]->format->bitsPerSample;
+    } else if (bits < 8 || bits > 16) {
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: Output format must be between 8 and 16 bits.");
+    }
+
+    d->func = vsapi->propGetFunc(in, "function", 0, &err);
+
+    if (m <= 0 && !d->func) {
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: Both lut and function are not set");
+    }
+
+    if (m > 0 && d->func) {
+        vsapi->freeFunc(d->func);
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: Both lut and function are set");
+    }
+
+    // two 16 bit clips need 32 bits of index
+    int64_t entries = static_cast<int64_t>(1) << (d->xbits + d->ybits);
+
+    if (m > 0 && m != entries) {
+        vsapi->freeNode(d->node[0]);
+        vsapi->freeNode(d->node[1]);
+        RETERROR("Lut2: bad lut length");
+    }
+
+    d->vi_out = *d->vi[0];
+    d->vi_out.format = vsapi->registerFormat(d->vi[0]->format->colorFamily, d->vi[0]->format->sampleType, bits, d->vi[0]->format->subSamplingW, d->vi[0]->format->subSamplingH, core);
+    d->outBytes = d->vi_out.format->bytesPerSample;
+    d->maximum = (1 << bits) - 1;
+    d->avx2 = lutUseAVX2();
+
+    if (d->xbits + d->ybits <= lut2SingleBlockBits)
+        d->lut.resize(static_cast<size_t>(entries) * d->outBytes + lutPadding);
+
+    if (d->func) {
+        d->rows.reset(new std::atomic<uint8_t *>[1 << d->ybits]);
+        for (int i = 0; i < (1 << d->ybits); i++)
+            d->rows[i] = nullptr;
+
+        // small tables are made right away so errors are reported here
+        if (d->xbits + d->ybits <= lut2LazyBits) {
+            std::string errMsg;
+            std::vector<int> rows(1 << d->ybits);
+            for (int i = 0; i < (1 << d->ybits); i++)
+                rows[i] = i;
+            funcToLut2Rows(errMsg, d.get(), rows, core, vsapi);
+            vsapi->freeFunc(d->func);
+            d->func = nullptr;
+            d->rows.reset();
+
+            if (!errMsg.empty()) {
+                vsapi->freeNode(d->node[0]);
+                vsapi->freeNode(d->node[1]);
+                RETERROR(errMsg.c_str());
+            }
+        }
+    } else {
+        const int64_t *arr = vsapi->propGetIntArray(in, "lut", NULL);
+
+        for (int i = 0; i < m; i++) {
+            int64_t v = arr[i];
+
+            if (v < 0 || v > d->maximum) {
+                vsapi->freeNode(d->node[0]);
+                vsapi->freeNode(d->node[1]);
+                RETERROR("Lut2: lut value out of range");
+            }
+
+            if (d->outBytes == 1)
+                d->lut[i] = static_cast<uint8_t>(v);
+            else
+                reinterpret_cast<uint16_t *>(d->lut.data())[i] = static_cast<uint16_t>(v);
+        }
+    }
+
+    vsapi->createFilter(in, out, "Lut2", lut2Init, lut2Getframe, lut2Free, fmParallel, 0, d.release(), core);
+}
+
+//////////////////////////////////////////
+// Init
+
+void VS_CC lutInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin) {
+    //configFunc("com.vapoursynth.std", "std", "VapourSynth Core Functions", VAPOURSYNTH_API_VERSION, 1, plugin);
+    registerFunc("Lut", "clip:clip;planes:int[]:opt;lut:int[]:opt;lutf:float[]:opt;function:func:opt;", lutCreate, 0, plugin);
+    registerFunc("Lut2", "clipa:clip;clipb:clip;planes:int[]:opt;lut:int[]:opt;function:func:opt;bits:int:opt;", lut2Create, 0, plugin);
+}
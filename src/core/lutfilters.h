@@ -22,7 +22,34 @@
 #define LUTFILTERS_H
 
 #include "VapourSynth.h"
+#include <stdint.h>
 
 void VS_CC lutInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin);
 
+// Float luts are piecewise linear. The input value is mapped to a position in
+// the table and the first and last segments are extended to cover values
+// outside of the table's range. NaN ends up in the first segment.
+static inline float lutLookupFloat(float v, const float *values, const float *slopes, float scale, float offset, float last) {
+    float pos = v * scale + offset;
+    float p = pos > 0 ? pos : 0;
+    int i;
+    p = p < last ? p : last;
+    i = (int)p;
+    return values[i] + (pos - (float)i) * slopes[i];
+}
+
+#ifdef VS_TARGET_CPU_X86
+#ifdef __cplusplus
+extern "C" {
+#endif
+// All of these process a whole row. The integer tables must have 4 bytes of
+// padding at the end since every lookup reads 4 bytes.
+void vs_lut_avx2(const void *srcp, void *dstp, int bytesPerSample, int width, const void *lut);
+void vs_lut2_avx2(const void *srcpx, int xbytes, const void *srcpy, int ybytes, int shift, void *dstp, int dbytes, int width, const void *lut);
+void vs_lut_float_avx2(const float *srcp, float *dstp, int width, const float *values, const float *slopes, float scale, float offset, float last);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
 #endif // LUTFILTERS_H
@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2012-2014 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. The lookups use gathers of 8 elements at a time and give
+// the same results as the C versions.
+
+#ifdef VS_TARGET_CPU_X86
+#include <immintrin.h>
+
+#include "VSHelper.h"
+#include "lutfilters.h"
+
+
+// 8 samples of 1 or 2 bytes widened to 32 bits
+static inline __m256i loadIndices(const uint8_t *p, int bytes) {
+    if (bytes == 1)
+        return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+    else
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+// The table entries are gathered as 32 bit values which is why the tables
+// need padding at the end, the extra bytes are masked away.
+static inline __m256i gatherEntries(const uint8_t *lut, __m256i idx, int bytes) {
+    if (bytes == 1)
+        return _mm256_and_si256(_mm256_i32gather_epi32((const int *)lut, idx, 1), _mm256_set1_epi32(0xFF));
+    else
+        return _mm256_and_si256(_mm256_i32gather_epi32((const int *)lut, idx, 2), _mm256_set1_epi32(0xFFFF));
+}
+
+static inline void storeEntries(uint8_t *p, __m256i lo, __m256i hi, int bytes) {
+    __m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+
+    if (bytes == 1)
+        _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1)));
+    else
+        _mm256_storeu_si256((__m256i *)p, w);
+}
+
+static inline int loadSample(const uint8_t *p, int bytes, int x) {
+    return bytes == 1 ? p[x] : ((const uint16_t *)p)[x];
+}
+
+static inline void storeSample(uint8_t *p, int bytes, int x, const uint8_t *lut, int idx) {
+    if (bytes == 1)
+        p[x] = lut[idx];
+    else
+        ((uint16_t *)p)[x] = ((const uint16_t *)lut)[idx];
+}
+
+void vs_lut_avx2(const void *srcp, void *dstp, int bytesPerSample, int width, const void *lut) {
+    const uint8_t *s = (const uint8_t *)srcp;
+    uint8_t *d = (uint8_t *)dstp;
+    const uint8_t *l = (const uint8_t *)lut;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m256i lo = gatherEntries(l, loadIndices(s + x * bytesPerSample, bytesPerSample), bytesPerSample);
+        __m256i hi = gatherEntries(l, loadIndices(s + (x + 8) * bytesPerSample, bytesPerSample), bytesPerSample);
+        storeEntries(d + x * bytesPerSample, lo, hi, bytesPerSample);
+    }
+
+    for (; x < width; x++)
+        storeSample(d, bytesPerSample, x, l, loadSample(s, bytesPerSample, x));
+}
+
+void vs_lut2_avx2(const void *srcpx, int xbytes, const void *srcpy, int ybytes, int shift, void *dstp, int dbytes, int width, const void *lut) {
+    const uint8_t *sx = (const uint8_t *)srcpx;
+    const uint8_t *sy = (const uint8_t *)srcpy;
+    uint8_t *d = (uint8_t *)dstp;
+    const uint8_t *l = (const uint8_t *)lut;
+    __m128i count = _mm_cvtsi32_si128(shift);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m256i lo = _mm256_add_epi32(_mm256_sll_epi32(loadIndices(sy + x * ybytes, ybytes), count), loadIndices(sx + x * xbytes, xbytes));
+        __m256i hi = _mm256_add_epi32(_mm256_sll_epi32(loadIndices(sy + (x + 8) * ybytes, ybytes), count), loadIndices(sx + (x + 8) * xbytes, xbytes));
+        storeEntries(d + x * dbytes, gatherEntries(l, lo, dbytes), gatherEntries(l, hi, dbytes), dbytes);
+    }
+
+    for (; x < width; x++)
+        storeSample(d, dbytes, x, l, (loadSample(sy, ybytes, x) << shift) + loadSample(sx, xbytes, x));
+}
+
+void vs_lut_float_avx2(const float *srcp, float *dstp, int width, const float *values, const float *slopes, float scale, float offset, float last) {
+    const __m256 vscale = _mm256_set1_ps(scale);
+    const __m256 voffset = _mm256_set1_ps(offset);
+    const __m256 vlast = _mm256_set1_ps(last);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256 pos = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(srcp + x), vscale), voffset);
+        // maxps returns the second operand for NaN which matches the C version
+        __m256i i = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(pos, _mm256_setzero_ps()), vlast));
+        __m256 v = _mm256_i32gather_ps(values, i, 4);
+        __m256 s = _mm256_i32gather_ps(slopes, i, 4);
+        _mm256_storeu_ps(dstp + x, _mm256_add_ps(v, _mm256_mul_ps(_mm256_sub_ps(pos, _mm256_cvtepi32_ps(i)), s)));
+    }
+
+    for (; x < width; x++)
+        dstp[x] = lutLookupFloat(srcp[x], values, slopes, scale, offset, last);
+}
+
+#endif
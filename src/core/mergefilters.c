@@ -22,9 +22,205 @@
 #include "VSHelper.h"
 #include "filtershared.h"
 #include <stdlib.h>
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "cpufeatures.h"
+#endif
 
 #define CLAMP(value, lower, upper) do { if (value < lower) value = lower; else if (value > upper) value = upper; } while(0)
 
+static int mergeUseAVX2(void) {
+#ifdef VS_TARGET_CPU_X86
+    CPUFeatures cpu;
+    getCPUFeatures(&cpu);
+    return !!cpu.avx2;
+#else
+    return 0;
+#endif
+}
+
+#ifdef VS_TARGET_CPU_X86
+
+// The SSE2 versions of the high bitdepth and float kernels, the 8 bit ones are
+// in asm/x86/merge.asm. Like the AVX2 ones in mergefilters_avx2.c they process
+// whole strides and give the same results as the C versions.
+
+// sse2 has no 32 bit multiply so the even and odd products are done separately
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void vs_merge_uint16_sse2(const uint8_t *srcp1, const uint8_t *srcp2, unsigned weight, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    // the samples are biased by 32768 to fit in signed words, since the weights
+    // always add up to 32768 this adds 32768 * 32768 to every sum
+    const __m128i weights = _mm_set1_epi32((int)((weight << 16) | (32768 - weight)));
+    const __m128i round = _mm_set1_epi32((1 << 30) + (1 << 14));
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(srcp1 + x)), bias);
+            __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(srcp2 + x)), bias);
+            __m128i lo = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights), round), 15);
+            __m128i hi = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights), round), 15);
+            // there is no unsigned saturating pack either so the bias is reapplied around it
+            __m128i t = _mm_packs_epi32(_mm_sub_epi32(lo, bias32), _mm_sub_epi32(hi, bias32));
+            _mm_storeu_si128((__m128i *)(dstp + x), _mm_xor_si128(t, bias));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_merge_float_sse2(const uint8_t *srcp1, const uint8_t *srcp2, float weight, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m128 w = _mm_set1_ps(weight);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128 a = _mm_loadu_ps((const float *)(srcp1 + x));
+            __m128 b = _mm_loadu_ps((const float *)(srcp2 + x));
+            _mm_storeu_ps((float *)(dstp + x), _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), w)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+// a + (((b - a) * mask + round) >> bits) for 4 dwords, the result is the low word of each dword
+static inline __m128i maskedMergeDwords_sse2(__m128i a, __m128i b, __m128i m, __m128i round, __m128i count) {
+    m = _mm_sub_epi32(m, _mm_cmpgt_epi32(m, _mm_set1_epi32(2)));
+    __m128i t = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(mullo_epi32_sse2(_mm_sub_epi32(b, a), m), round), count), a);
+    return _mm_srai_epi32(_mm_slli_epi32(t, 16), 16);
+}
+
+static void vs_masked_merge_uint16_sse2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m128i round = _mm_set1_epi32(1 << (bits - 1));
+    const __m128i count = _mm_cvtsi32_si128(bits);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(srcp1 + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(srcp2 + x));
+            __m128i m = _mm_loadu_si128((const __m128i *)(maskp + x));
+            __m128i lo = maskedMergeDwords_sse2(_mm_unpacklo_epi16(a, zero), _mm_unpacklo_epi16(b, zero), _mm_unpacklo_epi16(m, zero), round, count);
+            __m128i hi = maskedMergeDwords_sse2(_mm_unpackhi_epi16(a, zero), _mm_unpackhi_epi16(b, zero), _mm_unpackhi_epi16(m, zero), round, count);
+            _mm_storeu_si128((__m128i *)(dstp + x), _mm_packs_epi32(lo, hi));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        maskp += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_masked_merge_float_sse2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128 a = _mm_loadu_ps((const float *)(srcp1 + x));
+            __m128 b = _mm_loadu_ps((const float *)(srcp2 + x));
+            __m128 m = _mm_loadu_ps((const float *)(maskp + x));
+            _mm_storeu_ps((float *)(dstp + x), _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), m)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        maskp += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_make_diff_uint16_sse2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m128i half = _mm_set1_epi16((short)(1 << (bits - 1)));
+    const __m128i maxvalue = _mm_set1_epi16((short)((1 << bits) - 1));
+    const __m128i zero = _mm_setzero_si128();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(srcp1 + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(srcp2 + x));
+            __m128i t;
+            if (bits == 16) {
+                t = _mm_xor_si128(_mm_subs_epi16(_mm_xor_si128(a, half), _mm_xor_si128(b, half)), half);
+            } else {
+                // the difference fits in a signed word and saturating at 32767 is above the maximum
+                t = _mm_adds_epi16(_mm_sub_epi16(a, b), half);
+                t = _mm_min_epi16(_mm_max_epi16(t, zero), maxvalue);
+            }
+            _mm_storeu_si128((__m128i *)(dstp + x), t);
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_make_diff_float_sse2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma) {
+    // the clamping keeps NaN like the C version
+    const __m128 lower = _mm_set1_ps(chroma ? -0.5f : 0.0f);
+    const __m128 upper = _mm_set1_ps(chroma ? 0.5f : 1.0f);
+    const __m128 offset = _mm_set1_ps(0.5f);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128 t = _mm_sub_ps(_mm_loadu_ps((const float *)(srcp1 + x)), _mm_loadu_ps((const float *)(srcp2 + x)));
+            if (!chroma)
+                t = _mm_add_ps(t, offset);
+            _mm_storeu_ps((float *)(dstp + x), _mm_min_ps(upper, _mm_max_ps(lower, t)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_merge_diff_uint16_sse2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m128i half = _mm_set1_epi16((short)(1 << (bits - 1)));
+    const __m128i maxvalue = _mm_set1_epi16((short)((1 << bits) - 1));
+    const __m128i zero = _mm_setzero_si128();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(srcp1 + x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(srcp2 + x));
+            __m128i t;
+            if (bits == 16) {
+                t = _mm_xor_si128(_mm_adds_epi16(_mm_xor_si128(a, half), _mm_xor_si128(b, half)), half);
+            } else {
+                t = _mm_adds_epi16(_mm_sub_epi16(a, half), b);
+                t = _mm_min_epi16(_mm_max_epi16(t, zero), maxvalue);
+            }
+            _mm_storeu_si128((__m128i *)(dstp + x), t);
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+static void vs_merge_diff_float_sse2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma) {
+    const __m128 lower = _mm_set1_ps(chroma ? -0.5f : 0.0f);
+    const __m128 upper = _mm_set1_ps(chroma ? 0.5f : 1.0f);
+    const __m128 offset = _mm_set1_ps(0.5f);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 16) {
+            __m128 t = _mm_add_ps(_mm_loadu_ps((const float *)(srcp1 + x)), _mm_loadu_ps((const float *)(srcp2 + x)));
+            if (!chroma)
+                t = _mm_sub_ps(t, offset);
+            _mm_storeu_ps((float *)(dstp + x), _mm_min_ps(upper, _mm_max_ps(lower, t)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+#endif
+
 //////////////////////////////////////////
 // Merge
 
@@ -39,6 +235,7 @@ typedef struct {
     unsigned weight[3];
     float fweight[3];
     int process[3];
+    int avx2;
 } MergeData;
 
 const unsigned MergeShift = 15;
@@ -66,17 +263,24 @@ static const VSFrameRef *VS_CC mergeGetFrame(int n, int activationReason, void *
                 unsigned weight = d->weight[plane];
                 float fweight = d->fweight[plane];
                 int h = vsapi->getFrameHeight(src1, plane);
+#ifndef VS_TARGET_CPU_X86
                 int w = vsapi->getFrameWidth(src2, plane);
+#endif
                 int stride = vsapi->getStride(src1, plane);
                 const uint8_t *srcp1 = vsapi->getReadPtr(src1, plane);
                 const uint8_t *srcp2 = vsapi->getReadPtr(src2, plane);
                 uint8_t *dstp = vsapi->getWritePtr(dst, plane);
 
                 if (d->vi->format->sampleType == stInteger) {
+#ifndef VS_TARGET_CPU_X86
                     const unsigned round = 1 << (MergeShift - 1);
+#endif
                     if (d->vi->format->bytesPerSample == 1) {
 #ifdef VS_TARGET_CPU_X86
-                        vs_merge_uint8_sse2(srcp1, srcp2, weight, dstp, stride, h);
+                        if (d->avx2)
+                            vs_merge_uint8_avx2(srcp1, srcp2, weight, dstp, stride, h);
+                        else
+                            vs_merge_uint8_sse2(srcp1, srcp2, weight, dstp, stride, h);
 #else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++)
@@ -87,6 +291,12 @@ static const VSFrameRef *VS_CC mergeGetFrame(int n, int activationReason, void *
                         }
 #endif
                     } else if (d->vi->format->bytesPerSample == 2) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_merge_uint16_avx2(srcp1, srcp2, weight, dstp, stride, h);
+                        else
+                            vs_merge_uint16_sse2(srcp1, srcp2, weight, dstp, stride, h);
+#else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++)
                                 ((uint16_t *)dstp)[x] = ((const uint16_t *)srcp1)[x] + (((((const uint16_t *)srcp2)[x] - ((const uint16_t *)srcp1)[x]) * weight + round) >> MergeShift);
@@ -94,9 +304,16 @@ static const VSFrameRef *VS_CC mergeGetFrame(int n, int activationReason, void *
                             srcp2 += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 } else if (d->vi->format->sampleType == stFloat) {
                     if (d->vi->format->bytesPerSample == 4) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_merge_float_avx2(srcp1, srcp2, fweight, dstp, stride, h);
+                        else
+                            vs_merge_float_sse2(srcp1, srcp2, fweight, dstp, stride, h);
+#else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++)
                                 ((float *)dstp)[x] = (((const float *)srcp1)[x] + (((const float *)srcp2)[x] - ((const float *)srcp1)[x]) * fweight);
@@ -104,6 +321,7 @@ static const VSFrameRef *VS_CC mergeGetFrame(int n, int activationReason, void *
                             srcp2 += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 }
             }
@@ -188,6 +406,8 @@ static void VS_CC mergeCreate(const VSMap *in, VSMap *out, void *userData, VSCor
         RETERROR("Merge: more weights given than the number of planes to merge");
     }
 
+    d.avx2 = mergeUseAVX2();
+
     data = malloc(sizeof(d));
     *data = d;
 
@@ -209,6 +429,7 @@ typedef struct {
     VSNodeRef *mask23;
     int first_plane;
     int process[3];
+    int avx2;
 } MaskedMergeData;
 
 static void VS_CC maskedMergeInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
@@ -238,7 +459,9 @@ static const VSFrameRef *VS_CC maskedMergeGetFrame(int n, int activationReason,
         for (int plane = 0; plane < d->vi->format->numPlanes; plane++) {
             if (d->process[plane]) {
                 int h = vsapi->getFrameHeight(src1, plane);
+#ifndef VS_TARGET_CPU_X86
                 int w = vsapi->getFrameWidth(src2, plane);
+#endif
                 int stride = vsapi->getStride(src1, plane);
                 const uint8_t *srcp1 = vsapi->getReadPtr(src1, plane);
                 const uint8_t *srcp2 = vsapi->getReadPtr(src2, plane);
@@ -248,7 +471,10 @@ static const VSFrameRef *VS_CC maskedMergeGetFrame(int n, int activationReason,
                 if (d->vi->format->sampleType == stInteger) {
                     if (d->vi->format->bytesPerSample == 1) {
 #ifdef VS_TARGET_CPU_X86
-                        vs_masked_merge_uint8_sse2(srcp1, srcp2, maskp, dstp, stride, h);
+                        if (d->avx2)
+                            vs_masked_merge_uint8_avx2(srcp1, srcp2, maskp, dstp, stride, h);
+                        else
+                            vs_masked_merge_uint8_sse2(srcp1, srcp2, maskp, dstp, stride, h);
 #else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++)
@@ -260,6 +486,12 @@ static const VSFrameRef *VS_CC maskedMergeGetFrame(int n, int activationReason,
                         }
 #endif
                     } else if (d->vi->format->bytesPerSample == 2) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_masked_merge_uint16_avx2(srcp1, srcp2, maskp, dstp, stride, h, d->vi->format->bitsPerSample);
+                        else
+                            vs_masked_merge_uint16_sse2(srcp1, srcp2, maskp, dstp, stride, h, d->vi->format->bitsPerSample);
+#else
                         const unsigned shift = d->vi->format->bitsPerSample;
                         const unsigned round = 1 << (shift - 1);
                         for (int y = 0; y < h; y++) {
@@ -271,9 +503,16 @@ static const VSFrameRef *VS_CC maskedMergeGetFrame(int n, int activationReason,
                             maskp += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 } else if (d->vi->format->sampleType == stFloat) {
                     if (d->vi->format->bytesPerSample == 4) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_masked_merge_float_avx2(srcp1, srcp2, maskp, dstp, stride, h);
+                        else
+                            vs_masked_merge_float_sse2(srcp1, srcp2, maskp, dstp, stride, h);
+#else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++)
                                 ((float *)dstp)[x] = ((const float *)srcp1)[x] + ((((const float *)srcp2)[x] - ((const float *)srcp1)[x]) * ((const float *)maskp)[x]);
@@ -282,6 +521,7 @@ static const VSFrameRef *VS_CC maskedMergeGetFrame(int n, int activationReason,
                             maskp += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 }
             }
@@ -387,6 +627,8 @@ static void VS_CC maskedMergeCreate(const VSMap *in, VSMap *out, void *userData,
         vsapi->freeMap(min);
     }
 
+    d.avx2 = mergeUseAVX2();
+
     data = malloc(sizeof(d));
     *data = d;
 
@@ -405,6 +647,7 @@ typedef struct {
     VSNodeRef *node2;
     const VSVideoInfo *vi;
     int process[3];
+    int avx2;
 } MakeDiffData;
 
 static void VS_CC makeDiffInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
@@ -427,7 +670,9 @@ static const VSFrameRef *VS_CC makeDiffGetFrame(int n, int activationReason, voi
         for (int plane = 0; plane < d->vi->format->numPlanes; plane++) {
             if (d->process[plane]) {
                 int h = vsapi->getFrameHeight(src1, plane);
+#ifndef VS_TARGET_CPU_X86
                 int w = vsapi->getFrameWidth(src2, plane);
+#endif
                 int stride = vsapi->getStride(src1, plane);
                 const uint8_t *srcp1 = vsapi->getReadPtr(src1, plane);
                 const uint8_t *srcp2 = vsapi->getReadPtr(src2, plane);
@@ -436,7 +681,10 @@ static const VSFrameRef *VS_CC makeDiffGetFrame(int n, int activationReason, voi
                 if (d->vi->format->sampleType == stInteger) {
                     if (d->vi->format->bytesPerSample == 1) {
 #ifdef VS_TARGET_CPU_X86
-                        vs_make_diff_uint8_sse2(srcp1, srcp2, dstp, stride, h);
+                        if (d->avx2)
+                            vs_make_diff_uint8_avx2(srcp1, srcp2, dstp, stride, h);
+                        else
+                            vs_make_diff_uint8_sse2(srcp1, srcp2, dstp, stride, h);
 #else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++) {
@@ -450,6 +698,12 @@ static const VSFrameRef *VS_CC makeDiffGetFrame(int n, int activationReason, voi
                         }
 #endif
                     } else if (d->vi->format->bytesPerSample == 2) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_make_diff_uint16_avx2(srcp1, srcp2, dstp, stride, h, d->vi->format->bitsPerSample);
+                        else
+                            vs_make_diff_uint16_sse2(srcp1, srcp2, dstp, stride, h, d->vi->format->bitsPerSample);
+#else
                         const unsigned halfpoint = 1 << (d->vi->format->bitsPerSample - 1);
                         const int maxvalue = (1 << d->vi->format->bitsPerSample) - 1;
                         for (int y = 0; y < h; y++) {
@@ -462,10 +716,18 @@ static const VSFrameRef *VS_CC makeDiffGetFrame(int n, int activationReason, voi
                             srcp2 += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 } else if (d->vi->format->sampleType == stFloat) {
                     if (d->vi->format->bytesPerSample == 4) {
-                        if (plane == 0 || d->vi->format->colorFamily == cmRGB) {
+                        int chroma = plane > 0 && d->vi->format->colorFamily != cmRGB;
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_make_diff_float_avx2(srcp1, srcp2, dstp, stride, h, chroma);
+                        else
+                            vs_make_diff_float_sse2(srcp1, srcp2, dstp, stride, h, chroma);
+#else
+                        if (!chroma) {
                             for (int y = 0; y < h; y++) {
                                 for (int x = 0; x < w; x++) {
                                     float temp = ((const float *)srcp1)[x] - ((const float *)srcp2)[x] + 0.5f;
@@ -488,6 +750,7 @@ static const VSFrameRef *VS_CC makeDiffGetFrame(int n, int activationReason, voi
                                 dstp += stride;
                             }
                         }
+#endif
                     }
                 }
             }
@@ -555,6 +818,8 @@ static void VS_CC makeDiffCreate(const VSMap *in, VSMap *out, void *userData, VS
         d.process[o] = 1;
     }
 
+    d.avx2 = mergeUseAVX2();
+
     data = malloc(sizeof(d));
     *data = d;
 
@@ -573,6 +838,7 @@ typedef struct {
     VSNodeRef *node2;
     const VSVideoInfo *vi;
     int process[3];
+    int avx2;
 } MergeDiffData;
 
 static void VS_CC mergeDiffInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
@@ -595,7 +861,9 @@ static const VSFrameRef *VS_CC mergeDiffGetFrame(int n, int activationReason, vo
         for (int plane = 0; plane < d->vi->format->numPlanes; plane++) {
             if (d->process[plane]) {
                 int h = vsapi->getFrameHeight(src1, plane);
+#ifndef VS_TARGET_CPU_X86
                 int w = vsapi->getFrameWidth(src1, plane);
+#endif
                 int stride = vsapi->getStride(src1, plane);
                 const uint8_t *srcp1 = vsapi->getReadPtr(src1, plane);
                 const uint8_t *srcp2 = vsapi->getReadPtr(src2, plane);
@@ -604,7 +872,10 @@ static const VSFrameRef *VS_CC mergeDiffGetFrame(int n, int activationReason, vo
                 if (d->vi->format->sampleType == stInteger) {
                     if (d->vi->format->bytesPerSample == 1) {
 #ifdef VS_TARGET_CPU_X86
-                        vs_merge_diff_uint8_sse2(srcp1, srcp2, dstp, stride, h);
+                        if (d->avx2)
+                            vs_merge_diff_uint8_avx2(srcp1, srcp2, dstp, stride, h);
+                        else
+                            vs_merge_diff_uint8_sse2(srcp1, srcp2, dstp, stride, h);
 #else
                         for (int y = 0; y < h; y++) {
                             for (int x = 0; x < w; x++) {
@@ -618,6 +889,12 @@ static const VSFrameRef *VS_CC mergeDiffGetFrame(int n, int activationReason, vo
                         }
 #endif
                     } else if (d->vi->format->bytesPerSample == 2) {
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_merge_diff_uint16_avx2(srcp1, srcp2, dstp, stride, h, d->vi->format->bitsPerSample);
+                        else
+                            vs_merge_diff_uint16_sse2(srcp1, srcp2, dstp, stride, h, d->vi->format->bitsPerSample);
+#else
                         const int halfpoint = 1 << (d->vi->format->bitsPerSample - 1);
                         const int maxvalue = (1 << d->vi->format->bitsPerSample) - 1;
                         for (int y = 0; y < h; y++) {
@@ -630,10 +907,18 @@ static const VSFrameRef *VS_CC mergeDiffGetFrame(int n, int activationReason, vo
                             srcp2 += stride;
                             dstp += stride;
                         }
+#endif
                     }
                 } else if (d->vi->format->sampleType == stFloat) {
                     if (d->vi->format->bytesPerSample == 4) {
-                        if (plane == 0 || d->vi->format->colorFamily == cmRGB) {
+                        int chroma = plane > 0 && d->vi->format->colorFamily != cmRGB;
+#ifdef VS_TARGET_CPU_X86
+                        if (d->avx2)
+                            vs_merge_diff_float_avx2(srcp1, srcp2, dstp, stride, h, chroma);
+                        else
+                            vs_merge_diff_float_sse2(srcp1, srcp2, dstp, stride, h, chroma);
+#else
+                        if (!chroma) {
                             for (int y = 0; y < h; y++) {
                                 for (int x = 0; x < w; x++) {
                                     float temp = ((const float *)srcp1)[x] + ((const float *)srcp2)[x] - 0.5f;
@@ -656,6 +941,7 @@ static const VSFrameRef *VS_CC mergeDiffGetFrame(int n, int activationReason, vo
                                 dstp += stride;
                             }
                         }
+#endif
                     }
                 }
             }
@@ -722,6 +1008,8 @@ static void VS_CC mergeDiffCreate(const VSMap *in, VSMap *out, void *userData, V
         d.process[o] = 1;
     }
 
+    d.avx2 = mergeUseAVX2();
+
     data = malloc(sizeof(d));
     *data = d;
 
@@ -25,4 +25,22 @@
 
 void VS_CC mergeInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin);
 
+#ifdef VS_TARGET_CPU_X86
+#include <stdint.h>
+
+// All of these process whole strides, the stride must be a multiple of 32.
+void vs_merge_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, unsigned weight, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_merge_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, unsigned weight, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_merge_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, float weight, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_masked_merge_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_masked_merge_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height, int bits);
+void vs_masked_merge_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_make_diff_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_make_diff_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits);
+void vs_make_diff_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma);
+void vs_merge_diff_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height);
+void vs_merge_diff_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits);
+void vs_merge_diff_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma);
+#endif
+
 #endif // MERGEFILTERS_H
@@ -0,0 +1,283 @@
+/*
+* Copyright (c) 2012-2015 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. All kernels give the same results as the C versions in
+// mergefilters.c.
+
+#ifdef VS_TARGET_CPU_X86
+#include <immintrin.h>
+
+#include "VSHelper.h"
+#include "mergefilters.h"
+
+
+// (a * w1 + b * w2 + round) >> shift for 16 words where the weights are
+// interleaved as w1, w2 pairs and the results fit in signed words
+static inline __m256i weightedWords(__m256i a, __m256i b, __m256i wlo, __m256i whi, __m256i round, int shift) {
+    __m256i lo = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wlo), round), shift);
+    __m256i hi = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), whi), round), shift);
+    return _mm256_packs_epi32(lo, hi);
+}
+
+// a + (((b - a) * mask + round) >> bits) for 8 dwords, the result is the low word of each dword
+static inline __m256i maskedMergeDwords(__m256i a, __m256i b, __m256i m, __m256i round, __m128i count) {
+    m = _mm256_sub_epi32(m, _mm256_cmpgt_epi32(m, _mm256_set1_epi32(2)));
+    __m256i t = _mm256_add_epi32(_mm256_sra_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(b, a), m), round), count), a);
+    return _mm256_srai_epi32(_mm256_slli_epi32(t, 16), 16);
+}
+
+void vs_merge_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, unsigned weight, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m256i weights = _mm256_set1_epi32((int)((weight << 16) | (32768 - weight)));
+    const __m256i round = _mm256_set1_epi32(1 << 14);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(srcp1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(srcp2 + x));
+            __m256i lo = weightedWords(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), weights, weights, round, 15);
+            __m256i hi = weightedWords(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), weights, weights, round, 15);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_packus_epi16(lo, hi));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_merge_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, unsigned weight, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    // the samples are biased by 32768 to fit in signed words, since the weights
+    // always add up to 32768 this adds 32768 * 32768 to every sum
+    const __m256i weights = _mm256_set1_epi32((int)((weight << 16) | (32768 - weight)));
+    const __m256i round = _mm256_set1_epi32((1 << 30) + (1 << 14));
+    const __m256i bias = _mm256_set1_epi16((short)0x8000);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp1 + x)), bias);
+            __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp2 + x)), bias);
+            __m256i lo = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights), round), 15);
+            __m256i hi = _mm256_srli_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights), round), 15);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_packus_epi32(lo, hi));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_merge_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, float weight, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m256 w = _mm256_set1_ps(weight);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256 a = _mm256_loadu_ps((const float *)(srcp1 + x));
+            __m256 b = _mm256_loadu_ps((const float *)(srcp2 + x));
+            _mm256_storeu_ps((float *)(dstp + x), _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), w)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_masked_merge_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m256i round = _mm256_set1_epi32(128);
+    const __m256i two = _mm256_set1_epi16(2);
+    const __m256i full = _mm256_set1_epi16(256);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(srcp1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(srcp2 + x));
+            __m256i m = _mm256_loadu_si256((const __m256i *)(maskp + x));
+            __m256i mlo = _mm256_unpacklo_epi8(m, zero);
+            __m256i mhi = _mm256_unpackhi_epi8(m, zero);
+            // mask values above 2 get 1 added so 255 means only the second clip
+            mlo = _mm256_sub_epi16(mlo, _mm256_cmpgt_epi16(mlo, two));
+            mhi = _mm256_sub_epi16(mhi, _mm256_cmpgt_epi16(mhi, two));
+            __m256i ilo = _mm256_sub_epi16(full, mlo);
+            __m256i ihi = _mm256_sub_epi16(full, mhi);
+            __m256i lo = weightedWords(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi16(ilo, mlo), _mm256_unpackhi_epi16(ilo, mlo), round, 8);
+            __m256i hi = weightedWords(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), _mm256_unpacklo_epi16(ihi, mhi), _mm256_unpackhi_epi16(ihi, mhi), round, 8);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_packus_epi16(lo, hi));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        maskp += stride;
+        dstp += stride;
+    }
+}
+
+void vs_masked_merge_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m256i round = _mm256_set1_epi32(1 << (bits - 1));
+    const __m128i count = _mm_cvtsi32_si128(bits);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(srcp1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(srcp2 + x));
+            __m256i m = _mm256_loadu_si256((const __m256i *)(maskp + x));
+            __m256i lo = maskedMergeDwords(_mm256_unpacklo_epi16(a, zero), _mm256_unpacklo_epi16(b, zero), _mm256_unpacklo_epi16(m, zero), round, count);
+            __m256i hi = maskedMergeDwords(_mm256_unpackhi_epi16(a, zero), _mm256_unpackhi_epi16(b, zero), _mm256_unpackhi_epi16(m, zero), round, count);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_packs_epi32(lo, hi));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        maskp += stride;
+        dstp += stride;
+    }
+}
+
+void vs_masked_merge_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, const uint8_t *maskp, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256 a = _mm256_loadu_ps((const float *)(srcp1 + x));
+            __m256 b = _mm256_loadu_ps((const float *)(srcp2 + x));
+            __m256 m = _mm256_loadu_ps((const float *)(maskp + x));
+            _mm256_storeu_ps((float *)(dstp + x), _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), m)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        maskp += stride;
+        dstp += stride;
+    }
+}
+
+void vs_make_diff_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp1 + x)), bias);
+            __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp2 + x)), bias);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_xor_si256(_mm256_subs_epi8(a, b), bias));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_make_diff_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m256i half = _mm256_set1_epi16((short)(1 << (bits - 1)));
+    const __m256i maxvalue = _mm256_set1_epi16((short)((1 << bits) - 1));
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(srcp1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(srcp2 + x));
+            __m256i t;
+            if (bits == 16) {
+                t = _mm256_xor_si256(_mm256_subs_epi16(_mm256_xor_si256(a, half), _mm256_xor_si256(b, half)), half);
+            } else {
+                // the difference fits in a signed word and saturating at 32767 is above the maximum
+                t = _mm256_adds_epi16(_mm256_sub_epi16(a, b), half);
+                t = _mm256_min_epi16(_mm256_max_epi16(t, zero), maxvalue);
+            }
+            _mm256_storeu_si256((__m256i *)(dstp + x), t);
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_make_diff_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma) {
+    // the clamping keeps NaN like the C version
+    const __m256 lower = _mm256_set1_ps(chroma ? -0.5f : 0.0f);
+    const __m256 upper = _mm256_set1_ps(chroma ? 0.5f : 1.0f);
+    const __m256 offset = _mm256_set1_ps(0.5f);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256 t = _mm256_sub_ps(_mm256_loadu_ps((const float *)(srcp1 + x)), _mm256_loadu_ps((const float *)(srcp2 + x)));
+            if (!chroma)
+                t = _mm256_add_ps(t, offset);
+            _mm256_storeu_ps((float *)(dstp + x), _mm256_min_ps(upper, _mm256_max_ps(lower, t)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_merge_diff_uint8_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height) {
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp1 + x)), bias);
+            __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(srcp2 + x)), bias);
+            _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_xor_si256(_mm256_adds_epi8(a, b), bias));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_merge_diff_uint16_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int bits) {
+    const __m256i half = _mm256_set1_epi16((short)(1 << (bits - 1)));
+    const __m256i maxvalue = _mm256_set1_epi16((short)((1 << bits) - 1));
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(srcp1 + x));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(srcp2 + x));
+            __m256i t;
+            if (bits == 16) {
+                t = _mm256_xor_si256(_mm256_adds_epi16(_mm256_xor_si256(a, half), _mm256_xor_si256(b, half)), half);
+            } else {
+                t = _mm256_adds_epi16(_mm256_sub_epi16(a, half), b);
+                t = _mm256_min_epi16(_mm256_max_epi16(t, zero), maxvalue);
+            }
+            _mm256_storeu_si256((__m256i *)(dstp + x), t);
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+void vs_merge_diff_float_avx2(const uint8_t *srcp1, const uint8_t *srcp2, uint8_t *dstp, intptr_t stride, intptr_t height, int chroma) {
+    const __m256 lower = _mm256_set1_ps(chroma ? -0.5f : 0.0f);
+    const __m256 upper = _mm256_set1_ps(chroma ? 0.5f : 1.0f);
+    const __m256 offset = _mm256_set1_ps(0.5f);
+
+    for (intptr_t y = 0; y < height; y++) {
+        for (intptr_t x = 0; x < stride; x += 32) {
+            __m256 t = _mm256_add_ps(_mm256_loadu_ps((const float *)(srcp1 + x)), _mm256_loadu_ps((const float *)(srcp2 + x)));
+            if (!chroma)
+                t = _mm256_sub_ps(t, offset);
+            _mm256_storeu_ps((float *)(dstp + x), _mm256_min_ps(upper, _mm256_max_ps(lower, t)));
+        }
+        srcp1 += stride;
+        srcp2 += stride;
+        dstp += stride;
+    }
+}
+
+#endif
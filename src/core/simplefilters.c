@@ -25,6 +25,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#ifdef VS_TARGET_OS_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
 static uint32_t doubleToUInt32S(double v) {
     if (v < 0)
@@ -1338,13 +1343,36 @@ static void VS_CC assumeFPSCreate(const VSMap *in, VSMap *out, void *userData, V
 //////////////////////////////////////////
 // FrameEval
 
+#ifdef VS_TARGET_OS_WINDOWS
+typedef CRITICAL_SECTION FrameEvalMutex;
+#define frameEvalMutexInit(m) InitializeCriticalSection(m)
+#define frameEvalMutexDestroy(m) DeleteCriticalSection(m)
+#define frameEvalMutexLock(m) EnterCriticalSection(m)
+#define frameEvalMutexUnlock(m) LeaveCriticalSection(m)
+#else
+typedef pthread_mutex_t FrameEvalMutex;
+#define frameEvalMutexInit(m) pthread_mutex_init(m, 0)
+#define frameEvalMutexDestroy(m) pthread_mutex_destroy(m)
+#define frameEvalMutexLock(m) pthread_mutex_lock(m)
+#define frameEvalMutexUnlock(m) pthread_mutex_unlock(m)
+#endif
+
+typedef struct {
+    int64_t key;
+    VSNodeRef *node;
+} FrameEvalEntry;
+
 typedef struct {
     VSVideoInfo vi;
     VSFuncRef *func;
+    VSFuncRef *key;
     VSNodeRef **propsrc;
     int numpropsrc;
-    VSMap *in;
-    VSMap *out;
+    // the clips returned so far for each key, sorted by key
+    FrameEvalEntry *entries;
+    int numentries;
+    int maxentries;
+    FrameEvalMutex lock;
 } FrameEvalData;
 
 static void VS_CC frameEvalInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
@@ -1352,6 +1380,117 @@ static void VS_CC frameEvalInit(VSMap *in, VSMap *out, void **instanceData, VSNo
     vsapi->setVideoInfo(&d->vi, 1, node);
 }
 
+// returns the position of key or where it should be inserted
+static int frameEvalFindKey(const FrameEvalData *d, int64_t key) {
+    int lo = 0;
+    int hi = d->numentries;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (d->entries[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Returns a reference to the clip previously stored for key, or stores node if there is none.
+// Two threads can evaluate the same new key at once so the first one to finish wins.
+static VSNodeRef *frameEvalLookup(FrameEvalData *d, int64_t key, VSNodeRef *node, const VSAPI *vsapi) {
+    VSNodeRef *ret = 0;
+    frameEvalMutexLock(&d->lock);
+    int i = frameEvalFindKey(d, key);
+    if (i < d->numentries && d->entries[i].key == key) {
+        ret = vsapi->cloneNodeRef(d->entries[i].node);
+    } else if (node) {
+        if (d->numentries == d->maxentries) {
+            d->maxentries = d->maxentries ? d->maxentries * 2 : 8;
+            d->entries = realloc(d->entries, d->maxentries * sizeof(FrameEvalEntry));
+        }
+        memmove(d->entries + i + 1, d->entries + i, (d->numentries - i) * sizeof(FrameEvalEntry));
+        d->entries[i].key = key;
+        d->entries[i].node = vsapi->cloneNodeRef(node);
+        d->numentries++;
+    }
+    frameEvalMutexUnlock(&d->lock);
+
+    if (ret && node)
+        vsapi->freeNode(node);
+    return ret ? ret : node;
+}
+
+// Every call gets its own maps so several frames can be evaluated at the same time
+static VSNodeRef *frameEvalGetNode(FrameEvalData *d, const VSMap *args, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    int64_t key = 0;
+    int err;
+    VSMap *out = vsapi->createMap();
+
+    if (d->key) {
+        vsapi->callFunc(d->key, args, out, core, vsapi);
+        if (vsapi->getError(out)) {
+            vsapi->setFilterError(vsapi->getError(out), frameCtx);
+            vsapi->freeMap(out);
+            return 0;
+        }
+
+        key = vsapi->propGetInt(out, "val", 0, &err);
+        vsapi->clearMap(out);
+
+        if (err) {
+            vsapi->freeMap(out);
+            vsapi->setFilterError("FrameEval: Key function didn't return an integer", frameCtx);
+            return 0;
+        }
+
+        VSNodeRef *node = frameEvalLookup(d, key, 0, vsapi);
+        if (node) {
+            vsapi->freeMap(out);
+            return node;
+        }
+    }
+
+    vsapi->callFunc(d->func, args, out, core, vsapi);
+    if (vsapi->getError(out)) {
+        vsapi->setFilterError(vsapi->getError(out), frameCtx);
+        vsapi->freeMap(out);
+        return 0;
+    }
+
+    VSNodeRef *node = vsapi->propGetNode(out, "val", 0, &err);
+    vsapi->freeMap(out);
+
+    if (err) {
+        vsapi->setFilterError("FrameEval: Function didn't return a clip", frameCtx);
+        return 0;
+    }
+
+    if (d->key)
+        node = frameEvalLookup(d, key, node, vsapi);
+    return node;
+}
+
+static const VSFrameRef *frameEvalReturnFrame(FrameEvalData *d, int n, VSNodeRef *node, VSFrameContext *frameCtx, const VSAPI *vsapi) {
+    const VSFrameRef *frame = vsapi->getFrameFilter(n, node, frameCtx);
+    vsapi->freeNode(node);
+
+    if (d->vi.width || d->vi.height) {
+        if (d->vi.width != vsapi->getFrameWidth(frame, 0) || d->vi.height != vsapi->getFrameHeight(frame, 0)) {
+            vsapi->freeFrame(frame);
+            vsapi->setFilterError("FrameEval: Returned frame has wrong dimensions", frameCtx);
+            return 0;
+        }
+    }
+
+    if (d->vi.format) {
+        if (d->vi.format != vsapi->getFrameFormat(frame)) {
+            vsapi->freeFrame(frame);
+            vsapi->setFilterError("FrameEval: Returned frame has wrong format", frameCtx);
+            return 0;
+        }
+    }
+    return frame;
+}
+
 static const VSFrameRef *VS_CC frameEvalGetFrameWithProps(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     FrameEvalData *d = (FrameEvalData *) * instanceData;
 
@@ -1359,54 +1498,24 @@ static const VSFrameRef *VS_CC frameEvalGetFrameWithProps(int n, int activationR
         for (int i = 0; i < d->numpropsrc; i++)
             vsapi->requestFrameFilter(n, d->propsrc[i], frameCtx);
     } else if (activationReason == arAllFramesReady && !*frameData) {
-        int err;
-        vsapi->propSetInt(d->in, "n", n, paAppend);
+        VSMap *args = vsapi->createMap();
+        vsapi->propSetInt(args, "n", n, paAppend);
         for (int i = 0; i < d->numpropsrc; i++) {
             const VSFrameRef *f = vsapi->getFrameFilter(n, d->propsrc[i], frameCtx);
-            vsapi->propSetFrame(d->in, "f", f, paAppend);
+            vsapi->propSetFrame(args, "f", f, paAppend);
             vsapi->freeFrame(f);
         }
-        vsapi->callFunc(d->func, d->in, d->out, core, vsapi);
-        vsapi->clearMap(d->in);
-        if (vsapi->getError(d->out)) {
-            vsapi->setFilterError(vsapi->getError(d->out), frameCtx);
-            vsapi->clearMap(d->out);
-            return 0;
-        }
+        VSNodeRef *node = frameEvalGetNode(d, args, frameCtx, core, vsapi);
+        vsapi->freeMap(args);
 
-        VSNodeRef *node = vsapi->propGetNode(d->out, "val", 0, &err);
-        vsapi->clearMap(d->out);
-
-        if (err) {
-            vsapi->setFilterError("FrameEval: Function didn't return a clip", frameCtx);
+        if (!node)
             return 0;
-        }
 
         *frameData = node;
 
         vsapi->requestFrameFilter(n, node, frameCtx);
     } else if (activationReason == arAllFramesReady) {
-        const VSFrameRef *frame;
-        VSNodeRef *node = (VSNodeRef *)*frameData;
-        frame = vsapi->getFrameFilter(n, node, frameCtx);
-        vsapi->freeNode(node);
-
-        if (d->vi.width || d->vi.height) {
-            if (d->vi.width != vsapi->getFrameWidth(frame, 0) || d->vi.height != vsapi->getFrameHeight(frame, 0)) {
-                vsapi->freeFrame(frame);
-                vsapi->setFilterError("FrameEval: Returned frame has wrong dimensions", frameCtx);
-                return 0;
-            }
-        }
-
-        if (d->vi.format) {
-            if (d->vi.format != vsapi->getFrameFormat(frame)) {
-                vsapi->freeFrame(frame);
-                vsapi->setFilterError("FrameEval: Returned frame has wrong format", frameCtx);
-                return 0;
-            }
-        }
-        return frame;
+        return frameEvalReturnFrame(d, n, (VSNodeRef *)*frameData, frameCtx, vsapi);
     } else if (activationReason == arError) {
         vsapi->freeNode(*frameData);
     }
@@ -1418,49 +1527,19 @@ static const VSFrameRef *VS_CC frameEvalGetFrameNoProps(int n, int activationRea
     FrameEvalData *d = (FrameEvalData *) * instanceData;
 
     if (activationReason == arInitial) {
+        VSMap *args = vsapi->createMap();
+        vsapi->propSetInt(args, "n", n, paAppend);
+        VSNodeRef *node = frameEvalGetNode(d, args, frameCtx, core, vsapi);
+        vsapi->freeMap(args);
 
-        int err;
-        vsapi->propSetInt(d->in, "n", n, paAppend);
-        vsapi->callFunc(d->func, d->in, d->out, core, vsapi);
-        vsapi->clearMap(d->in);
-        if (vsapi->getError(d->out)) {
-            vsapi->setFilterError(vsapi->getError(d->out), frameCtx);
-            vsapi->clearMap(d->out);
+        if (!node)
             return 0;
-        }
-
-        VSNodeRef *node = vsapi->propGetNode(d->out, "val", 0, &err);
-        vsapi->clearMap(d->out);
-
-        if (err) {
-            vsapi->setFilterError("FrameEval: Function didn't return a clip", frameCtx);
-            return 0;
-        }
 
         *frameData = node;
 
         vsapi->requestFrameFilter(n, node, frameCtx);
     } else if (activationReason == arAllFramesReady) {
-        VSNodeRef *node = (VSNodeRef *)*frameData;
-        const VSFrameRef *frame = vsapi->getFrameFilter(n, node, frameCtx);
-        vsapi->freeNode(node);
-
-        if (d->vi.width || d->vi.height) {
-            if (d->vi.width != vsapi->getFrameWidth(frame, 0) || d->vi.height != vsapi->getFrameHeight(frame, 0)) {
-                vsapi->freeFrame(frame);
-                vsapi->setFilterError("FrameEval: Returned frame has wrong dimensions", frameCtx);
-                return 0;
-            }
-        }
-
-        if (d->vi.format) {
-            if (d->vi.format != vsapi->getFrameFormat(frame)) {
-                vsapi->freeFrame(frame);
-                vsapi->setFilterError("FrameEval: Returned frame has wrong format", frameCtx);
-                return 0;
-            }
-        }
-        return frame;
+        return frameEvalReturnFrame(d, n, (VSNodeRef *)*frameData, frameCtx, vsapi);
     } else if (activationReason == arError) {
         vsapi->freeNode(*frameData);
     }
@@ -1473,20 +1552,25 @@ static void VS_CC frameEvalFree(void *instanceData, VSCore *core, const VSAPI *v
     for (int i = 0; i < d->numpropsrc; i++)
         vsapi->freeNode(d->propsrc[i]);
     free(d->propsrc);
+    for (int i = 0; i < d->numentries; i++)
+        vsapi->freeNode(d->entries[i].node);
+    free(d->entries);
+    frameEvalMutexDestroy(&d->lock);
     vsapi->freeFunc(d->func);
-    vsapi->freeMap(d->in);
-    vsapi->freeMap(d->out);
+    vsapi->freeFunc(d->key);
     free(d);
 }
 
 static void VS_CC frameEvalCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     FrameEvalData d;
     FrameEvalData *data;
+    int err;
     VSNodeRef *node = vsapi->propGetNode(in, "clip", 0, 0);
     d.propsrc = 0;
     d.vi = *vsapi->getVideoInfo(node);
     vsapi->freeNode(node);
     d.func = vsapi->propGetFunc(in, "eval", 0, 0);
+    d.key = vsapi->propGetFunc(in, "key", 0, &err);
     d.numpropsrc = vsapi->propNumElements(in, "prop_src");
     if (d.numpropsrc < 0)
         d.numpropsrc = 0;
@@ -1496,13 +1580,15 @@ static void VS_CC frameEvalCreate(const VSMap *in, VSMap *out, void *userData, V
             d.propsrc[i] = vsapi->propGetNode(in, "prop_src", i, 0);
     }
 
-    d.in = vsapi->createMap();
-    d.out = vsapi->createMap();
+    d.entries = 0;
+    d.numentries = 0;
+    d.maxentries = 0;
 
     data = malloc(sizeof(d));
     *data = d;
+    frameEvalMutexInit(&data->lock);
 
-    vsapi->createFilter(in, out, "FrameEval", frameEvalInit, d.numpropsrc ? frameEvalGetFrameWithProps : frameEvalGetFrameNoProps, frameEvalFree, d.numpropsrc ? fmParallelRequests : fmUnordered, 0, data, core);
+    vsapi->createFilter(in, out, "FrameEval", frameEvalInit, d.numpropsrc ? frameEvalGetFrameWithProps : frameEvalGetFrameNoProps, frameEvalFree, fmParallel, 0, data, core);
 }
 
 //////////////////////////////////////////
@@ -2427,7 +2513,7 @@ void VS_CC stdlibInitialize(VSConfigPlugin configFunc, VSRegisterFunction regist
     registerFunc("StackHorizontal", "clips:clip[];", stackCreate, 0, plugin);
     registerFunc("BlankClip", "clip:clip:opt;width:int:opt;height:int:opt;format:int:opt;length:int:opt;fpsnum:int:opt;fpsden:int:opt;color:float[]:opt;keep:int:opt;", blankClipCreate, 0, plugin);
     registerFunc("AssumeFPS", "clip:clip;src:clip:opt;fpsnum:int:opt;fpsden:int:opt;", assumeFPSCreate, 0, plugin);
-    registerFunc("FrameEval", "clip:clip;eval:func;prop_src:clip[]:opt;", frameEvalCreate, 0, plugin);
+    registerFunc("FrameEval", "clip:clip;eval:func;prop_src:clip[]:opt;key:func:opt;", frameEvalCreate, 0, plugin);
     registerFunc("ModifyFrame", "clip:clip;clips:clip[];selector:func;", modifyFrameCreate, 0, plugin);
     registerFunc("Transpose", "clip:clip;", transposeCreate, 0, plugin);
     registerFunc("PEMVerifier", "clip:clip;upper:int[]:opt;lower:int[]:opt;", pemVerifierCreate, 0, plugin);
@@ -490,7 +490,8 @@ static const VSFrameRef *VS_CC textGetFrame(int n, int activationReason, void **
             text.append(ci->versionString).append("\n");
             text.append("Threads: ").append(std::to_string(ci->numThreads)).append("\n");
             text.append("Maximum framebuffer cache size: ").append(std::to_string(ci->maxFramebufferSize)).append(" bytes\n");
-            text.append("Used framebuffer cache size: ").append(std::to_string(ci->usedFramebufferSize)).append(" bytes");
+            text.append("Used framebuffer cache size: ").append(std::to_string(ci->usedFramebufferSize)).append(" bytes\n");
+            text.append("Framebuffer pool hits/misses: ").append(std::to_string(ci->framebufferPoolHits)).append("/").append(std::to_string(ci->framebufferPoolMisses));
 
             scrawl_text(text, d->alignment, dst, vsapi);
         } else if (d->filter == FILTER_CLIPINFO) {
@@ -134,9 +134,9 @@ static const VSFrameRef *VS_CC getFrameFilter(int n, VSNodeRef *clip, VSFrameCon
     int numFrames = clip->clip->getVideoInfo(clip->index).numFrames;
     if (numFrames && n >= numFrames)
         n = numFrames - 1;
-    auto ref = frameCtx->ctx->availableFrames.find(NodeOutputKey(clip->clip.get(), n, clip->index));
-    if (ref != frameCtx->ctx->availableFrames.end())
-        return new VSFrameRef(ref->second);
+    const PVideoFrame *ref = frameCtx->ctx->availableFrames.find(NodeOutputKey(clip->clip.get(), n, clip->index));
+    if (ref)
+        return new VSFrameRef(*ref);
     return nullptr;
 }
 
@@ -161,6 +161,12 @@ static VSFrameRef *VS_CC newVideoFrame2(const VSFormat *format, int width, int h
     return new VSFrameRef(core->newVideoFrame(format, width, height, fp, planes, propSrc ? propSrc->frame.get() : nullptr));
 }
 
+static VSFrameRef *VS_CC newVideoFrameExternal(const VSFormat *format, int width, int height, uint8_t * const *planes, const int *strides, VSFrameBufferFree free, void *userData, const VSFrameRef *propSrc, VSCore *core) {
+    assert(format && planes && strides && core);
+    PVideoFrame f = core->newVideoFrame(format, width, height, planes, strides, free, userData, propSrc ? propSrc->frame.get() : nullptr);
+    return f ? new VSFrameRef(f) : nullptr;
+}
+
 static VSFrameRef *VS_CC copyFrame(const VSFrameRef *frame, VSCore *core) {
     assert(frame && core);
     return new VSFrameRef(core->copyFrame(frame->frame));
@@ -543,6 +549,21 @@ static int VS_CC propSetFloatArray(VSMap *map, const char *key, const double *d,
     return 0;
 }
 
+static void VS_CC setProfiling(int enable, VSCore *core) {
+    assert(core);
+    core->setProfiling(!!enable);
+}
+
+static void VS_CC getProfile(VSMap *out, VSCore *core) {
+    assert(out && core);
+    core->getProfile(*out);
+}
+
+static void VS_CC parallelFor(int count, VSParallelTask task, void *userData, VSCore *core) {
+    assert(task && core);
+    core->threadPool->parallelFor(count, task, userData);
+}
+
 const VSAPI vsapi = {
     &createCore,
     &freeCore,
@@ -628,7 +649,12 @@ const VSAPI vsapi = {
     &propGetIntArray,
     &propGetFloatArray,
     &propSetIntArray,
-    &propSetFloatArray
+    &propSetFloatArray,
+
+    &setProfiling,
+    &getProfile,
+    &parallelFor,
+    &newVideoFrameExternal
 };
 
 ///////////////////////////////
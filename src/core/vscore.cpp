@@ -28,6 +28,9 @@
 #include "settings.h"
 #endif
 #include <assert.h>
+#include <time.h>
+#include <chrono>
+#include <algorithm>
 
 #ifdef VS_TARGET_CPU_X86
 #include "x86utils.h"
@@ -40,7 +43,6 @@
 
 // Internal filter headers
 extern "C" {
-#include "lutfilters.h"
 #include "mergefilters.h"
 #include "reorderfilters.h"
 #include "simplefilters.h"
@@ -50,6 +52,7 @@ extern "C" {
 #include "exprfilter.h"
 #include "textfilter.h"
 #include "genericfilters.h"
+#include "lutfilters.h"
 
 static inline bool isAlpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
@@ -226,36 +229,169 @@ void VSVariant::initStorage(VSVType t) {
 
 ///////////////
 
-VSPlaneData::VSPlaneData(size_t dataSize, MemoryUse &mem) : mem(mem), size(dataSize + 2 * VSFrame::guardSpace) {
-    data = vs_aligned_malloc<uint8_t>(size + 2 * VSFrame::guardSpace, VSFrame::alignment);
-    assert(data);
-    if (!data)
-        vsFatal("Failed to allocate memory for planes. Out of memory.");
-    mem.add(size);
+size_t MemoryUse::getBufferSizeClass(size_t bytes) {
+    // eight classes per power of two so a recycled buffer wastes at most 12.5%
+    size_t step = VSFrame::alignment;
+    while (step * 8 < bytes)
+        step *= 2;
+    return (bytes + step - 1) & ~(step - 1);
+}
+
+void MemoryUse::releaseBuffer(uint8_t *buf, size_t bytes) {
+    vs_aligned_free(buf);
+    if (used.fetch_sub(bytes) == bytes && freeOnZero)
+        delete this;
+}
+
+uint8_t *MemoryUse::allocBuffer(size_t bytes) {
+    bytes = getBufferSizeClass(bytes);
+
+    {
+        std::lock_guard<std::mutex> lock(bufferLock);
+        auto iter = buffers.find(bytes);
+        if (iter != buffers.end() && !iter->second.empty()) {
+            uint8_t *buf = iter->second.back();
+            iter->second.pop_back();
+            ++bufferHits;
+            return buf;
+        }
+    }
+
+    uint8_t *buf = vs_aligned_malloc<uint8_t>(bytes, VSFrame::alignment);
+    if (buf) {
+        add(bytes);
+        ++bufferMisses;
+    }
+    return buf;
+}
+
+void MemoryUse::freeBuffer(uint8_t *buf, size_t bytes) {
+    bytes = getBufferSizeClass(bytes);
+
+    // don't hold on to memory that the caches need or that nobody will ask for again
+    if (!isOverLimit()) {
+        std::lock_guard<std::mutex> lock(bufferLock);
+        if (!freeOnZero) {
+            buffers[bytes].push_back(buf);
+            return;
+        }
+    }
+
+    releaseBuffer(buf, bytes);
+}
+
+void MemoryUse::trimBuffers() {
+    std::map<size_t, std::vector<uint8_t *>> unused;
+    {
+        std::lock_guard<std::mutex> lock(bufferLock);
+        std::swap(unused, buffers);
+    }
+
+    for (const auto &iter : unused)
+        for (uint8_t *buf : iter.second)
+            releaseBuffer(buf, iter.first);
+}
+
+void MemoryUse::signalFree() {
+    // the extra byte keeps the last released buffer from deleting this while trimming
+    add(1);
+    freeOnZero = true;
+    trimBuffers();
+    releaseBuffer(nullptr, 1);
+}
+
+///////////////
+
+// while profiling this points to the counter for the getframe call running in the current thread
+#ifdef _MSC_VER
+static __declspec(thread) int64_t *allocationCounter = nullptr;
+#else
+static __thread int64_t *allocationCounter = nullptr;
+#endif
+
+static int64_t getThreadCPUTime() {
+#ifdef VS_TARGET_OS_WINDOWS
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0;
+    uint64_t kernel = (static_cast<uint64_t>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime;
+    uint64_t user = (static_cast<uint64_t>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime;
+    return static_cast<int64_t>(kernel + user) * 100;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
 #ifdef VS_FRAME_GUARD
-    for (size_t i = 0; i < VSFrame::guardSpace / sizeof(VS_FRAME_GUARD_PATTERN); i++) {
-        reinterpret_cast<uint32_t *>(data)[i] = VS_FRAME_GUARD_PATTERN;
-        reinterpret_cast<uint32_t *>(data + size - VSFrame::guardSpace)[i] = VS_FRAME_GUARD_PATTERN;
+static void writeGuardPattern(uint8_t *plane, size_t size) {
+    for (size_t j = 0; j < VSFrame::guardSpace / sizeof(VS_FRAME_GUARD_PATTERN); j++) {
+        reinterpret_cast<uint32_t *>(plane)[j] = VS_FRAME_GUARD_PATTERN;
+        reinterpret_cast<uint32_t *>(plane + size - VSFrame::guardSpace)[j] = VS_FRAME_GUARD_PATTERN;
     }
+}
 #endif
+
+VSPlaneData::VSPlaneData(size_t dataSize, MemoryUse &mem) : mem(mem), size(dataSize), guard(VSFrame::guardSpace) {
+    data = mem.allocBuffer(size);
+    assert(data);
+    if (!data)
+        vsFatal("Failed to allocate memory for planes. Out of memory.");
+    if (allocationCounter)
+        *allocationCounter += size;
 }
 
-VSPlaneData::VSPlaneData(const VSPlaneData &d) : mem(d.mem), size(d.size) {
-    data = vs_aligned_malloc<uint8_t>(size, VSFrame::alignment);
+// copies a single plane of dataSize bytes, the copy always gets its own guard space
+VSPlaneData::VSPlaneData(const VSPlaneData &d, size_t offset, size_t dataSize) : mem(d.mem), size(dataSize + 2 * VSFrame::guardSpace), guard(VSFrame::guardSpace) {
+    assert(offset + dataSize + 2 * d.guard <= d.size);
+    data = mem.allocBuffer(size);
     assert(data);
     if (!data)
         vsFatal("Failed to allocate memory for plane in copy constructor. Out of memory.");
-    mem.add(size);
-    memcpy(data, d.data, size);
+    memcpy(data + guard, d.data + offset + d.guard, dataSize);
+#ifdef VS_FRAME_GUARD
+    writeGuardPattern(data, size);
+#endif
+    if (allocationCounter)
+        *allocationCounter += size;
+}
+
+VSPlaneData::VSPlaneData(uint8_t *data, size_t dataSize, const std::shared_ptr<VSExternalBuffer> &external, MemoryUse &mem) : mem(mem), external(external), data(data), size(dataSize), guard(0) {
 }
 
 VSPlaneData::~VSPlaneData() {
-    vs_aligned_free(data);
-    mem.subtract(size);
+    if (!external)
+        mem.freeBuffer(data, size);
 }
 
 ///////////////
 
+void VSFrame::allocPlanes(const VSFrame * const *planeSrc, MemoryUse &mem) {
+    // all planes that aren't copied from another frame are placed after each other in one allocation
+    size_t total = 0;
+    for (int i = 0; i < format->numPlanes; i++) {
+        if (planeSrc && planeSrc[i])
+            continue;
+        offset[i] = total;
+        total += getPlaneSize(i);
+    }
+
+    if (!total)
+        return;
+
+    VSPlaneDataPtr block = std::make_shared<VSPlaneData>(total, mem);
+    for (int i = 0; i < format->numPlanes; i++) {
+        if (planeSrc && planeSrc[i])
+            continue;
+        data[i] = block;
+#ifdef VS_FRAME_GUARD
+        writeGuardPattern(block->data + offset[i], getPlaneSize(i));
+#endif
+    }
+}
+
 VSFrame::VSFrame(const VSFormat *f, int width, int height, const VSFrame *propSrc, VSCore *core) : format(f), width(width), height(height) {
     if (!f || width <= 0 || height <= 0)
         vsFatal("Invalid new frame");
@@ -274,12 +410,10 @@ VSFrame::VSFrame(const VSFormat *f, int width, int height, const VSFrame *propSr
         stride[2] = 0;
     }
 
-    data[0] = std::make_shared<VSPlaneData>(stride[0] * height, *core->memory);
-    if (f->numPlanes == 3) {
-        int size23 = stride[1] * (height >> f->subSamplingH);
-        data[1] = std::make_shared<VSPlaneData>(size23, *core->memory);
-        data[2] = std::make_shared<VSPlaneData>(size23, *core->memory);
-    }
+    offset[0] = 0;
+    offset[1] = 0;
+    offset[2] = 0;
+    allocPlanes(nullptr, *core->memory);
 }
 
 VSFrame::VSFrame(const VSFormat *f, int width, int height, const VSFrame * const *planeSrc, const int *plane, const VSFrame *propSrc, VSCore *core) : format(f), width(width), height(height) {
@@ -300,6 +434,10 @@ VSFrame::VSFrame(const VSFormat *f, int width, int height, const VSFrame * const
         stride[2] = 0;
     }
 
+    offset[0] = 0;
+    offset[1] = 0;
+    offset[2] = 0;
+
     for (int i = 0; i < format->numPlanes; i++) {
         if (planeSrc[i]) {
             if (plane[i] < 0 || plane[i] >= planeSrc[i]->format->numPlanes)
@@ -307,20 +445,47 @@ VSFrame::VSFrame(const VSFormat *f, int width, int height, const VSFrame * const
             if (planeSrc[i]->getHeight(plane[i]) != getHeight(i) || planeSrc[i]->getWidth(plane[i]) != getWidth(i))
                 vsFatal("Copied plane dimensions do not match, error in frame creation");
             data[i] = planeSrc[i]->data[plane[i]];
-        } else {
-            if (i == 0) {
-                data[i] = std::make_shared<VSPlaneData>(stride[0] * height, *core->memory);
-            } else {
-                data[i] = std::make_shared<VSPlaneData>(stride[i] * (height >> f->subSamplingH), *core->memory);
-            }
+            offset[i] = planeSrc[i]->offset[plane[i]];
         }
     }
+
+    allocPlanes(planeSrc, *core->memory);
+}
+
+VSFrame::VSFrame(const VSFormat *f, int width, int height, uint8_t * const *planes, const int *strides, const std::shared_ptr<VSExternalBuffer> &external, const VSFrame *propSrc, VSCore *core) : format(f), width(width), height(height) {
+    if (!f || width <= 0 || height <= 0)
+        vsFatal("Invalid new frame");
+
+    if (propSrc)
+        properties = propSrc->properties;
+
+    for (int i = 0; i < 3; i++) {
+        stride[i] = 0;
+        offset[i] = 0;
+    }
+
+    assert(isValidExternal(f, width, planes, strides));
+
+    for (int i = 0; i < format->numPlanes; i++) {
+        stride[i] = strides[i];
+        data[i] = std::make_shared<VSPlaneData>(planes[i], static_cast<size_t>(strides[i]) * getHeight(i), external, *core->memory);
+    }
+}
+
+bool VSFrame::isValidExternal(const VSFormat *f, int width, uint8_t * const *planes, const int *strides) {
+    for (int i = 0; i < f->numPlanes; i++)
+        if (!planes[i] || reinterpret_cast<uintptr_t>(planes[i]) % alignment || strides[i] != getDefaultStride(f, width, i))
+            return false;
+    return true;
 }
 
 VSFrame::VSFrame(const VSFrame &f) {
     data[0] = f.data[0];
     data[1] = f.data[1];
     data[2] = f.data[2];
+    offset[0] = f.offset[0];
+    offset[1] = f.offset[1];
+    offset[2] = f.offset[2];
     format = f.format;
     width = f.width;
     height = f.height;
@@ -337,32 +502,50 @@ int VSFrame::getStride(int plane) const {
     return stride[plane];
 }
 
+size_t VSFrame::getFrameSize() const {
+    size_t size = 0;
+    for (int p = 0; p < format->numPlanes; p++)
+        size += stride[p] * getHeight(p);
+    return size;
+}
+
 const uint8_t *VSFrame::getReadPtr(int plane) const {
     if (plane < 0 || plane >= format->numPlanes)
         vsFatal("Invalid plane requested");
 
-    return data[plane]->data + guardSpace;
+    return data[plane]->data + offset[plane] + data[plane]->guard;
 }
 
 uint8_t *VSFrame::getWritePtr(int plane) {
     if (plane < 0 || plane >= format->numPlanes)
         vsFatal("Invalid plane requested");
 
-    // copy the plane data if this isn't the only reference
-    if (!data[plane].unique())
-        data[plane] = std::make_shared<VSPlaneData>(*data[plane].get());
+    // copy the plane data if anything besides the other planes of this frame references it,
+    // only the requested plane is copied and the others stay in the shared block
+    long localRefs = 0;
+    for (int p = 0; p < format->numPlanes; p++)
+        if (data[p] == data[plane] && (p == plane || offset[p] != offset[plane]))
+            localRefs++;
+
+    // external memory is never written to since its owner may still be using it
+    if (data[plane].use_count() > localRefs || data[plane]->isExternal()) {
+        data[plane] = std::make_shared<VSPlaneData>(*data[plane].get(), offset[plane], stride[plane] * getHeight(plane));
+        offset[plane] = 0;
+    }
 
-    return data[plane]->data + guardSpace;
+    return data[plane]->data + offset[plane] + data[plane]->guard;
 }
 
 #ifdef VS_FRAME_GUARD
 bool VSFrame::verifyGuardPattern() {
     for (int p = 0; p < format->numPlanes; p++) {
+        if (data[p]->isExternal())
+            continue;
+        const uint8_t *plane = data[p]->data + offset[p];
+        size_t size = getPlaneSize(p);
         for (size_t i = 0; i < guardSpace / sizeof(VS_FRAME_GUARD_PATTERN); i++) {
-            uint32_t p1 = reinterpret_cast<uint32_t *>(data[p]->data)[i];
-            uint32_t p2 = reinterpret_cast<uint32_t *>(data[p]->data + data[p]->size - guardSpace)[i];
-            if (reinterpret_cast<uint32_t *>(data[p]->data)[i] != VS_FRAME_GUARD_PATTERN ||
-                reinterpret_cast<uint32_t *>(data[p]->data + data[p]->size - guardSpace)[i] != VS_FRAME_GUARD_PATTERN)
+            if (reinterpret_cast<const uint32_t *>(plane)[i] != VS_FRAME_GUARD_PATTERN ||
+                reinterpret_cast<const uint32_t *>(plane + size - guardSpace)[i] != VS_FRAME_GUARD_PATTERN)
                 return false;
         }
     }
@@ -472,7 +655,7 @@ VSFunction::VSFunction(const std::string &argString, VSPublicFunction func, void
 }
 
 VSNode::VSNode(const VSMap *in, VSMap *out, const std::string &name, VSFilterInit init, VSFilterGetFrame getFrame, VSFilterFree free, VSFilterMode filterMode, int flags, void *instanceData, int apiMajor, VSCore *core) :
-instanceData(instanceData), name(name), init(init), filterGetFrame(getFrame), free(free), filterMode(filterMode), apiMajor(apiMajor), core(core), flags(flags), hasVi(false), serialFrame(-1) {
+instanceData(instanceData), name(name), init(init), filterGetFrame(getFrame), free(free), filterMode(filterMode), apiMajor(apiMajor), core(core), flags(flags), hasVi(false), serialFrame(-1), processingTime(0), producedFrames(0) {
 
     if (flags & ~(nfNoCache | nfIsCache))
         vsFatal("Filter %s specified unknown flags", name.c_str());
@@ -498,9 +681,18 @@ instanceData(instanceData), name(name), init(init), filterGetFrame(getFrame), fr
             throw VSException("Filter creation aborted, zero (unknown) and negative length clips not allowed");
         }
     }
+
+    std::lock_guard<std::mutex> lock(core->nodeLock);
+    id = core->nodeIdCounter++;
+    core->nodes.insert(this);
 }
 
 VSNode::~VSNode() {
+    {
+        std::lock_guard<std::mutex> lock(core->nodeLock);
+        core->nodes.erase(this);
+    }
+
     if (free)
         free(instanceData, core, &vsapi);
 
@@ -533,7 +725,30 @@ void VSNode::setVideoInfo(const VSVideoInfo *vi, int numOutputs) {
 }
 
 PVideoFrame VSNode::getFrameInternal(int n, int activationReason, VSFrameContext &frameCtx) {
+    bool profiling = core->isProfiling();
+    int64_t allocatedBytes = 0;
+    int64_t *prevAllocationCounter = allocationCounter;
+    int64_t startCPUTime = 0;
+    if (profiling) {
+        allocationCounter = &allocatedBytes;
+        startCPUTime = getThreadCPUTime();
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
     const VSFrameRef *r = filterGetFrame(n, activationReason, &instanceData, &frameCtx.ctx->frameContext, &frameCtx, core, &vsapi);
+    int64_t elapsedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+    processingTime += elapsedTime;
+
+    if (profiling) {
+        allocationCounter = prevAllocationCounter;
+        NodeProfile &p = profile[activationReason - arError];
+        p.wallTime += elapsedTime;
+        p.cpuTime += getThreadCPUTime() - startCPUTime;
+        p.bytes += allocatedBytes;
+        ++p.calls;
+        if (r)
+            ++p.frames;
+    }
 
 #ifdef VS_TARGET_CPU_X86
     if (!vs_isMMXStateOk())
@@ -564,6 +779,7 @@ PVideoFrame VSNode::getFrameInternal(int n, int activationReason, VSFrameContext
             vsFatal("Guard memory corrupted in frame %d returned from %s", n, name.c_str());
 #endif
 
+        ++producedFrames;
         return p;
     }
 
@@ -583,10 +799,16 @@ bool VSNode::isWorkerThread() {
     return core->threadPool->isWorkerThread();
 }
 
-void VSNode::notifyCache(bool needMemory) {
+void VSNode::getCacheInfo(CacheSizeInfo &info) {
     std::lock_guard<std::mutex> lock(serialMutex);
     CacheInstance *cache = (CacheInstance *)instanceData;
-    cache->cache.adjustSize(needMemory);
+    cache->getSizeInfo(info);
+}
+
+void VSNode::setCacheSize(int maxFrames, bool clear) {
+    std::lock_guard<std::mutex> lock(serialMutex);
+    CacheInstance *cache = (CacheInstance *)instanceData;
+    cache->setSize(maxFrames, clear);
 }
 
 PVideoFrame VSCore::newVideoFrame(const VSFormat *f, int width, int height, const VSFrame *propSrc) {
@@ -597,6 +819,12 @@ PVideoFrame VSCore::newVideoFrame(const VSFormat *f, int width, int height, cons
     return std::make_shared<VSFrame>(f, width, height, planeSrc, planes, propSrc, this);
 }
 
+PVideoFrame VSCore::newVideoFrame(const VSFormat *f, int width, int height, uint8_t * const *planes, const int *strides, VSFrameBufferFree free, void *userData, const VSFrame *propSrc) {
+    if (!VSFrame::isValidExternal(f, width, planes, strides))
+        return nullptr;
+    return std::make_shared<VSFrame>(f, width, height, planes, strides, std::make_shared<VSExternalBuffer>(free, userData), propSrc, this);
+}
+
 PVideoFrame VSCore::copyFrame(const PVideoFrame &srcf) {
     return std::make_shared<VSFrame>(*srcf.get());
 }
@@ -727,6 +955,8 @@ const VSCoreInfo &VSCore::getCoreInfo() {
     coreInfo.numThreads = threadPool->threadCount();
     coreInfo.maxFramebufferSize = memory->getLimit();
     coreInfo.usedFramebufferSize = memory->memoryUse();
+    coreInfo.framebufferPoolHits = memory->getBufferHits();
+    coreInfo.framebufferPoolMisses = memory->getBufferMisses();
     return coreInfo;
 }
 
@@ -864,6 +1094,46 @@ bool VSCore::loadAllPluginsInPath(const std::string &path, const std::string &fi
     return true;
 }
 
+void VSCore::setProfiling(bool enable) {
+    std::lock_guard<std::mutex> lock(nodeLock);
+    // start from scratch every time profiling is turned on
+    if (enable && !profiling) {
+        for (VSNode *node : nodes) {
+            for (auto &p : node->profile) {
+                p.wallTime = 0;
+                p.cpuTime = 0;
+                p.calls = 0;
+                p.frames = 0;
+                p.bytes = 0;
+            }
+        }
+    }
+    profiling = enable;
+}
+
+void VSCore::getProfile(VSMap &out) {
+    std::lock_guard<std::mutex> lock(nodeLock);
+    std::vector<VSNode *> sortedNodes(nodes.begin(), nodes.end());
+    std::sort(sortedNodes.begin(), sortedNodes.end(), [](const VSNode *a, const VSNode *b) { return a->id < b->id; });
+
+    // one entry per node and activation reason that has been called
+    for (VSNode *node : sortedNodes) {
+        for (int i = 0; i < 4; i++) {
+            const NodeProfile &p = node->profile[i];
+            if (!p.calls)
+                continue;
+            vsapi.propSetData(&out, "name", node->name.c_str(), static_cast<int>(node->name.size()), paAppend);
+            vsapi.propSetInt(&out, "id", node->id, paAppend);
+            vsapi.propSetInt(&out, "reason", i + arError, paAppend);
+            vsapi.propSetFloat(&out, "walltime", p.wallTime / 1e9, paAppend);
+            vsapi.propSetFloat(&out, "cputime", p.cpuTime / 1e9, paAppend);
+            vsapi.propSetInt(&out, "calls", p.calls, paAppend);
+            vsapi.propSetInt(&out, "frames", p.frames, paAppend);
+            vsapi.propSetInt(&out, "bytes", p.bytes, paAppend);
+        }
+    }
+}
+
 void VSCore::filterInstanceCreated() {
     ++numFilterInstances;
 }
@@ -875,7 +1145,7 @@ void VSCore::filterInstanceDestroyed() {
     }
 }
 
-VSCore::VSCore(int threads) : coreFreed(false), numFilterInstances(1), formatIdOffset(1000), memory(new MemoryUse()) {
+VSCore::VSCore(int threads) : coreFreed(false), numFilterInstances(1), formatIdOffset(1000), profiling(false), nodeIdCounter(0), memory(new MemoryUse()) {
 #ifdef VS_TARGET_CPU_X86
     if (!vs_isMMXStateOk())
         vsFatal("Bad MMX state detected when creating new core");
@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <vector>
 #include <list>
+#include <deque>
 #include <set>
 #include <map>
 #include <memory>
@@ -58,6 +59,7 @@ struct VSNode;
 class VSThreadPool;
 class FrameContext;
 class ExtFunction;
+struct CacheSizeInfo;
 
 typedef std::shared_ptr<VSFrame> PVideoFrame;
 typedef std::weak_ptr<VSFrame> WVideoFrame;
@@ -87,6 +89,112 @@ public:
     inline bool operator<(const NodeOutputKey &v) const {
         return (node < v.node) || (node == v.node && n < v.n) || (node == v.node && n == v.n && index < v.index);
     }
+    inline size_t hash() const {
+        size_t h = reinterpret_cast<uintptr_t>(node);
+        h ^= static_cast<size_t>(n) * 2654435761u + 0x9e3779b9 + (h << 6) + (h >> 2);
+        h ^= static_cast<size_t>(index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+// A context rarely waits on more than a handful of frames so a flat list with
+// linear lookup is cheaper than a tree or hash table here
+class AvailableFrames {
+private:
+    std::vector<std::pair<NodeOutputKey, PVideoFrame>> frames;
+public:
+    void insert(const NodeOutputKey &key, const PVideoFrame &frame) {
+        if (!find(key))
+            frames.push_back(std::make_pair(key, frame));
+    }
+    const PVideoFrame *find(const NodeOutputKey &key) const {
+        for (const auto &iter : frames)
+            if (iter.first == key)
+                return &iter.second;
+        return nullptr;
+    }
+    void erase(const NodeOutputKey &key) {
+        for (auto iter = frames.begin(); iter != frames.end(); ++iter) {
+            if (iter->first == key) {
+                std::swap(*iter, frames.back());
+                frames.pop_back();
+                return;
+            }
+        }
+    }
+};
+
+// The contexts the thread pool is working on, looked up for every frame request. Open
+// addressing with linear probing, erased entries are filled by shifting the following
+// ones back so lookups never have to skip over deleted slots.
+class FrameContextTable {
+private:
+    struct Entry {
+        NodeOutputKey key;
+        PFrameContext context;
+        Entry() : key(nullptr, 0, 0) {}
+    };
+    std::vector<Entry> entries;
+    size_t count;
+
+    size_t mask() const {
+        return entries.size() - 1;
+    }
+
+    size_t findIndex(const NodeOutputKey &key) const {
+        for (size_t i = key.hash() & mask();; i = (i + 1) & mask())
+            if (!entries[i].context || entries[i].key == key)
+                return i;
+    }
+
+    void grow() {
+        std::vector<Entry> old(entries.size() * 2);
+        old.swap(entries);
+        for (auto &iter : old) {
+            if (iter.context) {
+                Entry &e = entries[findIndex(iter.key)];
+                e.key = iter.key;
+                e.context = std::move(iter.context);
+            }
+        }
+    }
+public:
+    FrameContextTable() : entries(64), count(0) {}
+
+    PFrameContext *find(const NodeOutputKey &key) {
+        Entry &e = entries[findIndex(key)];
+        return e.context ? &e.context : nullptr;
+    }
+
+    // does nothing if the key is already present
+    void insert(const NodeOutputKey &key, const PFrameContext &context) {
+        // kept at most half full so probe sequences stay short
+        if ((count + 1) * 2 > entries.size())
+            grow();
+        Entry &e = entries[findIndex(key)];
+        if (e.context)
+            return;
+        e.key = key;
+        e.context = context;
+        count++;
+    }
+
+    void erase(const NodeOutputKey &key) {
+        size_t i = findIndex(key);
+        if (!entries[i].context)
+            return;
+        entries[i].context.reset();
+        count--;
+        for (size_t j = (i + 1) & mask(); entries[j].context; j = (j + 1) & mask()) {
+            // an entry can only move back if the hole isn't before the position it hashes to
+            size_t home = entries[j].key.hash() & mask();
+            if (((j - home) & mask()) >= ((j - i) & mask())) {
+                entries[i].key = entries[j].key;
+                entries[i].context = std::move(entries[j].context);
+                i = j;
+            }
+        }
+    }
 };
 
 // variant types
@@ -298,7 +406,14 @@ class MemoryUse {
 private:
     std::atomic<size_t> used;
     size_t maxMemoryUse;
-    bool freeOnZero;
+    std::atomic<bool> freeOnZero;
+    // recycled plane buffers grouped by size class, they still count as used memory
+    std::mutex bufferLock;
+    std::map<size_t, std::vector<uint8_t *>> buffers;
+    std::atomic<int64_t> bufferHits;
+    std::atomic<int64_t> bufferMisses;
+    static size_t getBufferSizeClass(size_t bytes);
+    void releaseBuffer(uint8_t *buf, size_t bytes);
 public:
     void add(size_t bytes) {
         used.fetch_add(bytes);
@@ -320,26 +435,54 @@ public:
     bool isOverLimit() {
         return used > maxMemoryUse;
     }
-    void signalFree() {
-        freeOnZero = true;
-        if (!used)
-            delete this;
+    int64_t getBufferHits() {
+        return bufferHits;
+    }
+    int64_t getBufferMisses() {
+        return bufferMisses;
     }
-    MemoryUse() : used(0), freeOnZero(false) {
+    uint8_t *allocBuffer(size_t bytes);
+    void freeBuffer(uint8_t *buf, size_t bytes);
+    void trimBuffers();
+    void signalFree();
+    MemoryUse() : used(0), freeOnZero(false), bufferHits(0), bufferMisses(0) {
         // 1GB
         maxMemoryUse = 1024*1024*1024;
     }
 };
 
+// Memory that was handed to the core with newVideoFrameExternal, the owner is
+// told to release it once no plane refers to it anymore
+class VSExternalBuffer {
+private:
+    VSFrameBufferFree freeBuffer;
+    void *userData;
+public:
+    VSExternalBuffer(VSFrameBufferFree freeBuffer, void *userData) : freeBuffer(freeBuffer), userData(userData) {}
+    VSExternalBuffer(const VSExternalBuffer &) = delete;
+    ~VSExternalBuffer() {
+        if (freeBuffer)
+            freeBuffer(userData);
+    }
+};
+
 class VSPlaneData {
 private:
     MemoryUse &mem;
+    std::shared_ptr<VSExternalBuffer> external;
 public:
     uint8_t *data;
     const size_t size;
+    // bytes before the plane starts, external memory has no guard space
+    const int guard;
     VSPlaneData(size_t dataSize, MemoryUse &mem);
-    VSPlaneData(const VSPlaneData &d);
+    VSPlaneData(const VSPlaneData &d, size_t offset, size_t dataSize);
+    VSPlaneData(uint8_t *data, size_t dataSize, const std::shared_ptr<VSExternalBuffer> &external, MemoryUse &mem);
+    VSPlaneData(const VSPlaneData &) = delete;
     ~VSPlaneData();
+    bool isExternal() const {
+        return !!external;
+    }
 };
 
 typedef std::shared_ptr<VSPlaneData> VSPlaneDataPtr;
@@ -347,13 +490,24 @@ typedef std::shared_ptr<VSPlaneData> VSPlaneDataPtr;
 class VSFrame {
 private:
     const VSFormat *format;
+    // planes allocated together share a single block, offset is where each plane's guard space starts
     VSPlaneDataPtr data[3];
+    size_t offset[3];
     int width;
     int height;
     int stride[3];
     VSMap properties;
+    size_t getPlaneSize(int plane) const {
+        return stride[plane] * getHeight(plane) + 2 * guardSpace;
+    }
+    void allocPlanes(const VSFrame * const *planeSrc, MemoryUse &mem);
 public:
     static const int alignment = 32;
+    // the stride every frame of this format and width has, planes are only shared between frames that have it
+    static int getDefaultStride(const VSFormat *f, int width, int plane) {
+        return ((width >> (plane ? f->subSamplingW : 0)) * f->bytesPerSample + (alignment - 1)) & ~(alignment - 1);
+    }
+    static bool isValidExternal(const VSFormat *f, int width, uint8_t * const *planes, const int *strides);
 #ifdef VS_FRAME_GUARD
     static const int guardSpace = alignment;
 #else
@@ -362,6 +516,7 @@ public:
 
     VSFrame(const VSFormat *f, int width, int height, const VSFrame *propSrc, VSCore *core);
     VSFrame(const VSFormat *f, int width, int height, const VSFrame * const *planeSrc, const int *plane, const VSFrame *propSrc, VSCore *core);
+    VSFrame(const VSFormat *f, int width, int height, uint8_t * const *planes, const int *strides, const std::shared_ptr<VSExternalBuffer> &external, const VSFrame *propSrc, VSCore *core);
     VSFrame(const VSFrame &f);
 
     VSMap &getProperties() {
@@ -383,6 +538,7 @@ public:
         return height >> (plane ? format->subSamplingH : 0);
     }
     int getStride(int plane) const;
+    size_t getFrameSize() const;
     const uint8_t *getReadPtr(int plane) const;
     uint8_t *getWritePtr(int plane);
 
@@ -393,9 +549,8 @@ public:
 
 class FrameContext {
     friend class VSThreadPool;
-    friend void runTasks(VSThreadPool *owner, volatile bool &stop);
 private:
-    int numFrameRequests;
+    std::atomic<int> numFrameRequests;
     int n;
     VSNode *clip;
     PVideoFrame returnedFrame;
@@ -407,7 +562,7 @@ private:
     bool error;
 public:
     VSNodeRef *node;
-    std::map<NodeOutputKey, PVideoFrame> availableFrames;
+    AvailableFrames availableFrames;
     int lastCompletedN;
     int index;
     VSNodeRef *lastCompletedNode;
@@ -424,8 +579,19 @@ public:
     FrameContext(int n, int index, VSNodeRef *node, VSFrameDoneCallback frameDone, void *userData);
 };
 
+// profiling data for one activation reason of a node
+struct NodeProfile {
+    std::atomic<int64_t> wallTime;
+    std::atomic<int64_t> cpuTime;
+    std::atomic<int64_t> calls;
+    std::atomic<int64_t> frames;
+    std::atomic<int64_t> bytes;
+    NodeProfile() : wallTime(0), cpuTime(0), calls(0), frames(0), bytes(0) {}
+};
+
 struct VSNode {
     friend class VSThreadPool;
+    friend struct VSCore;
 private:
     void *instanceData;
     std::string name;
@@ -450,6 +616,15 @@ private:
     std::mutex concurrentFramesMutex;
     std::set<int> concurrentFrames;
 
+    // time spent in the getframe function and the number of frames returned,
+    // used to estimate how expensive it is to throw away a frame from this node
+    std::atomic<int64_t> processingTime;
+    std::atomic<int64_t> producedFrames;
+
+    // only collected while profiling is enabled, indexed by activation reason - arError
+    int id;
+    NodeProfile profile[4];
+
     PVideoFrame getFrameInternal(int n, int activationReason, VSFrameContext &frameCtx);
 public:
     VSNode(const VSMap *in, VSMap *out, const std::string &name, VSFilterInit init, VSFilterGetFrame getFrame, VSFilterFree free, VSFilterMode filterMode, int flags, void *instanceData, int apiMajor, VSCore *core);
@@ -479,7 +654,15 @@ public:
     void releaseThread();
     bool isWorkerThread();
 
-    void notifyCache(bool needMemory);
+    // average nanoseconds spent per returned frame, 0 if nothing has been returned yet
+    int64_t getFrameCost() const {
+        int64_t frames = producedFrames;
+        return frames ? processingTime / frames : 0;
+    }
+
+    // only for cache nodes, the serial lock keeps the cache from being used while it's inspected or resized
+    void getCacheInfo(CacheSizeInfo &info);
+    void setCacheSize(int maxFrames, bool clear);
 };
 
 struct VSFrameContext {
@@ -491,13 +674,48 @@ struct VSFrameContext {
 class VSThreadPool {
     friend struct VSCore;
 private:
+    // every worker thread owns one of these, new tasks created by a worker go into its own queue
+    // and idle workers steal from the others so no global lock is needed to find work
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<PFrameContext> tasks;
+        size_t index;
+        WorkQueue(size_t index) : index(index) {}
+    };
+
+    // independent pieces of work split off from a single getframe call, the thread that
+    // started the batch runs them too so the batch always completes even if no worker is idle
+    struct SubTaskBatch {
+        VSParallelTask func;
+        void *userData;
+        int count;
+        std::atomic<int> next;
+        std::atomic<int> remaining;
+        std::mutex doneLock;
+        std::condition_variable done;
+        SubTaskBatch(VSParallelTask func, void *userData, int count) : func(func), userData(userData), count(count), next(0), remaining(count) {}
+    };
+
     VSCore *core;
+    // protects allContexts and allThreads
     std::mutex lock;
+    // only used to put idle threads to sleep and wake them up again
+    std::mutex idleLock;
     std::mutex callbackLock;
     std::map<std::thread::id, std::thread *> allThreads;
-    std::list<PFrameContext> tasks;
-    std::map<NodeOutputKey, PFrameContext> allContexts;
+    // tasks started from outside the worker threads
+    WorkQueue sharedQueue;
+    std::vector<WorkQueue *> ownedQueues;
+    // the queue list can only grow, readers use the most recently published copy without locking
+    std::vector<std::vector<WorkQueue *> *> queueLists;
+    std::atomic<std::vector<WorkQueue *> *> workerQueues;
+    FrameContextTable allContexts;
+    std::mutex subTaskLock;
+    std::deque<SubTaskBatch *> subTasks;
+    // lets workers skip the lock when there are no batches
+    std::atomic<unsigned> pendingBatches;
     std::condition_variable newWork;
+    std::atomic<unsigned> workEpoch;
     std::atomic<unsigned> activeThreads;
     std::atomic<unsigned> idleThreads;
     unsigned maxThreads;
@@ -505,9 +723,13 @@ private:
     std::atomic<unsigned> ticks;
     void wakeThread();
     void notifyCaches(bool needMemory);
-    void startInternal(const PFrameContext &context);
+    void startInternal(const PFrameContext &context, WorkQueue *queue);
     void spawnThread();
-    static void runTasks(VSThreadPool *owner, std::atomic<bool> &stop);
+    bool tryTakeTask(WorkQueue *queue, PFrameContext &task, VSActivationReason &ar, bool &skipCall, int &remainingRequests, bool &parallelRequestsNeedsUnlock);
+    bool runTask(WorkQueue *queue);
+    bool runSubTask();
+    static void runBatchItem(SubTaskBatch *batch, int index);
+    static void runTasks(VSThreadPool *owner, WorkQueue *queue, std::atomic<bool> &stop);
 public:
     VSThreadPool(VSCore *core, int threads);
     ~VSThreadPool();
@@ -517,6 +739,7 @@ public:
     int threadCount() const;
     void setThreadCount(int threads);
     void start(const PFrameContext &context);
+    void parallelFor(int count, VSParallelTask func, void *userData);
     void waitForDone();
     void releaseThread();
     void reserveThread();
@@ -589,6 +812,10 @@ private:
     VSCoreInfo coreInfo;
     std::set<VSNode *> caches;
     std::mutex cacheLock;
+    std::atomic<bool> profiling;
+    int nodeIdCounter;
+    std::set<VSNode *> nodes;
+    std::mutex nodeLock;
 
     ~VSCore();
 
@@ -604,6 +831,7 @@ public:
 
     PVideoFrame newVideoFrame(const VSFormat *f, int width, int height, const VSFrame *propSrc);
     PVideoFrame newVideoFrame(const VSFormat *f, int width, int height, const VSFrame * const *planeSrc, const int *planes, const VSFrame *propSrc);
+    PVideoFrame newVideoFrame(const VSFormat *f, int width, int height, uint8_t * const *planes, const int *strides, VSFrameBufferFree free, void *userData, const VSFrame *propSrc);
     PVideoFrame copyFrame(const PVideoFrame &srcf);
     void copyFrameProps(const PVideoFrame &src, PVideoFrame &dst);
 
@@ -624,6 +852,12 @@ public:
     void filterInstanceCreated();
     void filterInstanceDestroyed();
 
+    bool isProfiling() const {
+        return profiling;
+    }
+    void setProfiling(bool enable);
+    void getProfile(VSMap &out);
+
     VSCore(int threads);
     void freeCore();
 };
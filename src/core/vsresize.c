@@ -19,6 +19,13 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef VS_TARGET_OS_WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 #ifdef _MSC_VER
 #define inline _inline
 #endif
@@ -28,6 +35,10 @@
 #include "vsresize.h"
 #include "VSHelper.h"
 #include "filtershared.h"
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "cpufeatures.h"
+#endif
 
 static enum PixelFormat formatIdToPixelFormat(int id) {
     switch (id) {
@@ -130,17 +141,655 @@ static enum AVColorSpace GetAssumedColorSpace(int W, int H) {
         return AVCOL_SPC_BT470BG;
 }
 
+//////////////////////////////////////////
+// Native resampler
+
+// Used instead of swscale when only the dimensions change. Every plane is resampled
+// separately with a horizontal and a vertical pass, the intermediate result is stored
+// with the same sample type as the input except for half precision which is worked
+// on as single precision. Sample positions are center aligned and edge pixels are
+// repeated.
+
+typedef enum {
+    rkNone,
+    rkPoint,
+    rkBilinear,
+    rkBicubic,
+    rkLanczos,
+    rkSpline36
+} ResizeKernel;
+
+static double kernelSupport(ResizeKernel kernel) {
+    switch (kernel) {
+    case rkPoint:
+        return 0.5;
+    case rkBilinear:
+        return 1.0;
+    case rkBicubic:
+        return 2.0;
+    default:
+        return 3.0;
+    }
+}
+
+static double sinc(double x) {
+    if (x == 0.0)
+        return 1.0;
+    x *= 3.14159265358979323846;
+    return sin(x) / x;
+}
+
+static double kernelWeight(ResizeKernel kernel, double x) {
+    x = fabs(x);
+
+    switch (kernel) {
+    case rkPoint:
+        return 1.0;
+    case rkBilinear:
+        return VSMAX(1.0 - x, 0.0);
+    case rkBicubic: {
+        // same parameters as swscale's bicubic, b = 0 and c = 0.6
+        const double b = 0.0;
+        const double c = 0.6;
+        if (x < 1.0)
+            return ((12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x + (6.0 - 2.0 * b)) / 6.0;
+        else if (x < 2.0)
+            return ((-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x + (-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c)) / 6.0;
+        return 0.0;
+    }
+    case rkLanczos:
+        return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    case rkSpline36:
+        if (x < 1.0)
+            return ((13.0 / 11.0 * x - 453.0 / 209.0) * x - 3.0 / 209.0) * x + 1.0;
+        x -= 1.0;
+        if (x < 1.0)
+            return ((-6.0 / 11.0 * x + 270.0 / 209.0) * x - 156.0 / 209.0) * x;
+        x -= 1.0;
+        if (x < 1.0)
+            return ((1.0 / 11.0 * x - 45.0 / 209.0) * x + 26.0 / 209.0) * x;
+        return 0.0;
+    default:
+        return 0.0;
+    }
+}
+
+static void freeResampleFilter(ResampleFilter *f) {
+    free(f->left);
+    VS_ALIGNED_FREE(f->coeffsInt);
+    VS_ALIGNED_FREE(f->coeffsFloat);
+}
+
+static int isIdentityFilter(int srcSize, int dstSize, double shift, double width) {
+    return srcSize == dstSize && shift == 0.0 && width == srcSize;
+}
+
+// shift and width describe the source window in input samples, returns 0 on failure
+static int buildResampleFilter(ResampleFilter *f, ResizeKernel kernel, int srcSize, int dstSize, double shift, double width) {
+    double step = width / dstSize;
+    // filters are stretched when downscaling so all input samples contribute, point resizing always picks the nearest sample
+    double filterScale = (kernel == rkPoint || step <= 1.0) ? 1.0 : 1.0 / step;
+    double radius = kernelSupport(kernel) / filterScale;
+    int fullWidth = (kernel == rkPoint) ? 1 : (int)ceil(radius * 2.0);
+    double *weights;
+    int i;
+
+    f->srcSize = srcSize;
+    f->dstSize = dstSize;
+    f->filterWidth = VSMIN(fullWidth, srcSize);
+    f->coeffStride = (f->filterWidth + 7) & ~7;
+    f->left = malloc(dstSize * sizeof(int));
+    VS_ALIGNED_MALLOC((void **)&f->coeffsInt, dstSize * f->coeffStride * sizeof(int16_t), 16);
+    VS_ALIGNED_MALLOC((void **)&f->coeffsFloat, dstSize * f->coeffStride * sizeof(float), 16);
+    weights = malloc(f->filterWidth * sizeof(double));
+
+    if (!f->left || !f->coeffsInt || !f->coeffsFloat || !weights) {
+        free(weights);
+        freeResampleFilter(f);
+        return 0;
+    }
+
+    memset(f->coeffsInt, 0, dstSize * f->coeffStride * sizeof(int16_t));
+    memset(f->coeffsFloat, 0, dstSize * f->coeffStride * sizeof(float));
+
+    for (i = 0; i < dstSize; i++) {
+        double center = shift + (i + 0.5) * step;
+        int first = (kernel == rkPoint) ? (int)floor(center) : (int)floor(center - radius - 0.5) + 1;
+        int left = VSMAX(VSMIN(first, srcSize - f->filterWidth), 0);
+        int16_t *coeffsInt = f->coeffsInt + i * f->coeffStride;
+        float *coeffsFloat = f->coeffsFloat + i * f->coeffStride;
+        double total = 0.0;
+        int intTotal = 0;
+        int largest = 0;
+        int k;
+
+        for (k = 0; k < f->filterWidth; k++)
+            weights[k] = 0.0;
+
+        // taps outside the source are folded into the edge samples
+        for (k = 0; k < fullWidth; k++) {
+            int pos = first + k;
+            double w = kernelWeight(kernel, (pos + 0.5 - center) * filterScale);
+            weights[VSMAX(VSMIN(pos, srcSize - 1), 0) - left] += w;
+            total += w;
+        }
+
+        for (k = 0; k < f->filterWidth; k++) {
+            double w = weights[k] / total;
+            coeffsFloat[k] = (float)w;
+            coeffsInt[k] = (int16_t)floor(w * (1 << RESAMPLE_INT_BITS) + 0.5);
+            intTotal += coeffsInt[k];
+            if (abs(coeffsInt[k]) > abs(coeffsInt[largest]))
+                largest = k;
+        }
+
+        // make sure flat areas stay exactly the same after rounding
+        coeffsInt[largest] += (1 << RESAMPLE_INT_BITS) - intTotal;
+        f->left[i] = left;
+    }
+
+    free(weights);
+    return 1;
+}
+
+static inline uint32_t bit_cast_uint32(float v) {
+    uint32_t ret;
+    memcpy(&ret, &v, sizeof(ret));
+    return ret;
+}
+
+static inline float bit_cast_float(uint32_t v) {
+    float ret;
+    memcpy(&ret, &v, sizeof(ret));
+    return ret;
+}
+
+static inline float halfToFloat(uint16_t x) {
+    const uint32_t shiftedExp = 0x7C00 << 13;
+    uint32_t f = (x & 0x7FFF) << 13;
+    uint32_t exp = f & shiftedExp;
+
+    f += (127 - 15) << 23;
+    if (exp == shiftedExp) {
+        // inf and nan
+        f += (128 - 16) << 23;
+    } else if (!exp) {
+        // denormals
+        f += 1 << 23;
+        f = bit_cast_uint32(bit_cast_float(f) - bit_cast_float(113 << 23));
+    }
+
+    return bit_cast_float(f | ((uint32_t)(x & 0x8000) << 16));
+}
+
+// the same conversion as BlankClip uses
+static inline uint16_t floatToHalf(float x) {
+    float magic = bit_cast_float((uint32_t)15 << 23);
+    uint32_t inf = 255UL << 23;
+    uint32_t f16inf = 31UL << 23;
+    uint32_t sign_mask = 0x80000000UL;
+    uint32_t round_mask = ~0x0FFFU;
+    uint16_t ret;
+    uint32_t f = bit_cast_uint32(x);
+    uint32_t sign = f & sign_mask;
+    f ^= sign;
+
+    if (f >= inf) {
+        ret = f > inf ? 0x7E00 : 0x7C00;
+    } else {
+        f &= round_mask;
+        f = bit_cast_uint32(bit_cast_float(f) * magic);
+        f -= round_mask;
+
+        if (f > f16inf)
+            f = f16inf;
+
+        ret = (uint16_t)(f >> 13);
+    }
+
+    ret |= (uint16_t)(sign >> 16);
+    return ret;
+}
+
+// integer samples are stored with an offset of 0x8000 when 16 bits wide so they fit in int16_t for the multiplication
+
+static void resampleLineInt(const int16_t *line, int offset, int maxValue, int bytesPerSample, void *dstp, const ResampleFilter *f, int avx2) {
+    const int round = 1 << (RESAMPLE_INT_BITS - 1);
+    int x = 0;
+
+#ifdef VS_TARGET_CPU_X86
+    const __m128i vround = _mm_set1_epi32(round + (offset << RESAMPLE_INT_BITS));
+
+    if (avx2)
+        x = vs_resample_line_int_avx2(line, offset, maxValue, bytesPerSample, dstp, f);
+
+    for (; x + 4 <= f->dstSize; x += 4) {
+        __m128i acc[4];
+        __m128i t0, t1, sum;
+        int i, k;
+
+        for (i = 0; i < 4; i++) {
+            const int16_t *src = line + f->left[x + i];
+            const int16_t *coeffs = f->coeffsInt + (x + i) * f->coeffStride;
+            acc[i] = _mm_setzero_si128();
+            for (k = 0; k < f->coeffStride; k += 8)
+                acc[i] = _mm_add_epi32(acc[i], _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(src + k)), _mm_load_si128((const __m128i *)(coeffs + k))));
+        }
+
+        t0 = _mm_add_epi32(_mm_unpacklo_epi32(acc[0], acc[1]), _mm_unpackhi_epi32(acc[0], acc[1]));
+        t1 = _mm_add_epi32(_mm_unpacklo_epi32(acc[2], acc[3]), _mm_unpackhi_epi32(acc[2], acc[3]));
+        sum = _mm_add_epi32(_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1));
+        sum = _mm_srai_epi32(_mm_add_epi32(sum, vround), RESAMPLE_INT_BITS);
+
+        {
+            int32_t result[4];
+            _mm_storeu_si128((__m128i *)result, sum);
+            for (i = 0; i < 4; i++) {
+                int v = VSMAX(VSMIN(result[i], maxValue), 0);
+                if (bytesPerSample == 1)
+                    ((uint8_t *)dstp)[x + i] = (uint8_t)v;
+                else
+                    ((uint16_t *)dstp)[x + i] = (uint16_t)v;
+            }
+        }
+    }
+#endif
+
+    for (; x < f->dstSize; x++) {
+        const int16_t *src = line + f->left[x];
+        const int16_t *coeffs = f->coeffsInt + x * f->coeffStride;
+        int sum = 0;
+        int k;
+        for (k = 0; k < f->filterWidth; k++)
+            sum += src[k] * coeffs[k];
+        sum = ((sum + round) >> RESAMPLE_INT_BITS) + offset;
+        sum = VSMAX(VSMIN(sum, maxValue), 0);
+        if (bytesPerSample == 1)
+            ((uint8_t *)dstp)[x] = (uint8_t)sum;
+        else
+            ((uint16_t *)dstp)[x] = (uint16_t)sum;
+    }
+}
+
+static void resampleLineFloat(const float *line, float *dstp, const ResampleFilter *f, int avx2) {
+    int x = 0;
+
+#ifdef VS_TARGET_CPU_X86
+    if (avx2)
+        x = vs_resample_line_float_avx2(line, dstp, f);
+
+    for (; x + 4 <= f->dstSize; x += 4) {
+        __m128 acc[4];
+        __m128 t0, t1;
+        int i, k;
+
+        for (i = 0; i < 4; i++) {
+            const float *src = line + f->left[x + i];
+            const float *coeffs = f->coeffsFloat + (x + i) * f->coeffStride;
+            acc[i] = _mm_setzero_ps();
+            for (k = 0; k < f->coeffStride; k += 4)
+                acc[i] = _mm_add_ps(acc[i], _mm_mul_ps(_mm_loadu_ps(src + k), _mm_load_ps(coeffs + k)));
+        }
+
+        t0 = _mm_add_ps(_mm_unpacklo_ps(acc[0], acc[1]), _mm_unpackhi_ps(acc[0], acc[1]));
+        t1 = _mm_add_ps(_mm_unpacklo_ps(acc[2], acc[3]), _mm_unpackhi_ps(acc[2], acc[3]));
+        _mm_storeu_ps(dstp + x, _mm_add_ps(_mm_movelh_ps(t0, t1), _mm_movehl_ps(t1, t0)));
+    }
+#endif
+
+    for (; x < f->dstSize; x++) {
+        const float *src = line + f->left[x];
+        const float *coeffs = f->coeffsFloat + x * f->coeffStride;
+        float sum = 0.f;
+        int k;
+        for (k = 0; k < f->filterWidth; k++)
+            sum += src[k] * coeffs[k];
+        dstp[x] = sum;
+    }
+}
+
+// line has to have room for srcSize + coeffStride samples and row for dstSize samples,
+// half precision output is written as single precision when toFloat is set
+static void resampleHorizontal(const uint8_t *srcp, int srcStride, uint8_t *dstp, int dstStride, int height, const VSFormat *fi, int toFloat, void *line, float *row, const ResampleFilter *f, int avx2) {
+    int y, x;
+
+    if (fi->sampleType == stFloat) {
+        float *fline = (float *)line;
+        int half = fi->bytesPerSample == 2;
+        memset(fline + f->srcSize, 0, f->coeffStride * sizeof(float));
+        for (y = 0; y < height; y++) {
+            if (half) {
+                for (x = 0; x < f->srcSize; x++)
+                    fline[x] = halfToFloat(((const uint16_t *)srcp)[x]);
+            } else {
+                memcpy(fline, srcp, f->srcSize * sizeof(float));
+            }
+            if (half && !toFloat) {
+                resampleLineFloat(fline, row, f, avx2);
+                for (x = 0; x < f->dstSize; x++)
+                    ((uint16_t *)dstp)[x] = floatToHalf(row[x]);
+            } else {
+                resampleLineFloat(fline, (float *)dstp, f, avx2);
+            }
+            srcp += srcStride;
+            dstp += dstStride;
+        }
+    } else {
+        int16_t *iline = (int16_t *)line;
+        int offset = (fi->bytesPerSample == 2) ? 0x8000 : 0;
+        int maxValue = (1 << fi->bitsPerSample) - 1;
+        memset(iline + f->srcSize, 0, f->coeffStride * sizeof(int16_t));
+        for (y = 0; y < height; y++) {
+            if (fi->bytesPerSample == 1) {
+                for (x = 0; x < f->srcSize; x++)
+                    iline[x] = srcp[x];
+            } else {
+                for (x = 0; x < f->srcSize; x++)
+                    iline[x] = (int16_t)(((const uint16_t *)srcp)[x] - 0x8000);
+            }
+            resampleLineInt(iline, offset, maxValue, fi->bytesPerSample, dstp, f, avx2);
+            srcp += srcStride;
+            dstp += dstStride;
+        }
+    }
+}
+
+// relies on the frame strides being padded to at least 32 bytes, half precision input has
+// to be converted to single precision first and the output goes through row
+static void resampleVertical(const uint8_t *srcp, int srcStride, uint8_t *dstp, int dstStride, int width, const VSFormat *fi, float *row, const ResampleFilter *f, int avx2) {
+    const int round = 1 << (RESAMPLE_INT_BITS - 1);
+    int maxValue = (1 << fi->bitsPerSample) - 1;
+    int y, x, k;
+
+    for (y = 0; y < f->dstSize; y++) {
+        const uint8_t *src = srcp + f->left[y] * srcStride;
+        const int16_t *coeffsInt = f->coeffsInt + y * f->coeffStride;
+        const float *coeffsFloat = f->coeffsFloat + y * f->coeffStride;
+        x = 0;
+
+        if (fi->sampleType == stFloat) {
+            int half = fi->bytesPerSample == 2;
+            float *dst = half ? row : (float *)dstp;
+#ifdef VS_TARGET_CPU_X86
+            if (avx2) {
+                vs_resample_vertical_float_avx2(src, srcStride, dst, width, coeffsFloat, f->filterWidth);
+                x = width;
+            }
+            for (; x < width; x += 4) {
+                __m128 acc = _mm_setzero_ps();
+                for (k = 0; k < f->filterWidth; k++)
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps((const float *)(src + k * srcStride) + x), _mm_set1_ps(coeffsFloat[k])));
+                _mm_store_ps(dst + x, acc);
+            }
+#endif
+            for (; x < width; x++) {
+                float sum = 0.f;
+                for (k = 0; k < f->filterWidth; k++)
+                    sum += ((const float *)(src + k * srcStride))[x] * coeffsFloat[k];
+                dst[x] = sum;
+            }
+            if (half) {
+                for (x = 0; x < width; x++)
+                    ((uint16_t *)dstp)[x] = floatToHalf(row[x]);
+            }
+        } else {
+            int offset = (fi->bytesPerSample == 2) ? 0x8000 : 0;
+#ifdef VS_TARGET_CPU_X86
+            const __m128i vround = _mm_set1_epi32(round);
+            const __m128i sign = _mm_set1_epi16((short)offset);
+            const __m128i vmax = _mm_set1_epi16((short)maxValue);
+            if (avx2) {
+                vs_resample_vertical_int_avx2(src, srcStride, dstp, width, fi->bytesPerSample, maxValue, coeffsInt, f->filterWidth);
+                x = width;
+            }
+            for (; x < width; x += 8) {
+                __m128i lo = _mm_setzero_si128();
+                __m128i hi = _mm_setzero_si128();
+                __m128i res;
+                for (k = 0; k < f->filterWidth; k += 2) {
+                    const uint8_t *row0 = src + k * srcStride;
+                    const uint8_t *row1 = (k + 1 < f->filterWidth) ? row0 + srcStride : row0;
+                    __m128i c = _mm_set1_epi32((int)((uint16_t)coeffsInt[k] | ((uint32_t)(uint16_t)coeffsInt[k + 1] << 16)));
+                    __m128i a, b;
+                    if (fi->bytesPerSample == 1) {
+                        a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row0 + x)), _mm_setzero_si128());
+                        b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row1 + x)), _mm_setzero_si128());
+                    } else {
+                        a = _mm_xor_si128(_mm_load_si128((const __m128i *)(row0 + x * 2)), sign);
+                        b = _mm_xor_si128(_mm_load_si128((const __m128i *)(row1 + x * 2)), sign);
+                    }
+                    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+                    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+                }
+                lo = _mm_srai_epi32(_mm_add_epi32(lo, vround), RESAMPLE_INT_BITS);
+                hi = _mm_srai_epi32(_mm_add_epi32(hi, vround), RESAMPLE_INT_BITS);
+                res = _mm_packs_epi32(lo, hi);
+                if (fi->bytesPerSample == 1) {
+                    _mm_storel_epi64((__m128i *)(dstp + x), _mm_packus_epi16(res, res));
+                } else {
+                    // still offset by 0x8000 so the signed saturation clamps to the 16 bit range
+                    res = _mm_xor_si128(res, sign);
+                    res = _mm_sub_epi16(res, _mm_subs_epu16(res, vmax));
+                    _mm_store_si128((__m128i *)(dstp + x * 2), res);
+                }
+            }
+#endif
+            for (; x < width; x++) {
+                int sum = 0;
+                for (k = 0; k < f->filterWidth; k++) {
+                    const uint8_t *row = src + k * srcStride;
+                    int v = (fi->bytesPerSample == 1) ? row[x] : ((const uint16_t *)row)[x] - offset;
+                    sum += v * coeffsInt[k];
+                }
+                sum = ((sum + round) >> RESAMPLE_INT_BITS) + offset;
+                sum = VSMAX(VSMIN(sum, maxValue), 0);
+                if (fi->bytesPerSample == 1)
+                    dstp[x] = (uint8_t)sum;
+                else
+                    ((uint16_t *)dstp)[x] = (uint16_t)sum;
+            }
+        }
+
+        dstp += dstStride;
+    }
+}
+
+//////////////////////////////////////////
+// Resize
+
+#ifdef VS_TARGET_OS_WINDOWS
+typedef CRITICAL_SECTION ResizeMutex;
+#define resizeMutexInit(m) InitializeCriticalSection(m)
+#define resizeMutexDestroy(m) DeleteCriticalSection(m)
+#define resizeMutexLock(m) EnterCriticalSection(m)
+#define resizeMutexUnlock(m) LeaveCriticalSection(m)
+#else
+typedef pthread_mutex_t ResizeMutex;
+#define resizeMutexInit(m) pthread_mutex_init(m, 0)
+#define resizeMutexDestroy(m) pthread_mutex_destroy(m)
+#define resizeMutexLock(m) pthread_mutex_lock(m)
+#define resizeMutexUnlock(m) pthread_mutex_unlock(m)
+#endif
+
+// a scaler context can only be used by one thread at a time so every frame being
+// resized takes one out of the idle list and puts it back when done
+typedef struct ResizeContext {
+    // either an swscale context or filters for the native resampler, a filter
+    // without coefficients means the plane isn't resampled in that direction
+    struct SwsContext *context;
+    ResampleFilter horizontal[3];
+    ResampleFilter vertical[3];
+    uint8_t *tmp;
+    int tmpStride;
+    void *line;
+    float *row;
+    const VSFormat *srcformat;
+    int srcw;
+    int srch;
+    struct ResizeContext *next;
+} ResizeContext;
+
 typedef struct {
     VSNodeRef *node;
     VSVideoInfo vi;
-    struct SwsContext *context;
-    const VSFormat *lsrcformat;
-    int lsrcw;
-    int lsrch;
+    // idle contexts, most recently used first
+    ResizeContext *contexts;
+    // at most one idle context per thread is kept, read at creation since getCoreInfo() isn't thread safe
+    int maxIdle;
+    ResizeMutex contextLock;
+    ResizeKernel kernel;
+    // source window in luma samples, width and height are 0 when not set
+    double srcLeft;
+    double srcTop;
+    double srcWidth;
+    double srcHeight;
     int dstrange;
     int flags;
+    int avx2;
 } ResizeData;
 
+static void freeResizeContexts(ResizeContext *ctx) {
+    while (ctx) {
+        ResizeContext *next = ctx->next;
+        int plane;
+        if (ctx->context)
+            sws_freeContext(ctx->context);
+        for (plane = 0; plane < 3; plane++) {
+            freeResampleFilter(&ctx->horizontal[plane]);
+            freeResampleFilter(&ctx->vertical[plane]);
+        }
+        VS_ALIGNED_FREE(ctx->tmp);
+        VS_ALIGNED_FREE(ctx->line);
+        VS_ALIGNED_FREE(ctx->row);
+        free(ctx);
+        ctx = next;
+    }
+}
+
+static int hasSourceWindow(const ResizeData *d) {
+    return d->srcLeft != 0.0 || d->srcTop != 0.0 || d->srcWidth > 0.0 || d->srcHeight > 0.0;
+}
+
+static int isNativeFormat(const VSFormat *fi) {
+    return fi->colorFamily != cmCompat && ((fi->sampleType == stInteger && fi->bytesPerSample <= 2) || fi->sampleType == stFloat);
+}
+
+// the native resampler is used when only the dimensions change
+static int canResampleNatively(const ResizeData *d, const VSFormat *fi) {
+    return d->kernel != rkNone && fi == d->vi.format && isNativeFormat(fi);
+}
+
+static int initNativeContext(ResizeContext *ctx, const ResizeData *d, const VSFormat *fi, int w, int h) {
+    double srcWidth = d->srcWidth > 0.0 ? d->srcWidth : w;
+    double srcHeight = d->srcHeight > 0.0 ? d->srcHeight : h;
+    size_t lineSize = 0;
+    int plane;
+
+    for (plane = 0; plane < fi->numPlanes; plane++) {
+        int ssw = plane ? fi->subSamplingW : 0;
+        int ssh = plane ? fi->subSamplingH : 0;
+        int sw = w >> ssw;
+        int sh = h >> ssh;
+        int dw = d->vi.width >> ssw;
+        int dh = d->vi.height >> ssh;
+        double left = d->srcLeft / (1 << ssw);
+        double top = d->srcTop / (1 << ssh);
+        double width = srcWidth / (1 << ssw);
+        double height = srcHeight / (1 << ssh);
+
+        if (!isIdentityFilter(sw, dw, left, width)) {
+            if (!buildResampleFilter(&ctx->horizontal[plane], d->kernel, sw, dw, left, width))
+                return 0;
+            lineSize = VSMAX(lineSize, (size_t)(sw + ctx->horizontal[plane].coeffStride));
+        }
+
+        if (!isIdentityFilter(sh, dh, top, height)) {
+            if (!buildResampleFilter(&ctx->vertical[plane], d->kernel, sh, dh, top, height))
+                return 0;
+        }
+    }
+
+    // the first plane is always the largest one
+    ctx->tmpStride = (d->vi.width * (fi->sampleType == stFloat ? (int)sizeof(float) : fi->bytesPerSample) + 31) & ~31;
+    VS_ALIGNED_MALLOC((void **)&ctx->tmp, (size_t)ctx->tmpStride * h, 32);
+    VS_ALIGNED_MALLOC((void **)&ctx->line, lineSize * sizeof(float) + 16, 32);
+    // only used for half precision, where tmpStride already holds a row of floats
+    VS_ALIGNED_MALLOC((void **)&ctx->row, ctx->tmpStride, 32);
+    return ctx->tmp && ctx->line && ctx->row;
+}
+
+static void halfToFloatPlane(const uint8_t *srcp, int srcStride, uint8_t *dstp, int dstStride, int width, int height) {
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            ((float *)dstp)[x] = halfToFloat(((const uint16_t *)srcp)[x]);
+        srcp += srcStride;
+        dstp += dstStride;
+    }
+}
+
+static void resampleFrame(const ResizeContext *ctx, const VSFrameRef *src, VSFrameRef *dst, const VSFormat *fi, int avx2, const VSAPI *vsapi) {
+    int half = fi->sampleType == stFloat && fi->bytesPerSample == 2;
+    int plane;
+
+    for (plane = 0; plane < fi->numPlanes; plane++) {
+        const ResampleFilter *h = &ctx->horizontal[plane];
+        const ResampleFilter *v = &ctx->vertical[plane];
+        const uint8_t *srcp = vsapi->getReadPtr(src, plane);
+        int srcStride = vsapi->getStride(src, plane);
+        uint8_t *dstp = vsapi->getWritePtr(dst, plane);
+        int dstStride = vsapi->getStride(dst, plane);
+
+        if (h->left && v->left) {
+            resampleHorizontal(srcp, srcStride, ctx->tmp, ctx->tmpStride, vsapi->getFrameHeight(src, plane), fi, 1, ctx->line, ctx->row, h, avx2);
+            resampleVertical(ctx->tmp, ctx->tmpStride, dstp, dstStride, vsapi->getFrameWidth(dst, plane), fi, ctx->row, v, avx2);
+        } else if (h->left) {
+            resampleHorizontal(srcp, srcStride, dstp, dstStride, vsapi->getFrameHeight(dst, plane), fi, 0, ctx->line, ctx->row, h, avx2);
+        } else if (v->left && half) {
+            halfToFloatPlane(srcp, srcStride, ctx->tmp, ctx->tmpStride, vsapi->getFrameWidth(src, plane), vsapi->getFrameHeight(src, plane));
+            resampleVertical(ctx->tmp, ctx->tmpStride, dstp, dstStride, vsapi->getFrameWidth(dst, plane), fi, ctx->row, v, avx2);
+        } else if (v->left) {
+            resampleVertical(srcp, srcStride, dstp, dstStride, vsapi->getFrameWidth(dst, plane), fi, ctx->row, v, avx2);
+        } else {
+            vs_bitblt(dstp, dstStride, srcp, srcStride, vsapi->getFrameWidth(dst, plane) * fi->bytesPerSample, vsapi->getFrameHeight(dst, plane));
+        }
+    }
+}
+
+static ResizeContext *takeResizeContext(ResizeData *d, const VSFormat *fi, int w, int h) {
+    ResizeContext **prev;
+    ResizeContext *ctx;
+
+    resizeMutexLock(&d->contextLock);
+    for (prev = &d->contexts; (ctx = *prev); prev = &ctx->next) {
+        if (ctx->srcformat == fi && ctx->srcw == w && ctx->srch == h) {
+            *prev = ctx->next;
+            break;
+        }
+    }
+    resizeMutexUnlock(&d->contextLock);
+
+    return ctx;
+}
+
+// keeps at most maxIdle contexts around, the least recently used ones are freed first
+static void returnResizeContext(ResizeData *d, ResizeContext *ctx, int maxIdle) {
+    ResizeContext *excess = 0;
+    int i;
+
+    resizeMutexLock(&d->contextLock);
+    ctx->next = d->contexts;
+    d->contexts = ctx;
+    for (i = 1; ctx->next && i < maxIdle; i++)
+        ctx = ctx->next;
+    excess = ctx->next;
+    ctx->next = 0;
+    resizeMutexUnlock(&d->contextLock);
+
+    freeResizeContexts(excess);
+}
+
 static void VS_CC resizeInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
     ResizeData *d = (ResizeData *) * instanceData;
     vsapi->setVideoInfo(&d->vi, 1, node);
@@ -169,35 +818,68 @@ static const VSFrameRef *VS_CC resizeGetframe(int n, int activationReason, void
         // flip output on compat rgb
         int flip_src;
         int flip_dst;
+        ResizeContext *ctx = takeResizeContext(d, fi, w, h);
 
-        if (!d->context || d->lsrcformat != fi || d->lsrcw != w || d->lsrch != h) {
+        if (!ctx) {
             int srcid = formatIdToPixelFormat(fi->id);
+            int native = canResampleNatively(d, fi);
 
-            if (srcid == PIX_FMT_NONE) {
+            if (!native && srcid == PIX_FMT_NONE) {
                 vsapi->freeFrame(src);
                 vsapi->freeFrame(dst);
                 vsapi->setFilterError("Resize: input format not supported", frameCtx);
                 return 0;
             }
 
-            if (d->context)
-                sws_freeContext(d->context);
+            if (!native && hasSourceWindow(d)) {
+                vsapi->freeFrame(src);
+                vsapi->freeFrame(dst);
+                vsapi->setFilterError("Resize: source cropping is only supported when the format doesn't change", frameCtx);
+                return 0;
+            }
 
-            d->context = getSwsContext(
-                             w, h, srcid, GetAssumedColorSpace(w, h), AVCOL_RANGE_UNSPECIFIED,
-                             d->vi.width, d->vi.height, formatIdToPixelFormat(d->vi.format->id), GetAssumedColorSpace(d->vi.width, d->vi.height), AVCOL_RANGE_UNSPECIFIED,
-                             d->flags);
+            ctx = calloc(1, sizeof(ResizeContext));
 
-            if (!d->context) {
+            if (!ctx) {
                 vsapi->freeFrame(src);
                 vsapi->freeFrame(dst);
-                vsapi->setFilterError("Resize: context creation failed", frameCtx);
+                vsapi->setFilterError("Resize: failed to allocate context", frameCtx);
                 return 0;
             }
 
-            d->lsrcformat = fi;
-            d->lsrcw = w;
-            d->lsrch = h;
+            if (native) {
+                if (!initNativeContext(ctx, d, fi, w, h)) {
+                    freeResizeContexts(ctx);
+                    vsapi->freeFrame(src);
+                    vsapi->freeFrame(dst);
+                    vsapi->setFilterError("Resize: failed to allocate resampling filters", frameCtx);
+                    return 0;
+                }
+            } else {
+                ctx->context = getSwsContext(
+                                 w, h, srcid, GetAssumedColorSpace(w, h), AVCOL_RANGE_UNSPECIFIED,
+                                 d->vi.width, d->vi.height, formatIdToPixelFormat(d->vi.format->id), GetAssumedColorSpace(d->vi.width, d->vi.height), AVCOL_RANGE_UNSPECIFIED,
+                                 d->flags);
+
+                if (!ctx->context) {
+                    free(ctx);
+                    vsapi->freeFrame(src);
+                    vsapi->freeFrame(dst);
+                    vsapi->setFilterError("Resize: context creation failed", frameCtx);
+                    return 0;
+                }
+            }
+
+            ctx->srcformat = fi;
+            ctx->srcw = w;
+            ctx->srch = h;
+        }
+
+        if (!ctx->context) {
+            resampleFrame(ctx, src, dst, fi, d->avx2, vsapi);
+            vsapi->freeFrame(src);
+            returnResizeContext(d, ctx, d->maxIdle);
+            return dst;
         }
 
         switchsrc = fi->colorFamily == cmRGB;
@@ -229,9 +911,12 @@ static const VSFrameRef *VS_CC resizeGetframe(int n, int activationReason, void
             }
         }
 
-        sws_scale(d->context, srcp, src_stride, 0, h, dstp, dst_stride);
+        sws_scale(ctx->context, srcp, src_stride, 0, h, dstp, dst_stride);
         vsapi->freeFrame(src);
 
+        // enough to keep one context per thread for a constant format clip
+        returnResizeContext(d, ctx, d->maxIdle);
+
         return dst;
     }
 
@@ -241,32 +926,66 @@ static const VSFrameRef *VS_CC resizeGetframe(int n, int activationReason, void
 static void VS_CC resizeFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     ResizeData *d = (ResizeData *)instanceData;
 
-    if (d->context)
-        sws_freeContext(d->context);
+    freeResizeContexts(d->contexts);
+    resizeMutexDestroy(&d->contextLock);
 
     vsapi->freeNode(d->node);
     free(instanceData);
 }
 
+static ResizeKernel flagsToKernel(int flags) {
+    switch (flags) {
+    case SWS_POINT:
+        return rkPoint;
+    case SWS_BILINEAR:
+        return rkBilinear;
+    case SWS_BICUBIC:
+        return rkBicubic;
+    case SWS_LANCZOS:
+        return rkLanczos;
+    case SWS_SPLINE:
+        return rkSpline36;
+    default:
+        return rkNone;
+    }
+}
+
 static void VS_CC resizeCreate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     ResizeData d;
     ResizeData *data;
+    const VSFormat *srcformat;
     int id;
     int dstwidth;
     int dstheight;
     int pf;
     int err;
-    d.context = 0;
+    d.contexts = 0;
     d.dstrange = 0;
-    d.lsrcformat = 0;
-    d.lsrch = 0;
-    d.lsrcw = 0;
     d.node = 0;
     d.flags = int64ToIntS((intptr_t)userData);
+    d.kernel = flagsToKernel(d.flags);
+    d.maxIdle = vsapi->getCoreInfo(core)->numThreads;
+    d.avx2 = 0;
+#ifdef VS_TARGET_CPU_X86
+    {
+        CPUFeatures cpu;
+        getCPUFeatures(&cpu);
+        d.avx2 = !!cpu.avx2;
+    }
+#endif
+
+    d.srcLeft = vsapi->propGetFloat(in, "src_left", 0, &err);
+    d.srcTop = vsapi->propGetFloat(in, "src_top", 0, &err);
+    d.srcWidth = vsapi->propGetFloat(in, "src_width", 0, &err);
+    if (!err && d.srcWidth <= 0)
+        RETERROR("Resize: src_width must be positive");
+    d.srcHeight = vsapi->propGetFloat(in, "src_height", 0, &err);
+    if (!err && d.srcHeight <= 0)
+        RETERROR("Resize: src_height must be positive");
+
     d.node = vsapi->propGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
-    if (d.vi.format && formatIdToPixelFormat(d.vi.format->id) == PIX_FMT_NONE)
-        RETERROR("Resize: input format not supported");
+    srcformat = d.vi.format;
 
     dstwidth = int64ToIntS(vsapi->propGetInt(in, "width", 0, &err));
 
@@ -290,13 +1009,23 @@ static void VS_CC resizeCreate(const VSMap *in, VSMap *out, void *userData, VSCo
         d.vi.height = dstheight;
 
     pf = formatIdToPixelFormat(id);
+    d.vi.format = vsapi->getFormatPreset(id, core);
 
-    if (pf == PIX_FMT_NONE) {
+    // formats swscale can't handle still work as long as only the dimensions change
+    if (!d.vi.format || (pf == PIX_FMT_NONE && !(srcformat && canResampleNatively(&d, srcformat)))) {
         vsapi->freeNode(d.node);
         RETERROR("Resize: unsupported output format");
     }
 
-    d.vi.format = vsapi->getFormatPreset(id, core);
+    if (srcformat && formatIdToPixelFormat(srcformat->id) == PIX_FMT_NONE && !canResampleNatively(&d, srcformat)) {
+        vsapi->freeNode(d.node);
+        RETERROR("Resize: input format not supported");
+    }
+
+    if (srcformat && hasSourceWindow(&d) && !canResampleNatively(&d, srcformat)) {
+        vsapi->freeNode(d.node);
+        RETERROR("Resize: source cropping is only supported when the format doesn't change");
+    }
 
     if ((d.vi.width % (1 << d.vi.format->subSamplingW)) || (d.vi.height % (1 << d.vi.format->subSamplingH))) {
         vsapi->freeNode(d.node);
@@ -309,16 +1038,21 @@ static void VS_CC resizeCreate(const VSMap *in, VSMap *out, void *userData, VSCo
     }
 
     data = malloc(sizeof(d));
+    if (!data) {
+        vsapi->freeNode(d.node);
+        RETERROR("Resize: failed to allocate filter data");
+    }
     *data = d;
+    resizeMutexInit(&data->contextLock);
 
-    vsapi->createFilter(in, out, "Resize", resizeInit, resizeGetframe, resizeFree, fmParallelRequests, 0, data, core);
+    vsapi->createFilter(in, out, "Resize", resizeInit, resizeGetframe, resizeFree, fmParallel, 0, data, core);
 }
 
 //////////////////////////////////////////
 // Init
 
 void VS_CC resizeInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin) {
-    const char *a = "clip:clip;width:int:opt;height:int:opt;format:int:opt;yuvrange:int:opt;";
+    const char *a = "clip:clip;width:int:opt;height:int:opt;format:int:opt;yuvrange:int:opt;src_left:float:opt;src_top:float:opt;src_width:float:opt;src_height:float:opt;";
     configFunc("com.vapoursynth.resize", "resize", "VapourSynth Resize", VAPOURSYNTH_API_VERSION, 1, plugin);
     registerFunc("Bilinear", a, resizeCreate, (void *)SWS_BILINEAR, plugin);
     registerFunc("Bicubic", a, resizeCreate, (void *)SWS_BICUBIC, plugin);
@@ -25,4 +25,30 @@
 
 void VS_CC resizeInitialize(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin *plugin);
 
+#include <stdint.h>
+
+#define RESAMPLE_INT_BITS 14
+
+// the filter for one direction of one plane, every output sample is the weighted
+// sum of filterWidth input samples starting at left[i]
+typedef struct {
+    int srcSize;
+    int dstSize;
+    int filterWidth;
+    // filterWidth rounded up to a multiple of 8, the extra coefficients are 0
+    int coeffStride;
+    int *left;
+    int16_t *coeffsInt;
+    float *coeffsFloat;
+} ResampleFilter;
+
+#ifdef VS_TARGET_CPU_X86
+// The horizontal ones return how many output samples were done, always a multiple of 8.
+// The vertical ones do a whole row and rely on the strides being padded to 32 bytes.
+int vs_resample_line_int_avx2(const int16_t *line, int offset, int maxValue, int bytesPerSample, void *dstp, const ResampleFilter *f);
+int vs_resample_line_float_avx2(const float *line, float *dstp, const ResampleFilter *f);
+void vs_resample_vertical_int_avx2(const uint8_t *srcp, int srcStride, uint8_t *dstp, int width, int bytesPerSample, int maxValue, const int16_t *coeffs, int filterWidth);
+void vs_resample_vertical_float_avx2(const uint8_t *srcp, int srcStride, float *dstp, int width, const float *coeffs, int filterWidth);
+#endif
+
 #endif // VSRESIZE_H
@@ -0,0 +1,160 @@
+/*
+* Copyright (c) 2012-2015 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. The sums are formed in the same order as in the SSE2
+// versions in vsresize.c so the results are identical.
+
+#ifdef VS_TARGET_CPU_X86
+#include <immintrin.h>
+
+#include "vsresize.h"
+
+
+// two 128 bit halves from different places, the first one in the low lane
+static inline __m256i loadLanes(const int16_t *lo, const int16_t *hi) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)), _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+static inline __m256 loadLanesPS(const float *lo, const float *hi) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+// output samples x to x + 3 are done in the low lanes and x + 4 to x + 7 in the high ones
+int vs_resample_line_int_avx2(const int16_t *line, int offset, int maxValue, int bytesPerSample, void *dstp, const ResampleFilter *f) {
+    const __m256i round = _mm256_set1_epi32((1 << (RESAMPLE_INT_BITS - 1)) + (offset << RESAMPLE_INT_BITS));
+    const __m256i vmax = _mm256_set1_epi32(maxValue);
+    int x;
+
+    for (x = 0; x + 8 <= f->dstSize; x += 8) {
+        __m256i acc[4];
+        __m256i t0, t1, sum;
+        __m128i res;
+        int i, k;
+
+        for (i = 0; i < 4; i++) {
+            const int16_t *src0 = line + f->left[x + i];
+            const int16_t *src1 = line + f->left[x + i + 4];
+            const int16_t *coeffs0 = f->coeffsInt + (x + i) * f->coeffStride;
+            const int16_t *coeffs1 = f->coeffsInt + (x + i + 4) * f->coeffStride;
+            acc[i] = _mm256_setzero_si256();
+            for (k = 0; k < f->coeffStride; k += 8)
+                acc[i] = _mm256_add_epi32(acc[i], _mm256_madd_epi16(loadLanes(src0 + k, src1 + k), loadLanes(coeffs0 + k, coeffs1 + k)));
+        }
+
+        t0 = _mm256_add_epi32(_mm256_unpacklo_epi32(acc[0], acc[1]), _mm256_unpackhi_epi32(acc[0], acc[1]));
+        t1 = _mm256_add_epi32(_mm256_unpacklo_epi32(acc[2], acc[3]), _mm256_unpackhi_epi32(acc[2], acc[3]));
+        sum = _mm256_add_epi32(_mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1));
+        sum = _mm256_srai_epi32(_mm256_add_epi32(sum, round), RESAMPLE_INT_BITS);
+        sum = _mm256_min_epi32(_mm256_max_epi32(sum, _mm256_setzero_si256()), vmax);
+        sum = _mm256_packus_epi32(sum, sum);
+        res = _mm256_castsi256_si128(_mm256_permute4x64_epi64(sum, 0x08));
+
+        if (bytesPerSample == 1)
+            _mm_storel_epi64((__m128i *)((uint8_t *)dstp + x), _mm_packus_epi16(res, res));
+        else
+            _mm_storeu_si128((__m128i *)((uint16_t *)dstp + x), res);
+    }
+
+    return x;
+}
+
+int vs_resample_line_float_avx2(const float *line, float *dstp, const ResampleFilter *f) {
+    int x;
+
+    for (x = 0; x + 8 <= f->dstSize; x += 8) {
+        __m256 acc[4];
+        __m256 t0, t1;
+        int i, k;
+
+        for (i = 0; i < 4; i++) {
+            const float *src0 = line + f->left[x + i];
+            const float *src1 = line + f->left[x + i + 4];
+            const float *coeffs0 = f->coeffsFloat + (x + i) * f->coeffStride;
+            const float *coeffs1 = f->coeffsFloat + (x + i + 4) * f->coeffStride;
+            acc[i] = _mm256_setzero_ps();
+            for (k = 0; k < f->coeffStride; k += 4)
+                acc[i] = _mm256_add_ps(acc[i], _mm256_mul_ps(loadLanesPS(src0 + k, src1 + k), loadLanesPS(coeffs0 + k, coeffs1 + k)));
+        }
+
+        t0 = _mm256_add_ps(_mm256_unpacklo_ps(acc[0], acc[1]), _mm256_unpackhi_ps(acc[0], acc[1]));
+        t1 = _mm256_add_ps(_mm256_unpacklo_ps(acc[2], acc[3]), _mm256_unpackhi_ps(acc[2], acc[3]));
+        // movelh and movehl within each lane
+        _mm256_storeu_ps(dstp + x, _mm256_add_ps(_mm256_shuffle_ps(t0, t1, 0x44), _mm256_shuffle_ps(t0, t1, 0xEE)));
+    }
+
+    return x;
+}
+
+void vs_resample_vertical_int_avx2(const uint8_t *srcp, int srcStride, uint8_t *dstp, int width, int bytesPerSample, int maxValue, const int16_t *coeffs, int filterWidth) {
+    const __m256i round = _mm256_set1_epi32(1 << (RESAMPLE_INT_BITS - 1));
+    const __m256i sign = _mm256_set1_epi16((short)(bytesPerSample == 2 ? 0x8000 : 0));
+    const __m256i vmax = _mm256_set1_epi16((short)maxValue);
+    int x, k;
+
+    for (x = 0; x < width; x += 16) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        __m256i res;
+
+        for (k = 0; k < filterWidth; k += 2) {
+            const uint8_t *row0 = srcp + k * srcStride;
+            const uint8_t *row1 = (k + 1 < filterWidth) ? row0 + srcStride : row0;
+            __m256i c = _mm256_set1_epi32((int)((uint16_t)coeffs[k] | ((uint32_t)(uint16_t)coeffs[k + 1] << 16)));
+            __m256i a, b;
+            if (bytesPerSample == 1) {
+                a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row0 + x)));
+                b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row1 + x)));
+            } else {
+                a = _mm256_xor_si256(_mm256_load_si256((const __m256i *)(row0 + x * 2)), sign);
+                b = _mm256_xor_si256(_mm256_load_si256((const __m256i *)(row1 + x * 2)), sign);
+            }
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c));
+        }
+
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), RESAMPLE_INT_BITS);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), RESAMPLE_INT_BITS);
+        res = _mm256_packs_epi32(lo, hi);
+
+        if (bytesPerSample == 1) {
+            res = _mm256_permute4x64_epi64(_mm256_packus_epi16(res, res), 0x08);
+            _mm_storeu_si128((__m128i *)(dstp + x), _mm256_castsi256_si128(res));
+        } else {
+            // still offset by 0x8000 so the signed saturation clamps to the 16 bit range
+            res = _mm256_xor_si256(res, sign);
+            res = _mm256_sub_epi16(res, _mm256_subs_epu16(res, vmax));
+            _mm256_store_si256((__m256i *)(dstp + x * 2), res);
+        }
+    }
+}
+
+void vs_resample_vertical_float_avx2(const uint8_t *srcp, int srcStride, float *dstp, int width, const float *coeffs, int filterWidth) {
+    int x, k;
+
+    for (x = 0; x < width; x += 8) {
+        __m256 acc = _mm256_setzero_ps();
+        for (k = 0; k < filterWidth; k++)
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_load_ps((const float *)(srcp + k * srcStride) + x), _mm256_set1_ps(coeffs[k])));
+        _mm256_store_ps(dstp + x, acc);
+    }
+}
+
+#endif
@@ -19,257 +19,304 @@
 */
 
 #include "vscore.h"
+#include "cachefilter.h"
 #include <assert.h>
+#include <algorithm>
 #ifdef VS_TARGET_CPU_X86
 #include "x86utils.h"
 #endif
 
-void VSThreadPool::runTasks(VSThreadPool *owner, std::atomic<bool> &stop) {
-#ifdef VS_TARGET_CPU_X86
-    if (!vs_isMMXStateOk())
-        vsFatal("Bad MMX state detected after creating new thread");
-#endif
-#ifdef VS_TARGET_OS_WINDOWS
-    if (!vs_isFPUStateOk())
-        vsWarning("Bad FPU state detected after creating new thread");
-    if (!vs_isSSEStateOk())
-        vsFatal("Bad SSE state detected after creating new thread");
-#endif
+bool VSThreadPool::tryTakeTask(WorkQueue *queue, PFrameContext &task, VSActivationReason &ar, bool &skipCall, int &remainingRequests, bool &parallelRequestsNeedsUnlock) {
+    std::lock_guard<std::mutex> l(queue->lock);
+    size_t numTasks = queue->tasks.size();
 
-    std::unique_lock<std::mutex> lock(owner->lock);
-
-    while (true) {
-        bool ranTask = false;
+    for (size_t pos = 0; pos < numTasks; pos++) {
+        FrameContext *mainContext = queue->tasks[pos].get();
+        FrameContext *leafContext = nullptr;
 
 /////////////////////////////////////////////////////////////////////////////////////////////
-// Go through all tasks from the top (oldest) and process the first one possible
-        for (std::list<PFrameContext>::iterator iter = owner->tasks.begin(); iter != owner->tasks.end(); ++iter) {
-            FrameContext *mainContext = iter->get();
-            FrameContext *leafContext = nullptr;
-
-/////////////////////////////////////////////////////////////////////////////////////////////
-// Handle the output tasks
-            if (mainContext->frameDone && mainContext->returnedFrame) {
-                PFrameContext mainContextRef(*iter);
-                owner->tasks.erase(iter);
-                owner->returnFrame(mainContextRef, mainContext->returnedFrame);
-                ranTask = true;
-                break;
-            }
+// Output tasks can always run
 
-            if (mainContext->frameDone && mainContext->hasError()) {
-                PFrameContext mainContextRef(*iter);
-                owner->tasks.erase(iter);
-                owner->returnFrame(mainContextRef, mainContext->getErrorMessage());
-                ranTask = true;
-                break;
-            }
+        if (mainContext->frameDone && (mainContext->returnedFrame || mainContext->hasError())) {
+            task = std::move(queue->tasks[pos]);
+            queue->tasks.erase(queue->tasks.begin() + pos);
+            return true;
+        }
 
-            bool hasLeafContext = mainContext->returnedFrame || mainContext->hasError();
-            if (hasLeafContext)
-            {
-                leafContext = mainContext;
-                mainContext = mainContext->upstreamContext.get();
-            }
+        bool hasLeafContext = mainContext->returnedFrame || mainContext->hasError();
+        if (hasLeafContext) {
+            leafContext = mainContext;
+            mainContext = mainContext->upstreamContext.get();
+        }
 
-            VSNode *clip = mainContext->clip;
-            int filterMode = clip->filterMode;
+        VSNode *clip = mainContext->clip;
+        int filterMode = clip->filterMode;
 
 /////////////////////////////////////////////////////////////////////////////////////////////
-// This part handles the locking for the different filter modes
-
-            bool parallelRequestsNeedsUnlock = false;
-            if (filterMode == fmUnordered) {
-                // already busy?
-                if (!clip->serialMutex.try_lock())
-                    continue;
-            } else if (filterMode == fmSerial) {
-                // already busy?
-                if (!clip->serialMutex.try_lock())
-                    continue;
-                // no frame in progress?
-                if (clip->serialFrame == -1) {
-                    clip->serialFrame = mainContext->n;
-                //
-                } else if (clip->serialFrame != mainContext->n) {
-                    clip->serialMutex.unlock();
-                    continue;
-                }
-                // continue processing the already started frame
-            } else if (filterMode == fmParallel) {
-                std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
-                // is the filter already processing another call for this frame? if so move along
-                if (clip->concurrentFrames.count(mainContext->n)) {
-                    continue;
-                } else {
+// This part handles the locking for the different filter modes, only the node itself is locked
+
+        parallelRequestsNeedsUnlock = false;
+        // fmParallelRequests can have several completed requests for the same frame processed at once
+        // so the frame context bookkeeping has to be done while holding the node lock
+        std::unique_lock<std::mutex> parallelRequestsLock;
+        if (filterMode == fmUnordered) {
+            // already busy?
+            if (!clip->serialMutex.try_lock())
+                continue;
+        } else if (filterMode == fmSerial) {
+            // already busy?
+            if (!clip->serialMutex.try_lock())
+                continue;
+            // no frame in progress?
+            if (clip->serialFrame == -1) {
+                clip->serialFrame = mainContext->n;
+            //
+            } else if (clip->serialFrame != mainContext->n) {
+                clip->serialMutex.unlock();
+                continue;
+            }
+            // continue processing the already started frame
+        } else if (filterMode == fmParallel) {
+            std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
+            // is the filter already processing another call for this frame? if so move along
+            if (clip->concurrentFrames.count(mainContext->n)) {
+                continue;
+            } else {
+                clip->concurrentFrames.insert(mainContext->n);
+            }
+        } else if (filterMode == fmParallelRequests) {
+            std::unique_lock<std::mutex> lock(clip->concurrentFramesMutex);
+            // is the filter already processing another call for this frame? if so move along
+            if (clip->concurrentFrames.count(mainContext->n)) {
+                continue;
+            } else {
+                // do we need the serial lock since all frames will be ready this time?
+                // check if we're in the arAllFramesReady state so we need additional locking
+                if (mainContext->numFrameRequests == 1) {
+                    if (!clip->serialMutex.try_lock())
+                        continue;
+                    parallelRequestsNeedsUnlock = true;
                     clip->concurrentFrames.insert(mainContext->n);
                 }
-            } else if (filterMode == fmParallelRequests) {
-                std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
-                // is the filter already processing another call for this frame? if so move along
-                if (clip->concurrentFrames.count(mainContext->n)) {
-                    continue;
-                } else {
-                    // do we need the serial lock since all frames will be ready this time?
-                    // check if we're in the arAllFramesReady state so we need additional locking
-                    if (mainContext->numFrameRequests == 1) {
-                        if (!clip->serialMutex.try_lock())
-                            continue;
-                        parallelRequestsNeedsUnlock = true;
-                        clip->concurrentFrames.insert(mainContext->n);
-                    }
-                }
             }
+            parallelRequestsLock = std::move(lock);
+        }
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Figure out the activation reason
+
+        ar = arInitial;
+        skipCall = false; // Used to avoid multiple error calls for the same frame request going into a filter
+        if ((hasLeafContext && leafContext->hasError()) || mainContext->hasError()) {
+            ar = arError;
+            skipCall = mainContext->setError(leafContext->getErrorMessage());
+            --mainContext->numFrameRequests;
+        } else if (hasLeafContext && leafContext->returnedFrame) {
+            if (--mainContext->numFrameRequests > 0)
+                ar = arFrameReady;
+            else
+                ar = arAllFramesReady;
+
+            mainContext->availableFrames.insert(NodeOutputKey(leafContext->clip, leafContext->n, leafContext->index), leafContext->returnedFrame);
+            mainContext->lastCompletedN = leafContext->n;
+            mainContext->lastCompletedNode = leafContext->node;
+        }
+
+        remainingRequests = mainContext->numFrameRequests;
+        assert(remainingRequests >= 0);
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Remove the context from the task list
 
-            PFrameContext mainContextRef;
-            PFrameContext leafContextRef;
-            if (hasLeafContext) {
-                leafContextRef = *iter;
-                mainContextRef = leafContextRef->upstreamContext;
-            } else {
-                mainContextRef = *iter;
-            }
+        task = std::move(queue->tasks[pos]);
+        queue->tasks.erase(queue->tasks.begin() + pos);
+        return true;
+    }
 
-            owner->tasks.erase(iter);
-
-            /////////////////////////////////////////////////////////////////////////////////////////////
-            // Figure out the activation reason
-
-            VSActivationReason ar = arInitial;
-            bool skipCall = false; // Used to avoid multiple error calls for the same frame request going into a filter
-            if ((hasLeafContext && leafContext->hasError()) || mainContext->hasError()) {
-                ar = arError;
-                skipCall = mainContext->setError(leafContext->getErrorMessage());
-                --mainContext->numFrameRequests;
-            } else if (hasLeafContext && leafContext->returnedFrame) {
-                if (--mainContext->numFrameRequests > 0)
-                    ar = arFrameReady;
-                else
-                    ar = arAllFramesReady;
-
-                mainContext->availableFrames.insert(std::make_pair(NodeOutputKey(leafContext->clip, leafContext->n, leafContext->index), leafContext->returnedFrame));
-                mainContext->lastCompletedN = leafContext->n;
-                mainContext->lastCompletedNode = leafContext->node;
-            }
+    return false;
+}
+
+bool VSThreadPool::runTask(WorkQueue *queue) {
+    PFrameContext task;
+    VSActivationReason ar = arInitial;
+    bool skipCall = false;
+    int remainingRequests = 0;
+    bool parallelRequestsNeedsUnlock = false;
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Look for something to do, new external requests are started first and everything is taken
+// oldest first so requests for the same frame from different paths are likely to overlap and
+// get merged, this matters a lot for graphs without caches
+
+    bool found = tryTakeTask(&sharedQueue, task, ar, skipCall, remainingRequests, parallelRequestsNeedsUnlock);
+    if (!found)
+        found = tryTakeTask(queue, task, ar, skipCall, remainingRequests, parallelRequestsNeedsUnlock);
+    if (!found) {
+        const std::vector<WorkQueue *> &queues = *workerQueues.load();
+        for (size_t i = 1; i < queues.size() && !found; i++)
+            found = tryTakeTask(queues[(queue->index + i) % queues.size()], task, ar, skipCall, remainingRequests, parallelRequestsNeedsUnlock);
+    }
+
+    if (!found)
+        return false;
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Handle the output tasks
+
+    if (task->frameDone && task->returnedFrame) {
+        returnFrame(task, task->returnedFrame);
+        return true;
+    }
 
-            assert(mainContext->numFrameRequests >= 0);
+    if (task->frameDone && task->hasError()) {
+        returnFrame(task, task->getErrorMessage());
+        return true;
+    }
+
+    bool hasLeafContext = task->returnedFrame || task->hasError();
+    PFrameContext mainContextRef = hasLeafContext ? task->upstreamContext : task;
+    FrameContext *mainContext = mainContextRef.get();
+    task.reset();
 
-            bool hasExistingRequests = !!mainContext->numFrameRequests;
+    VSNode *clip = mainContext->clip;
+    int filterMode = clip->filterMode;
+    bool hasExistingRequests = !!remainingRequests;
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Do the actual processing
 
-            lock.unlock();
+    VSFrameContext externalFrameCtx(mainContextRef);
+    assert(ar == arError || !mainContext->hasError());
+    PVideoFrame f;
+    if (!skipCall)
+        f = clip->getFrameInternal(mainContext->n, ar, externalFrameCtx);
+    bool frameProcessingDone = f || mainContext->hasError();
+    bool requestedFrames = !externalFrameCtx.reqList.empty() && !frameProcessingDone;
 
-            VSFrameContext externalFrameCtx(mainContextRef);
-            assert(ar == arError || !mainContext->hasError());
-            PVideoFrame f;
-            if (!skipCall)
-                f = clip->getFrameInternal(mainContext->n, ar, externalFrameCtx);
-            ranTask = true;
-            bool frameProcessingDone = f || mainContext->hasError();
+    // all new requests have to be counted before another thread can get the chance to complete one of them
+    if (requestedFrames)
+        mainContext->numFrameRequests += static_cast<int>(externalFrameCtx.reqList.size());
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Unlock so the next job can run on the context
-            if (filterMode == fmUnordered) {
-                clip->serialMutex.unlock();
-            } else if (filterMode == fmSerial) {
-                if (frameProcessingDone)
-                    clip->serialFrame = -1;
-                clip->serialMutex.unlock();
-            } else if (filterMode == fmParallel) {
-                std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
-                clip->concurrentFrames.erase(mainContext->n);
-            } else if (filterMode == fmParallelRequests) {
-                std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
-                clip->concurrentFrames.erase(mainContext->n);
-                if (parallelRequestsNeedsUnlock)
-                    clip->serialMutex.unlock();
-            }
+    if (filterMode == fmUnordered) {
+        clip->serialMutex.unlock();
+    } else if (filterMode == fmSerial) {
+        if (frameProcessingDone)
+            clip->serialFrame = -1;
+        clip->serialMutex.unlock();
+    } else if (filterMode == fmParallel) {
+        std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
+        clip->concurrentFrames.erase(mainContext->n);
+    } else if (filterMode == fmParallelRequests) {
+        std::lock_guard<std::mutex> lock(clip->concurrentFramesMutex);
+        clip->concurrentFrames.erase(mainContext->n);
+        if (parallelRequestsNeedsUnlock)
+            clip->serialMutex.unlock();
+    }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Handle frames that were requested
-            bool requestedFrames = !externalFrameCtx.reqList.empty() && !frameProcessingDone;
 
-            lock.lock();
-
-            if (requestedFrames) {
-                for (auto &reqIter : externalFrameCtx.reqList)
-                    owner->startInternal(reqIter);
-                externalFrameCtx.reqList.clear();
-            }
+    if (requestedFrames) {
+        for (auto &reqIter : externalFrameCtx.reqList)
+            startInternal(reqIter, queue);
+        externalFrameCtx.reqList.clear();
+    }
 
-            if (frameProcessingDone)
-                owner->allContexts.erase(NodeOutputKey(mainContext->clip, mainContext->n, mainContext->index));
+    if (frameProcessingDone) {
+        std::lock_guard<std::mutex> l(lock);
+        NodeOutputKey key(mainContext->clip, mainContext->n, mainContext->index);
+        PFrameContext *found = allContexts.find(key);
+        if (found && *found == mainContextRef)
+            allContexts.erase(key);
+    }
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Propagate status to other linked contexts
 // CHANGES mainContextRef!!!
 
-            if (mainContext->hasError() && !hasExistingRequests && !requestedFrames) {
-                PFrameContext n;
-                do {
-                    n = mainContextRef->notificationChain;
-
-                    if (n) {
-                        mainContextRef->notificationChain.reset();
-                        n->setError(mainContextRef->getErrorMessage());
-                    }
-
-                    if (mainContextRef->upstreamContext) {
-                        owner->startInternal(mainContextRef);
-                    }
-
-                    if (mainContextRef->frameDone) {
-                        owner->returnFrame(mainContextRef, mainContextRef->getErrorMessage());
-                    }
-                } while ((mainContextRef = n));
-            } else if (f) {
-                if (hasExistingRequests || requestedFrames)
-                    vsFatal("A frame was returned at the end of processing by %s but there are still outstanding requests", clip->name.c_str());
-                PFrameContext n;
-
-                do {
-                    n = mainContextRef->notificationChain;
-
-                    if (n)
-                        mainContextRef->notificationChain.reset();
-
-                    if (mainContextRef->upstreamContext) {
-                        mainContextRef->returnedFrame = f;
-                        owner->startInternal(mainContextRef);
-                    }
-
-                    if (mainContextRef->frameDone)
-                        owner->returnFrame(mainContextRef, f);
-                } while ((mainContextRef = n));
-            } else if (hasExistingRequests || requestedFrames) {
-                // already scheduled, do nothing
-            } else {
-                vsFatal("No frame returned at the end of processing by %s", clip->name.c_str());
+    if (mainContext->hasError() && !hasExistingRequests && !requestedFrames) {
+        PFrameContext n;
+        do {
+            n = mainContextRef->notificationChain;
+
+            if (n) {
+                mainContextRef->notificationChain.reset();
+                n->setError(mainContextRef->getErrorMessage());
             }
-            break;
-        }
 
+            if (mainContextRef->upstreamContext) {
+                startInternal(mainContextRef, queue);
+            }
+
+            if (mainContextRef->frameDone) {
+                returnFrame(mainContextRef, mainContextRef->getErrorMessage());
+            }
+        } while ((mainContextRef = n));
+    } else if (f) {
+        if (hasExistingRequests || requestedFrames)
+            vsFatal("A frame was returned at the end of processing by %s but there are still outstanding requests", clip->name.c_str());
+        PFrameContext n;
+
+        do {
+            n = mainContextRef->notificationChain;
+
+            if (n)
+                mainContextRef->notificationChain.reset();
+
+            if (mainContextRef->upstreamContext) {
+                mainContextRef->returnedFrame = f;
+                startInternal(mainContextRef, queue);
+            }
+
+            if (mainContextRef->frameDone)
+                returnFrame(mainContextRef, f);
+        } while ((mainContextRef = n));
+    } else if (hasExistingRequests || requestedFrames) {
+        // already scheduled, do nothing
+    } else {
+        vsFatal("No frame returned at the end of processing by %s", clip->name.c_str());
+    }
+
+    return true;
+}
+
+void VSThreadPool::runTasks(VSThreadPool *owner, WorkQueue *queue, std::atomic<bool> &stop) {
+#ifdef VS_TARGET_CPU_X86
+    if (!vs_isMMXStateOk())
+        vsFatal("Bad MMX state detected after creating new thread");
+#endif
+#ifdef VS_TARGET_OS_WINDOWS
+    if (!vs_isFPUStateOk())
+        vsWarning("Bad FPU state detected after creating new thread");
+    if (!vs_isSSEStateOk())
+        vsFatal("Bad SSE state detected after creating new thread");
+#endif
+
+    while (true) {
+        // anything queued after this point will be noticed before going to sleep
+        unsigned epoch = owner->workEpoch;
+        // sub-frame tasks go first since a getframe call is already waiting for them
+        bool ranTask = owner->runSubTask() || owner->runTask(queue);
 
         if (!ranTask || owner->activeThreadCount() > owner->threadCount()) {
+            std::unique_lock<std::mutex> lock(owner->idleLock);
             --owner->activeThreads;
-            if (stop) {
-                lock.unlock();
+            if (stop)
                 break;
-            }
             ++owner->idleThreads;
-            owner->newWork.wait(lock);
+            if (ranTask || epoch == owner->workEpoch)
+                owner->newWork.wait(lock);
             --owner->idleThreads;
             ++owner->activeThreads;
         }
     }
 }
 
-VSThreadPool::VSThreadPool(VSCore *core, int threads) : core(core), activeThreads(0), idleThreads(0), stopThreads(false), ticks(0) {
+VSThreadPool::VSThreadPool(VSCore *core, int threads) : core(core), sharedQueue(0), pendingBatches(0), workEpoch(0), activeThreads(0), idleThreads(0), stopThreads(false), ticks(0) {
+    queueLists.push_back(new std::vector<WorkQueue *>());
+    workerQueues = queueLists.back();
     setThreadCount(threads);
 }
 
@@ -282,9 +329,13 @@ int VSThreadPool::threadCount() const {
 }
 
 void VSThreadPool::spawnThread() {
-    std::thread *thread = new std::thread(runTasks, this, std::ref(stopThreads));
-    allThreads.insert(std::make_pair(thread->get_id(), thread));
+    WorkQueue *queue = new WorkQueue(ownedQueues.size());
+    ownedQueues.push_back(queue);
+    queueLists.push_back(new std::vector<WorkQueue *>(ownedQueues));
+    workerQueues = queueLists.back();
     ++activeThreads;
+    std::thread *thread = new std::thread(runTasks, this, queue, std::ref(stopThreads));
+    allThreads.insert(std::make_pair(thread->get_id(), thread));
 }
 
 void VSThreadPool::setThreadCount(int threads) {
@@ -296,11 +347,16 @@ void VSThreadPool::setThreadCount(int threads) {
 }
 
 void VSThreadPool::wakeThread() {
+    ++workEpoch;
     if (activeThreads < maxThreads) {
-        if (idleThreads == 0) // newly spawned threads are active so no need to notify an additional thread
-            spawnThread();
-        else
+        if (idleThreads == 0) { // newly spawned threads are active so no need to notify an additional thread
+            std::lock_guard<std::mutex> l(lock);
+            if (activeThreads < maxThreads && idleThreads == 0)
+                spawnThread();
+        } else {
+            std::lock_guard<std::mutex> l(idleLock);
             newWork.notify_one();
+        }
     }
 }
 
@@ -314,50 +370,43 @@ void VSThreadPool::reserveThread() {
 
 void VSThreadPool::notifyCaches(bool needMemory) {
     std::lock_guard<std::mutex> lock(core->cacheLock);
-    for (auto &cache : core->caches)
-        cache->notifyCache(needMemory);
+    adjustCacheSizes(core->caches, *core->memory, needMemory);
 }
 
 void VSThreadPool::start(const PFrameContext &context) {
     assert(context);
-    std::lock_guard<std::mutex> l(lock);
-    startInternal(context);
+    startInternal(context, &sharedQueue);
 }
 
 void VSThreadPool::returnFrame(const PFrameContext &rCtx, const PVideoFrame &f) {
     assert(rCtx->frameDone);
-    // we need to unlock here so the callback may request more frames without causing a deadlock
+    // no scheduler locks are held here so the callback may request more frames without causing a deadlock
     // AND so that slow callbacks will only block operations in this thread, not all the others
-    lock.unlock();
     VSFrameRef *ref = new VSFrameRef(f);
-    callbackLock.lock();
+    std::lock_guard<std::mutex> l(callbackLock);
     rCtx->frameDone(rCtx->userData, ref, rCtx->n, rCtx->node, nullptr);
-    callbackLock.unlock();
-    lock.lock();
 }
 
 void VSThreadPool::returnFrame(const PFrameContext &rCtx, const std::string &errMsg) {
     assert(rCtx->frameDone);
-    // we need to unlock here so the callback may request more frames without causing a deadlock
-    // AND so that slow callbacks will only block operations in this thread, not all the others
-    lock.unlock();
-    callbackLock.lock();
+    std::lock_guard<std::mutex> l(callbackLock);
     rCtx->frameDone(rCtx->userData, nullptr, rCtx->n, rCtx->node, errMsg.c_str());
-    callbackLock.unlock();
-    lock.lock();
 }
 
-void VSThreadPool::startInternal(const PFrameContext &context) {
+void VSThreadPool::startInternal(const PFrameContext &context, WorkQueue *queue) {
     //technically this could be done by walking up the context chain and add a new notification to the correct one
     //unfortunately this would probably be quite slow for deep scripts so just hope the cache catches it
 
     if (context->n < 0)
         vsFatal("Negative frame request by: %s", context->clip->getName().c_str());
 
-    // check to see if it's time to reevaluate cache sizes
+    // check to see if it's time to reevaluate cache sizes, unused frame buffers are the cheapest to give back so they go first
     if (core->memory->isOverLimit()) {
-        ticks = 0;
-        notifyCaches(true);
+        core->memory->trimBuffers();
+        if (core->memory->isOverLimit()) {
+            ticks = 0;
+            notifyCaches(true);
+        }
     }
 
     // a normal tick for caches to adjust their sizes based on recent history
@@ -367,36 +416,110 @@ void VSThreadPool::startInternal(const PFrameContext &context) {
     }
 
     // add it immediately if the task is to return a completed frame or report an error since it never has an existing context
-    if (context->returnedFrame || context->hasError()) {
-        tasks.push_back(context);
-    } else {
-        if (context->upstreamContext)
-            ++context->upstreamContext->numFrameRequests;
-
+    if (!context->returnedFrame && !context->hasError()) {
+        // the upstream context has already counted this request
         NodeOutputKey p(context->clip, context->n, context->index);
 
-        if (allContexts.count(p)) {
-            PFrameContext &ctx = allContexts[p];
+        std::lock_guard<std::mutex> l(lock);
+        PFrameContext *found = allContexts.find(p);
+        if (found) {
+            PFrameContext &ctx = *found;
             assert(context->clip == ctx->clip && context->n == ctx->n && context->index == ctx->index);
 
             if (ctx->returnedFrame) {
                 // special case where the requested frame is encountered "by accident"
                 context->returnedFrame = ctx->returnedFrame;
-                tasks.push_back(context);
             } else {
                 // add it to the list of contexts to notify when it's available
                 context->notificationChain = ctx->notificationChain;
                 ctx->notificationChain = context;
+                return;
             }
         } else {
             // create a new context and append it to the tasks
-            allContexts[p] = context;
-            tasks.push_back(context);
+            allContexts.insert(p, context);
         }
     }
+
+    {
+        std::lock_guard<std::mutex> l(queue->lock);
+        queue->tasks.push_back(context);
+    }
     wakeThread();
 }
 
+void VSThreadPool::runBatchItem(SubTaskBatch *batch, int index) {
+    batch->func(index, batch->userData);
+    // the batch lives on the starting thread's stack so it may not be touched after the last item is reported
+    std::lock_guard<std::mutex> l(batch->doneLock);
+    if (--batch->remaining == 0)
+        batch->done.notify_one();
+}
+
+bool VSThreadPool::runSubTask() {
+    if (!pendingBatches)
+        return false;
+
+    SubTaskBatch *batch = nullptr;
+    int index = 0;
+    {
+        std::lock_guard<std::mutex> l(subTaskLock);
+        while (!subTasks.empty()) {
+            batch = subTasks.front();
+            index = batch->next++;
+            if (index < batch->count)
+                break;
+            subTasks.pop_front();
+            --pendingBatches;
+            batch = nullptr;
+        }
+    }
+
+    if (!batch)
+        return false;
+    runBatchItem(batch, index);
+    return true;
+}
+
+void VSThreadPool::parallelFor(int count, VSParallelTask func, void *userData) {
+    if (count <= 0)
+        return;
+
+    if (count == 1 || maxThreads < 2) {
+        for (int i = 0; i < count; i++)
+            func(i, userData);
+        return;
+    }
+
+    SubTaskBatch batch(func, userData, count);
+    {
+        std::lock_guard<std::mutex> l(subTaskLock);
+        subTasks.push_back(&batch);
+        ++pendingBatches;
+    }
+
+    // only threads that would otherwise be idle are woken, the calling thread is already counted as active
+    int helpers = std::min(count - 1, static_cast<int>(maxThreads) - 1);
+    for (int i = 0; i < helpers; i++)
+        wakeThread();
+
+    int index;
+    while ((index = batch.next++) < count)
+        runBatchItem(&batch, index);
+
+    {
+        std::lock_guard<std::mutex> l(subTaskLock);
+        auto iter = std::find(subTasks.begin(), subTasks.end(), &batch);
+        if (iter != subTasks.end()) {
+            subTasks.erase(iter);
+            --pendingBatches;
+        }
+    }
+
+    std::unique_lock<std::mutex> l(batch.doneLock);
+    batch.done.wait(l, [&batch] { return batch.remaining == 0; });
+}
+
 bool VSThreadPool::isWorkerThread() {
     std::lock_guard<std::mutex> m(lock);
     return allThreads.count(std::this_thread::get_id()) > 0;
@@ -413,15 +536,22 @@ VSThreadPool::~VSThreadPool() {
     while (!allThreads.empty()) {
         auto iter = allThreads.begin();
         auto thread = iter->second;
-        newWork.notify_all();
+        {
+            std::lock_guard<std::mutex> l(idleLock);
+            newWork.notify_all();
+        }
         m.unlock();
         thread->join();
         m.lock();
         allThreads.erase(iter);
         delete thread;
-        newWork.notify_all();
     }
 
     assert(activeThreads == 0);
     assert(idleThreads == 0);
+
+    for (auto iter : queueLists)
+        delete iter;
+    for (auto iter : ownedQueues)
+        delete iter;
 };
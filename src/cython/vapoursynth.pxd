@@ -129,6 +129,8 @@ cdef extern from "include/VapourSynth.h" nogil:
         int numThreads
         int64_t maxFramebufferSize
         int64_t usedFramebufferSize
+        int64_t framebufferPoolHits
+        int64_t framebufferPoolMisses
 
     cdef struct VSVideoInfo:
         VSFormat *format
@@ -159,6 +161,7 @@ cdef extern from "include/VapourSynth.h" nogil:
     ctypedef void (__stdcall *VSFilterFree)(void *instanceData, VSCore *core, const VSAPI *vsapi)
     ctypedef void (__stdcall *VSFreeFuncData)(void *userData)
     ctypedef void (__stdcall *VSMessageHandler)(int msgType, const char *msg, void *userData)
+    ctypedef void (__stdcall *VSFrameBufferFree)(void *userData)
 
     ctypedef struct VSAPI:
         VSCore *createCore(int threads) nogil
@@ -243,5 +246,9 @@ cdef extern from "include/VapourSynth.h" nogil:
         const double *propGetFloatArray(const VSMap *map, const char *key, int *error) nogil
         int propSetIntArray(VSMap *map, const char *key, const int64_t *i, int size) nogil
         int propSetFloatArray(VSMap *map, const char *key, const double *d, int size) nogil
+
+        void setProfiling(int enable, VSCore *core) nogil
+        void getProfile(VSMap *out, VSCore *core) nogil
+        VSFrameRef *newVideoFrameExternal(const VSFormat *format, int width, int height, uint8_t * const *planes, const int *strides, VSFrameBufferFree free, void *userData, const VSFrameRef *propSrc, VSCore *core) nogil
         
     const VSAPI *getVapourSynthAPI(int version) nogil
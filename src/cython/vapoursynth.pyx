@@ -21,7 +21,12 @@ cimport vapoursynth
 cimport cython.parallel
 from cython cimport view
 from libc.stdint cimport intptr_t, uint16_t, uint32_t
+from libc.stdlib cimport malloc, calloc, free
+from libc.stdio cimport snprintf
+from libc.string cimport memcpy
 from cpython.ref cimport Py_INCREF, Py_DECREF
+from cpython.buffer cimport PyObject_GetBuffer, PyBuffer_Release, PyBUF_WRITABLE, PyBUF_FORMAT, PyBUF_STRIDES, PyBUF_RECORDS_RO
+from cpython.exc cimport PyErr_CheckSignals
 import os
 import ctypes
 import threading
@@ -29,6 +34,21 @@ import traceback
 import gc
 import sys
 
+cdef extern from "pythread.h" nogil:
+    ctypedef void *PyThread_type_lock
+    ctypedef enum PyLockStatus:
+        PY_LOCK_FAILURE
+        PY_LOCK_ACQUIRED
+        PY_LOCK_INTR
+    PyThread_type_lock PyThread_allocate_lock()
+    void PyThread_free_lock(PyThread_type_lock lock)
+    int PyThread_acquire_lock(PyThread_type_lock lock, int waitflag)
+    PyLockStatus PyThread_acquire_lock_timed(PyThread_type_lock lock, long long microseconds, int intr_flag)
+    void PyThread_release_lock(PyThread_type_lock lock)
+
+cdef extern from "src/cython/vsoutput.h" nogil:
+    int vsWriteAll(int fd, const void *buf, size_t count)
+
 _using_vsscript = False
 _environment_id_stack = []
 _environment_id = None
@@ -339,6 +359,111 @@ cdef void __stdcall frameDoneCallback(void *data, const VSFrameRef *f, int n, VS
         d.condition.notify()
         d.condition.release()
 
+# The state of output() when writing to a file descriptor. Everything in here is
+# only touched with the lock held, so the frame callbacks never need the GIL
+# except to report progress.
+ctypedef struct NativeOutputData:
+    const VSAPI *funcs
+    VSNodeRef *node
+    int fd
+    int requested
+    int completed
+    int total
+    int output
+    int num_planes
+    bint y4m
+    bint finished
+    void *progress_data
+    const VSFrameRef **reorder
+    PyThread_type_lock lock
+    PyThread_type_lock done
+    char error[512]
+
+cdef bint writeFrameNative(NativeOutputData *d, const VSFrameRef *f) nogil:
+    cdef const VSFormat *fi = d.funcs.getFrameFormat(f)
+    cdef const uint8_t *readptr
+    cdef int stride
+    cdef int row_size
+    cdef int height
+    cdef int p
+    cdef int y
+
+    if d.y4m and vsWriteAll(d.fd, b'FRAME\n', 6):
+        return False
+
+    for p in range(d.num_planes):
+        stride = d.funcs.getStride(f, p)
+        readptr = d.funcs.getReadPtr(f, p)
+        row_size = d.funcs.getFrameWidth(f, p) * fi.bytesPerSample
+        height = d.funcs.getFrameHeight(f, p)
+
+        if stride == row_size:
+            if vsWriteAll(d.fd, readptr, <size_t>row_size * height):
+                return False
+        else:
+            for y in range(height):
+                if vsWriteAll(d.fd, readptr, row_size):
+                    return False
+                readptr += stride
+    return True
+
+# Kept out of the callback itself since it would otherwise take the GIL on every
+# return to clean up its Python locals
+cdef void reportProgressNative(NativeOutputData *d) with gil:
+    cd = <CallbackData>d.progress_data
+    try:
+        cd.progress_update(d.completed, d.total)
+    except BaseException, e:
+        msg = ('Progress update caused an exception: ' + str(e)).encode('utf-8')
+        snprintf(d.error, sizeof(d.error), '%s', <const char *>msg)
+        d.total = d.requested
+
+cdef void __stdcall frameDoneCallbackNative(void *data, const VSFrameRef *f, int n, VSNodeRef *node, const char *errormsg) nogil:
+    cdef NativeOutputData *d = <NativeOutputData *>data
+    cdef const VSAPI *funcs = d.funcs
+    cdef int next_frame = -1
+
+    PyThread_acquire_lock(d.lock, 1)
+    d.completed = d.completed + 1
+
+    if f == NULL:
+        if not d.error[0]:
+            if errormsg == NULL:
+                snprintf(d.error, sizeof(d.error), 'Failed to retrieve frame %d', n)
+            else:
+                snprintf(d.error, sizeof(d.error), 'Failed to retrieve frame %d with error: %s', n, errormsg)
+        d.total = d.requested
+    elif d.error[0]:
+        funcs.freeFrame(f)
+    else:
+        d.reorder[n] = f
+
+        while d.output < d.requested and d.reorder[d.output] != NULL:
+            if not writeFrameNative(d, d.reorder[d.output]):
+                snprintf(d.error, sizeof(d.error), 'File write call returned an error')
+                d.total = d.requested
+            funcs.freeFrame(d.reorder[d.output])
+            d.reorder[d.output] = NULL
+            d.output = d.output + 1
+            if d.error[0]:
+                break
+
+        if d.progress_data != NULL:
+            reportProgressNative(d)
+
+    if d.requested < d.total:
+        next_frame = d.requested
+        d.requested = d.requested + 1
+    elif d.completed == d.total and not d.finished:
+        d.finished = True
+        PyThread_release_lock(d.done)
+
+    PyThread_release_lock(d.lock)
+
+    # d may already be gone once the lock has been released after the last frame
+    if next_frame >= 0:
+        funcs.getFrameAsync(next_frame, node, frameDoneCallbackNative, data)
+
 cdef object mapToDict(const VSMap *map, bint flatten, bint add_cache, Core core, const VSAPI *funcs):
     cdef int numKeys = funcs.propNumKeys(map)
     retdict = {}
@@ -758,6 +883,49 @@ cdef class VideoFrame(object):
             raise IndexError('Specified plane index out of range')
         return self.funcs.getStride(self.constf, plane)
 
+    def get_plane(self, int plane):
+        if plane < 0 or plane >= self.format.num_planes:
+            raise IndexError('Specified plane index out of range')
+        cdef VideoPlane instance = VideoPlane.__new__(VideoPlane)
+        instance.frame = self
+        instance.plane = plane
+        instance.width = self.funcs.getFrameWidth(self.constf, plane)
+        instance.height = self.funcs.getFrameHeight(self.constf, plane)
+        return instance
+
+    # The whole frame can only be exported as a single (plane, y, x) buffer when
+    # all planes have the same size and are evenly spaced, otherwise get_plane()
+    # has to be used.
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        cdef const uint8_t *ptrs[3]
+        cdef Py_ssize_t plane_distance = 0
+        cdef int num_planes = self.format.num_planes
+        cdef int stride = self.funcs.getStride(self.constf, 0)
+        cdef int p
+
+        if flags & PyBUF_WRITABLE and self.readonly:
+            raise BufferError('Cannot obtain write access to a read only frame')
+        # A writable frame always exports its own copy of the planes, a shared
+        # plane would be replaced by a later write access and leave the view dangling
+        for p in range(num_planes):
+            if not self.readonly:
+                ptrs[p] = self.funcs.getWritePtr(self.f, p)
+            else:
+                ptrs[p] = self.funcs.getReadPtr(self.constf, p)
+
+        if num_planes > 1:
+            if self.format.subsampling_w or self.format.subsampling_h:
+                raise BufferError('Frames with subsampled planes can only be accessed one plane at a time')
+            plane_distance = ptrs[1] - ptrs[0]
+            for p in range(1, num_planes):
+                if ptrs[p] - ptrs[p - 1] != plane_distance or self.funcs.getStride(self.constf, p) != stride:
+                    raise BufferError('The planes of the frame are not evenly spaced and can only be accessed one plane at a time')
+
+        fillFrameBuffer(buffer, self, ptrs[0], num_planes if num_planes > 1 else 0, plane_distance, self.height, self.width, stride, flags)
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        free(buffer.internal)
+
     def __str__(self):
         cdef str s = 'VideoFrame\n'
         s += '\tFormat: ' + self.format.name + '\n'
@@ -765,6 +933,85 @@ cdef class VideoFrame(object):
         s += '\tHeight: ' + str(self.height) + '\n'
         return s
 
+# Fills in a buffer describing a single plane, or several planes when num_planes
+# is non-zero, the shape and strides are freed by __releasebuffer__
+cdef int fillFrameBuffer(Py_buffer *buffer, object obj, const uint8_t *ptr, int num_planes, Py_ssize_t plane_distance, int height, int width, int stride, int flags) except -1:
+    cdef VideoFrame frame = obj if isinstance(obj, VideoFrame) else (<VideoPlane>obj).frame
+    cdef int bytes_per_sample = frame.format.bytes_per_sample
+    cdef Py_ssize_t *layout
+    cdef int ndim = 3 if num_planes else 2
+
+    if flags & PyBUF_STRIDES != PyBUF_STRIDES:
+        raise BufferError('Frames have padding at the end of each line and can only be exported with strides')
+
+    layout = <Py_ssize_t *>malloc(2 * ndim * sizeof(Py_ssize_t))
+    if layout == NULL:
+        raise MemoryError()
+
+    if num_planes:
+        layout[0] = num_planes
+        layout[ndim] = plane_distance
+    layout[ndim - 2] = height
+    layout[ndim - 1] = width
+    layout[2 * ndim - 2] = stride
+    layout[2 * ndim - 1] = bytes_per_sample
+
+    buffer.buf = <void *>ptr
+    buffer.obj = obj
+    buffer.len = <Py_ssize_t>height * width * bytes_per_sample * (num_planes if num_planes else 1)
+    buffer.readonly = not (flags & PyBUF_WRITABLE)
+    buffer.itemsize = bytes_per_sample
+    buffer.format = NULL
+    if flags & PyBUF_FORMAT:
+        if frame.format.sample_type == stFloat:
+            buffer.format = 'e' if bytes_per_sample == 2 else 'f'
+        else:
+            buffer.format = 'B' if bytes_per_sample == 1 else ('H' if bytes_per_sample == 2 else 'I')
+    buffer.ndim = ndim
+    buffer.shape = layout
+    buffer.strides = layout + ndim
+    buffer.suboffsets = NULL
+    buffer.internal = layout
+    return 0
+
+cdef class VideoPlane(object):
+    cdef VideoFrame frame
+    cdef readonly int plane
+    cdef readonly int width
+    cdef readonly int height
+
+    def __init__(self):
+        raise Error('Class cannot be instantiated directly')
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        cdef const uint8_t *ptr
+        if flags & PyBUF_WRITABLE and self.frame.readonly:
+            raise BufferError('Cannot obtain write access to a read only frame')
+        # see VideoFrame.__getbuffer__
+        if not self.frame.readonly:
+            ptr = self.frame.funcs.getWritePtr(self.frame.f, self.plane)
+        else:
+            ptr = self.frame.funcs.getReadPtr(self.frame.constf, self.plane)
+        fillFrameBuffer(buffer, self, ptr, 0, 0, self.height, self.width, self.frame.funcs.getStride(self.frame.constf, self.plane), flags)
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        free(buffer.internal)
+
+# Keeps the buffers that external frames point into alive until the core lets go of them
+cdef class ExternalFrameBuffers(object):
+    cdef Py_buffer views[3]
+    cdef int num_views
+
+    def __dealloc__(self):
+        cdef int i
+        for i in range(self.num_views):
+            PyBuffer_Release(&self.views[i])
+
+cdef void __stdcall releaseExternalFrameBuffers(void *pobj) nogil:
+    with gil:
+        fobj = <object>pobj
+        Py_DECREF(fobj)
+
 cdef VideoFrame createConstVideoFrame(const VSFrameRef *constf, const VSAPI *funcs, Core core):
     cdef VideoFrame instance = VideoFrame.__new__(VideoFrame)
     instance.constf = constf
@@ -899,6 +1146,17 @@ cdef class VideoNode(object):
         cdef str header = 'YUV4MPEG2 ' + y4mformat + 'W' + str(self.width) + ' H' + str(self.height) + ' F' + str(self.fps_num) + ':' + str(self.fps_den) + ' Ip A0:0\n'
         if y4m:
             fileobj.write(header.encode('utf-8'))
+
+        # Real files and pipes are written to directly from the frame callbacks
+        try:
+            fd = fileobj.fileno()
+        except (AttributeError, OSError, ValueError):
+            fd = -1
+        if fd >= 0:
+            fileobj.flush()
+            self.outputNative(d, fd, prefetch)
+            return
+
         d.condition.acquire()
 
         for n in range(min(prefetch, d.total)):
@@ -918,7 +1176,81 @@ cdef class VideoNode(object):
 
         if d.error:
             raise Error(d.error)
-            
+
+    cdef outputNative(self, CallbackData cd, int fd, int prefetch):
+        cdef NativeOutputData d
+        cdef PyLockStatus status
+        cdef int n
+
+        # calloc(0) may return NULL and no callback would ever finish the wait below
+        if cd.total == 0:
+            return
+
+        d.funcs = self.funcs
+        d.node = self.node
+        d.fd = fd
+        d.requested = min(prefetch, cd.total)
+        d.completed = 0
+        d.total = cd.total
+        d.output = 0
+        d.num_planes = cd.num_planes
+        d.y4m = cd.y4m
+        d.finished = False
+        d.progress_data = <void *>cd if cd.progress_update is not None else NULL
+        d.error[0] = 0
+        d.reorder = <const VSFrameRef **>calloc(cd.total, sizeof(VSFrameRef *))
+        d.lock = PyThread_allocate_lock()
+        d.done = PyThread_allocate_lock()
+        if d.reorder == NULL or d.lock == NULL or d.done == NULL:
+            free(d.reorder)
+            if d.lock != NULL:
+                PyThread_free_lock(d.lock)
+            if d.done != NULL:
+                PyThread_free_lock(d.done)
+            raise MemoryError()
+        PyThread_acquire_lock(d.done, 1)
+
+        with nogil:
+            for n in range(d.requested):
+                self.funcs.getFrameAsync(n, self.node, frameDoneCallbackNative, &d)
+
+        # Wake up regularly so that ctrl-c still works
+        stored_exception = None
+        while True:
+            with nogil:
+                status = PyThread_acquire_lock_timed(d.done, 100000, 1)
+            if status == PY_LOCK_ACQUIRED:
+                break
+            try:
+                PyErr_CheckSignals()
+            except BaseException, e:
+                stored_exception = e
+                with nogil:
+                    PyThread_acquire_lock(d.lock, 1)
+                    d.total = d.requested
+                    if d.completed == d.total and not d.finished:
+                        d.finished = True
+                        PyThread_release_lock(d.done)
+                    PyThread_release_lock(d.lock)
+
+        # Make sure the last callback has let go of the lock before freeing it
+        with nogil:
+            PyThread_acquire_lock(d.lock, 1)
+            PyThread_release_lock(d.lock)
+
+        for n in range(cd.total):
+            if d.reorder[n] != NULL:
+                self.funcs.freeFrame(d.reorder[n])
+        free(d.reorder)
+        PyThread_free_lock(d.lock)
+        PyThread_free_lock(d.done)
+
+        if stored_exception is not None:
+            raise stored_exception
+
+        if d.error[0]:
+            raise Error(d.error.decode('utf-8', 'replace'))
+
     def __add__(self, other):
         if not isinstance(other, VideoNode):
             raise TypeError('Only clips can be spliced')
@@ -1145,6 +1477,66 @@ cdef class Core(object):
             raise Error('Invalid format specified')
         return createFormat(fmt)
 
+    def create_video_frame(self, object format, int width, int height, object planes = None, VideoFrame prop_src = None):
+        cdef const VSFormat *fmt
+        cdef const VSFrameRef *propsrc = prop_src.constf if prop_src is not None else NULL
+        cdef ExternalFrameBuffers buffers
+        cdef VSFrameRef *f
+        cdef uint8_t *ptrs[3]
+        cdef uint8_t *dstp
+        cdef int strides[3]
+        cdef bint aligned = True
+        cdef int p
+        cdef int y
+        cdef int plane_width
+        cdef int plane_height
+        cdef Py_buffer *view
+
+        fmt = self.funcs.getFormatPreset(format.id if isinstance(format, Format) else format, self.core)
+        if fmt == NULL:
+            raise Error('Format not registered')
+        if width <= 0 or height <= 0 or width % (1 << fmt.subSamplingW) or height % (1 << fmt.subSamplingH):
+            raise Error('Invalid frame dimensions')
+
+        if planes is None:
+            return createVideoFrame(self.funcs.newVideoFrame(fmt, width, height, propsrc, self.core), self.funcs, self)
+
+        if len(planes) != fmt.numPlanes:
+            raise Error('The number of planes doesn\'t match the format')
+
+        buffers = ExternalFrameBuffers.__new__(ExternalFrameBuffers)
+        for p in range(fmt.numPlanes):
+            PyObject_GetBuffer(planes[p], &buffers.views[p], PyBUF_RECORDS_RO)
+            buffers.num_views = p + 1
+            view = &buffers.views[p]
+            plane_width = width >> (fmt.subSamplingW if p else 0)
+            plane_height = height >> (fmt.subSamplingH if p else 0)
+            if view.ndim != 2 or view.shape[0] != plane_height or view.shape[1] != plane_width:
+                raise Error('Plane ' + str(p) + ' has the wrong dimensions')
+            if view.itemsize != fmt.bytesPerSample or view.strides[1] != fmt.bytesPerSample:
+                raise Error('Plane ' + str(p) + ' has the wrong sample size or isn\'t contiguous along the lines')
+            ptrs[p] = <uint8_t *>view.buf
+            strides[p] = <int>view.strides[0]
+            # the core expects every frame of a format and width to have the same strides
+            if <uintptr_t>view.buf % 32 or view.strides[0] != (plane_width * fmt.bytesPerSample + 31) & ~31:
+                aligned = False
+
+        # Only aligned memory with the default strides can be used directly, everything else is copied
+        if aligned:
+            Py_INCREF(buffers)
+            f = self.funcs.newVideoFrameExternal(fmt, width, height, ptrs, strides, releaseExternalFrameBuffers, <void *>buffers, propsrc, self.core)
+            if f != NULL:
+                return createVideoFrame(f, self.funcs, self)
+            Py_DECREF(buffers)
+
+        f = self.funcs.newVideoFrame(fmt, width, height, propsrc, self.core)
+        for p in range(fmt.numPlanes):
+            view = &buffers.views[p]
+            dstp = self.funcs.getWritePtr(f, p)
+            for y in range(view.shape[0]):
+                memcpy(dstp + y * self.funcs.getStride(f, p), ptrs[p] + y * strides[p], view.shape[1] * view.itemsize)
+        return createVideoFrame(f, self.funcs, self)
+
     def get_format(self, int id):
         cdef const VSFormat *f = self.funcs.getFormatPreset(id, self.core)
 
@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2012-2015 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef VSOUTPUT_H
+#define VSOUTPUT_H
+
+#include <errno.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Used by VideoNode.output() to write frames straight to a file descriptor
+// without holding the GIL. Returns 0 on success and -1 on failure.
+static int vsWriteAll(int fd, const void *buf, size_t count) {
+    const char *p = (const char *)buf;
+    while (count > 0) {
+#ifdef _WIN32
+        int chunk = count > 0x40000000 ? 0x40000000 : (int)count;
+        int written = _write(fd, p, (unsigned)chunk);
+#else
+        ptrdiff_t written = write(fd, p, count);
+#endif
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += written;
+        count -= (size_t)written;
+    }
+    return 0;
+}
+
+#endif
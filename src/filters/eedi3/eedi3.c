@@ -33,6 +33,13 @@
 #include "VapourSynth.h"
 #include "VSHelper.h"
 
+#include "eedi3.h"
+
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "../../core/cpufeatures.h"
+#endif
+
 
 typedef struct {
     VSNodeRef *node;
@@ -44,9 +51,35 @@ typedef struct {
     int planes;
     float alpha, beta, gamma,  vthresh0, vthresh1, vthresh2;
     int field, nrad, mdis, vcheck;
+    int bps, peak;
+    float scale; // peak / 255, the costs that don't come from differences between pixels are multiplied by it
+
+    const VSFormat *scratchFormat;
+    int tasks; // the lines of a plane are split into this many tasks
+
+    SADRowFunc sadRow;
+    CostRowFunc costRow;
+    PathRowFunc pathRow;
+    VCheckRowFunc vcheckRow;
 } eedi3Data;
 
 
+// The line level code handles both 8 and 16 bit planes through these.
+static inline int getPixel(const uint8_t *p, int x, int bps)
+{
+    return bps == 1 ? p[x] : ((const uint16_t *)p)[x];
+}
+
+
+static inline void setPixel(uint8_t *p, int x, int v, int bps)
+{
+    if(bps == 1)
+        p[x] = (uint8_t)v;
+    else
+        ((uint16_t *)p)[x] = (uint16_t)v;
+}
+
+
 static void VS_CC eedi3Init(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi)
 {
     eedi3Data *d = (eedi3Data *) * instanceData;
@@ -54,10 +87,527 @@ static void VS_CC eedi3Init(VSMap *in, VSMap *out, void **instanceData, VSNode *
 }
 
 
+void eedi3SADRowC(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                  const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                  int nrad, int n, int *s)
+{
+    int i, k;
+
+    for(i = 0; i < n; ++i) {
+        int sum = 0;
+
+        for(k = i - nrad; k <= i + nrad; ++k)
+            sum +=
+                abs(a3p[k] - b1p[k]) +
+                abs(a1p[k] - b1n[k]) +
+                abs(a1n[k] - b3n[k]);
+
+        s[i] = sum;
+    }
+}
+
+
+void eedi3CostRowC(const int *s0, const int *s1, const int *s2, int cost3,
+                   const uint8_t *ipa, const uint8_t *ipb,
+                   const uint8_t *c1p, const uint8_t *c1n, int n,
+                   float alpha, float bu, float w, float *costs)
+{
+    int i;
+
+    for(i = 0; i < n; ++i) {
+        const int ip = (ipa[i] + ipb[i] + 1) >> 1; // should use cubic if ucubic=true
+        const int v = abs(c1p[i] - ip) + abs(c1n[i] - ip);
+
+        if(cost3)
+            costs[i] = alpha * (s0[i] + s1[i] + s2[i]) * 0.333333f + bu + w * v;
+        else
+            costs[i] = alpha * s0[i] + bu + w * v;
+    }
+}
+
+
+void eedi3PathRowC(const float *ppT, const float *tT, float *pT, int *piT,
+                   int ulim, int vlim, int r, const float *pen)
+{
+    int u, v;
+
+    for(u = -ulim; u <= ulim; ++u) {
+        int idx = 0;
+        float bval = FLT_MAX;
+
+        for(v = VSMAX(-vlim, u - r); v <= VSMIN(vlim, u + r); ++v) {
+            const double y = ppT[v] + pen[abs(u - v)];
+            const float ccost = (float)VSMIN(y, FLT_MAX * 0.9);
+
+            if(ccost < bval) {
+                bval = ccost;
+                idx = v;
+            }
+        }
+
+        const double y = bval + tT[u];
+
+        pT[u] = (float)VSMIN(y, FLT_MAX * 0.9);
+
+        piT[u] = idx;
+    }
+}
+
+
+void eedi3SADRow16C(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                    const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                    int nrad, int n, int *s)
+{
+    const uint16_t *a3 = (const uint16_t *)a3p;
+    const uint16_t *a1 = (const uint16_t *)a1p;
+    const uint16_t *a1b = (const uint16_t *)a1n;
+    const uint16_t *b1 = (const uint16_t *)b1p;
+    const uint16_t *b1b = (const uint16_t *)b1n;
+    const uint16_t *b3 = (const uint16_t *)b3n;
+    int i, k;
+
+    for(i = 0; i < n; ++i) {
+        int sum = 0;
+
+        for(k = i - nrad; k <= i + nrad; ++k)
+            sum +=
+                abs(a3[k] - b1[k]) +
+                abs(a1[k] - b1b[k]) +
+                abs(a1b[k] - b3[k]);
+
+        s[i] = sum;
+    }
+}
+
+
+void eedi3CostRow16C(const int *s0, const int *s1, const int *s2, int cost3,
+                     const uint8_t *ipa, const uint8_t *ipb,
+                     const uint8_t *c1p, const uint8_t *c1n, int n,
+                     float alpha, float bu, float w, float *costs)
+{
+    const uint16_t *a = (const uint16_t *)ipa;
+    const uint16_t *b = (const uint16_t *)ipb;
+    const uint16_t *p = (const uint16_t *)c1p;
+    const uint16_t *q = (const uint16_t *)c1n;
+    int i;
+
+    for(i = 0; i < n; ++i) {
+        const int ip = (a[i] + b[i] + 1) >> 1;
+        const int v = abs(p[i] - ip) + abs(q[i] - ip);
+
+        if(cost3)
+            costs[i] = alpha * (s0[i] + s1[i] + s2[i]) * 0.333333f + bu + w * v;
+        else
+            costs[i] = alpha * s0[i] + bu + w * v;
+    }
+}
+
+
+void eedi3VCheckRowC(const int *cur, const int *cint, const int *mdiff0,
+                     const int *mdiff1, const int *dircv, int n,
+                     float vthresh0, float vthresh1, float vthresh2, int *dst)
+{
+    int x;
+
+    for(x = 0; x < n; ++x) {
+        const float a0 = mdiff0[x] / vthresh0;
+        const float a1 = mdiff1[x] / vthresh1;
+        const float a2 = VSMAX((vthresh2 - dircv[x]) / vthresh2, 0.0f);
+        const float a = VSMIN(VSMAX(VSMAX(a0, a1), a2), 1.0f);
+
+        dst[x] = (int)((1.0 - a) * cur[x] + a * cint[x]);
+    }
+}
+
+
+#ifdef VS_TARGET_CPU_X86
+static inline __m128i absDiffU8(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+
+// The vector loops below handle the last partial block by moving it back so
+// it ends at n. This recomputes some outputs but never touches anything the
+// C versions wouldn't.
+static void sadRowSSE2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                       const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                       int nrad, int n, int *s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i, k;
+
+    if(n < 16) {
+        eedi3SADRowC(a3p, a1p, a1n, b1p, b1n, b3n, nrad, n, s);
+        return;
+    }
+
+    for(i = 0; i < n; i += 16) {
+        const int j = VSMIN(i, n - 16);
+        __m128i lo = zero;
+        __m128i hi = zero;
+
+        for(k = j - nrad; k <= j + nrad; ++k) {
+            const __m128i d0 = absDiffU8(_mm_loadu_si128((const __m128i *)(a3p + k)), _mm_loadu_si128((const __m128i *)(b1p + k)));
+            const __m128i d1 = absDiffU8(_mm_loadu_si128((const __m128i *)(a1p + k)), _mm_loadu_si128((const __m128i *)(b1n + k)));
+            const __m128i d2 = absDiffU8(_mm_loadu_si128((const __m128i *)(a1n + k)), _mm_loadu_si128((const __m128i *)(b3n + k)));
+            lo = _mm_add_epi16(lo, _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(d0, zero), _mm_unpacklo_epi8(d1, zero)), _mm_unpacklo_epi8(d2, zero)));
+            hi = _mm_add_epi16(hi, _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(d0, zero), _mm_unpackhi_epi8(d1, zero)), _mm_unpackhi_epi8(d2, zero)));
+        }
+
+        _mm_storeu_si128((__m128i *)(s + j), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(s + j + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(s + j + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(s + j + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+}
+
+
+static void costRowSSE2(const int *s0, const int *s1, const int *s2, int cost3,
+                        const uint8_t *ipa, const uint8_t *ipb,
+                        const uint8_t *c1p, const uint8_t *c1n, int n,
+                        float alpha, float bu, float w, float *costs)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 valpha = _mm_set1_ps(alpha);
+    const __m128 vthird = _mm_set1_ps(0.333333f);
+    const __m128 vbu = _mm_set1_ps(bu);
+    const __m128 vw = _mm_set1_ps(w);
+    int i, h;
+
+    if(n < 8) {
+        eedi3CostRowC(s0, s1, s2, cost3, ipa, ipb, c1p, c1n, n, alpha, bu, w, costs);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        const __m128i ip = _mm_avg_epu8(_mm_loadl_epi64((const __m128i *)(ipa + j)), _mm_loadl_epi64((const __m128i *)(ipb + j)));
+        const __m128i d0 = absDiffU8(_mm_loadl_epi64((const __m128i *)(c1p + j)), ip);
+        const __m128i d1 = absDiffU8(_mm_loadl_epi64((const __m128i *)(c1n + j)), ip);
+        const __m128i v16 = _mm_add_epi16(_mm_unpacklo_epi8(d0, zero), _mm_unpacklo_epi8(d1, zero));
+
+        for(h = 0; h < 8; h += 4) {
+            const __m128i v32 = h ? _mm_unpackhi_epi16(v16, zero) : _mm_unpacklo_epi16(v16, zero);
+            __m128i sum = _mm_loadu_si128((const __m128i *)(s0 + j + h));
+            __m128 c;
+
+            if(cost3) {
+                sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(s1 + j + h)));
+                sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(s2 + j + h)));
+                c = _mm_mul_ps(_mm_mul_ps(valpha, _mm_cvtepi32_ps(sum)), vthird);
+            } else {
+                c = _mm_mul_ps(valpha, _mm_cvtepi32_ps(sum));
+            }
+
+            c = _mm_add_ps(_mm_add_ps(c, vbu), _mm_mul_ps(vw, _mm_cvtepi32_ps(v32)));
+            _mm_storeu_ps(costs + j + h, c);
+        }
+    }
+}
+
+
+static void pathRowSSE2(const float *ppT, const float *tT, float *pT, int *piT,
+                        int ulim, int vlim, int r, const float *pen)
+{
+    const __m128 cmax = _mm_set1_ps((float)(FLT_MAX * 0.9));
+    const __m128 inf = _mm_set1_ps(FLT_MAX);
+    const __m128i lanes = _mm_set_epi32(3, 2, 1, 0);
+    const __m128i vmin = _mm_set1_epi32(-vlim - 1);
+    const __m128i vmax = _mm_set1_epi32(vlim + 1);
+    const int n = ulim * 2 + 1;
+    int i, k;
+
+    if(n < 4) {
+        eedi3PathRowC(ppT, tT, pT, piT, ulim, vlim, r, pen);
+        return;
+    }
+
+    for(i = 0; i < n; i += 4) {
+        const int u = VSMIN(i, n - 4) - ulim;
+        const __m128i vu = _mm_add_epi32(_mm_set1_epi32(u), lanes);
+        __m128 bval = inf;
+        __m128i idx = _mm_setzero_si128();
+
+        // same order as the C version so ties resolve to the lowest v
+        for(k = -r; k <= r; ++k) {
+            const __m128i vv = _mm_add_epi32(vu, _mm_set1_epi32(k));
+            const __m128 valid = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(vv, vmin), _mm_cmplt_epi32(vv, vmax)));
+            __m128 c = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(ppT + u + k), _mm_set1_ps(pen[abs(k)])), cmax);
+            c = _mm_or_ps(_mm_and_ps(valid, c), _mm_andnot_ps(valid, inf));
+
+            const __m128 lt = _mm_cmplt_ps(c, bval);
+            bval = _mm_or_ps(_mm_and_ps(lt, c), _mm_andnot_ps(lt, bval));
+            idx = _mm_or_si128(_mm_and_si128(_mm_castps_si128(lt), vv), _mm_andnot_si128(_mm_castps_si128(lt), idx));
+        }
+
+        _mm_storeu_ps(pT + u, _mm_min_ps(_mm_add_ps(bval, _mm_loadu_ps(tT + u)), cmax));
+        _mm_storeu_si128((__m128i *)(piT + u), idx);
+    }
+}
+
+
+static inline __m128i absDiffU16(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+
+// Three differences of 16 bit pixels don't fit in 16 bits so the sums are
+// widened before they're added.
+static void sadRow16SSE2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                         const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                         int nrad, int n, int *s)
+{
+    const uint16_t *a3 = (const uint16_t *)a3p;
+    const uint16_t *a1 = (const uint16_t *)a1p;
+    const uint16_t *a1b = (const uint16_t *)a1n;
+    const uint16_t *b1 = (const uint16_t *)b1p;
+    const uint16_t *b1b = (const uint16_t *)b1n;
+    const uint16_t *b3 = (const uint16_t *)b3n;
+    const __m128i zero = _mm_setzero_si128();
+    int i, k;
+
+    if(n < 8) {
+        eedi3SADRow16C(a3p, a1p, a1n, b1p, b1n, b3n, nrad, n, s);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        __m128i lo = zero;
+        __m128i hi = zero;
+
+        for(k = j - nrad; k <= j + nrad; ++k) {
+            const __m128i d0 = absDiffU16(_mm_loadu_si128((const __m128i *)(a3 + k)), _mm_loadu_si128((const __m128i *)(b1 + k)));
+            const __m128i d1 = absDiffU16(_mm_loadu_si128((const __m128i *)(a1 + k)), _mm_loadu_si128((const __m128i *)(b1b + k)));
+            const __m128i d2 = absDiffU16(_mm_loadu_si128((const __m128i *)(a1b + k)), _mm_loadu_si128((const __m128i *)(b3 + k)));
+            lo = _mm_add_epi32(lo, _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(d0, zero), _mm_unpacklo_epi16(d1, zero)), _mm_unpacklo_epi16(d2, zero)));
+            hi = _mm_add_epi32(hi, _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(d0, zero), _mm_unpackhi_epi16(d1, zero)), _mm_unpackhi_epi16(d2, zero)));
+        }
+
+        _mm_storeu_si128((__m128i *)(s + j), lo);
+        _mm_storeu_si128((__m128i *)(s + j + 4), hi);
+    }
+}
+
+
+static void costRow16SSE2(const int *s0, const int *s1, const int *s2, int cost3,
+                          const uint8_t *ipa, const uint8_t *ipb,
+                          const uint8_t *c1p, const uint8_t *c1n, int n,
+                          float alpha, float bu, float w, float *costs)
+{
+    const uint16_t *a = (const uint16_t *)ipa;
+    const uint16_t *b = (const uint16_t *)ipb;
+    const uint16_t *p = (const uint16_t *)c1p;
+    const uint16_t *q = (const uint16_t *)c1n;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 valpha = _mm_set1_ps(alpha);
+    const __m128 vthird = _mm_set1_ps(0.333333f);
+    const __m128 vbu = _mm_set1_ps(bu);
+    const __m128 vw = _mm_set1_ps(w);
+    int i, h;
+
+    if(n < 8) {
+        eedi3CostRow16C(s0, s1, s2, cost3, ipa, ipb, c1p, c1n, n, alpha, bu, w, costs);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        const __m128i ip = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + j)), _mm_loadu_si128((const __m128i *)(b + j)));
+        const __m128i d0 = absDiffU16(_mm_loadu_si128((const __m128i *)(p + j)), ip);
+        const __m128i d1 = absDiffU16(_mm_loadu_si128((const __m128i *)(q + j)), ip);
+
+        for(h = 0; h < 8; h += 4) {
+            const __m128i v32 = h ? _mm_add_epi32(_mm_unpackhi_epi16(d0, zero), _mm_unpackhi_epi16(d1, zero))
+                                  : _mm_add_epi32(_mm_unpacklo_epi16(d0, zero), _mm_unpacklo_epi16(d1, zero));
+            __m128i sum = _mm_loadu_si128((const __m128i *)(s0 + j + h));
+            __m128 c;
+
+            if(cost3) {
+                sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(s1 + j + h)));
+                sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(s2 + j + h)));
+                c = _mm_mul_ps(_mm_mul_ps(valpha, _mm_cvtepi32_ps(sum)), vthird);
+            } else {
+                c = _mm_mul_ps(valpha, _mm_cvtepi32_ps(sum));
+            }
+
+            c = _mm_add_ps(_mm_add_ps(c, vbu), _mm_mul_ps(vw, _mm_cvtepi32_ps(v32)));
+            _mm_storeu_ps(costs + j + h, c);
+        }
+    }
+}
+
+
+// Like in the C version a * cint is a float product and the rest of the blend
+// is done with doubles, two pixels at a time.
+static inline __m128i vcheckBlend2(__m128 a, __m128 acint, __m128i cur)
+{
+    const __m128d r = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_cvtps_pd(a)), _mm_cvtepi32_pd(cur)),
+                                 _mm_cvtps_pd(acint));
+    return _mm_cvttpd_epi32(r);
+}
+
+
+static void vcheckRowSSE2(const int *cur, const int *cint, const int *mdiff0,
+                          const int *mdiff1, const int *dircv, int n,
+                          float vthresh0, float vthresh1, float vthresh2, int *dst)
+{
+    const __m128 vt0 = _mm_set1_ps(vthresh0);
+    const __m128 vt1 = _mm_set1_ps(vthresh1);
+    const __m128 vt2 = _mm_set1_ps(vthresh2);
+    const __m128 one = _mm_set1_ps(1.0f);
+    int i;
+
+    if(n < 4) {
+        eedi3VCheckRowC(cur, cint, mdiff0, mdiff1, dircv, n, vthresh0, vthresh1, vthresh2, dst);
+        return;
+    }
+
+    for(i = 0; i < n; i += 4) {
+        const int j = VSMIN(i, n - 4);
+        const __m128 a0 = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(mdiff0 + j))), vt0);
+        const __m128 a1 = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(mdiff1 + j))), vt1);
+        const __m128 a2 = _mm_max_ps(_mm_div_ps(_mm_sub_ps(vt2, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(dircv + j)))), vt2), _mm_setzero_ps());
+        const __m128 a = _mm_min_ps(_mm_max_ps(_mm_max_ps(a0, a1), a2), one);
+        const __m128 ac = _mm_mul_ps(a, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(cint + j))));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(cur + j));
+        const __m128i lo = vcheckBlend2(a, ac, c);
+        const __m128i hi = vcheckBlend2(_mm_movehl_ps(a, a), _mm_movehl_ps(ac, ac), _mm_shuffle_epi32(c, 0xEE));
+
+        _mm_storeu_si128((__m128i *)(dst + j), _mm_unpacklo_epi64(lo, hi));
+    }
+}
+#endif
+
+
+// Connection costs are calculated one direction at a time since the pixels
+// compared for consecutive positions are then consecutive as well. The
+// second and third cost3 terms of a position are the first term of the
+// positions u pixels to the left and right with the same direction. The
+// row functions get byte pointers, so offsets are in samples times bps.
+static void calcCostsFP(const uint8_t *src3p, const uint8_t *src1p, const uint8_t *src1n,
+                        const uint8_t *src3n, const int width, const float alpha,
+                        const float beta, const int nrad, const int mdis, const int cost3,
+                        int *rows, float *ccosts, const eedi3Data *d)
+{
+    const int tpitch = mdis * 2 + 1;
+    const int bps = d->bps;
+    const float w = 1.0f - alpha - beta;
+    int *s0 = rows;
+    int *s1 = s0 + width;
+    int *s2 = s1 + width;
+    float *crow = (float *)(s2 + width);
+
+    int i, u;
+
+    for(u = -mdis; u <= mdis; ++u) {
+        // positions that have this direction
+        const int x0 = abs(u);
+        const int n = width - 2 * x0;
+        const int a = (x0 + u) * bps;
+        const int b = (x0 - u) * bps;
+        const int c = x0 * bps;
+
+        if(n <= 0)
+            continue;
+
+        d->sadRow(src3p + a, src1p + a, src1n + a, src1p + b, src1n + b, src3n + b, nrad, n, s0);
+
+        if(cost3) {
+            const int lo = u > 0 ? u * 2 : x0;
+            const int hi = u < 0 ? width + u * 2 : x0 + n;
+            const int a2 = (x0 + u * 2) * bps;
+            const int l = lo * bps;
+            const int l2 = (lo - u * 2) * bps;
+
+            d->sadRow(src3p + a2, src1p + a2, src1n + a2, src1p + c, src1n + c, src3n + c, nrad, n, s2);
+            memcpy(s1, s2, n * sizeof(int));
+
+            if(hi > lo)
+                d->sadRow(src3p + l, src1p + l, src1n + l,
+                          src1p + l2, src1n + l2, src3n + l2, nrad, hi - lo, s1 + lo - x0);
+        }
+
+        d->costRow(s0, s1, s2, cost3, src1p + a, src1n + b, src1p + c, src1n + c, n,
+                   alpha, beta * abs(u) * d->scale, w, crow);
+
+        for(i = 0; i < n; ++i)
+            ccosts[(x0 + i) * tpitch + mdis + u] = crow[i];
+    }
+}
+
+
+static void calcCostsHP(const uint8_t *src3p, const uint8_t *src1p, const uint8_t *src1n,
+                        const uint8_t *src3n, const uint8_t *hp3p, const uint8_t *hp1p,
+                        const uint8_t *hp1n, const uint8_t *hp3n, const int width, const float alpha,
+                        const float beta, const int nrad, const int mdis, const int cost3,
+                        int *rows, float *ccosts, const eedi3Data *d)
+{
+    const int tpitch = mdis * 4 + 1;
+    const int bps = d->bps;
+    const float w = 1.0f - alpha - beta;
+    int *s0 = rows;
+    int *s1 = s0 + width;
+    int *s2 = s1 + width;
+    float *crow = (float *)(s2 + width);
+
+    int i, u;
+
+    for(u = -mdis * 2; u <= mdis * 2; ++u) {
+        const int u2 = u >> 1;
+        const int x0 = (abs(u) + 1) >> 1;
+        const int n = width - 2 * x0;
+        const int a = (x0 + u2) * bps;
+        const int c = x0 * bps;
+        const uint8_t *ipa, *ipb;
+
+        if(n <= 0)
+            continue;
+
+        if(!(u & 1)) {
+            const int b = (x0 - u2) * bps;
+
+            d->sadRow(src3p + a, src1p + a, src1n + a, src1p + b, src1n + b, src3n + b, nrad, n, s0);
+            ipa = src1p + a;
+            ipb = src1n + b;
+        } else {
+            const int b = (x0 - u2 - 1) * bps;
+
+            d->sadRow(hp3p + a, hp1p + a, hp1n + a, hp1p + b, hp1n + b, hp3n + b, nrad, n, s0);
+            ipa = hp1p + a;
+            ipb = hp1n + b;
+        }
+
+        if(cost3) {
+            const int lo = u > 0 ? u : x0;
+            const int hi = u < 0 ? width + u : x0 + n;
+            const int a1 = (x0 + u) * bps;
+            const int l = lo * bps;
+            const int l1 = (lo - u) * bps;
+
+            d->sadRow(src3p + a1, src1p + a1, src1n + a1, src1p + c, src1n + c, src3n + c, nrad, n, s2);
+            memcpy(s1, s2, n * sizeof(int));
+
+            if(hi > lo)
+                d->sadRow(src3p + l, src1p + l, src1n + l,
+                          src1p + l1, src1n + l1, src3n + l1, nrad, hi - lo, s1 + lo - x0);
+        }
+
+        d->costRow(s0, s1, s2, cost3, ipa, ipb, src1p + c, src1n + c, n,
+                   alpha, beta * abs(u) * 0.5f * d->scale, w, crow);
+
+        for(i = 0; i < n; ++i)
+            ccosts[(x0 + i) * tpitch + mdis * 2 + u] = crow[i];
+    }
+}
+
+
 static void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
                          const float alpha, const float beta, const float gamma, const int nrad,
                          const int mdis, float *temp, uint8_t *dstp, int *dmap, const int ucubic,
-                         const int cost3)
+                         const int cost3, int *rows, const eedi3Data *d)
 {
     const uint8_t *src3p = srcp - 3 * pitch;
     const uint8_t *src1p = srcp - 1 * pitch;
@@ -68,101 +618,25 @@ static void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
     float *pcosts = ccosts + width * tpitch;
     int *pbackt = (int *)(pcosts + width * tpitch);
     int *fpath = pbackt + width * tpitch;
+    const float pen[2] = { gamma * 0, gamma * 1 };
+    const int bps = d->bps;
+    const int peak = d->peak;
 
-    int k, u, v, x;
+    int x;
 
     // calculate all connection costs
-    if(!cost3) {
-        for(x = 0; x < width; ++x) {
-            const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
-
-            for(u = -umax; u <= umax; ++u) {
-                int s = 0;
-
-                for(k = -nrad; k <= nrad; ++k)
-                    s +=
-                        abs(src3p[x + u + k] - src1p[x - u + k]) +
-                        abs(src1p[x + u + k] - src1n[x - u + k]) +
-                        abs(src1n[x + u + k] - src3n[x - u + k]);
-
-                const int ip = (src1p[x + u] + src1n[x - u] + 1) >> 1; // should use cubic if ucubic=true
-                const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-                ccosts[x * tpitch + mdis + u] = alpha * s + beta * abs(u) + (1.0f - alpha - beta) * v;
-            }
-        }
-    } else {
-        for(x = 0; x < width; ++x) {
-            const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
-
-            for(u = -umax; u <= umax; ++u) {
-                int s0 = 0, s1 = -1, s2 = -1;
-
-                for(k = -nrad; k <= nrad; ++k)
-                    s0 +=
-                        abs(src3p[x + u + k] - src1p[x - u + k]) +
-                        abs(src1p[x + u + k] - src1n[x - u + k]) +
-                        abs(src1n[x + u + k] - src3n[x - u + k]);
-
-                if((u >= 0 && x >= u * 2) || (u <= 0 && x < width + u * 2)) {
-                    s1 = 0;
-
-                    for(k = -nrad; k <= nrad; ++k)
-                        s1 +=
-                            abs(src3p[x + k] - src1p[x - u * 2 + k]) +
-                            abs(src1p[x + k] - src1n[x - u * 2 + k]) +
-                            abs(src1n[x + k] - src3n[x - u * 2 + k]);
-                }
-
-                if((u <= 0 && x >= u * 2) || (u >= 0 && x < width + u * 2)) {
-                    s2 = 0;
-
-                    for(k = -nrad; k <= nrad; ++k)
-                        s2 +=
-                            abs(src3p[x + u * 2 + k] - src1p[x + k]) +
-                            abs(src1p[x + u * 2 + k] - src1n[x + k]) +
-                            abs(src1n[x + u * 2 + k] - src3n[x + k]);
-                }
-
-                s1 = s1 >= 0 ? s1 : (s2 >= 0 ? s2 : s0);
-                s2 = s2 >= 0 ? s2 : (s1 >= 0 ? s1 : s0);
-                const int ip = (src1p[x + u] + src1n[x - u] + 1) >> 1; // should use cubic if ucubic=true
-                const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-                ccosts[x * tpitch + mdis + u] = alpha * (s0 + s1 + s2) * 0.333333f + beta * abs(u) + (1.0f - alpha - beta) * v;
-            }
-        }
-    }
+    calcCostsFP(src3p, src1p, src1n, src3n, width, alpha, beta, nrad, mdis, cost3, rows, ccosts, d);
 
     // calculate path costs
     pcosts[mdis] = ccosts[mdis];
 
     for(x = 1; x < width; ++x) {
-        float *tT = ccosts + x * tpitch;
-        float *ppT = pcosts + (x - 1) * tpitch;
-        float *pT = pcosts + x * tpitch;
-        int *piT = pbackt + (x - 1) * tpitch;
         const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
+        const int umax2 = VSMIN(VSMIN(x - 1, width - x), mdis);
 
-        for(u = -umax; u <= umax; ++u) {
-            int idx = 0;
-            float bval = FLT_MAX;
-            const int umax2 = VSMIN(VSMIN(x - 1, width - x), mdis);
-
-            for(v = VSMAX(-umax2, u - 1); v <= VSMIN(umax2, u + 1); ++v) {
-                const double y = ppT[mdis + v] + gamma * abs(u - v);
-                const float ccost = (float)VSMIN(y, FLT_MAX * 0.9);
-
-                if(ccost < bval) {
-                    bval = ccost;
-                    idx = v;
-                }
-            }
-
-            const double y = bval + tT[mdis + u];
-
-            pT[mdis + u] = (float)VSMIN(y, FLT_MAX * 0.9);
-
-            piT[mdis + u] = idx;
-        }
+        d->pathRow(pcosts + (x - 1) * tpitch + mdis, ccosts + x * tpitch + mdis,
+                   pcosts + x * tpitch + mdis, pbackt + (x - 1) * tpitch + mdis,
+                   umax, umax2, 1, pen);
     }
 
     // backtrack
@@ -178,10 +652,10 @@ static void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
         const int ad = abs(dir);
 
         if(ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
-            dstp[x] = VSMIN(VSMAX((36 * (src1p[x + dir] + src1n[x - dir]) -
-                               4 * (src3p[x + dir * 3] + src3n[x - dir * 3]) + 32) >> 6, 0), 255);
+            setPixel(dstp, x, VSMIN(VSMAX((36 * (getPixel(src1p, x + dir, bps) + getPixel(src1n, x - dir, bps)) -
+                                  4 * (getPixel(src3p, x + dir * 3, bps) + getPixel(src3n, x - dir * 3, bps)) + 32) >> 6, 0), peak), bps);
         else
-            dstp[x] = (src1p[x + dir] + src1n[x - dir] + 1) >> 1;
+            setPixel(dstp, x, (getPixel(src1p, x + dir, bps) + getPixel(src1n, x - dir, bps) + 1) >> 1, bps);
     }
 }
 
@@ -189,7 +663,7 @@ static void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
 static void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
                          const float alpha, const float beta, const float gamma, const int nrad,
                          const int mdis, float *temp, uint8_t *dstp, int *dmap, const int ucubic,
-                         const int cost3)
+                         const int cost3, int *rows, const eedi3Data *d)
 {
     const uint8_t *src3p = srcp - 3 * pitch;
     const uint8_t *src1p = srcp - 1 * pitch;
@@ -200,145 +674,43 @@ static void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
     float *pcosts = ccosts + width * tpitch;
     int *pbackt = (int *)(pcosts + width * tpitch);
     int *fpath = pbackt + width * tpitch;
-    // calculate half pel values
-    uint8_t *hp3p = (uint8_t *)fpath;
-    uint8_t *hp1p = hp3p + width;
-    uint8_t *hp1n = hp1p + width;
-    uint8_t *hp3n = hp1n + width;
-
-    int k, u, v, x;
-
-    for(x = 0; x < width - 1; ++x) {
-        if(!ucubic || (x == 0 || x == width - 2)) {
-            hp3p[x] = (src3p[x] + src3p[x + 1] + 1) >> 1;
-            hp1p[x] = (src1p[x] + src1p[x + 1] + 1) >> 1;
-            hp1n[x] = (src1n[x] + src1n[x + 1] + 1) >> 1;
-            hp3n[x] = (src3n[x] + src3n[x + 1] + 1) >> 1;
-        } else {
-            hp3p[x] = VSMIN(VSMAX((36 * (src3p[x] + src3p[x + 1]) - 4 * (src3p[x - 1] + src3p[x + 2]) + 32) >> 6, 0), 255);
-            hp1p[x] = VSMIN(VSMAX((36 * (src1p[x] + src1p[x + 1]) - 4 * (src1p[x - 1] + src1p[x + 2]) + 32) >> 6, 0), 255);
-            hp1n[x] = VSMIN(VSMAX((36 * (src1n[x] + src1n[x + 1]) - 4 * (src1n[x - 1] + src1n[x + 2]) + 32) >> 6, 0), 255);
-            hp3n[x] = VSMIN(VSMAX((36 * (src3n[x] + src3n[x + 1]) - 4 * (src3n[x - 1] + src3n[x + 2]) + 32) >> 6, 0), 255);
+    const int bps = d->bps;
+    const int peak = d->peak;
+    // calculate half pel values, the sad windows of the odd directions reach
+    // a few pixels past both ends of the line so the padding is filled too
+    uint8_t *hp[4];
+    const uint8_t *src[4] = { src3p, src1p, src1n, src3n };
+    const float pen[3] = { gamma * 0 * 0.5f, gamma * 1 * 0.5f, gamma * 2 * 0.5f };
+
+    int i, x;
+
+    for(i = 0; i < 4; ++i) {
+        const uint8_t *s = src[i];
+        hp[i] = (uint8_t *)fpath + (4 + i * (width + 8)) * bps;
+
+        for(x = -4; x < width + 4; ++x) {
+            if(!ucubic || x <= 0 || x >= width - 2)
+                setPixel(hp[i], x, (getPixel(s, x, bps) + getPixel(s, x + 1, bps) + 1) >> 1, bps);
+            else
+                setPixel(hp[i], x, VSMIN(VSMAX((36 * (getPixel(s, x, bps) + getPixel(s, x + 1, bps)) -
+                                        4 * (getPixel(s, x - 1, bps) + getPixel(s, x + 2, bps)) + 32) >> 6, 0), peak), bps);
         }
     }
 
     // calculate all connection costs
-    if(!cost3) {
-        for(x = 0; x < width; ++x) {
-            const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
-
-            for(u = -umax * 2; u <= umax * 2; ++u) {
-                int s = 0, ip;
-                const int u2 = u >> 1;
-
-                if(!(u & 1)) {
-                    for(k = -nrad; k <= nrad; ++k)
-                        s +=
-                            abs(src3p[x + u2 + k] - src1p[x - u2 + k]) +
-                            abs(src1p[x + u2 + k] - src1n[x - u2 + k]) +
-                            abs(src1n[x + u2 + k] - src3n[x - u2 + k]);
-
-                    ip = (src1p[x + u2] + src1n[x - u2] + 1) >> 1; // should use cubic if ucubic=true
-                } else {
-                    for(k = -nrad; k <= nrad; ++k)
-                        s +=
-                            abs(hp3p[x + u2 + k] - hp1p[x - u2 - 1 + k]) +
-                            abs(hp1p[x + u2 + k] - hp1n[x - u2 - 1 + k]) +
-                            abs(hp1n[x + u2 + k] - hp3n[x - u2 - 1 + k]);
-
-                    ip = (hp1p[x + u2] + hp1n[x - u2 - 1] + 1) >> 1; // should use cubic if ucubic=true
-                }
-
-                const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-
-                ccosts[x * tpitch + mdis * 2 + u] = alpha * s + beta * abs(u) * 0.5f + (1.0f - alpha - beta) * v;
-            }
-        }
-    } else {
-        for(x = 0; x < width; ++x) {
-            const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
-
-            for(u = -umax * 2; u <= umax * 2; ++u) {
-                int s0 = 0, s1 = -1, s2 = -1, ip;
-                const int u2 = u >> 1;
-
-                if(!(u & 1)) {
-                    for(k = -nrad; k <= nrad; ++k)
-                        s0 +=
-                            abs(src3p[x + u2 + k] - src1p[x - u2 + k]) +
-                            abs(src1p[x + u2 + k] - src1n[x - u2 + k]) +
-                            abs(src1n[x + u2 + k] - src3n[x - u2 + k]);
-
-                    ip = (src1p[x + u2] + src1n[x - u2] + 1) >> 1; // should use cubic if ucubic=true
-                } else {
-                    for(k = -nrad; k <= nrad; ++k)
-                        s0 +=
-                            abs(hp3p[x + u2 + k] - hp1p[x - u2 - 1 + k]) +
-                            abs(hp1p[x + u2 + k] - hp1n[x - u2 - 1 + k]) +
-                            abs(hp1n[x + u2 + k] - hp3n[x - u2 - 1 + k]);
-
-                    ip = (hp1p[x + u2] + hp1n[x - u2 - 1] + 1) >> 1; // should use cubic if ucubic=true
-                }
-
-                if((u >= 0 && x >= u) || (u <= 0 && x < width + u)) {
-                    s1 = 0;
-
-                    for(k = -nrad; k <= nrad; ++k)
-                        s1 +=
-                            abs(src3p[x + k] - src1p[x - u + k]) +
-                            abs(src1p[x + k] - src1n[x - u + k]) +
-                            abs(src1n[x + k] - src3n[x - u + k]);
-                }
-
-                if((u <= 0 && x >= u) || (u >= 0 && x < width + u)) {
-                    s2 = 0;
-
-                    for(k = -nrad; k <= nrad; ++k)
-                        s2 +=
-                            abs(src3p[x + u + k] - src1p[x + k]) +
-                            abs(src1p[x + u + k] - src1n[x + k]) +
-                            abs(src1n[x + u + k] - src3n[x + k]);
-                }
-
-                s1 = s1 >= 0 ? s1 : (s2 >= 0 ? s2 : s0);
-                s2 = s2 >= 0 ? s2 : (s1 >= 0 ? s1 : s0);
-                const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-                ccosts[x * tpitch + mdis * 2 + u] = alpha * (s0 + s1 + s2) * 0.333333f + beta * abs(u) * 0.5f + (1.0f - alpha - beta) * v;
-            }
-        }
-    }
+    calcCostsHP(src3p, src1p, src1n, src3n, hp[0], hp[1], hp[2], hp[3], width, alpha, beta, nrad, mdis,
+                cost3, rows, ccosts, d);
 
     // calculate path costs
     pcosts[mdis * 2] = ccosts[mdis * 2];
 
     for(x = 1; x < width; ++x) {
-        float *tT = ccosts + x * tpitch;
-        float *ppT = pcosts + (x - 1) * tpitch;
-        float *pT = pcosts + x * tpitch;
-        int *piT = pbackt + (x - 1) * tpitch;
         const int umax = VSMIN(VSMIN(x, width - 1 - x), mdis);
+        const int umax2 = VSMIN(VSMIN(x - 1, width - x), mdis);
 
-        for(u = -umax * 2; u <= umax * 2; ++u) {
-            int idx = 0;
-            float bval = FLT_MAX;
-            const int umax2 = VSMIN(VSMIN(x - 1, width - x), mdis);
-
-            for(v = VSMAX(-umax2 * 2, u - 2); v <= VSMIN(umax2 * 2, u + 2); ++v) {
-                const double y = ppT[mdis * 2 + v] + gamma * abs(u - v) * 0.5f;
-                const float ccost = (float)VSMIN(y, FLT_MAX * 0.9);
-
-                if(ccost < bval) {
-                    bval = ccost;
-                    idx = v;
-                }
-            }
-
-            const double y = bval + tT[mdis * 2 + u];
-
-            pT[mdis * 2 + u] = (float)VSMIN(y, FLT_MAX * 0.9);
-
-            piT[mdis * 2 + u] = idx;
-        }
+        d->pathRow(pcosts + (x - 1) * tpitch + mdis * 2, ccosts + x * tpitch + mdis * 2,
+                   pcosts + x * tpitch + mdis * 2, pbackt + (x - 1) * tpitch + mdis * 2,
+                   umax * 2, umax2 * 2, 2, pen);
     }
 
     // backtrack
@@ -357,73 +729,206 @@ static void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
             const int ad = abs(d2);
 
             if(ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
-                dstp[x] = VSMIN(VSMAX((36 * (src1p[x + d2] + src1n[x - d2]) -
-                                   4 * (src3p[x + d2 * 3] + src3n[x - d2 * 3]) + 32) >> 6, 0), 255);
+                setPixel(dstp, x, VSMIN(VSMAX((36 * (getPixel(src1p, x + d2, bps) + getPixel(src1n, x - d2, bps)) -
+                                      4 * (getPixel(src3p, x + d2 * 3, bps) + getPixel(src3n, x - d2 * 3, bps)) + 32) >> 6, 0), peak), bps);
             else
-                dstp[x] = (src1p[x + d2] + src1n[x - d2] + 1) >> 1;
+                setPixel(dstp, x, (getPixel(src1p, x + d2, bps) + getPixel(src1n, x - d2, bps) + 1) >> 1, bps);
         } else {
             const int d20 = dir >> 1;
             const int d21 = (dir + 1) >> 1;
             const int d30 = (dir * 3) >> 1;
             const int d31 = (dir * 3 + 1) >> 1;
             const int ad = VSMAX(abs(d30), abs(d31));
+            const int c1 = getPixel(src1p, x + d20, bps) + getPixel(src1p, x + d21, bps); // should use cubic if ucubic=true
+            const int c2 = getPixel(src1n, x - d20, bps) + getPixel(src1n, x - d21, bps); // should use cubic if ucubic=true
 
             if(ucubic && x >= ad && x <= width - 1 - ad) {
-                const int c0 = src3p[x + d30] + src3p[x + d31];
-                const int c1 = src1p[x + d20] + src1p[x + d21]; // should use cubic if ucubic=true
-                const int c2 = src1n[x - d20] + src1n[x - d21]; // should use cubic if ucubic=true
-                const int c3 = src3n[x - d30] + src3n[x - d31];
-                dstp[x] = VSMIN(VSMAX((36 * (c1 + c2) - 4 * (c0 + c3) + 64) >> 7, 0), 255);
+                const int c0 = getPixel(src3p, x + d30, bps) + getPixel(src3p, x + d31, bps);
+                const int c3 = getPixel(src3n, x - d30, bps) + getPixel(src3n, x - d31, bps);
+                setPixel(dstp, x, VSMIN(VSMAX((36 * (c1 + c2) - 4 * (c0 + c3) + 64) >> 7, 0), peak), bps);
             } else
-                dstp[x] = (src1p[x + d20] + src1p[x + d21] + src1n[x - d20] + src1n[x - d21] + 2) >> 2;
+                setPixel(dstp, x, (c1 + c2 + 2) >> 2, bps);
         }
     }
 }
 
 
-static VSFrameRef *copyPad(const VSFrameRef *src, int fn, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi, void **instanceData)
+typedef struct {
+    const eedi3Data *d;
+    const uint8_t *srcp;
+    uint8_t *dstp;
+    int *dmap;
+    int spitch, dpitch, dmpitch;
+    int width, lines, linesPerTask;
+    VSCore *core;
+    const VSAPI *vsapi;
+} eedi3Lines;
+
+
+// Interpolates one group of lines of a plane. Every line only depends on the
+// padded source so the groups can be processed in any order and on any thread.
+// The scratch memory of each group is a frame from the pool of the core so it
+// gets reused instead of allocated for every group.
+static void VS_CC interpLines(int index, void *userData)
 {
-    eedi3Data *d = (eedi3Data *) * instanceData;
+    eedi3Lines *l = (eedi3Lines *)userData;
+    const eedi3Data *d = l->d;
+    const VSAPI *vsapi = l->vsapi;
+    const int first = index * l->linesPerTask;
+    const int last = VSMIN(first + l->linesPerTask, l->lines);
+    const int wsrows = VSMAX(d->mdis * 4 + 1, 16) * 4;
+    int off;
+
+    VSFrameRef *scratch = vsapi->newVideoFrame(d->scratchFormat, d->vi.width * (int)sizeof(float), wsrows + 4, NULL, l->core);
+    float *workspace = (float *)vsapi->getWritePtr(scratch, 0);
+    int *rows = (int *)(workspace + d->vi.width * wsrows);
+
+    for(off = first; off < last; ++off) {
+        if(d->hp)
+            interpLineHP(l->srcp + off * 2 * l->spitch, l->width, l->spitch, d->alpha, d->beta,
+                         d->gamma, d->nrad, d->mdis, workspace, l->dstp + off * 2 * l->dpitch,
+                         l->dmap + off * l->dmpitch, d->ucubic, d->cost3, rows, d);
+        else
+            interpLineFP(l->srcp + off * 2 * l->spitch, l->width, l->spitch, d->alpha, d->beta,
+                         d->gamma, d->nrad, d->mdis, workspace, l->dstp + off * 2 * l->dpitch,
+                         l->dmap + off * l->dmpitch, d->ucubic, d->cost3, rows, d);
+    }
+
+    vsapi->freeFrame(scratch);
+}
+
+
+// Gathers what the vertical check needs for one line. Called with a constant
+// bps so it gets inlined into a separate loop for each sample size.
+static inline void vcheckGather(const uint8_t *dstp, const uint8_t *dst1p, const uint8_t *dst1n,
+                                const uint8_t *dst2p, const uint8_t *dst2n, const uint8_t *dst3p,
+                                const uint8_t *dst3n, const uint8_t *scpp, const int *dstpd,
+                                int dmpitch, int width, int *cur, int *cint, int *mdiff0,
+                                int *mdiff1, int *dircv, const eedi3Data *d, const int bps)
+{
+    int x;
 
+    for(x = 0; x < width; ++x) {
+        const int dirc = dstpd[x];
+        const int c = getPixel(dstp, x, bps);
+        const int c1p = getPixel(dst1p, x, bps);
+        const int c1n = getPixel(dst1n, x, bps);
+
+        cur[x] = c;
+        cint[x] = scpp ? getPixel(scpp, x, bps) :
+                  VSMIN(VSMAX((36 * (c1p + c1n) - 4 * (getPixel(dst3p, x, bps) + getPixel(dst3n, x, bps)) + 32) >> 6, 0), d->peak);
+
+        // these make the blend return cint
+        mdiff0[x] = 0;
+        mdiff1[x] = 0;
+        dircv[x] = 0;
+
+        if(dirc == 0)
+            continue;
+
+        const int dirt = dstpd[x - dmpitch];
+
+        const int dirb = dstpd[x + dmpitch];
+
+        if(VSMAX(dirc * dirt, dirc * dirb) < 0 || (dirt == dirb && dirt == 0))
+            continue;
+
+        int it, ib, vt, vb, vc;
+        vc = abs(c - c1p) + abs(c - c1n);
+
+        if(d->hp) {
+            if(!(dirc & 1)) {
+                const int d2 = dirc >> 1;
+                const int p2 = getPixel(dst2p, x + d2, bps);
+                const int p1 = getPixel(dst1p, x + d2, bps);
+                const int n2 = getPixel(dst2n, x - d2, bps);
+                const int n1 = getPixel(dst1n, x - d2, bps);
+                it = (p2 + getPixel(dstp, x - d2, bps) + 1) >> 1;
+                vt = abs(p2 - p1) + abs(getPixel(dstp, x + d2, bps) - p1);
+                ib = (getPixel(dstp, x + d2, bps) + n2 + 1) >> 1;
+                vb = abs(n2 - n1) + abs(getPixel(dstp, x - d2, bps) - n1);
+            } else {
+                const int d20 = dirc >> 1;
+                const int d21 = (dirc + 1) >> 1;
+                const int pa2p = getPixel(dst2p, x + d20, bps) + getPixel(dst2p, x + d21, bps) + 1;
+                const int pa1p = getPixel(dst1p, x + d20, bps) + getPixel(dst1p, x + d21, bps) + 1;
+                const int ps0 = getPixel(dstp, x - d20, bps) + getPixel(dstp, x - d21, bps) + 1;
+                const int pa0 = getPixel(dstp, x + d20, bps) + getPixel(dstp, x + d21, bps) + 1;
+                const int ps1n = getPixel(dst1n, x - d20, bps) + getPixel(dst1n, x - d21, bps) + 1;
+                const int ps2n = getPixel(dst2n, x - d20, bps) + getPixel(dst2n, x - d21, bps) + 1;
+                it = (pa2p + ps0) >> 2;
+                vt = (abs(pa2p - pa1p) + abs(pa0 - pa1p)) >> 1;
+                ib = (pa0 + ps2n) >> 2;
+                vb = (abs(ps2n - ps1n) + abs(ps0 - ps1n)) >> 1;
+            }
+        } else {
+            const int p2 = getPixel(dst2p, x + dirc, bps);
+            const int p1 = getPixel(dst1p, x + dirc, bps);
+            const int n2 = getPixel(dst2n, x - dirc, bps);
+            const int n1 = getPixel(dst1n, x - dirc, bps);
+            it = (p2 + getPixel(dstp, x - dirc, bps) + 1) >> 1;
+            vt = abs(p2 - p1) + abs(getPixel(dstp, x + dirc, bps) - p1);
+            ib = (getPixel(dstp, x + dirc, bps) + n2 + 1) >> 1;
+            vb = abs(n2 - n1) + abs(getPixel(dstp, x - dirc, bps) - n1);
+        }
+
+        const int d0 = abs(it - c1p);
+        const int d1 = abs(ib - c1n);
+        const int d2 = abs(vt - vc);
+        const int d3 = abs(vb - vc);
+
+        mdiff0[x] = d->vcheck == 1 ? VSMIN(d0, d1) : d->vcheck == 2 ? ((d0 + d1 + 1) >> 1) : VSMAX(d0, d1);
+        mdiff1[x] = d->vcheck == 1 ? VSMIN(d2, d3) : d->vcheck == 2 ? ((d2 + d3 + 1) >> 1) : VSMAX(d2, d3);
+        dircv[x] = d->hp ? (abs(dirc) >> 1) : abs(dirc);
+    }
+}
+
+
+// The padded frame comes from the frame pool of the core like any other frame.
+// Only the planes that are processed are padded.
+static VSFrameRef *copyPad(const VSFrameRef *src, int fn, const eedi3Data *d, VSCore *core, const VSAPI *vsapi)
+{
     const int off = 1 - fn;
+    const int bps = d->bps;
     VSFrameRef *srcPF = vsapi->newVideoFrame(d->vi.format, d->vi.width + 24 * (1 << d->vi.format->subSamplingW), d->vi.height + 8 * (1 << d->vi.format->subSamplingH), NULL, core);
 
     int b, x, y;
 
-    if(!d->dh) {
-        for(b = 0; b < d->vi.format->numPlanes; ++b)
-            vs_bitblt(vsapi->getWritePtr(srcPF, b) + vsapi->getStride(srcPF, b) * (4 + off) + 12,
+    for(b = 0; b < d->vi.format->numPlanes; ++b) {
+        if(!(d->planes & (1 << b)))
+            continue;
+
+        if(!d->dh)
+            vs_bitblt(vsapi->getWritePtr(srcPF, b) + vsapi->getStride(srcPF, b) * (4 + off) + 12 * bps,
                       vsapi->getStride(srcPF, b) * 2,
                       vsapi->getReadPtr(src, b) + vsapi->getStride(src, b)*off,
                       vsapi->getStride(src, b) * 2,
-                      vsapi->getFrameWidth(src, b) * d->vi.format->bytesPerSample,
+                      vsapi->getFrameWidth(src, b) * bps,
                       vsapi->getFrameHeight(src, b) >> 1);
-    } else {
-        for(b = 0; b < d->vi.format->numPlanes; ++b)
-            vs_bitblt(vsapi->getWritePtr(srcPF, b) + vsapi->getStride(srcPF, b) * (4 + off) + 12,
+        else
+            vs_bitblt(vsapi->getWritePtr(srcPF, b) + vsapi->getStride(srcPF, b) * (4 + off) + 12 * bps,
                       vsapi->getStride(srcPF, b) * 2,
                       vsapi->getReadPtr(src, b),
                       vsapi->getStride(src, b),
-                      vsapi->getFrameWidth(src, b) * d->vi.format->bytesPerSample,
+                      vsapi->getFrameWidth(src, b) * bps,
                       vsapi->getFrameHeight(src, b));
-    }
 
-    for(b = 0; b < d->vi.format->numPlanes; ++b) {
         // fixme, probably pads a bit too much with subsampled formats
         uint8_t *dstp = vsapi->getWritePtr(srcPF, b);
         const int dst_pitch = vsapi->getStride(srcPF, b);
-        const int height = vsapi->getFrameHeight(src, b) + 8;
-        const int width = vsapi->getFrameWidth(src, b) + 24;
+        // the padding is around a plane of the output size, with dh it's twice as tall as src
+        const int height = (b ? d->vi.height >> d->vi.format->subSamplingH : d->vi.height) + 8;
+        const int width = (b ? d->vi.width >> d->vi.format->subSamplingW : d->vi.width) + 24;
         dstp += (4 + off) * dst_pitch;
 
         for(y = 4 + off; y < height - 4; y += 2) {
             for(x = 0; x < 12; ++x)
-                dstp[x] = dstp[24 - x];
+                setPixel(dstp, x, getPixel(dstp, 24 - x, bps), bps);
 
             int c = 2;
 
             for(x = width - 12; x < width; ++x, c += 2)
-                dstp[x] = dstp[x - c];
+                setPixel(dstp, x, getPixel(dstp, x - c, bps), bps);
 
             dstp += dst_pitch * 2;
         }
@@ -432,13 +937,13 @@ static VSFrameRef *copyPad(const VSFrameRef *src, int fn, VSFrameContext *frameC
 
         for(y = off; y < 4; y += 2)
             vs_bitblt(dstp + y * dst_pitch, dst_pitch,
-                      dstp + (8 - y) * dst_pitch, dst_pitch, width, 1);
+                      dstp + (8 - y) * dst_pitch, dst_pitch, width * bps, 1);
 
         int c = 2 + 2 * off;
 
         for(y = height - 4 + off; y < height; y += 2, c += 4)
             vs_bitblt(dstp + y * dst_pitch, dst_pitch,
-                      dstp + (y - c) * dst_pitch, dst_pitch, width, 1);
+                      dstp + (y - c) * dst_pitch, dst_pitch, width * bps, 1);
     }
 
     return srcPF;
@@ -481,7 +986,7 @@ static const VSFrameRef *VS_CC eedi3GetFrame(int n, int activationReason, void *
         }
 
 
-        VSFrameRef *srcPF = copyPad(src, field_n, frameCtx, core, vsapi, instanceData);
+        VSFrameRef *srcPF = copyPad(src, field_n, d, core, vsapi);
 
         const VSFrameRef *scpPF;
 
@@ -494,26 +999,20 @@ static const VSFrameRef *VS_CC eedi3GetFrame(int n, int activationReason, void *
         VSFrameRef *dst = vsapi->newVideoFrame(d->vi.format, d->vi.width, d->vi.height, src, core);
         vsapi->freeFrame(src);
 
-        float *workspace = NULL;
-        VS_ALIGNED_MALLOC((void **)&workspace, d->vi.width * VSMAX(d->mdis * 4 + 1, 16) * 4 * sizeof(float), 16);
-        if (!workspace){
-            vsapi->setFilterError("EEDI3: Memory allocation failed", frameCtx);
-            vsapi->freeFrame(scpPF);
-            vsapi->freeFrame(srcPF);
-            vsapi->freeFrame(dst);
-            return 0;
-        }
-
-        int *dmapa = NULL;
-        VS_ALIGNED_MALLOC((void **)&dmapa, vsapi->getStride(dst, 0)*vsapi->getFrameHeight(dst, 0)*sizeof(int), 16);
-        if (!dmapa) {
-            VS_ALIGNED_FREE(workspace);
-            vsapi->setFilterError("EEDI3: Memory allocation failed", frameCtx);
-            vsapi->freeFrame(scpPF);
-            vsapi->freeFrame(srcPF);
-            vsapi->freeFrame(dst);
-            return 0;
-        }
+        // the direction map is followed by the rows the vertical check works with,
+        // it's a frame so the memory is recycled like the padded source
+        const int dmpitch = d->vi.width;
+        VSFrameRef *scratch = vsapi->newVideoFrame(d->scratchFormat, dmpitch * (int)sizeof(int), d->vi.height + 6, NULL, core);
+        int *dmapa = (int *)vsapi->getWritePtr(scratch, 0);
+        int *vcur = dmapa + dmpitch * d->vi.height;
+        int *vcint = vcur + dmpitch;
+        int *vmdiff0 = vcint + dmpitch;
+        int *vmdiff1 = vmdiff0 + dmpitch;
+        int *vdircv = vmdiff1 + dmpitch;
+        int *tline = vdircv + dmpitch;
+
+        const int tasks = d->tasks;
+        const int bps = d->bps;
 
         int b, x, y;
 
@@ -528,25 +1027,28 @@ static const VSFrameRef *VS_CC eedi3GetFrame(int n, int activationReason, void *
             uint8_t *dstp = vsapi->getWritePtr(dst, b);
             const int dpitch = vsapi->getStride(dst, b);
             vs_bitblt(dstp + (1 - field_n)*dpitch, dpitch * 2,
-                      srcp + (4 + 1 - field_n)*spitch + 12, spitch * 2,
-                      width - 24,
+                      srcp + (4 + 1 - field_n)*spitch + 12 * bps, spitch * 2,
+                      (width - 24) * bps,
                       (height - 8) >> 1);
             srcp += (4 + field_n) * spitch;
             dstp += field_n * dpitch;
 
-            // ~99% of the processing time is spent in this loop
-            for(y = 4 + field_n; y < height - 4; y += 2) {
-                const int off = (y - 4 - field_n) >> 1;
-
-                if(d->hp)
-                    interpLineHP(srcp + 12 + off * 2 * spitch, width - 24, spitch, d->alpha, d->beta,
-                                 d->gamma, d->nrad, d->mdis, workspace, dstp + off * 2 * dpitch,
-                                 dmapa + off * dpitch, d->ucubic, d->cost3);
-                else
-                    interpLineFP(srcp + 12 + off * 2 * spitch, width - 24, spitch, d->alpha, d->beta,
-                                 d->gamma, d->nrad, d->mdis, workspace, dstp + off * 2 * dpitch,
-                                 dmapa + off * dpitch, d->ucubic, d->cost3);
-            }
+            // ~99% of the processing time is spent here
+            eedi3Lines lines;
+            lines.d = d;
+            lines.srcp = srcp + 12 * bps;
+            lines.dstp = dstp;
+            lines.dmap = dmapa;
+            lines.spitch = spitch;
+            lines.dpitch = dpitch;
+            lines.dmpitch = dmpitch;
+            lines.width = width - 24;
+            lines.lines = (height - 8 - field_n + 1) >> 1;
+            lines.linesPerTask = VSMAX((lines.lines + tasks - 1) / tasks, 1);
+            lines.core = core;
+            lines.vsapi = vsapi;
+
+            vsapi->parallelFor((lines.lines + lines.linesPerTask - 1) / lines.linesPerTask, interpLines, &lines, core);
 
             if(d->vcheck > 0) {
                 int *dstpd = dmapa;
@@ -560,84 +1062,27 @@ static const VSFrameRef *VS_CC eedi3GetFrame(int n, int activationReason, void *
 
                 for(y = 4 + field_n; y < height - 4; y += 2) {
                     if(y >= 6 && y < height - 6) {
-                        const uint8_t *dst3p = srcp - 3 * spitch + 12;
+                        const uint8_t *dst3p = srcp - 3 * spitch + 12 * bps;
                         const uint8_t *dst2p = dstp - 2 * dpitch;
                         const uint8_t *dst1p = dstp - 1 * dpitch;
                         const uint8_t *dst1n = dstp + 1 * dpitch;
                         const uint8_t *dst2n = dstp + 2 * dpitch;
-                        const uint8_t *dst3n = srcp + 3 * spitch + 12;
-                        uint8_t *tline = (uint8_t *)workspace;
-
-                        for(x = 0; x < width - 24; ++x) {
-                            const int dirc = dstpd[x];
-                            const int cint = scpp ? scpp[x] :
-                                             VSMIN(VSMAX((36 * (dst1p[x] + dst1n[x]) - 4 * (dst3p[x] + dst3n[x]) + 32) >> 6, 0), 255);
-
-                            if(dirc == 0) {
-                                tline[x] = cint;
-                                continue;
-                            }
-
-                            const int dirt = dstpd[x - dpitch];
-
-                            const int dirb = dstpd[x + dpitch];
-
-                            if(VSMAX(dirc * dirt, dirc * dirb) < 0 || (dirt == dirb && dirt == 0)) {
-                                tline[x] = cint;
-                                continue;
-                            }
-
-                            int it, ib, vt, vb, vc;
-                            vc = abs(dstp[x] - dst1p[x]) + abs(dstp[x] - dst1n[x]);
-
-                            if(d->hp) {
-                                if(!(dirc & 1)) {
-                                    const int d2 = dirc >> 1;
-                                    it = (dst2p[x + d2] + dstp[x - d2] + 1) >> 1;
-                                    vt = abs(dst2p[x + d2] - dst1p[x + d2]) + abs(dstp[x + d2] - dst1p[x + d2]);
-                                    ib = (dstp[x + d2] + dst2n[x - d2] + 1) >> 1;
-                                    vb = abs(dst2n[x - d2] - dst1n[x - d2]) + abs(dstp[x - d2] - dst1n[x - d2]);
-                                } else {
-                                    const int d20 = dirc >> 1;
-                                    const int d21 = (dirc + 1) >> 1;
-                                    const int pa2p = dst2p[x + d20] + dst2p[x + d21] + 1;
-                                    const int pa1p = dst1p[x + d20] + dst1p[x + d21] + 1;
-                                    const int ps0 = dstp[x - d20] + dstp[x - d21] + 1;
-                                    const int pa0 = dstp[x + d20] + dstp[x + d21] + 1;
-                                    const int ps1n = dst1n[x - d20] + dst1n[x - d21] + 1;
-                                    const int ps2n = dst2n[x - d20] + dst2n[x - d21] + 1;
-                                    it = (pa2p + ps0) >> 2;
-                                    vt = (abs(pa2p - pa1p) + abs(pa0 - pa1p)) >> 1;
-                                    ib = (pa0 + ps2n) >> 2;
-                                    vb = (abs(ps2n - ps1n) + abs(ps0 - ps1n)) >> 1;
-                                }
-                            } else {
-                                it = (dst2p[x + dirc] + dstp[x - dirc] + 1) >> 1;
-                                vt = abs(dst2p[x + dirc] - dst1p[x + dirc]) + abs(dstp[x + dirc] - dst1p[x + dirc]);
-                                ib = (dstp[x + dirc] + dst2n[x - dirc] + 1) >> 1;
-                                vb = abs(dst2n[x - dirc] - dst1n[x - dirc]) + abs(dstp[x - dirc] - dst1n[x - dirc]);
-                            }
-
-                            const int d0 = abs(it - dst1p[x]);
-                            const int d1 = abs(ib - dst1n[x]);
-                            const int d2 = abs(vt - vc);
-                            const int d3 = abs(vb - vc);
-
-                            const int mdiff0 = d->vcheck == 1 ? VSMIN(d0, d1) : d->vcheck == 2 ? ((d0 + d1 + 1) >> 1) : VSMAX(d0, d1);
-                            const int mdiff1 = d->vcheck == 1 ? VSMIN(d2, d3) : d->vcheck == 2 ? ((d2 + d3 + 1) >> 1) : VSMAX(d2, d3);
-
-                            const float a0 = mdiff0 / d->vthresh0;
-                            const float a1 = mdiff1 / d->vthresh1;
-
-                            const int dircv = d->hp ? (abs(dirc) >> 1) : abs(dirc);
-
-                            const float a2 = VSMAX((d->vthresh2 - dircv) / d->vthresh2, 0.0f);
-                            const float a = VSMIN(VSMAX(VSMAX(a0, a1), a2), 1.0f);
-
-                            tline[x] = (int)((1.0 - a) * dstp[x] + a * cint);
-                        }
-
-                        memcpy(dstp, tline, width - 24);
+                        const uint8_t *dst3n = srcp + 3 * spitch + 12 * bps;
+
+                        // the checks need scattered reads, the blend with its
+                        // divisions and double math is done in a separate pass
+                        if(bps == 1)
+                            vcheckGather(dstp, dst1p, dst1n, dst2p, dst2n, dst3p, dst3n, scpp, dstpd, dmpitch,
+                                         width - 24, vcur, vcint, vmdiff0, vmdiff1, vdircv, d, 1);
+                        else
+                            vcheckGather(dstp, dst1p, dst1n, dst2p, dst2n, dst3p, dst3n, scpp, dstpd, dmpitch,
+                                         width - 24, vcur, vcint, vmdiff0, vmdiff1, vdircv, d, 2);
+
+                        d->vcheckRow(vcur, vcint, vmdiff0, vmdiff1, vdircv, width - 24,
+                                     d->vthresh0, d->vthresh1, d->vthresh2, tline);
+
+                        for(x = 0; x < width - 24; ++x)
+                            setPixel(dstp, x, tline[x], bps);
                     }
 
                     srcp += 2 * spitch;
@@ -646,13 +1091,12 @@ static const VSFrameRef *VS_CC eedi3GetFrame(int n, int activationReason, void *
                     if(scpp)
                         scpp += 2 * scpitch;
 
-                    dstpd += dpitch;
+                    dstpd += dmpitch;
                 }
             }
         }
 
-        VS_ALIGNED_FREE(dmapa);
-        VS_ALIGNED_FREE(workspace);
+        vsapi->freeFrame(scratch);
         vsapi->freeFrame(srcPF);
         vsapi->freeFrame(scpPF);
 
@@ -689,6 +1133,7 @@ static void VS_CC eedi3Create(const VSMap *in, VSMap *out, void *userData, VSCor
     eedi3Data d;
     eedi3Data *data;
     int err;
+    int threads;
 
     d.node = vsapi->propGetNode(in, "clip", 0, 0);
     d.vi = *vsapi->getVideoInfo(d.node);
@@ -773,8 +1218,8 @@ static void VS_CC eedi3Create(const VSMap *in, VSMap *out, void *userData, VSCor
     // goto or macro... macro or goto...
     char msg[80];
 
-    if(d.vi.format->bytesPerSample != 1) {
-        sprintf(msg, "eedi3:  only 8 bits per sample input supported");
+    if(!d.vi.format || d.vi.format->sampleType != stInteger || d.vi.format->bytesPerSample > 2) {
+        sprintf(msg, "eedi3:  only constant format 8-16 bits per sample integer input supported");
         goto error;
     }
 
@@ -840,6 +1285,15 @@ static void VS_CC eedi3Create(const VSMap *in, VSMap *out, void *userData, VSCor
         goto error;
     }
 
+    // gamma and the vertical check thresholds are given in 8 bit units, beta is
+    // scaled where it's used since the weight of the differences depends on it
+    d.bps = d.vi.format->bytesPerSample;
+    d.peak = (1 << d.vi.format->bitsPerSample) - 1;
+    d.scale = d.peak / 255.0f;
+    d.gamma *= d.scale;
+    d.vthresh0 *= d.scale;
+    d.vthresh1 *= d.scale;
+
     if(d.field > 1) {
         d.vi.numFrames *= 2;
         muldivRational(&d.vi.fpsNum, &d.vi.fpsDen, 2, 1);
@@ -861,6 +1315,35 @@ static void VS_CC eedi3Create(const VSMap *in, VSMap *out, void *userData, VSCor
     }
 
 
+    d.scratchFormat = vsapi->getFormatPreset(pfGray8, core);
+
+    // several tasks per thread so the work still spreads evenly when only some workers are idle,
+    // getCoreInfo() isn't thread safe so it can't be called from the getframe function
+    threads = vsapi->getCoreInfo(core)->numThreads;
+    d.tasks = threads > 1 ? threads * 4 : 1;
+
+    d.sadRow = d.bps == 1 ? eedi3SADRowC : eedi3SADRow16C;
+    d.costRow = d.bps == 1 ? eedi3CostRowC : eedi3CostRow16C;
+    d.pathRow = eedi3PathRowC;
+    d.vcheckRow = eedi3VCheckRowC;
+
+#ifdef VS_TARGET_CPU_X86
+    CPUFeatures cpu;
+    getCPUFeatures(&cpu);
+
+    if(cpu.avx2) {
+        d.sadRow = d.bps == 1 ? eedi3SADRowAVX2 : eedi3SADRow16AVX2;
+        d.costRow = d.bps == 1 ? eedi3CostRowAVX2 : eedi3CostRow16AVX2;
+        d.pathRow = eedi3PathRowAVX2;
+        d.vcheckRow = eedi3VCheckRowAVX2;
+    } else {
+        d.sadRow = d.bps == 1 ? sadRowSSE2 : sadRow16SSE2;
+        d.costRow = d.bps == 1 ? costRowSSE2 : costRow16SSE2;
+        d.pathRow = pathRowSSE2;
+        d.vcheckRow = vcheckRowSSE2;
+    }
+#endif
+
     data = (eedi3Data *)malloc(sizeof(d));
     *data = d;
 
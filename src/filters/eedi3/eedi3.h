@@ -0,0 +1,101 @@
+/*
+**   VapourSynth port by Fredrik Mellbin
+**
+**   eedi3 (enhanced edge directed interpolation 3). Works by finding the
+**   best non-decreasing (non-crossing) warping between two lines according to
+**   a cost functional. Doesn't really have anything to do with eedi2 aside
+**   from doing edge-directed interpolation (they use different techniques).
+**
+**   Copyright (C) 2010 Kevin Stone
+**
+**   This program is free software; you can redistribute it and/or modify
+**   it under the terms of the GNU General Public License as published by
+**   the Free Software Foundation; either version 2 of the License, or
+**   (at your option) any later version.
+**
+**   This program is distributed in the hope that it will be useful,
+**   but WITHOUT ANY WARRANTY; without even the implied warranty of
+**   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**   GNU General Public License for more details.
+**
+**   You should have received a copy of the GNU General Public License
+**   along with this program; if not, write to the Free Software
+**   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef EEDI3_H
+#define EEDI3_H
+
+#include <stdint.h>
+
+// Sum of absolute differences between the a and b lines over 2*nrad+1 pixels
+// for n consecutive positions. The lines are passed as 3p, 1p, 1n and 1p, 1n, 3n.
+typedef void (*SADRowFunc)(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                           const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                           int nrad, int n, int *s);
+
+// Connection costs for one direction at n consecutive positions. s1 and s2
+// are only used when cost3 is set.
+typedef void (*CostRowFunc)(const int *s0, const int *s1, const int *s2, int cost3,
+                            const uint8_t *ipa, const uint8_t *ipb,
+                            const uint8_t *c1p, const uint8_t *c1n, int n,
+                            float alpha, float bu, float w, float *costs);
+
+// Path costs for all directions in [-ulim, ulim] of one position. The
+// previous position has directions in [-vlim, vlim] and a direction may
+// change by at most r, pen[d] is the penalty for changing it by d.
+typedef void (*PathRowFunc)(const float *ppT, const float *tT, float *pT, int *piT,
+                            int ulim, int vlim, int r, const float *pen);
+
+// Blends the interpolated pixels cur with cint by how much the vertical
+// check failed. mdiff0, mdiff1 and dircv are the differences and direction
+// the check found, pixels that fail it entirely have them all set to 0.
+typedef void (*VCheckRowFunc)(const int *cur, const int *cint, const int *mdiff0,
+                              const int *mdiff1, const int *dircv, int n,
+                              float vthresh0, float vthresh1, float vthresh2, int *dst);
+
+#ifdef VS_TARGET_CPU_X86
+void eedi3SADRowAVX2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                     const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                     int nrad, int n, int *s);
+void eedi3CostRowAVX2(const int *s0, const int *s1, const int *s2, int cost3,
+                      const uint8_t *ipa, const uint8_t *ipb,
+                      const uint8_t *c1p, const uint8_t *c1n, int n,
+                      float alpha, float bu, float w, float *costs);
+void eedi3PathRowAVX2(const float *ppT, const float *tT, float *pT, int *piT,
+                      int ulim, int vlim, int r, const float *pen);
+void eedi3SADRow16AVX2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                       const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                       int nrad, int n, int *s);
+void eedi3CostRow16AVX2(const int *s0, const int *s1, const int *s2, int cost3,
+                        const uint8_t *ipa, const uint8_t *ipb,
+                        const uint8_t *c1p, const uint8_t *c1n, int n,
+                        float alpha, float bu, float w, float *costs);
+void eedi3VCheckRowAVX2(const int *cur, const int *cint, const int *mdiff0,
+                        const int *mdiff1, const int *dircv, int n,
+                        float vthresh0, float vthresh1, float vthresh2, int *dst);
+#endif
+
+void eedi3SADRowC(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                  const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                  int nrad, int n, int *s);
+void eedi3CostRowC(const int *s0, const int *s1, const int *s2, int cost3,
+                   const uint8_t *ipa, const uint8_t *ipb,
+                   const uint8_t *c1p, const uint8_t *c1n, int n,
+                   float alpha, float bu, float w, float *costs);
+void eedi3PathRowC(const float *ppT, const float *tT, float *pT, int *piT,
+                   int ulim, int vlim, int r, const float *pen);
+
+// The 16 bit versions take the same pointers, they point to uint16_t samples.
+void eedi3SADRow16C(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                    const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                    int nrad, int n, int *s);
+void eedi3CostRow16C(const int *s0, const int *s1, const int *s2, int cost3,
+                     const uint8_t *ipa, const uint8_t *ipb,
+                     const uint8_t *c1p, const uint8_t *c1n, int n,
+                     float alpha, float bu, float w, float *costs);
+void eedi3VCheckRowC(const int *cur, const int *cint, const int *mdiff0,
+                     const int *mdiff1, const int *dircv, int n,
+                     float vthresh0, float vthresh1, float vthresh2, int *dst);
+
+#endif
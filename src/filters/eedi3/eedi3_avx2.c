@@ -0,0 +1,292 @@
+/*
+**   VapourSynth port by Fredrik Mellbin
+**
+**   eedi3 (enhanced edge directed interpolation 3). Works by finding the
+**   best non-decreasing (non-crossing) warping between two lines according to
+**   a cost functional. Doesn't really have anything to do with eedi2 aside
+**   from doing edge-directed interpolation (they use different techniques).
+**
+**   Copyright (C) 2010 Kevin Stone
+**
+**   This program is free software; you can redistribute it and/or modify
+**   it under the terms of the GNU General Public License as published by
+**   the Free Software Foundation; either version 2 of the License, or
+**   (at your option) any later version.
+**
+**   This program is distributed in the hope that it will be useful,
+**   but WITHOUT ANY WARRANTY; without even the implied warranty of
+**   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**   GNU General Public License for more details.
+**
+**   You should have received a copy of the GNU General Public License
+**   along with this program; if not, write to the Free Software
+**   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. Multiplies and adds are kept separate so the results are
+// identical to the C versions.
+
+#ifdef VS_TARGET_CPU_X86
+#include <float.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "VSHelper.h"
+
+#include "eedi3.h"
+
+
+static inline __m256i absDiffU8(__m256i a, __m256i b)
+{
+    return _mm256_sub_epi8(_mm256_max_epu8(a, b), _mm256_min_epu8(a, b));
+}
+
+
+void eedi3SADRowAVX2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                     const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                     int nrad, int n, int *s)
+{
+    int i, k;
+
+    if(n < 32) {
+        eedi3SADRowC(a3p, a1p, a1n, b1p, b1n, b3n, nrad, n, s);
+        return;
+    }
+
+    for(i = 0; i < n; i += 32) {
+        const int j = VSMIN(i, n - 32);
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+
+        for(k = j - nrad; k <= j + nrad; ++k) {
+            const __m256i d0 = absDiffU8(_mm256_loadu_si256((const __m256i *)(a3p + k)), _mm256_loadu_si256((const __m256i *)(b1p + k)));
+            const __m256i d1 = absDiffU8(_mm256_loadu_si256((const __m256i *)(a1p + k)), _mm256_loadu_si256((const __m256i *)(b1n + k)));
+            const __m256i d2 = absDiffU8(_mm256_loadu_si256((const __m256i *)(a1n + k)), _mm256_loadu_si256((const __m256i *)(b3n + k)));
+            lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d0)));
+            lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d1)));
+            lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(d2)));
+            hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d0, 1)));
+            hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d1, 1)));
+            hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(d2, 1)));
+        }
+
+        _mm256_storeu_si256((__m256i *)(s + j), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(lo)));
+        _mm256_storeu_si256((__m256i *)(s + j + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(lo, 1)));
+        _mm256_storeu_si256((__m256i *)(s + j + 16), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(hi)));
+        _mm256_storeu_si256((__m256i *)(s + j + 24), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(hi, 1)));
+    }
+}
+
+
+void eedi3CostRowAVX2(const int *s0, const int *s1, const int *s2, int cost3,
+                      const uint8_t *ipa, const uint8_t *ipb,
+                      const uint8_t *c1p, const uint8_t *c1n, int n,
+                      float alpha, float bu, float w, float *costs)
+{
+    const __m256 valpha = _mm256_set1_ps(alpha);
+    const __m256 vthird = _mm256_set1_ps(0.333333f);
+    const __m256 vbu = _mm256_set1_ps(bu);
+    const __m256 vw = _mm256_set1_ps(w);
+    int i;
+
+    if(n < 8) {
+        eedi3CostRowC(s0, s1, s2, cost3, ipa, ipb, c1p, c1n, n, alpha, bu, w, costs);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        const __m128i ip = _mm_avg_epu8(_mm_loadl_epi64((const __m128i *)(ipa + j)), _mm_loadl_epi64((const __m128i *)(ipb + j)));
+        const __m128i p = _mm_loadl_epi64((const __m128i *)(c1p + j));
+        const __m128i q = _mm_loadl_epi64((const __m128i *)(c1n + j));
+        const __m128i d0 = _mm_sub_epi8(_mm_max_epu8(p, ip), _mm_min_epu8(p, ip));
+        const __m128i d1 = _mm_sub_epi8(_mm_max_epu8(q, ip), _mm_min_epu8(q, ip));
+        const __m256i v = _mm256_add_epi32(_mm256_cvtepu8_epi32(d0), _mm256_cvtepu8_epi32(d1));
+        __m256i sum = _mm256_loadu_si256((const __m256i *)(s0 + j));
+        __m256 c;
+
+        if(cost3) {
+            sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i *)(s1 + j)));
+            sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i *)(s2 + j)));
+            c = _mm256_mul_ps(_mm256_mul_ps(valpha, _mm256_cvtepi32_ps(sum)), vthird);
+        } else {
+            c = _mm256_mul_ps(valpha, _mm256_cvtepi32_ps(sum));
+        }
+
+        c = _mm256_add_ps(_mm256_add_ps(c, vbu), _mm256_mul_ps(vw, _mm256_cvtepi32_ps(v)));
+        _mm256_storeu_ps(costs + j, c);
+    }
+}
+
+
+void eedi3PathRowAVX2(const float *ppT, const float *tT, float *pT, int *piT,
+                      int ulim, int vlim, int r, const float *pen)
+{
+    const __m256 cmax = _mm256_set1_ps((float)(FLT_MAX * 0.9));
+    const __m256 inf = _mm256_set1_ps(FLT_MAX);
+    const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i vmin = _mm256_set1_epi32(-vlim - 1);
+    const __m256i vmax = _mm256_set1_epi32(vlim + 1);
+    const int n = ulim * 2 + 1;
+    int i, k;
+
+    if(n < 8) {
+        eedi3PathRowC(ppT, tT, pT, piT, ulim, vlim, r, pen);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int u = VSMIN(i, n - 8) - ulim;
+        const __m256i vu = _mm256_add_epi32(_mm256_set1_epi32(u), lanes);
+        __m256 bval = inf;
+        __m256i idx = _mm256_setzero_si256();
+
+        for(k = -r; k <= r; ++k) {
+            const __m256i vv = _mm256_add_epi32(vu, _mm256_set1_epi32(k));
+            const __m256 valid = _mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(vv, vmin), _mm256_cmpgt_epi32(vmax, vv)));
+            __m256 c = _mm256_min_ps(_mm256_add_ps(_mm256_loadu_ps(ppT + u + k), _mm256_set1_ps(pen[abs(k)])), cmax);
+            c = _mm256_blendv_ps(inf, c, valid);
+
+            const __m256 lt = _mm256_cmp_ps(c, bval, _CMP_LT_OQ);
+            bval = _mm256_blendv_ps(bval, c, lt);
+            idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(idx), _mm256_castsi256_ps(vv), lt));
+        }
+
+        _mm256_storeu_ps(pT + u, _mm256_min_ps(_mm256_add_ps(bval, _mm256_loadu_ps(tT + u)), cmax));
+        _mm256_storeu_si256((__m256i *)(piT + u), idx);
+    }
+}
+
+
+static inline __m256i absDiffU16(__m256i a, __m256i b)
+{
+    return _mm256_sub_epi16(_mm256_max_epu16(a, b), _mm256_min_epu16(a, b));
+}
+
+
+void eedi3SADRow16AVX2(const uint8_t *a3p, const uint8_t *a1p, const uint8_t *a1n,
+                       const uint8_t *b1p, const uint8_t *b1n, const uint8_t *b3n,
+                       int nrad, int n, int *s)
+{
+    const uint16_t *a3 = (const uint16_t *)a3p;
+    const uint16_t *a1 = (const uint16_t *)a1p;
+    const uint16_t *a1b = (const uint16_t *)a1n;
+    const uint16_t *b1 = (const uint16_t *)b1p;
+    const uint16_t *b1b = (const uint16_t *)b1n;
+    const uint16_t *b3 = (const uint16_t *)b3n;
+    int i, k;
+
+    if(n < 16) {
+        eedi3SADRow16C(a3p, a1p, a1n, b1p, b1n, b3n, nrad, n, s);
+        return;
+    }
+
+    for(i = 0; i < n; i += 16) {
+        const int j = VSMIN(i, n - 16);
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+
+        for(k = j - nrad; k <= j + nrad; ++k) {
+            const __m256i d0 = absDiffU16(_mm256_loadu_si256((const __m256i *)(a3 + k)), _mm256_loadu_si256((const __m256i *)(b1 + k)));
+            const __m256i d1 = absDiffU16(_mm256_loadu_si256((const __m256i *)(a1 + k)), _mm256_loadu_si256((const __m256i *)(b1b + k)));
+            const __m256i d2 = absDiffU16(_mm256_loadu_si256((const __m256i *)(a1b + k)), _mm256_loadu_si256((const __m256i *)(b3 + k)));
+            lo = _mm256_add_epi32(lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d0)));
+            lo = _mm256_add_epi32(lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d1)));
+            lo = _mm256_add_epi32(lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(d2)));
+            hi = _mm256_add_epi32(hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d0, 1)));
+            hi = _mm256_add_epi32(hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d1, 1)));
+            hi = _mm256_add_epi32(hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(d2, 1)));
+        }
+
+        _mm256_storeu_si256((__m256i *)(s + j), lo);
+        _mm256_storeu_si256((__m256i *)(s + j + 8), hi);
+    }
+}
+
+
+void eedi3CostRow16AVX2(const int *s0, const int *s1, const int *s2, int cost3,
+                        const uint8_t *ipa, const uint8_t *ipb,
+                        const uint8_t *c1p, const uint8_t *c1n, int n,
+                        float alpha, float bu, float w, float *costs)
+{
+    const uint16_t *a = (const uint16_t *)ipa;
+    const uint16_t *b = (const uint16_t *)ipb;
+    const uint16_t *pp = (const uint16_t *)c1p;
+    const uint16_t *qp = (const uint16_t *)c1n;
+    const __m256 valpha = _mm256_set1_ps(alpha);
+    const __m256 vthird = _mm256_set1_ps(0.333333f);
+    const __m256 vbu = _mm256_set1_ps(bu);
+    const __m256 vw = _mm256_set1_ps(w);
+    int i;
+
+    if(n < 8) {
+        eedi3CostRow16C(s0, s1, s2, cost3, ipa, ipb, c1p, c1n, n, alpha, bu, w, costs);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        const __m128i ip = _mm_avg_epu16(_mm_loadu_si128((const __m128i *)(a + j)), _mm_loadu_si128((const __m128i *)(b + j)));
+        const __m128i p = _mm_loadu_si128((const __m128i *)(pp + j));
+        const __m128i q = _mm_loadu_si128((const __m128i *)(qp + j));
+        const __m128i d0 = _mm_sub_epi16(_mm_max_epu16(p, ip), _mm_min_epu16(p, ip));
+        const __m128i d1 = _mm_sub_epi16(_mm_max_epu16(q, ip), _mm_min_epu16(q, ip));
+        const __m256i v = _mm256_add_epi32(_mm256_cvtepu16_epi32(d0), _mm256_cvtepu16_epi32(d1));
+        __m256i sum = _mm256_loadu_si256((const __m256i *)(s0 + j));
+        __m256 c;
+
+        if(cost3) {
+            sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i *)(s1 + j)));
+            sum = _mm256_add_epi32(sum, _mm256_loadu_si256((const __m256i *)(s2 + j)));
+            c = _mm256_mul_ps(_mm256_mul_ps(valpha, _mm256_cvtepi32_ps(sum)), vthird);
+        } else {
+            c = _mm256_mul_ps(valpha, _mm256_cvtepi32_ps(sum));
+        }
+
+        c = _mm256_add_ps(_mm256_add_ps(c, vbu), _mm256_mul_ps(vw, _mm256_cvtepi32_ps(v)));
+        _mm256_storeu_ps(costs + j, c);
+    }
+}
+
+
+// Like in the C version a * cint is a float product and the rest of the blend
+// is done with doubles, four pixels at a time.
+static inline __m128i vcheckBlend4(__m128 a, __m128 acint, __m128i cur)
+{
+    const __m256d r = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_cvtps_pd(a)), _mm256_cvtepi32_pd(cur)),
+                                    _mm256_cvtps_pd(acint));
+    return _mm256_cvttpd_epi32(r);
+}
+
+
+void eedi3VCheckRowAVX2(const int *cur, const int *cint, const int *mdiff0,
+                        const int *mdiff1, const int *dircv, int n,
+                        float vthresh0, float vthresh1, float vthresh2, int *dst)
+{
+    const __m256 vt0 = _mm256_set1_ps(vthresh0);
+    const __m256 vt1 = _mm256_set1_ps(vthresh1);
+    const __m256 vt2 = _mm256_set1_ps(vthresh2);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    int i;
+
+    if(n < 8) {
+        eedi3VCheckRowC(cur, cint, mdiff0, mdiff1, dircv, n, vthresh0, vthresh1, vthresh2, dst);
+        return;
+    }
+
+    for(i = 0; i < n; i += 8) {
+        const int j = VSMIN(i, n - 8);
+        const __m256 a0 = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(mdiff0 + j))), vt0);
+        const __m256 a1 = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(mdiff1 + j))), vt1);
+        const __m256 a2 = _mm256_max_ps(_mm256_div_ps(_mm256_sub_ps(vt2, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(dircv + j)))), vt2), _mm256_setzero_ps());
+        const __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_max_ps(a0, a1), a2), one);
+        const __m256 ac = _mm256_mul_ps(a, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(cint + j))));
+        const __m256i c = _mm256_loadu_si256((const __m256i *)(cur + j));
+        const __m128i lo = vcheckBlend4(_mm256_castps256_ps128(a), _mm256_castps256_ps128(ac), _mm256_castsi256_si128(c));
+        const __m128i hi = vcheckBlend4(_mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(ac, 1), _mm256_extracti128_si256(c, 1));
+
+        _mm256_storeu_si256((__m256i *)(dst + j), _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    }
+}
+#endif
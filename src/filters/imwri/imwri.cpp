@@ -32,6 +32,10 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -49,6 +53,71 @@ static bool isGrayColorspace(Magick::ColorspaceType colorspace) {
     return colorspace == Magick::GRAYColorspace || colorspace == Magick::Rec601LumaColorspace || colorspace == Magick::Rec709LumaColorspace;
 }
 
+// Pixels are moved with ImageMagick's bulk export and import functions one
+// plane row at a time. They're written straight into the frame and only need
+// a temporary row when the sample values have to be scaled.
+
+class MagickExceptionInfo {
+    MagickCore::ExceptionInfo *exception;
+public:
+    MagickExceptionInfo() : exception(MagickCore::AcquireExceptionInfo()) {}
+    ~MagickExceptionInfo() { MagickCore::DestroyExceptionInfo(exception); }
+    MagickCore::ExceptionInfo *get() { return exception; }
+    // Magick++ takes the exception by reference in ImageMagick 6 and by pointer in 7
+    void throwException() {
+#if MagickLibVersion >= 0x700
+        Magick::throwException(exception);
+#else
+        Magick::throwException(*exception);
+#endif
+    }
+};
+
+static void exportRow(const Magick::Image &image, int y, int width, const char *channel, const VSFormat *fi, uint8_t *dst, std::vector<uint16_t> &tmp, MagickExceptionInfo &exception) {
+    uint16_t *row = (fi->bytesPerSample == 2) ? reinterpret_cast<uint16_t *>(dst) : tmp.data();
+
+    // 16 bit export and a shift gives the same values as reading the quantums directly, bytes would be rounded
+    if (!MagickCore::ExportImagePixels(image.constImage(), 0, y, width, 1, channel, MagickCore::ShortPixel, row, exception.get()))
+        exception.throwException();
+
+    if (fi->bytesPerSample == 1) {
+        for (int x = 0; x < width; x++)
+            dst[x] = row[x] >> 8;
+    } else if (fi->bitsPerSample < 16) {
+        const int shiftR = 16 - fi->bitsPerSample;
+        for (int x = 0; x < width; x++)
+            row[x] >>= shiftR;
+    }
+}
+
+static void importRow(Magick::Image &image, int y, int width, const char *channel, const VSFormat *fi, const uint8_t *src, std::vector<uint16_t> &tmp, MagickExceptionInfo &exception) {
+    const void *row = src;
+    MagickCore::StorageType type = MagickCore::CharPixel;
+
+    if (fi->bytesPerSample == 2) {
+        type = MagickCore::ShortPixel;
+        if (fi->bitsPerSample < 16) {
+            const int shiftL = 16 - fi->bitsPerSample;
+            const int shiftR = fi->bitsPerSample;
+            const uint16_t *srcp = reinterpret_cast<const uint16_t *>(src);
+            for (int x = 0; x < width; x++)
+                tmp[x] = (srcp[x] << shiftL) + (srcp[x] >> shiftR);
+            row = tmp.data();
+        }
+    }
+
+#if MagickLibVersion >= 0x700
+    if (!MagickCore::ImportImagePixels(image.image(), 0, y, width, 1, channel, type, row, exception.get()))
+        exception.throwException();
+#else
+    // ImageMagick 6 leaves import errors in the image
+    if (!MagickCore::ImportImagePixels(image.image(), 0, y, width, 1, channel, type, row)) {
+        MagickCore::GetImageException(image.image(), exception.get());
+        exception.throwException();
+    }
+#endif
+}
+
 static void initMagick(VSCore *core, const VSAPI *vsapi) {
     std::string path;
 #ifdef _WIN32
@@ -176,108 +245,23 @@ static const VSFrameRef *VS_CC writeGetFrame(int n, int activationReason, void *
             if (isGray)
                 image.colorSpace(Magick::GRAYColorspace);
 
-            int strideR = vsapi->getStride(frame, 0);
-            int strideG = vsapi->getStride(frame, isGray ? 0 : 1);
-            int strideB = vsapi->getStride(frame, isGray ? 0 : 2);
-            int strideA = 0;
-            if (alphaFrame)
-                strideA = vsapi->getStride(alphaFrame, 0);
-
             if (fi->bitsPerSample < static_cast<int>(image.depth()))
                 image.depth(fi->bitsPerSample);
 
-            Magick::Pixels pixelCache(image);
-
-            if (fi->bytesPerSample == 2 && alphaFrame) {
-                const int shiftL = 16 - fi->bitsPerSample;
-                const int shiftR = fi->bitsPerSample;
-
-                const uint16_t *r = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, 0));
-                const uint16_t *g = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, isGray ? 0 : 1));
-                const uint16_t *b = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, isGray ? 0 : 2));
-                const uint16_t *a = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(alphaFrame, 0));
-
-                for (int y = 0; y < height; y++) {
-                    Magick::PixelPacket* pixels = pixelCache.get(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        pixels[x].red = (r[x] << shiftL) + (r[x] >> shiftR);
-                        pixels[x].green = (g[x] << shiftL) + (b[x] >> shiftR);
-                        pixels[x].blue = (b[x] << shiftL) + (b[x] >> shiftR);
-                        pixels[x].opacity = (a[x] << shiftL) + (a[x] >> shiftR);
-                    }
-
-                    r += strideR / sizeof(uint16_t);
-                    g += strideG / sizeof(uint16_t);
-                    b += strideB / sizeof(uint16_t);
-                    a += strideA / sizeof(uint16_t);
-
-                    pixelCache.sync();
-                }
-            } else if (fi->bytesPerSample == 2) {
-                const int shiftL = 16 - fi->bitsPerSample;
-                const int shiftR = fi->bitsPerSample;
-
-                const uint16_t *r = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, 0));
-                const uint16_t *g = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, isGray ? 0 : 1));
-                const uint16_t *b = reinterpret_cast<const uint16_t *>(vsapi->getReadPtr(frame, isGray ? 0 : 2));
-
-                for (int y = 0; y < height; y++) {
-                    Magick::PixelPacket* pixels = pixelCache.get(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        pixels[x].red = (r[x] << shiftL) + (r[x] >> shiftR);
-                        pixels[x].green = (g[x] << shiftL) + (b[x] >> shiftR);
-                        pixels[x].blue = (b[x] << shiftL) + (b[x] >> shiftR);
-                        pixels[x].opacity = 0;
-                    }
-
-                    r += strideR / sizeof(uint16_t);
-                    g += strideG / sizeof(uint16_t);
-                    b += strideB / sizeof(uint16_t);
-
-                    pixelCache.sync();
-                }
-            } else if (fi->bytesPerSample == 1 && alphaFrame) {
-                const uint8_t *r = vsapi->getReadPtr(frame, 0);
-                const uint8_t *g = vsapi->getReadPtr(frame, isGray ? 0 : 1);
-                const uint8_t *b = vsapi->getReadPtr(frame, isGray ? 0 : 2);
-                const uint8_t *a = vsapi->getReadPtr(alphaFrame, 0);
-
-                for (int y = 0; y < height; y++) {
-                    Magick::PixelPacket* pixels = pixelCache.get(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        pixels[x].red = (r[x] << 8) + r[x];
-                        pixels[x].green = (g[x] << 8) + g[x];
-                        pixels[x].blue = (b[x] << 8) + b[x];
-                        pixels[x].opacity = (a[x] << 8) + a[x];
-                    }
-
-                    r += strideR;
-                    g += strideG;
-                    b += strideB;
-                    a += strideA;
-
-                    pixelCache.sync();
-                }
-            } else /*if (fi->bytesPerSample == 1)*/ {
-                const uint8_t *r = vsapi->getReadPtr(frame, 0);
-                const uint8_t *g = vsapi->getReadPtr(frame, isGray ? 0 : 1);
-                const uint8_t *b = vsapi->getReadPtr(frame, isGray ? 0 : 2);
-
-                for (int y = 0; y < height; y++) {
-                    Magick::PixelPacket* pixels = pixelCache.get(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        pixels[x].red = (r[x] << 8) + r[x];
-                        pixels[x].green = (g[x] << 8) + g[x];
-                        pixels[x].blue = (b[x] << 8) + b[x];
-                        pixels[x].opacity = 0;
-                    }
-
-                    r += strideR;
-                    g += strideG;
-                    b += strideB;
-
-                    pixelCache.sync();
+            image.modifyImage();
+            MagickExceptionInfo exception;
+            std::vector<uint16_t> tmp(width);
+
+            for (int y = 0; y < height; y++) {
+                if (isGray) {
+                    importRow(image, y, width, "I", fi, vsapi->getReadPtr(frame, 0) + y * vsapi->getStride(frame, 0), tmp, exception);
+                } else {
+                    importRow(image, y, width, "R", fi, vsapi->getReadPtr(frame, 0) + y * vsapi->getStride(frame, 0), tmp, exception);
+                    importRow(image, y, width, "G", fi, vsapi->getReadPtr(frame, 1) + y * vsapi->getStride(frame, 1), tmp, exception);
+                    importRow(image, y, width, "B", fi, vsapi->getReadPtr(frame, 2) + y * vsapi->getStride(frame, 2), tmp, exception);
                 }
+                if (alphaFrame)
+                    importRow(image, y, width, "O", fi, vsapi->getReadPtr(alphaFrame, 0) + y * vsapi->getStride(alphaFrame, 0), tmp, exception);
             }
 
             image.write(specialPrintf(d->filename, n + d->firstNum));
@@ -364,6 +348,22 @@ static void VS_CC writeCreate(const VSMap *in, VSMap *out, void *userData, VSCor
 //////////////////////////////////////////
 // Read
 
+struct CachedFrame {
+    int n;
+    bool alpha;
+    const VSFrameRef *frame;
+};
+
+// An image that is being decoded. If the other output of the same frame is requested meanwhile it waits for the
+// decode to finish and is handed its half directly, so it can't be evicted from the cache before it's picked up.
+struct PendingDecode {
+    int n;
+    bool alpha; // which half the decode leaves over
+    bool waiting;
+    bool done;
+    const VSFrameRef *frame; // null when decoding failed
+};
+
 struct ReadData {
     VSVideoInfo vi[2];
     std::vector<std::string> filenames;
@@ -371,11 +371,15 @@ struct ReadData {
     bool alpha;
     bool mismatch;
     bool fileListMode;
-    int cachedFrameNum;
-    bool cachedAlpha;
-    const VSFrameRef *cachedFrame;
-
-    ReadData() : fileListMode(true), cachedFrameNum(-1), cachedAlpha(false), cachedFrame(nullptr) {};
+    // both outputs are decoded together so the other half is kept until it's requested,
+    // several images are decoded at the same time so there's one slot per thread
+    std::mutex cacheLock;
+    std::deque<CachedFrame> cachedFrames;
+    size_t maxCachedFrames;
+    std::list<PendingDecode> pendingDecodes;
+    std::condition_variable decodeDone;
+
+    ReadData() : fileListMode(true), maxCachedFrames(1) {};
 };
 
 static void VS_CC readInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
@@ -383,163 +387,129 @@ static void VS_CC readInit(VSMap *in, VSMap *out, void **instanceData, VSNode *n
     vsapi->setVideoInfo(d->vi, d->alpha ? 2 : 1, node);
 }
 
+// Decodes image n into frame and, when alpha is set, alphaFrame. Returns false after setting the error.
+static bool readImage(ReadData *d, int n, VSFrameRef *&frame, VSFrameRef *&alphaFrame, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    frame = nullptr;
+    alphaFrame = nullptr;
+
+    try {
+        Magick::Image image(d->fileListMode ? d->filenames[n] : specialPrintf(d->filenames[0], n + d->firstNum));
+        VSColorFamily cf = cmRGB;
+        if (isGrayColorspace(image.colorSpace()))
+            cf = cmGray;
+
+        int width = static_cast<int>(image.columns());
+        int height = static_cast<int>(image.rows());
+        int depth = std::min(std::max<int>(image.depth(), 8), 16);
+
+        if (d->vi[0].format && (cf != d->vi[0].format->colorFamily || depth != d->vi[0].format->bitsPerSample)) {
+            std::string err = "Read: Format mismatch for frame " + std::to_string(n) + ", is ";
+            err += vsapi->registerFormat(cf, stInteger, depth, 0, 0, core)->name + std::string(" but should be ") + d->vi[0].format->name;
+            vsapi->setFilterError(err.c_str(), frameCtx);
+            return false;
+        }
+
+        if (d->vi[0].width && (width != d->vi[0].width || height != d->vi[0].height)) {
+            std::string err = "Read: Size mismatch for frame " + std::to_string(n) + ", is " + std::to_string(width) + "x" + std::to_string(height) + " but should be " + std::to_string(d->vi[0].width) + "x" + std::to_string(d->vi[0].height);
+            vsapi->setFilterError(err.c_str(), frameCtx);
+            return false;
+        }
+
+        frame = vsapi->newVideoFrame(d->vi[0].format ? d->vi[0].format : vsapi->registerFormat(cf, stInteger, depth, 0, 0, core), width, height, nullptr, core);
+        if (d->alpha)
+            alphaFrame = vsapi->newVideoFrame(d->vi[1].format ? d->vi[1].format : vsapi->registerFormat(cmGray, stInteger, depth, 0, 0, core), width, height, nullptr, core);
+        const VSFormat *fi = vsapi->getFrameFormat(frame);
+ 
+        bool isGray = fi->colorFamily == cmGray;
+
+        MagickExceptionInfo exception;
+        std::vector<uint16_t> tmp(width);
+
+        for (int y = 0; y < height; y++) {
+            if (isGray) {
+                exportRow(image, y, width, "R", fi, vsapi->getWritePtr(frame, 0) + y * vsapi->getStride(frame, 0), tmp, exception);
+            } else {
+                exportRow(image, y, width, "R", fi, vsapi->getWritePtr(frame, 0) + y * vsapi->getStride(frame, 0), tmp, exception);
+                exportRow(image, y, width, "G", fi, vsapi->getWritePtr(frame, 1) + y * vsapi->getStride(frame, 1), tmp, exception);
+                exportRow(image, y, width, "B", fi, vsapi->getWritePtr(frame, 2) + y * vsapi->getStride(frame, 2), tmp, exception);
+            }
+            if (alphaFrame)
+                exportRow(image, y, width, "O", fi, vsapi->getWritePtr(alphaFrame, 0) + y * vsapi->getStride(alphaFrame, 0), tmp, exception);
+        }
+    } catch (Magick::Exception &e) {
+        vsapi->setFilterError((std::string("Read: ImageMagick error: ") + e.what()).c_str(), frameCtx);
+        vsapi->freeFrame(frame);
+        vsapi->freeFrame(alphaFrame);
+        frame = nullptr;
+        alphaFrame = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
 static const VSFrameRef *VS_CC readGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     ReadData *d = static_cast<ReadData *>(*instanceData);
 
     if (activationReason == arInitial) {
         int index = vsapi->getOutputIndex(frameCtx);
-        if (d->alpha && d->cachedFrameNum == n) {
-            if ((index == 0 && !d->cachedAlpha) || (index == 1 && d->cachedAlpha)) {
-                const VSFrameRef *frame = d->cachedFrame;
-                d->cachedFrame = nullptr;
-                d->cachedFrameNum = -1;
-                return frame;
-            }
-        }
-
         VSFrameRef *frame = nullptr;
         VSFrameRef *alphaFrame = nullptr;
-        
-        try {
-            Magick::Image image(d->fileListMode ? d->filenames[n] : specialPrintf(d->filenames[0], n + d->firstNum));
-            VSColorFamily cf = cmRGB;
-            if (isGrayColorspace(image.colorSpace()))
-                cf = cmGray;
-
-            int width = static_cast<int>(image.columns());
-            int height = static_cast<int>(image.rows());
-            int depth = std::min(std::max<int>(image.depth(), 8), 16);
 
-            if (d->vi[0].format && (cf != d->vi[0].format->colorFamily || depth != d->vi[0].format->bitsPerSample)) {
-                std::string err = "Read: Format mismatch for frame " + std::to_string(n) + ", is ";
-                err += vsapi->registerFormat(cf, stInteger, depth, 0, 0, core)->name + std::string(" but should be ") + d->vi[0].format->name;
-                vsapi->setFilterError(err.c_str(), frameCtx);
-                return nullptr;
+        if (!d->alpha)
+            return readImage(d, n, frame, alphaFrame, frameCtx, core, vsapi) ? frame : nullptr;
+
+        std::list<PendingDecode>::iterator pending;
+        {
+            std::unique_lock<std::mutex> lock(d->cacheLock);
+            for (auto iter = d->cachedFrames.begin(); iter != d->cachedFrames.end(); ++iter) {
+                if (iter->n == n && iter->alpha == (index == 1)) {
+                    const VSFrameRef *cached = iter->frame;
+                    d->cachedFrames.erase(iter);
+                    return cached;
+                }
             }
 
-            if (d->vi[0].width && (width != d->vi[0].width || height != d->vi[0].height)) {
-                std::string err = "Read: Size mismatch for frame " + std::to_string(n) + ", is " + std::to_string(width) + "x" + std::to_string(height) + " but should be " + std::to_string(d->vi[0].width) + "x" + std::to_string(d->vi[0].height);
-                vsapi->setFilterError(err.c_str(), frameCtx);
-                return nullptr;
+            for (auto iter = d->pendingDecodes.begin(); iter != d->pendingDecodes.end(); ++iter) {
+                if (iter->n == n && iter->alpha == (index == 1)) {
+                    iter->waiting = true;
+                    d->decodeDone.wait(lock, [&] { return iter->done; });
+                    const VSFrameRef *decoded = iter->frame;
+                    d->pendingDecodes.erase(iter);
+                    if (decoded)
+                        return decoded;
+                    // decoding it again reports the error for this output too
+                    break;
+                }
             }
 
-            frame = vsapi->newVideoFrame(d->vi[0].format ? d->vi[0].format : vsapi->registerFormat(cf, stInteger, depth, 0, 0, core), width, height, nullptr, core);
-            if (d->alpha)
-                alphaFrame = vsapi->newVideoFrame(d->vi[1].format ? d->vi[1].format : vsapi->registerFormat(cmGray, stInteger, depth, 0, 0, core), width, height, nullptr, core);
-            const VSFormat *fi = vsapi->getFrameFormat(frame);
- 
-            bool isGray = fi->colorFamily == cmGray;
+            PendingDecode decode = { n, index == 0, false, false, nullptr };
+            pending = d->pendingDecodes.insert(d->pendingDecodes.end(), decode);
+        }
 
-            int strideR = vsapi->getStride(frame, 0);
-            int strideG = vsapi->getStride(frame, isGray ? 0 : 1);
-            int strideB = vsapi->getStride(frame, isGray ? 0 : 2);
-            int strideA = 0;
-            if (alphaFrame)
-                strideA = vsapi->getStride(alphaFrame, 0);
-
-            Magick::Pixels pixelCache(image);
-
-            if (fi->bytesPerSample == 2 && alphaFrame) {
-                const int shiftR = 16 - fi->bitsPerSample;
-
-                uint16_t *r = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, 0));
-                uint16_t *g = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, isGray ? 0 : 1));
-                uint16_t *b = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, isGray ? 0 : 2));
-                uint16_t *a = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(alphaFrame, 0));
-
-                for (int y = 0; y < height; y++) {
-                    const Magick::PixelPacket* pixels = pixelCache.getConst(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        r[x] = pixels[x].red >> shiftR;
-                        g[x] = pixels[x].green >> shiftR;
-                        b[x] = pixels[x].blue >> shiftR;
-                        a[x] = pixels[x].opacity >> shiftR;
-                    }
-
-                    r += strideR / sizeof(uint16_t);
-                    g += strideG / sizeof(uint16_t);
-                    b += strideB / sizeof(uint16_t);
-                    a += strideA / sizeof(uint16_t);
-                }
-            } else if (fi->bytesPerSample == 2) {
-                const int shiftR = 16 - fi->bitsPerSample;
-
-                uint16_t *r = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, 0));
-                uint16_t *g = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, isGray ? 0 : 1));
-                uint16_t *b = reinterpret_cast<uint16_t *>(vsapi->getWritePtr(frame, isGray ? 0 : 2));
-
-                for (int y = 0; y < height; y++) {
-                    const Magick::PixelPacket* pixels = pixelCache.getConst(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        r[x] = pixels[x].red >> shiftR;
-                        g[x] = pixels[x].green >> shiftR;
-                        b[x] = pixels[x].blue >> shiftR;
-                    }
-
-                    r += strideR / sizeof(uint16_t);
-                    g += strideG / sizeof(uint16_t);
-                    b += strideB / sizeof(uint16_t);
-                }
-            } else if (fi->bytesPerSample == 1 && alphaFrame) {
-                uint8_t *r = vsapi->getWritePtr(frame, 0);
-                uint8_t *g = vsapi->getWritePtr(frame, isGray ? 0 : 1);
-                uint8_t *b = vsapi->getWritePtr(frame, isGray ? 0 : 2);
-                uint8_t *a = vsapi->getWritePtr(alphaFrame, 0);
-
-                for (int y = 0; y < height; y++) {
-                    const Magick::PixelPacket* pixels = pixelCache.getConst(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        r[x] = pixels[x].red >> 8;
-                        g[x] = pixels[x].green >> 8;
-                        b[x] = pixels[x].blue >> 8;
-                        a[x] = pixels[x].opacity >> 8;
-                    }
-
-                    r += strideR;
-                    g += strideG;
-                    b += strideB;
-                    a += strideA;
-                }
-            } else /*if (fi->bytesPerSample == 1)*/ {
-                uint8_t *r = vsapi->getWritePtr(frame, 0);
-                uint8_t *g = vsapi->getWritePtr(frame, isGray ? 0 : 1);
-                uint8_t *b = vsapi->getWritePtr(frame, isGray ? 0 : 2);
-
-                for (int y = 0; y < height; y++) {
-                    const Magick::PixelPacket* pixels = pixelCache.getConst(0, y, width, 1);
-                    for (int x = 0; x < width; x++) {
-                        r[x] = pixels[x].red >> 8;
-                        g[x] = pixels[x].green >> 8;
-                        b[x] = pixels[x].blue >> 8;
-                    }
-
-                    r += strideR;
-                    g += strideG;
-                    b += strideB;
+        bool success = readImage(d, n, frame, alphaFrame, frameCtx, core, vsapi);
+        const VSFrameRef *other = (index == 0) ? alphaFrame : frame;
+
+        std::lock_guard<std::mutex> lock(d->cacheLock);
+        if (pending->waiting) {
+            pending->frame = other;
+            pending->done = true;
+            d->decodeDone.notify_all();
+        } else {
+            d->pendingDecodes.erase(pending);
+            if (success) {
+                CachedFrame cached = { n, index == 0, other };
+                d->cachedFrames.push_back(cached);
+                if (d->cachedFrames.size() > d->maxCachedFrames) {
+                    vsapi->freeFrame(d->cachedFrames.front().frame);
+                    d->cachedFrames.pop_front();
                 }
             }
-        } catch (Magick::Exception &e) {
-            vsapi->setFilterError((std::string("Read: ImageMagick error: ") + e.what()).c_str(), frameCtx);
-            vsapi->freeFrame(frame);
-            vsapi->freeFrame(alphaFrame);
-            return nullptr;
         }
 
-        if (d->alpha) {
-            d->cachedFrameNum = n;
-            vsapi->freeFrame(d->cachedFrame);
-            if (index == 0) {
-                d->cachedAlpha = true;
-                d->cachedFrame = alphaFrame;
-                return frame;
-            } else /* if (index == 1) */ {
-                d->cachedAlpha = false;
-                d->cachedFrame = frame;
-                return alphaFrame;
-            }
-        } else {
-            return frame;
-        }
+        if (!success)
+            return nullptr;
+        return (index == 0) ? frame : alphaFrame;
     }
 
     return nullptr;
@@ -547,6 +517,8 @@ static const VSFrameRef *VS_CC readGetFrame(int n, int activationReason, void **
 
 static void VS_CC readFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     ReadData *d = static_cast<ReadData *>(instanceData);
+    for (auto &iter : d->cachedFrames)
+        vsapi->freeFrame(iter.frame);
     delete d;
 }
 
@@ -622,7 +594,9 @@ static void VS_CC readCreate(const VSMap *in, VSMap *out, void *userData, VSCore
         return;
     }
 
-    vsapi->createFilter(in, out, "Read", readInit, readGetFrame, readFree, fmUnordered, 0, d.release(), core);
+    d->maxCachedFrames = std::max(vsapi->getCoreInfo(core)->numThreads, 1);
+
+    vsapi->createFilter(in, out, "Read", readInit, readGetFrame, readFree, fmParallel, 0, d.release(), core);
 }
 
 
@@ -73,6 +73,8 @@ static void VS_CC MorphoCreate(const VSMap *in, VSMap *out, void *userData,
     }
 
     d.filter = (uintptr_t)userData;
+    d.tapx = NULL;
+    d.tapy = NULL;
 
     data = malloc(sizeof(d));
     *data = d;
@@ -90,7 +92,7 @@ error:
 static void VS_CC MorphoInit(VSMap *in, VSMap *out, void **instanceData,
                              VSNode *node, VSCore *core, const VSAPI *vsapi)
 {
-    int pads;
+    int pads, hsize, i, j;
 
     MorphoData *d = (MorphoData *) * instanceData;
     vsapi->setVideoInfo(&d->vi, 1, node);
@@ -104,6 +106,26 @@ static void VS_CC MorphoInit(VSMap *in, VSMap *out, void **instanceData,
     }
 
     SElemFuncs[d->shape](d->selem, d->size);
+
+    d->tapx = malloc(sizeof(int) * pads * pads);
+    d->tapy = malloc(sizeof(int) * pads * pads);
+    if (!d->tapx || !d->tapy) {
+        vsapi->setError(out, "Failed to allocate structuring element");
+        return;
+    }
+
+    hsize = d->size / 2;
+    d->ntaps = 0;
+
+    for (j = -hsize; j <= hsize; j++) {
+        for (i = -hsize; i <= hsize; i++) {
+            if (d->selem[i + hsize + ((j + hsize) * d->size)]) {
+                d->tapx[d->ntaps] = i;
+                d->tapy[d->ntaps] = j;
+                d->ntaps++;
+            }
+        }
+    }
 }
 
 static const VSFrameRef *VS_CC MorphoGetFrame(int n, int activationReason,
@@ -121,9 +143,29 @@ static const VSFrameRef *VS_CC MorphoGetFrame(int n, int activationReason,
         const VSFrameRef *src = vsapi->getFrameFilter(n, d->node, frameCtx);
         VSFrameRef *dst = vsapi->newVideoFrame(d->vi.format, d->vi.width,
                                                d->vi.height, src, core);
+        VSFrameRef *tmp = NULL;
+        VSFrameRef *work = NULL;
+        MorphoBuffers b = { NULL, NULL, 0, 0 };
 
         int i;
 
+        /* scratch space comes from the core so it's recycled between frames */
+        if (d->filter >= 2)
+            tmp = vsapi->newVideoFrame(d->vi.format, d->vi.width,
+                                       d->vi.height, NULL, core);
+
+        if (MorphoCanUseFast(d, d->vi.width, d->vi.height)) {
+            int pad = d->size / 2;
+            int gray = d->vi.format->bytesPerSample == 1 ? pfGray8 : pfGray16;
+
+            b.workHeight = d->vi.height + 2 * pad;
+            work = vsapi->newVideoFrame(vsapi->getFormatPreset(gray, core),
+                                        d->vi.width + 2 * pad,
+                                        3 * b.workHeight, NULL, core);
+            b.work = vsapi->getWritePtr(work, 0);
+            b.workStride = vsapi->getStride(work, 0);
+        }
+
         for (i = 0; i < d->vi.format->numPlanes; i++) {
             const uint8_t *srcp = vsapi->getReadPtr(src, i);
             uint8_t *dstp = vsapi->getWritePtr(dst, i);
@@ -131,10 +173,15 @@ static const VSFrameRef *VS_CC MorphoGetFrame(int n, int activationReason,
             int height = vsapi->getFrameHeight(src, i);
             int stride = vsapi->getStride(src, i);
 
-            FilterFuncs[d->filter](srcp, dstp, width, height, stride, d);
+            if (tmp)
+                b.tmp = vsapi->getWritePtr(tmp, i);
+
+            FilterFuncs[d->filter](srcp, dstp, width, height, stride, d, &b);
         }
 
         vsapi->freeFrame(src);
+        vsapi->freeFrame(tmp);
+        vsapi->freeFrame(work);
 
         return dst;
     }
@@ -149,6 +196,8 @@ static void VS_CC MorphoFree(void *instanceData, VSCore *core,
 
     vsapi->freeNode(d->node);
     free(d->selem);
+    free(d->tapx);
+    free(d->tapy);
     free(d);
 }
 
@@ -24,9 +24,24 @@ typedef struct MorphoData {
     int shape;
     int size;
 
+    /* offsets of the set pixels in selem, in scan order */
+    int *tapx;
+    int *tapy;
+    int ntaps;
+
     int filter;
 } MorphoData;
 
+typedef struct MorphoBuffers {
+    /* intermediate plane for the compound filters, same stride as the source */
+    uint8_t *tmp;
+
+    /* three padded planes for the decomposed square and diamond filters */
+    uint8_t *work;
+    int workStride;
+    int workHeight;
+} MorphoBuffers;
+
 static void VS_CC MorphoInit(VSMap *in, VSMap *out, void **instanceData,
                              VSNode *node, VSCore *core, const VSAPI *vsapi);
 
@@ -18,6 +18,7 @@
 
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "VapourSynth.h"
 #include "VSHelper.h"
@@ -25,6 +26,10 @@
 #include "morpho.h"
 #include "morpho_filters.h"
 
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#endif
+
 const char *FilterNames[] = {
     "Dilate",
     "Erode",
@@ -51,28 +56,315 @@ static inline int Border(int v, int max) {
     else if (v > max)
         v = max - (v - max);
 
-    return v;
+    /* only reached when the element is larger than the plane */
+    return VSMAX(0, VSMIN(v, max));
+}
+
+typedef void (*RowFunc)(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n);
+
+#define ROW_FUNC(NAME,T,OP)                                                    \
+    static void NAME##C(uint8_t *dst, const uint8_t *a, const uint8_t *b,      \
+                        int n)                                                 \
+    {                                                                          \
+        int x;                                                                 \
+                                                                               \
+        for (x = 0; x < n; x++)                                                \
+            ((T *)dst)[x] = OP(((const T *)a)[x], ((const T *)b)[x]);          \
+    }
+
+ROW_FUNC(MaxRow8, uint8_t, VSMAX)
+ROW_FUNC(MinRow8, uint8_t, VSMIN)
+ROW_FUNC(MaxRow16, uint16_t, VSMAX)
+ROW_FUNC(MinRow16, uint16_t, VSMIN)
+
+#ifdef VS_TARGET_CPU_X86
+/* SSE2 has no unsigned 16 bit min/max so they're built from saturating subtraction */
+static inline __m128i max_epu16(__m128i a, __m128i b) {
+    return _mm_add_epi16(_mm_subs_epu16(a, b), b);
+}
+
+static inline __m128i min_epu16(__m128i a, __m128i b) {
+    return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+#define ROW_FUNC_SSE2(NAME,T,OP)                                               \
+    static void NAME(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n)  \
+    {                                                                          \
+        int x;                                                                 \
+        int simd = n * sizeof(T) / 16 * 16;                                    \
+                                                                               \
+        for (x = 0; x < simd; x += 16) {                                       \
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + x));            \
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));            \
+            _mm_storeu_si128((__m128i *)(dst + x), OP(va, vb));                \
+        }                                                                      \
+                                                                               \
+        x /= sizeof(T);                                                        \
+        NAME##C(dst + x * sizeof(T), a + x * sizeof(T), b + x * sizeof(T),     \
+                n - x);                                                        \
+    }
+
+ROW_FUNC_SSE2(MaxRow8, uint8_t, _mm_max_epu8)
+ROW_FUNC_SSE2(MinRow8, uint8_t, _mm_min_epu8)
+ROW_FUNC_SSE2(MaxRow16, uint16_t, max_epu16)
+ROW_FUNC_SSE2(MinRow16, uint16_t, min_epu16)
+#else
+#define MaxRow8 MaxRow8C
+#define MinRow8 MinRow8C
+#define MaxRow16 MaxRow16C
+#define MinRow16 MinRow16C
+#endif
+
+/*
+ * Van Herk/Gil-Werman running min/max over 2k+1 samples along each row of
+ * a padded plane. Prefix and suffix values are built in blocks of 2k+1 so
+ * every output only needs one value of each. The result is written back to
+ * the row for x in [k, width - k).
+ */
+#define HORIZONTAL_PASS(NAME,T,OP)                                             \
+    static void NAME(uint8_t *plane, uint8_t *gline, uint8_t *hline,           \
+                     int width, int height, int stride, int k)                 \
+    {                                                                          \
+        T *g = (T *)gline;                                                     \
+        T *h = (T *)hline;                                                     \
+        int len = 2 * k + 1;                                                   \
+        int x, y;                                                              \
+                                                                               \
+        for (y = 0; y < height; y++) {                                         \
+            T *row = (T *)(plane + y * stride);                                \
+                                                                               \
+            for (x = 0; x < width; x++)                                        \
+                g[x] = (x % len == 0) ? row[x] : OP(g[x - 1], row[x]);         \
+                                                                               \
+            h[width - 1] = row[width - 1];                                     \
+            for (x = width - 2; x >= 0; x--)                                   \
+                h[x] = (x % len == len - 1) ? row[x] : OP(h[x + 1], row[x]);   \
+                                                                               \
+            for (x = k; x < width - k; x++)                                    \
+                row[x] = OP(h[x - k], g[x + k]);                               \
+        }                                                                      \
+    }
+
+HORIZONTAL_PASS(HorizontalMax8, uint8_t, VSMAX)
+HORIZONTAL_PASS(HorizontalMin8, uint8_t, VSMIN)
+HORIZONTAL_PASS(HorizontalMax16, uint16_t, VSMAX)
+HORIZONTAL_PASS(HorizontalMin16, uint16_t, VSMIN)
+
+typedef void (*HorizontalFunc)(uint8_t *, uint8_t *, uint8_t *, int, int, int,
+                               int);
+
+typedef struct FastPlane {
+    uint8_t *buf[3];
+    int stride;
+    int bps;
+    RowFunc op;
+} FastPlane;
+
+/* Copies the plane into a buffer with pad mirrored pixels on every side */
+static void PadPlane(const uint8_t *src, int width, int height, int stride,
+                     int pad, FastPlane *f)
+{
+    int bps = f->bps;
+    int x, y;
+
+    for (y = 0; y < height + 2 * pad; y++) {
+        const uint8_t *s = src + Border(y - pad, height - 1) * stride;
+        uint8_t *dp = f->buf[0] + y * f->stride;
+
+        memcpy(dp + pad * bps, s, width * bps);
+
+        for (x = 0; x < pad; x++) {
+            memcpy(dp + (pad - 1 - x) * bps,
+                   s + Border(x + 1, width - 1) * bps, bps);
+            memcpy(dp + (pad + width + x) * bps,
+                   s + Border(width + x, width - 1) * bps, bps);
+        }
+    }
+}
+
+/*
+ * Running min/max over the 2k+1 samples at (x + sx * t, y + t), |t| <= k.
+ * Like the horizontal pass but the prefix and suffix values are built a
+ * whole row at a time, which makes it possible to do vertical and diagonal
+ * lines with SIMD. The output covers nx by ny samples from (x0, y0) and
+ * may be the input buffer itself.
+ */
+static void LinePass(const uint8_t *in, uint8_t *g, uint8_t *h, int k, int sx,
+                     int x0, int y0, int nx, int ny, uint8_t *dst,
+                     int dstStride, const FastPlane *f)
+{
+    int bps = f->bps;
+    int stride = f->stride;
+    int len = 2 * k + 1;
+    int margin = sx ? k : 0;
+    int c0 = x0 - margin;
+    int c1 = x0 + nx + margin;
+    int r0 = y0 - k;
+    int r1 = y0 + ny + k;
+    int y;
+
+    for (y = r0; y < r1; y++) {
+        const uint8_t *ir = in + y * stride;
+        uint8_t *gr = g + y * stride;
+
+        if ((y - r0) % len == 0) {
+            memcpy(gr + c0 * bps, ir + c0 * bps, (c1 - c0) * bps);
+        } else {
+            /* the samples whose predecessor is outside the range start over */
+            int lo = c0 + VSMAX(sx, 0);
+            int hi = c1 + VSMIN(sx, 0);
+            f->op(gr + lo * bps, gr - stride + (lo - sx) * bps, ir + lo * bps,
+                  hi - lo);
+            if (sx > 0)
+                memcpy(gr + c0 * bps, ir + c0 * bps, bps);
+            else if (sx < 0)
+                memcpy(gr + (c1 - 1) * bps, ir + (c1 - 1) * bps, bps);
+        }
+    }
+
+    for (y = r1 - 1; y >= r0; y--) {
+        const uint8_t *ir = in + y * stride;
+        uint8_t *hr = h + y * stride;
+
+        if ((y - r0) % len == len - 1 || y == r1 - 1) {
+            memcpy(hr + c0 * bps, ir + c0 * bps, (c1 - c0) * bps);
+        } else {
+            int lo = c0 + VSMAX(-sx, 0);
+            int hi = c1 + VSMIN(-sx, 0);
+            f->op(hr + lo * bps, hr + stride + (lo + sx) * bps, ir + lo * bps,
+                  hi - lo);
+            if (sx < 0)
+                memcpy(hr + c0 * bps, ir + c0 * bps, bps);
+            else if (sx > 0)
+                memcpy(hr + (c1 - 1) * bps, ir + (c1 - 1) * bps, bps);
+        }
+    }
+
+    for (y = 0; y < ny; y++) {
+        int py = y0 + y;
+        f->op(dst + y * dstStride,
+              h + (py - k) * stride + (x0 - sx * k) * bps,
+              g + (py + k) * stride + (x0 + sx * k) * bps, nx);
+    }
+}
+
+/* Min/max of every sample and its four direct neighbours */
+static void CrossPass(const uint8_t *in, uint8_t *out, int x0, int y0, int nx,
+                      int ny, const FastPlane *f)
+{
+    int bps = f->bps;
+    int stride = f->stride;
+    int y;
+
+    for (y = y0; y < y0 + ny; y++) {
+        const uint8_t *ir = in + y * stride + x0 * bps;
+        uint8_t *orow = out + y * stride + x0 * bps;
+
+        f->op(orow, ir - stride, ir + stride, nx);
+        f->op(orow, orow, ir - bps, nx);
+        f->op(orow, orow, ir + bps, nx);
+        f->op(orow, orow, ir, nx);
+    }
+}
+
+/*
+ * Square and diamond elements of odd size are decomposed so the cost per
+ * pixel doesn't depend on the size. A square is a horizontal line followed
+ * by a vertical one. A diamond of radius r is a square rotated by 45 degrees
+ * that only contains every other pixel, made from two diagonal lines of
+ * radius k = (r - 1) / 2, followed by one or two 3x3 crosses to fill in the
+ * rest.
+ */
+static void MorphoFast(const uint8_t *src, uint8_t *dst, int width,
+                       int height, int stride, MorphoData *d,
+                       MorphoBuffers *b, int dilate)
+{
+    int r = d->size / 2;
+    int pw = width + 2 * r;
+    int ph = height + 2 * r;
+    FastPlane f;
+
+    f.stride = b->workStride;
+    f.bps = d->vi.format->bytesPerSample;
+    f.buf[0] = b->work;
+    f.buf[1] = b->work + b->workHeight * f.stride;
+    f.buf[2] = b->work + 2 * b->workHeight * f.stride;
+
+    if (f.bps == 1)
+        f.op = dilate ? MaxRow8 : MinRow8;
+    else
+        f.op = dilate ? MaxRow16 : MinRow16;
+
+    PadPlane(src, width, height, stride, r, &f);
+
+    if (d->shape == 0) {
+        HorizontalFunc hpass;
+
+        if (f.bps == 1)
+            hpass = dilate ? HorizontalMax8 : HorizontalMin8;
+        else
+            hpass = dilate ? HorizontalMax16 : HorizontalMin16;
+
+        hpass(f.buf[0], f.buf[1], f.buf[2], pw, ph, f.stride, r);
+        LinePass(f.buf[0], f.buf[1], f.buf[2], r, 0, r, r, width, height,
+                 dst, stride, &f);
+    } else {
+        int k = (r - 1) / 2;
+        int e = r - 2 * k;
+        int cur;
+
+        /* the crosses have to cover everything the diagonal passes read */
+        CrossPass(f.buf[0], f.buf[1], 1, 1, pw - 2, ph - 2, &f);
+        cur = 1;
+        if (e == 2) {
+            CrossPass(f.buf[1], f.buf[0], 2, 2, pw - 4, ph - 4, &f);
+            cur = 0;
+        }
+
+        if (k > 0) {
+            uint8_t *in = f.buf[cur];
+            uint8_t *g = f.buf[(cur + 1) % 3];
+            uint8_t *h = f.buf[(cur + 2) % 3];
+
+            LinePass(in, g, h, k, 1, r - k, r - k, width + 2 * k,
+                     height + 2 * k, in + (r - k) * f.stride + (r - k) * f.bps,
+                     f.stride, &f);
+            LinePass(in, g, h, k, -1, r, r, width, height, dst, stride, &f);
+        } else {
+            const uint8_t *in = f.buf[cur] + r * f.stride + r * f.bps;
+            int y;
+
+            for (y = 0; y < height; y++)
+                memcpy(dst + y * stride, in + y * f.stride, width * f.bps);
+        }
+    }
+}
+
+int MorphoCanUseFast(const MorphoData *d, int width, int height) {
+    return (d->shape == 0 || d->shape == 1) && d->size % 2 &&
+           d->size / 2 < width && d->size / 2 < height;
 }
 
 #define MORPHO(T,V,OP)                                                         \
-    int x, y;                                                                  \
+    int x, y, i;                                                               \
     int hsize = d->size / 2;                                                   \
+    int sstride = stride / sizeof(T);                                          \
                                                                                \
     for (y = 0; y < height; y++) {                                             \
+        int inner = (y >= hsize && y < height - hsize);                        \
+        const T *srcp = (const T *)src + y * sstride;                          \
+                                                                               \
         for (x = 0; x < width; x++) {                                          \
-            int i, j;                                                          \
             T v = (V);                                                         \
                                                                                \
-            for (j = -hsize; j <= hsize; j++) {                                \
-                for (i = -hsize; i <= hsize; i++) {                            \
-                    uint8_t mv = d->selem[i + hsize + ((j + hsize) * d->size)];\
-                                                                               \
-                    if (mv) {                                                  \
-                        int sx = Border(x + i, width - 1);                     \
-                        int sy = Border(y + j, height - 1);                    \
-                        T sv = ((const T *)&src[sy * stride])[sx];             \
-                        v = OP(v, sv);                                         \
-                    }                                                          \
+            if (inner && x >= hsize && x < width - hsize) {                    \
+                for (i = 0; i < d->ntaps; i++)                                 \
+                    v = OP(v, srcp[d->tapy[i] * sstride + d->tapx[i] + x]);    \
+            } else {                                                           \
+                for (i = 0; i < d->ntaps; i++) {                               \
+                    int sx = Border(x + d->tapx[i], width - 1);                \
+                    int sy = Border(y + d->tapy[i], height - 1);               \
+                    v = OP(v, ((const T *)src)[sy * sstride + sx]);            \
                 }                                                              \
             }                                                                  \
                                                                                \
@@ -83,9 +375,12 @@ static inline int Border(int v, int max) {
     }
 
 void MorphoDilate(const uint8_t *src, uint8_t *dst,
-                  int width, int height, int stride, MorphoData *d)
+                  int width, int height, int stride, MorphoData *d,
+                  MorphoBuffers *b)
 {
-    if (d->vi.format->bytesPerSample == 1) {
+    if (b->work && MorphoCanUseFast(d, width, height)) {
+        MorphoFast(src, dst, width, height, stride, d, b, 1);
+    } else if (d->vi.format->bytesPerSample == 1) {
         MORPHO(uint8_t, 0, VSMAX);
     } else {
         MORPHO(uint16_t, 0, VSMAX);
@@ -93,11 +388,14 @@ void MorphoDilate(const uint8_t *src, uint8_t *dst,
 }
 
 void MorphoErode(const uint8_t *src, uint8_t *dst,
-                 int width, int height, int stride, MorphoData *d)
+                 int width, int height, int stride, MorphoData *d,
+                 MorphoBuffers *b)
 {
     int sval = (1 << d->vi.format->bitsPerSample) - 1;
 
-    if (d->vi.format->bytesPerSample == 1) {
+    if (b->work && MorphoCanUseFast(d, width, height)) {
+        MorphoFast(src, dst, width, height, stride, d, b, 0);
+    } else if (d->vi.format->bytesPerSample == 1) {
         MORPHO(uint8_t, sval, VSMIN);
     } else {
         MORPHO(uint16_t, sval, VSMIN);
@@ -105,29 +403,28 @@ void MorphoErode(const uint8_t *src, uint8_t *dst,
 }
 
 void MorphoOpen(const uint8_t *src, uint8_t *dst,
-                int width, int height, int stride, MorphoData *d)
+                int width, int height, int stride, MorphoData *d,
+                MorphoBuffers *b)
 {
-    uint8_t *tmp = malloc(sizeof(uint8_t) * stride * height);
-    MorphoErode(src, tmp, width, height, stride, d);
-    MorphoDilate((const uint8_t*)tmp, dst, width, height, stride, d);
-    free(tmp);
+    MorphoErode(src, b->tmp, width, height, stride, d, b);
+    MorphoDilate((const uint8_t*)b->tmp, dst, width, height, stride, d, b);
 }
 
 void MorphoClose(const uint8_t *src, uint8_t *dst,
-                 int width, int height, int stride, MorphoData *d)
+                 int width, int height, int stride, MorphoData *d,
+                 MorphoBuffers *b)
 {
-    uint8_t *tmp = malloc(sizeof(uint8_t) * stride * height);
-    MorphoDilate(src, tmp, width, height, stride, d);
-    MorphoErode((const uint8_t*)tmp, dst, width, height, stride, d);
-    free(tmp);
+    MorphoDilate(src, b->tmp, width, height, stride, d, b);
+    MorphoErode((const uint8_t*)b->tmp, dst, width, height, stride, d, b);
 }
 
 void MorphoTopHat(const uint8_t *src, uint8_t *dst,
-                  int width, int height, int stride, MorphoData *d)
+                  int width, int height, int stride, MorphoData *d,
+                  MorphoBuffers *b)
 {
     int x, y;
 
-    MorphoOpen(src, dst, width, height, stride, d);
+    MorphoOpen(src, dst, width, height, stride, d, b);
 
     for (y = 0; y < height; y++) {
         if (d->vi.format->bytesPerSample == 1) {
@@ -149,11 +446,12 @@ void MorphoTopHat(const uint8_t *src, uint8_t *dst,
 }
 
 void MorphoBottomHat(const uint8_t *src, uint8_t *dst,
-                     int width, int height, int stride, MorphoData *d)
+                     int width, int height, int stride, MorphoData *d,
+                     MorphoBuffers *b)
 {
     int x, y;
 
-    MorphoClose(src, dst, width, height, stride, d);
+    MorphoClose(src, dst, width, height, stride, d, b);
 
     for (y = 0; y < height; y++) {
         if (d->vi.format->bytesPerSample == 1) {
@@ -16,20 +16,29 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-typedef void (*MorphoFilter)(const uint8_t*, uint8_t*, int, int, int, MorphoData*);
+typedef void (*MorphoFilter)(const uint8_t*, uint8_t*, int, int, int, MorphoData*,
+                             MorphoBuffers*);
 
 void MorphoDilate(const uint8_t *src, uint8_t *dst,
-                  int width, int height, int stride, MorphoData *d);
+                  int width, int height, int stride, MorphoData *d,
+                  MorphoBuffers *b);
 void MorphoErode(const uint8_t *src, uint8_t *dst,
-                 int width, int height, int stride, MorphoData *d);
+                 int width, int height, int stride, MorphoData *d,
+                 MorphoBuffers *b);
 void MorphoOpen(const uint8_t *src, uint8_t *dst,
-                int width, int height, int stride, MorphoData *d);
+                int width, int height, int stride, MorphoData *d,
+                MorphoBuffers *b);
 void MorphoClose(const uint8_t *src, uint8_t *dst,
-                 int width, int height, int stride, MorphoData *d);
+                 int width, int height, int stride, MorphoData *d,
+                 MorphoBuffers *b);
 void MorphoTopHat(const uint8_t *src, uint8_t *dst,
-                  int width, int height, int stride, MorphoData *d);
+                  int width, int height, int stride, MorphoData *d,
+                  MorphoBuffers *b);
 void MorphoBottomHat(const uint8_t *src, uint8_t *dst,
-                     int width, int height, int stride, MorphoData *d);
+                     int width, int height, int stride, MorphoData *d,
+                     MorphoBuffers *b);
+
+int MorphoCanUseFast(const MorphoData *d, int width, int height);
 
 extern const char *FilterNames[];
 extern const MorphoFilter FilterFuncs[];
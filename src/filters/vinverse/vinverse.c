@@ -19,18 +19,24 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <math.h>
+#include <stdlib.h>
 
 #include "VapourSynth.h"
 #include "VSHelper.h"
 
+#include "vinverse.h"
+
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "../../core/cpufeatures.h"
+#endif
+
 struct VinverseData {
     VSNodeRef *node;
     VSVideoInfo vi;
 
-    double sstr;
-    double scl;
-    int amnt;
+    VinverseParams params;
+    VinverseRowFunc row;
 
     int *dlut;
 };
@@ -39,31 +45,175 @@ typedef struct VinverseData VinverseData;
 static void VS_CC VinverseInit(VSMap *in, VSMap *out, void **instanceData,
                                VSNode *node, VSCore *core, const VSAPI *vsapi)
 {
-    int x, y;
     VinverseData *d = (VinverseData *) * instanceData;
     vsapi->setVideoInfo(&d->vi, 1, node);
+}
+
+void vinverseRow8C(const uint8_t *srcpp, const uint8_t *srcp,
+                   const uint8_t *srcc, const uint8_t *srcn,
+                   const uint8_t *srcnn, uint8_t *dstp,
+                   int width, const VinverseParams *params)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        int b3p = (srcp[x] + (srcc[x] << 1) + srcn[x] + 2) >> 2;
+        int b6p = (srcpp[x] + ((srcp[x] + srcn[x]) << 2) +
+                   srcc[x] * 6 + srcnn[x] + 8) >> 4;
+
+        int d1 = srcc[x] - b3p + 255;
+        int d2 = b3p - b6p + 255;
+        int df = b3p + params->dlut[(d1 << 9) + d2];
+
+        int minm = VSMAX(srcc[x] - params->amnt, 0);
+        int maxm = VSMIN(srcc[x] + params->amnt, 255);
+
+        if (df <= minm)
+            dstp[x] = minm;
+        else if (df >= maxm)
+            dstp[x] = maxm;
+        else
+            dstp[x] = df;
+    }
+}
+
+// The differences can be up to 17 bits here, which is too much for a table.
+void vinverseRow16C(const uint8_t *srcpp8, const uint8_t *srcp8,
+                    const uint8_t *srcc8, const uint8_t *srcn8,
+                    const uint8_t *srcnn8, uint8_t *dstp8,
+                    int width, const VinverseParams *params)
+{
+    const uint16_t *srcpp = (const uint16_t *)srcpp8;
+    const uint16_t *srcp = (const uint16_t *)srcp8;
+    const uint16_t *srcc = (const uint16_t *)srcc8;
+    const uint16_t *srcn = (const uint16_t *)srcn8;
+    const uint16_t *srcnn = (const uint16_t *)srcnn8;
+    uint16_t *dstp = (uint16_t *)dstp8;
+    int x;
+
+    for (x = 0; x < width; x++) {
+        int b3p = (srcp[x] + (srcc[x] << 1) + srcn[x] + 2) >> 2;
+        int b6p = (srcpp[x] + ((srcp[x] + srcn[x]) << 2) +
+                   srcc[x] * 6 + srcnn[x] + 8) >> 4;
+
+        int df = b3p + vinverseContra(srcc[x] - b3p, b3p - b6p,
+                                      params->sstr, params->scl);
+
+        int minm = VSMAX(srcc[x] - params->amnt, 0);
+        int maxm = VSMIN(srcc[x] + params->amnt, params->peak);
+
+        if (df <= minm)
+            dstp[x] = minm;
+        else if (df >= maxm)
+            dstp[x] = maxm;
+        else
+            dstp[x] = df;
+    }
+}
+
+#ifdef VS_TARGET_CPU_X86
+static inline __m128i maxEpi32(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static inline __m128i minEpi32(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128d blendPd(__m128d mask, __m128d a, __m128d b)
+{
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+// vinverseContra() for two values in the low half of x and y.
+static inline __m128i contra2SSE2(__m128i x, __m128i y, __m128d sstr, __m128d scl)
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d xd = _mm_cvtepi32_pd(x);
+    __m128d y2 = _mm_mul_pd(_mm_cvtepi32_pd(y), sstr);
+    __m128d da = blendPd(_mm_cmplt_pd(_mm_andnot_pd(sign, xd), _mm_andnot_pd(sign, y2)), xd, y2);
+    __m128d opposite = _mm_cmplt_pd(_mm_mul_pd(xd, y2), _mm_setzero_pd());
+    return _mm_cvttpd_epi32(blendPd(opposite, _mm_mul_pd(da, scl), da));
+}
+
+// Four pixels widened to 32 bits.
+static inline __m128i vinverse4SSE2(__m128i pp, __m128i p, __m128i c, __m128i n, __m128i nn,
+                                    __m128d sstr, __m128d scl, __m128i amnt, __m128i peak)
+{
+    __m128i b3p = _mm_add_epi32(_mm_add_epi32(p, n), _mm_add_epi32(_mm_slli_epi32(c, 1), _mm_set1_epi32(2)));
+    __m128i b6p = _mm_add_epi32(_mm_add_epi32(pp, nn), _mm_slli_epi32(_mm_add_epi32(p, n), 2));
+    __m128i d1, d2, df, lo, hi;
 
-    d->dlut = malloc(512 * 511 * sizeof(int));
+    b3p = _mm_srli_epi32(b3p, 2);
+    b6p = _mm_add_epi32(b6p, _mm_add_epi32(_mm_slli_epi32(c, 2), _mm_slli_epi32(c, 1)));
+    b6p = _mm_srli_epi32(_mm_add_epi32(b6p, _mm_set1_epi32(8)), 4);
 
-    if (!d->dlut) {
-        vsapi->setError(out, "malloc failure (dlut)");
+    d1 = _mm_sub_epi32(c, b3p);
+    d2 = _mm_sub_epi32(b3p, b6p);
+
+    lo = contra2SSE2(d1, d2, sstr, scl);
+    hi = contra2SSE2(_mm_srli_si128(d1, 8), _mm_srli_si128(d2, 8), sstr, scl);
+    df = _mm_add_epi32(b3p, _mm_unpacklo_epi64(lo, hi));
+
+    lo = maxEpi32(_mm_sub_epi32(c, amnt), _mm_setzero_si128());
+    hi = minEpi32(_mm_add_epi32(c, amnt), peak);
+
+    return minEpi32(maxEpi32(df, lo), hi);
+}
+
+// Eight 16 bit pixels at a time. The last group overlaps the previous one
+// instead of leaving a remainder, which is harmless since source and
+// destination are different frames. 8 bit clips use the table instead since
+// two doubles per vector are no faster than looking the results up.
+static void vinverseRow16SSE2(const uint8_t *srcpp, const uint8_t *srcp,
+                              const uint8_t *srcc, const uint8_t *srcn,
+                              const uint8_t *srcnn, uint8_t *dstp,
+                              int width, const VinverseParams *params)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(-32768);
+    const __m128d sstr = _mm_set1_pd(params->sstr);
+    const __m128d scl = _mm_set1_pd(params->scl);
+    const __m128i amnt = _mm_set1_epi32(params->amnt);
+    const __m128i peak = _mm_set1_epi32(params->peak);
+    const uint8_t *rows[5] = { srcpp, srcp, srcc, srcn, srcnn };
+    int i, r;
+
+    if (width < 8) {
+        vinverseRow16C(srcpp, srcp, srcc, srcn, srcnn, dstp, width, params);
         return;
     }
 
-    for (x = -255; x <= 255; x++) {
-        for (y = -255; y <= 255; y++) {
-            double y2 = y * d->sstr;
-            double da = fabs((double)x) < fabs(y2) ? x : y2;
-            d->dlut[((x + 255) << 9) + (y + 255)] = (double)x * y2 < 0.0 ?
-                                                    (int)(da * d->scl) : (int)da;
+    for (i = 0; i < width; i += 8) {
+        const int j = VSMIN(i, width - 8) * 2;
+        __m128i lo[5], hi[5];
+        __m128i rlo, rhi;
+
+        for (r = 0; r < 5; r++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(rows[r] + j));
+            lo[r] = _mm_unpacklo_epi16(v, zero);
+            hi[r] = _mm_unpackhi_epi16(v, zero);
         }
+
+        rlo = vinverse4SSE2(lo[0], lo[1], lo[2], lo[3], lo[4], sstr, scl, amnt, peak);
+        rhi = vinverse4SSE2(hi[0], hi[1], hi[2], hi[3], hi[4], sstr, scl, amnt, peak);
+
+        // There is no unsigned 32 to 16 bit pack in SSE2.
+        rlo = _mm_packs_epi32(_mm_sub_epi32(rlo, bias32), _mm_sub_epi32(rhi, bias32));
+        _mm_storeu_si128((__m128i *)(dstp + j), _mm_xor_si128(rlo, bias16));
     }
 }
+#endif
 
 static void Vinverse(const uint8_t *src, uint8_t *dst,
                      int width, int height, int stride, VinverseData *d)
 {
-    int x, y;
+    int y;
 
     for (y = 0; y < height; y++) {
         const uint8_t *srcpp = y <  2 ? src + stride * 2 : src - stride * 2;
@@ -71,25 +221,7 @@ static void Vinverse(const uint8_t *src, uint8_t *dst,
         const uint8_t *srcn  = y == height - 1 ? src - stride     : src + stride;
         const uint8_t *srcnn = y >  height - 3 ? src - stride * 2 : src + stride * 2;
 
-        for (x = 0; x < width; x++) {
-            uint8_t b3p = (srcp[x] + (src[x] << 1) + srcn[x] + 2) >> 2;
-            uint8_t b6p = (srcpp[x] + ((srcp[x] + srcn[x]) << 2) +
-                          src[x] * 6 + srcnn[x] + 8) >> 4;
-
-            int d1 = src[x] - b3p + 255;
-            int d2 = b3p - b6p + 255;
-            int df = b3p + d->dlut[(d1 << 9) + d2];
-
-            int minm = VSMAX(src[x] - d->amnt, 0);
-            int maxm = VSMIN(src[x] + d->amnt, 255);
-
-            if (df <= minm)
-                dst[x] = minm;
-            else if (df >= maxm)
-                dst[x] = maxm;
-            else
-                dst[x] = df;
-        }
+        d->row(srcpp, srcp, src, srcn, srcnn, dst, width, &d->params);
 
         src += stride;
         dst += stride;
@@ -147,6 +279,7 @@ static void VS_CC VinverseCreate(const VSMap *in, VSMap *out, void *userData,
 {
     VinverseData d, *data;
     int err;
+    int amnt;
 
     d.dlut = NULL;
     d.node = vsapi->propGetNode(in, "clip", 0, 0);
@@ -159,33 +292,73 @@ static void VS_CC VinverseCreate(const VSMap *in, VSMap *out, void *userData,
     }
 
     if (d.vi.format->sampleType != stInteger ||
-        d.vi.format->bytesPerSample != 1) {
+        d.vi.format->bitsPerSample > 16) {
 
-        vsapi->setError(out, "Only 8-bit int formats supported");
+        vsapi->setError(out, "Only 8-16 bit int formats supported");
         vsapi->freeNode(d.node);
         return;
     }
 
-    d.sstr = vsapi->propGetFloat(in, "sstr", 0, &err);
+    d.params.sstr = vsapi->propGetFloat(in, "sstr", 0, &err);
 
     if (err)
-        d.sstr = 2.7;
+        d.params.sstr = 2.7;
 
-    d.amnt = int64ToIntS(vsapi->propGetInt(in, "amnt", 0, &err));
+    amnt = int64ToIntS(vsapi->propGetInt(in, "amnt", 0, &err));
 
     if (err)
-        d.amnt = 255;
+        amnt = 255;
 
-    if (d.amnt < 1 || d.amnt > 255) {
+    if (amnt < 1 || amnt > 255) {
         vsapi->setError(out, "amnt must be greater than 0 and less than 256");
         vsapi->freeNode(d.node);
         return;
     }
 
-    d.scl = vsapi->propGetFloat(in, "scl", 0, &err);
+    d.params.scl = vsapi->propGetFloat(in, "scl", 0, &err);
 
     if (err)
-        d.scl = 0.25;
+        d.params.scl = 0.25;
+
+    // amnt is always given in the 8 bit range, so 255 leaves every
+    // bit depth unrestricted.
+    d.params.peak = (1 << d.vi.format->bitsPerSample) - 1;
+    d.params.amnt = (amnt * d.params.peak + 127) / 255;
+
+    d.row = d.vi.format->bytesPerSample == 1 ? vinverseRow8C : vinverseRow16C;
+
+#ifdef VS_TARGET_CPU_X86
+    {
+        CPUFeatures cpu;
+        getCPUFeatures(&cpu);
+
+        if (cpu.avx2)
+            d.row = d.vi.format->bytesPerSample == 1 ? vinverseRow8AVX2 : vinverseRow16AVX2;
+        else if (d.vi.format->bytesPerSample == 2)
+            d.row = vinverseRow16SSE2;
+    }
+#endif
+
+    // The 8 bit C version looks the results up in a table. The AVX2 version
+    // also uses it for lines too short for a full vector.
+    if (d.vi.format->bytesPerSample == 1) {
+        int x, y;
+
+        d.dlut = malloc(512 * 511 * sizeof(int));
+
+        if (!d.dlut) {
+            vsapi->setError(out, "malloc failure (dlut)");
+            vsapi->freeNode(d.node);
+            return;
+        }
+
+        for (x = -255; x <= 255; x++)
+            for (y = -255; y <= 255; y++)
+                d.dlut[((x + 255) << 9) + (y + 255)] =
+                    vinverseContra(x, y, d.params.sstr, d.params.scl);
+    }
+
+    d.params.dlut = d.dlut;
 
     data = malloc(sizeof(d));
     *data = d;
@@ -0,0 +1,76 @@
+/*
+ * Vinverse, a simple filter to remove residual combing.
+ *
+ * VapourSynth port by Martin Herkt
+ *
+ * Copyright (C) 2006 Kevin Stone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VINVERSE_H
+#define VINVERSE_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "VSHelper.h"
+
+typedef struct VinverseParams {
+    double sstr;
+    double scl;
+    int amnt; // in the scale of the clip
+    int peak;
+
+    const int *dlut; // only for 8 bit clips
+} VinverseParams;
+
+// Processes one line. srcc is the line itself, the others are the lines
+// one and two steps above and below it.
+typedef void (*VinverseRowFunc)(const uint8_t *srcpp, const uint8_t *srcp,
+                                const uint8_t *srcc, const uint8_t *srcn,
+                                const uint8_t *srcnn, uint8_t *dstp,
+                                int width, const VinverseParams *params);
+
+// The amount the blurred pixel is moved by, given the difference to the
+// source (x) and the difference between the two blurs (y). The SIMD versions
+// do the same double precision calculations so the results are identical.
+static inline int vinverseContra(int x, int y, double sstr, double scl)
+{
+    double y2 = y * sstr;
+    double da = fabs((double)x) < fabs(y2) ? x : y2;
+    return (double)x * y2 < 0.0 ? (int)(da * scl) : (int)da;
+}
+
+#ifdef VS_TARGET_CPU_X86
+void vinverseRow8AVX2(const uint8_t *srcpp, const uint8_t *srcp,
+                      const uint8_t *srcc, const uint8_t *srcn,
+                      const uint8_t *srcnn, uint8_t *dstp,
+                      int width, const VinverseParams *params);
+void vinverseRow16AVX2(const uint8_t *srcpp, const uint8_t *srcp,
+                       const uint8_t *srcc, const uint8_t *srcn,
+                       const uint8_t *srcnn, uint8_t *dstp,
+                       int width, const VinverseParams *params);
+#endif
+
+void vinverseRow8C(const uint8_t *srcpp, const uint8_t *srcp,
+                   const uint8_t *srcc, const uint8_t *srcn,
+                   const uint8_t *srcnn, uint8_t *dstp,
+                   int width, const VinverseParams *params);
+void vinverseRow16C(const uint8_t *srcpp, const uint8_t *srcp,
+                    const uint8_t *srcc, const uint8_t *srcn,
+                    const uint8_t *srcnn, uint8_t *dstp,
+                    int width, const VinverseParams *params);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Vinverse, a simple filter to remove residual combing.
+ *
+ * VapourSynth port by Martin Herkt
+ *
+ * Copyright (C) 2006 Kevin Stone
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. The results are identical to the C versions.
+
+#ifdef VS_TARGET_CPU_X86
+#include <immintrin.h>
+
+#include "VSHelper.h"
+
+#include "vinverse.h"
+
+
+// vinverseContra() for four values.
+static inline __m128i contra4(__m128i x, __m128i y, __m256d sstr, __m256d scl) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d xd = _mm256_cvtepi32_pd(x);
+    __m256d y2 = _mm256_mul_pd(_mm256_cvtepi32_pd(y), sstr);
+    __m256d da = _mm256_blendv_pd(y2, xd, _mm256_cmp_pd(_mm256_andnot_pd(sign, xd), _mm256_andnot_pd(sign, y2), _CMP_LT_OQ));
+    __m256d opposite = _mm256_cmp_pd(_mm256_mul_pd(xd, y2), _mm256_setzero_pd(), _CMP_LT_OQ);
+    return _mm256_cvttpd_epi32(_mm256_blendv_pd(da, _mm256_mul_pd(da, scl), opposite));
+}
+
+// Eight pixels widened to 32 bits.
+static inline __m256i vinverse8(__m256i pp, __m256i p, __m256i c, __m256i n, __m256i nn,
+                                __m256d sstr, __m256d scl, __m256i amnt, __m256i peak) {
+    __m256i b3p = _mm256_add_epi32(_mm256_add_epi32(p, n), _mm256_add_epi32(_mm256_slli_epi32(c, 1), _mm256_set1_epi32(2)));
+    __m256i b6p = _mm256_add_epi32(_mm256_add_epi32(pp, nn), _mm256_slli_epi32(_mm256_add_epi32(p, n), 2));
+    __m256i d1, d2, df, lo, hi;
+
+    b3p = _mm256_srli_epi32(b3p, 2);
+    b6p = _mm256_add_epi32(b6p, _mm256_mullo_epi32(c, _mm256_set1_epi32(6)));
+    b6p = _mm256_srli_epi32(_mm256_add_epi32(b6p, _mm256_set1_epi32(8)), 4);
+
+    d1 = _mm256_sub_epi32(c, b3p);
+    d2 = _mm256_sub_epi32(b3p, b6p);
+
+    df = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        contra4(_mm256_castsi256_si128(d1), _mm256_castsi256_si128(d2), sstr, scl)),
+        contra4(_mm256_extracti128_si256(d1, 1), _mm256_extracti128_si256(d2, 1), sstr, scl), 1);
+    df = _mm256_add_epi32(b3p, df);
+
+    lo = _mm256_max_epi32(_mm256_sub_epi32(c, amnt), _mm256_setzero_si256());
+    hi = _mm256_min_epi32(_mm256_add_epi32(c, amnt), peak);
+
+    return _mm256_min_epi32(_mm256_max_epi32(df, lo), hi);
+}
+
+// The constants are set up by the callers since stores through dstp could
+// otherwise make the compiler reload them from params for every group.
+static inline void vinverse8AVX2(const uint8_t *srcpp, const uint8_t *srcp,
+                                 const uint8_t *srcc, const uint8_t *srcn,
+                                 const uint8_t *srcnn, uint8_t *dstp,
+                                 __m256d sstr, __m256d scl, __m256i amnt, __m256i peak, int words) {
+    const uint8_t *rows[5] = { srcpp, srcp, srcc, srcn, srcnn };
+    __m256i v[5];
+    __m128i packed;
+    int i;
+
+    for (i = 0; i < 5; i++)
+        v[i] = words ? _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)rows[i]))
+                     : _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)rows[i]));
+
+    // packus works within each 128 bit lane, the permute puts the halves in order.
+    packed = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(
+        vinverse8(v[0], v[1], v[2], v[3], v[4], sstr, scl, amnt, peak), _mm256_setzero_si256()), 0xD8));
+
+    if (words)
+        _mm_storeu_si128((__m128i *)dstp, packed);
+    else
+        _mm_storel_epi64((__m128i *)dstp, _mm_packus_epi16(packed, packed));
+}
+
+
+void vinverseRow8AVX2(const uint8_t *srcpp, const uint8_t *srcp,
+                      const uint8_t *srcc, const uint8_t *srcn,
+                      const uint8_t *srcnn, uint8_t *dstp,
+                      int width, const VinverseParams *params) {
+    const __m256d sstr = _mm256_set1_pd(params->sstr);
+    const __m256d scl = _mm256_set1_pd(params->scl);
+    const __m256i amnt = _mm256_set1_epi32(params->amnt);
+    const __m256i peak = _mm256_set1_epi32(params->peak);
+    int i;
+
+    if (width < 8) {
+        vinverseRow8C(srcpp, srcp, srcc, srcn, srcnn, dstp, width, params);
+        return;
+    }
+
+    for (i = 0; i < width; i += 8) {
+        const int j = VSMIN(i, width - 8);
+        vinverse8AVX2(srcpp + j, srcp + j, srcc + j, srcn + j, srcnn + j, dstp + j, sstr, scl, amnt, peak, 0);
+    }
+}
+
+
+void vinverseRow16AVX2(const uint8_t *srcpp, const uint8_t *srcp,
+                       const uint8_t *srcc, const uint8_t *srcn,
+                       const uint8_t *srcnn, uint8_t *dstp,
+                       int width, const VinverseParams *params) {
+    const __m256d sstr = _mm256_set1_pd(params->sstr);
+    const __m256d scl = _mm256_set1_pd(params->scl);
+    const __m256i amnt = _mm256_set1_epi32(params->amnt);
+    const __m256i peak = _mm256_set1_epi32(params->peak);
+    int i;
+
+    if (width < 8) {
+        vinverseRow16C(srcpp, srcp, srcc, srcn, srcnn, dstp, width, params);
+        return;
+    }
+
+    for (i = 0; i < width; i += 8) {
+        const int j = VSMIN(i, width - 8) * 2;
+        vinverse8AVX2(srcpp + j, srcp + j, srcc + j, srcn + j, srcnn + j, dstp + j, sstr, scl, amnt, peak, 1);
+    }
+}
+#endif
@@ -22,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
@@ -32,6 +33,13 @@
 #include "VapourSynth.h"
 #include "VSHelper.h"
 
+#include "vivtc.h"
+
+#ifdef VS_TARGET_CPU_X86
+#include <emmintrin.h>
+#include "../../core/cpufeatures.h"
+#endif
+
 // Shared
 
 static int isPowerOf2(int i) {
@@ -45,8 +53,7 @@ typedef struct {
     VSNodeRef *clip2;
     const VSVideoInfo *vi;
     double scthresh;
-    int tpitchy;
-    int tpitchuv;
+    const VSFormat *scratchFormat;
     int order;
     int field;
     int mode;
@@ -60,6 +67,12 @@ typedef struct {
     int y1;
     int micmatch;
     int micout;
+
+    AbsDiffRowFunc absDiffRow;
+    CombRowFunc combRow;
+    CombCountRowFunc combCountRow;
+    DiffMapRowFunc diffMapRow;
+    FieldDiffRowFunc fieldDiffRow;
 } VFMData;
 
 
@@ -73,15 +86,328 @@ static void copyField(VSFrameRef *dst, const VSFrameRef *src, int field, const V
     }
 }
 
+void vfmAbsDiffRowC(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width) {
+    int x;
+    for (x=0; x<width; x++)
+        dstp[x] = abs(prvp[x]-nxtp[x]);
+}
+
+void vfmCombRowC(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh) {
+    const int cthresh6 = cthresh*6;
+    int x;
+    for (x=0; x<width; ++x) {
+        const int sFirst = srcp[x] - srcp[x - src_pitch];
+        const int sSecond = srcp[x] - srcp[x + src_pitch];
+        if ((sFirst > cthresh && sSecond > cthresh) || (sFirst < -cthresh && sSecond < -cthresh)) {
+            if (abs(srcp[x - 2*src_pitch]+(srcp[x]*4)+srcp[x + 2*src_pitch]-(3*(srcp[x - src_pitch]+srcp[x + src_pitch]))) > cthresh6)
+                cmkp[x] = 0xFF;
+        }
+    }
+}
+
+void vfmCombCountRowC(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums) {
+    int i, x;
+    for (i=0; i<groups; ++i) {
+        int sum = 0;
+        for (x=i*8; x<i*8+8; ++x) {
+            if (cmkpp[x] == 0xFF && cmkp[x] == 0xFF && cmkpn[x] == 0xFF)
+                ++sum;
+        }
+        sums[i] += sum;
+    }
+}
+
+void vfmDiffMapPixelsC(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2, int x0, int x1) {
+    int x, u, diff, count;
+    for (x=x0; x<x1; ++x) {
+        diff = dp[x];
+        if (diff > 3) {
+            for (count=0,u=x-1; u<x+2 && count<2; ++u) {
+                if (dp[u-tpitch] > 3) ++count;
+                if (dp[u] > 3) ++count;
+                if (dp[u+tpitch] > 3) ++count;
+            }
+            if (count > 1) {
+                ++dstp[x];
+                if (diff > 19) {
+                    int upper = 0, lower = 0;
+                    for (count=0, u=x-1; u<x+2 && count<6; ++u) {
+                        if (dp[u-tpitch] > 19) { ++count; upper = 1; }
+                        if (dp[u] > 19) ++count;
+                        if (dp[u+tpitch] > 19) { ++count; lower = 1; }
+                    }
+                    if (count > 3) {
+                        if (!upper || !lower) {
+                            int upper2f = 0, lower2f = 0;
+                            for (u=VSMAX(x-4,0); u<VSMIN(x+5,width); ++u)
+                            {
+                                if (upper2 && dp[u-2*tpitch] > 19)
+                                    upper2f = 1;
+                                if (dp[u-tpitch] > 19)
+                                    upper = 1;
+                                if (dp[u+tpitch] > 19)
+                                    lower = 1;
+                                if (lower2 && dp[u+2*tpitch] > 19)
+                                    lower2f = 1;
+                            }
+                            if ((upper && (lower || upper2f)) ||
+                                (lower && (upper || lower2f)))
+                                dstp[x] += 2;
+                            else if (count > 5)
+                                dstp[x] += 4;
+                        }
+                        else dstp[x] += 2;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void vfmDiffMapRowC(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2) {
+    vfmDiffMapPixelsC(dp, tpitch, dstp, width, upper2, lower2, 1, width-1);
+}
+
+void vfmFieldDiffRowC(const uint8_t *prvpf, const uint8_t *prvnf,
+    const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+    const uint8_t *nxtpf, const uint8_t *nxtnf,
+    const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum) {
+    int x, temp1, temp2;
+    for (x=startx; x<stopx; x++) {
+        if (mapp[x] > 0 || mapp[x + map_pitch] > 0) {
+            temp1 = curpf[x]+(curf[x]<<2)+curnf[x];
+            temp2 = abs(3*(prvpf[x]+prvnf[x])-temp1);
+            if (temp2 > 23 && ((mapp[x]&1) || (mapp[x + map_pitch]&1)))
+                accum[0] += temp2;
+            if (temp2 > 42) {
+                if ((mapp[x]&2) || (mapp[x + map_pitch]&2))
+                    accum[2] += temp2;
+                if ((mapp[x]&4) || (mapp[x + map_pitch]&4))
+                    accum[4] += temp2;
+            }
+            temp2 = abs(3*(nxtpf[x]+nxtnf[x])-temp1);
+            if (temp2 > 23 && ((mapp[x]&1) || (mapp[x + map_pitch]&1)))
+                accum[1] += temp2;
+            if (temp2 > 42) {
+                if ((mapp[x]&2) || (mapp[x + map_pitch]&2))
+                    accum[3] += temp2;
+                if ((mapp[x]&4) || (mapp[x + map_pitch]&4))
+                    accum[5] += temp2;
+            }
+        }
+    }
+}
+
+#ifdef VS_TARGET_CPU_X86
+static inline __m128i absDiffU8(__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+// unsigned a > b for bytes
+static inline __m128i cmpGtU8(__m128i a, __m128i b) {
+    return _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(a, b), _mm_setzero_si128()), _mm_set1_epi8(-1));
+}
+
+static inline int sumEpi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_srli_si128(v, 8));
+    v = _mm_add_epi32(v, _mm_srli_si128(v, 4));
+    return _mm_cvtsi128_si32(v);
+}
+
+// Rows shorter than a vector fall back to C. Otherwise the last partial block
+// is moved back so it ends at width, which recomputes a few pixels with the
+// same result.
+static void absDiffRowSSE2(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width) {
+    int i;
+
+    if (width < 16) {
+        vfmAbsDiffRowC(prvp, nxtp, dstp, width);
+        return;
+    }
+
+    for (i=0; i<width; i+=16) {
+        const int j = VSMIN(i, width - 16);
+        _mm_storeu_si128((__m128i *)(dstp + j), absDiffU8(_mm_loadu_si128((const __m128i *)(prvp + j)), _mm_loadu_si128((const __m128i *)(nxtp + j))));
+    }
+}
+
+static inline __m128i combMaskSSE2(__m128i pp, __m128i p, __m128i c, __m128i n, __m128i nn, __m128i t, __m128i nt, __m128i t6) {
+    const __m128i s1 = _mm_sub_epi16(c, p);
+    const __m128i s2 = _mm_sub_epi16(c, n);
+    const __m128i pn = _mm_add_epi16(p, n);
+    const __m128i d = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(pp, _mm_slli_epi16(c, 2)), nn), _mm_add_epi16(pn, _mm_add_epi16(pn, pn)));
+    const __m128i ad = _mm_max_epi16(d, _mm_sub_epi16(_mm_setzero_si128(), d));
+    const __m128i cond = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi16(s1, t), _mm_cmpgt_epi16(s2, t)),
+                                      _mm_and_si128(_mm_cmplt_epi16(s1, nt), _mm_cmplt_epi16(s2, nt)));
+    return _mm_and_si128(cond, _mm_cmpgt_epi16(ad, t6));
+}
+
+static void combRowSSE2(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i t = _mm_set1_epi16(cthresh);
+    const __m128i nt = _mm_set1_epi16(-cthresh);
+    const __m128i t6 = _mm_set1_epi16(cthresh*6);
+    int i;
+
+    if (width < 16) {
+        vfmCombRowC(srcp, src_pitch, cmkp, width, cthresh);
+        return;
+    }
+
+    for (i=0; i<width; i+=16) {
+        const int j = VSMIN(i, width - 16);
+        const __m128i pp = _mm_loadu_si128((const __m128i *)(srcp + j - 2*src_pitch));
+        const __m128i p = _mm_loadu_si128((const __m128i *)(srcp + j - src_pitch));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(srcp + j));
+        const __m128i n = _mm_loadu_si128((const __m128i *)(srcp + j + src_pitch));
+        const __m128i nn = _mm_loadu_si128((const __m128i *)(srcp + j + 2*src_pitch));
+        const __m128i lo = combMaskSSE2(_mm_unpacklo_epi8(pp, zero), _mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(c, zero),
+                                        _mm_unpacklo_epi8(n, zero), _mm_unpacklo_epi8(nn, zero), t, nt, t6);
+        const __m128i hi = combMaskSSE2(_mm_unpackhi_epi8(pp, zero), _mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(c, zero),
+                                        _mm_unpackhi_epi8(n, zero), _mm_unpackhi_epi8(nn, zero), t, nt, t6);
+        _mm_storeu_si128((__m128i *)(cmkp + j), _mm_packs_epi16(lo, hi));
+    }
+}
+
+static void combCountRowSSE2(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi8(-1);
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i m, s;
+    int i;
+
+    for (i=0; i+2<=groups; i+=2) {
+        m = _mm_and_si128(_mm_and_si128(_mm_loadu_si128((const __m128i *)(cmkpp + i*8)), _mm_loadu_si128((const __m128i *)(cmkp + i*8))),
+                          _mm_loadu_si128((const __m128i *)(cmkpn + i*8)));
+        s = _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(m, ff), one), zero);
+        sums[i] += _mm_cvtsi128_si32(s);
+        sums[i+1] += _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+    }
+
+    if (i < groups) {
+        m = _mm_and_si128(_mm_and_si128(_mm_loadl_epi64((const __m128i *)(cmkpp + i*8)), _mm_loadl_epi64((const __m128i *)(cmkp + i*8))),
+                          _mm_loadl_epi64((const __m128i *)(cmkpn + i*8)));
+        s = _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(m, ff), one), zero);
+        sums[i] += _mm_cvtsi128_si32(s);
+    }
+}
+
+// Without the early exits of the C version a pixel gets 1 when it and at least
+// one neighbour differ by more than 3. It gets another 2 if more than 3 pixels
+// of the 3x3 block differ by more than 19 and the motion extends vertically,
+// or 4 instead if it doesn't but more than 5 pixels differ that much.
+static void diffMapRowSSE2(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i t3 = _mm_set1_epi8(3);
+    const __m128i t19 = _mm_set1_epi8(19);
+    int x, k;
+
+    // the C version clips the wide search to the line so the vectors start at 4
+    if (width < 24) {
+        vfmDiffMapRowC(dp, tpitch, dstp, width, upper2, lower2);
+        return;
+    }
+
+    vfmDiffMapPixelsC(dp, tpitch, dstp, width, upper2, lower2, 1, 4);
+
+    for (x=4; x+20<=width; x+=16) {
+        __m128i c3 = zero, c19 = zero;
+        __m128i up = zero, lo = zero, up2 = zero, lo2 = zero;
+        __m128i a, b, wide, inc;
+        const __m128i d = _mm_loadu_si128((const __m128i *)(dp + x));
+
+        for (k=-1; k<=1; ++k) {
+            const __m128i vp = _mm_loadu_si128((const __m128i *)(dp + x + k - tpitch));
+            const __m128i vc = _mm_loadu_si128((const __m128i *)(dp + x + k));
+            const __m128i vn = _mm_loadu_si128((const __m128i *)(dp + x + k + tpitch));
+            c3 = _mm_sub_epi8(c3, _mm_add_epi8(_mm_add_epi8(cmpGtU8(vp, t3), cmpGtU8(vc, t3)), cmpGtU8(vn, t3)));
+            c19 = _mm_sub_epi8(c19, _mm_add_epi8(_mm_add_epi8(cmpGtU8(vp, t19), cmpGtU8(vc, t19)), cmpGtU8(vn, t19)));
+        }
+
+        for (k=-4; k<=4; ++k) {
+            up = _mm_or_si128(up, cmpGtU8(_mm_loadu_si128((const __m128i *)(dp + x + k - tpitch)), t19));
+            lo = _mm_or_si128(lo, cmpGtU8(_mm_loadu_si128((const __m128i *)(dp + x + k + tpitch)), t19));
+            if (upper2)
+                up2 = _mm_or_si128(up2, cmpGtU8(_mm_loadu_si128((const __m128i *)(dp + x + k - 2*tpitch)), t19));
+            if (lower2)
+                lo2 = _mm_or_si128(lo2, cmpGtU8(_mm_loadu_si128((const __m128i *)(dp + x + k + 2*tpitch)), t19));
+        }
+
+        a = _mm_and_si128(cmpGtU8(d, t3), _mm_cmpgt_epi8(c3, one));
+        b = _mm_and_si128(_mm_and_si128(a, cmpGtU8(d, t19)), _mm_cmpgt_epi8(c19, t3));
+        wide = _mm_or_si128(_mm_and_si128(up, _mm_or_si128(lo, up2)), _mm_and_si128(lo, _mm_or_si128(up, lo2)));
+        inc = _mm_or_si128(_mm_and_si128(wide, two), _mm_andnot_si128(wide, _mm_and_si128(_mm_cmpgt_epi8(c19, five), four)));
+        inc = _mm_or_si128(_mm_and_si128(a, one), _mm_and_si128(b, inc));
+        _mm_storeu_si128((__m128i *)(dstp + x), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(dstp + x)), inc));
+    }
+
+    vfmDiffMapPixelsC(dp, tpitch, dstp, width, upper2, lower2, x, width-1);
+}
+
+static void fieldDiffRowSSE2(const uint8_t *prvpf, const uint8_t *prvnf,
+    const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+    const uint8_t *nxtpf, const uint8_t *nxtnf,
+    const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i bit2 = _mm_set1_epi16(2);
+    const __m128i bit4 = _mm_set1_epi16(4);
+    const __m128i t23 = _mm_set1_epi16(23);
+    const __m128i t42 = _mm_set1_epi16(42);
+    __m128i sums[6];
+    int x, i;
+
+    for (i=0; i<6; ++i)
+        sums[i] = zero;
+
+    for (x=startx; x+8<=stopx; x+=8) {
+#define LOAD8(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)((p) + x)), zero)
+        const __m128i m = _mm_or_si128(LOAD8(mapp), LOAD8(mapp + map_pitch));
+        const __m128i m1 = _mm_cmpeq_epi16(_mm_and_si128(m, ones), ones);
+        const __m128i m2 = _mm_cmpeq_epi16(_mm_and_si128(m, bit2), bit2);
+        const __m128i m4 = _mm_cmpeq_epi16(_mm_and_si128(m, bit4), bit4);
+        const __m128i temp1 = _mm_add_epi16(_mm_add_epi16(LOAD8(curpf), _mm_slli_epi16(LOAD8(curf), 2)), LOAD8(curnf));
+        const __m128i ps = _mm_add_epi16(LOAD8(prvpf), LOAD8(prvnf));
+        const __m128i ns = _mm_add_epi16(LOAD8(nxtpf), LOAD8(nxtnf));
+#undef LOAD8
+        __m128i dp = _mm_sub_epi16(_mm_add_epi16(ps, _mm_add_epi16(ps, ps)), temp1);
+        __m128i dn = _mm_sub_epi16(_mm_add_epi16(ns, _mm_add_epi16(ns, ns)), temp1);
+        __m128i gt;
+        dp = _mm_max_epi16(dp, _mm_sub_epi16(zero, dp));
+        dn = _mm_max_epi16(dn, _mm_sub_epi16(zero, dn));
+
+        gt = _mm_and_si128(_mm_cmpgt_epi16(dp, t23), m1);
+        sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_and_si128(dp, gt), ones));
+        gt = _mm_cmpgt_epi16(dp, t42);
+        sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_and_si128(dp, _mm_and_si128(gt, m2)), ones));
+        sums[4] = _mm_add_epi32(sums[4], _mm_madd_epi16(_mm_and_si128(dp, _mm_and_si128(gt, m4)), ones));
+
+        gt = _mm_and_si128(_mm_cmpgt_epi16(dn, t23), m1);
+        sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_and_si128(dn, gt), ones));
+        gt = _mm_cmpgt_epi16(dn, t42);
+        sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_and_si128(dn, _mm_and_si128(gt, m2)), ones));
+        sums[5] = _mm_add_epi32(sums[5], _mm_madd_epi16(_mm_and_si128(dn, _mm_and_si128(gt, m4)), ones));
+    }
+
+    for (i=0; i<6; ++i)
+        accum[i] += sumEpi32(sums[i]);
+
+    vfmFieldDiffRowC(prvpf, prvnf, curpf, curf, curnf, nxtpf, nxtnf, mapp, map_pitch, x, stopx, accum);
+}
+#endif
+
 // the secret is that tbuffer is an interlaced, offset subset of all the lines
 static void buildABSDiffMask(const unsigned char *prvp, const unsigned char *nxtp,
     int src_pitch, int tpitch, unsigned char *tbuffer, int width, int height,
-    const VSAPI *vsapi) {
+    const VFMData *vfm) {
 
-    int y, x;
+    int y;
     for (y=0; y<height; ++y) {
-        for (x=0; x<width; x++)
-            tbuffer[x] = abs(prvp[x]-nxtp[x]);
+        vfm->absDiffRow(prvp, nxtp, tbuffer, width);
 
         prvp += src_pitch;
         nxtp += src_pitch;
@@ -90,8 +416,9 @@ static void buildABSDiffMask(const unsigned char *prvp, const unsigned char *nxt
 }
 
 
+// cArray has room for the block counts followed by width/8 column sums
 static int calcMI(const VSFrameRef *src, const VSAPI *vsapi,
-    int *blockN, int chroma, int cthresh, VSFrameRef *cmask, int *cArray, int blockx, int blocky)
+    int *blockN, int chroma, int cthresh, VSFrameRef *cmask, int *cArray, int blockx, int blocky, const VFMData *vfm)
 {
     int ret = 0;
     const int cthresh6 = cthresh*6;
@@ -130,14 +457,7 @@ static int calcMI(const VSFrameRef *src, const VSAPI *vsapi,
         cmkp += cmk_pitch;
 
         for (y=2; y<Height-2; ++y) {
-            for (x=0; x<Width; ++x) {
-                const int sFirst = srcp[x] - srcp[x - src_pitch];
-                const int sSecond = srcp[x] - srcp[x + src_pitch];
-                if ((sFirst > cthresh && sSecond > cthresh) || (sFirst < -cthresh && sSecond < -cthresh)) {
-                    if (abs(srcp[x - 2*src_pitch]+(srcp[x]*4)+srcp[x + 2*src_pitch]-(3*(srcp[x - src_pitch]+srcp[x + src_pitch]))) > cthresh6)
-                        cmkp[x] = 0xFF;
-                }
-            }
+            vfm->combRow(srcp, src_pitch, cmkp, Width, cthresh);
             srcp += src_pitch;
             cmkp += cmk_pitch;
         }
@@ -233,27 +553,49 @@ static int calcMI(const VSFrameRef *src, const VSAPI *vsapi,
         const int temp1 = (y/blocky)*xblocks4;
         const int temp2 = ((y+yhalf)/blocky)*xblocks4;
 
-        for (x=0; x<Widtha; x+=xhalf) {
-            const unsigned char *cmkppT = cmkpp;
-            const unsigned char *cmkpT = cmkp;
-            const unsigned char *cmkpnT = cmkpn;
-            int sum = 0;
-            for (u=0; u<yhalf; ++u) {
-                for (v=0; v<xhalf; ++v) {
-                    if (cmkppT[x+v] == 0xFF && cmkpT[x+v] == 0xFF &&
-                        cmkpnT[x+v] == 0xFF) ++sum;
+        // count whole rows 8 pixels at a time when the half blocks line up with that
+        if (!(xhalf & 7)) {
+            int *sums = cArray + arraysize;
+            const int groups = Widtha/8;
+            memset(sums,0,groups*sizeof(int));
+            for (u=0; u<yhalf; ++u)
+                vfm->combCountRow(cmkpp + u*cmk_pitch, cmkp + u*cmk_pitch, cmkpn + u*cmk_pitch, groups, sums);
+            for (x=0; x<Widtha; x+=xhalf) {
+                int sum = 0;
+                for (v=x/8; v<(x+xhalf)/8; ++v)
+                    sum += sums[v];
+                if (sum) {
+                    const int box1 = (x/blockx)*4;
+                    const int box2 = ((x+xhalf)/blockx)*4;
+                    cArray[temp1+box1+0] += sum;
+                    cArray[temp1+box2+1] += sum;
+                    cArray[temp2+box1+2] += sum;
+                    cArray[temp2+box2+3] += sum;
                 }
-                cmkppT += cmk_pitch;
-                cmkpT += cmk_pitch;
-                cmkpnT += cmk_pitch;
             }
-            if (sum) {
-                const int box1 = (x/blockx)*4;
-                const int box2 = ((x+xhalf)/blockx)*4;
-                cArray[temp1+box1+0] += sum;
-                cArray[temp1+box2+1] += sum;
-                cArray[temp2+box1+2] += sum;
-                cArray[temp2+box2+3] += sum;
+        } else {
+            for (x=0; x<Widtha; x+=xhalf) {
+                const unsigned char *cmkppT = cmkpp;
+                const unsigned char *cmkpT = cmkp;
+                const unsigned char *cmkpnT = cmkpn;
+                int sum = 0;
+                for (u=0; u<yhalf; ++u) {
+                    for (v=0; v<xhalf; ++v) {
+                        if (cmkppT[x+v] == 0xFF && cmkpT[x+v] == 0xFF &&
+                            cmkpnT[x+v] == 0xFF) ++sum;
+                    }
+                    cmkppT += cmk_pitch;
+                    cmkpT += cmk_pitch;
+                    cmkpnT += cmk_pitch;
+                }
+                if (sum) {
+                    const int box1 = (x/blockx)*4;
+                    const int box2 = ((x+xhalf)/blockx)*4;
+                    cArray[temp1+box1+0] += sum;
+                    cArray[temp1+box2+1] += sum;
+                    cArray[temp2+box1+2] += sum;
+                    cArray[temp2+box2+3] += sum;
+                }
             }
         }
 
@@ -314,65 +656,23 @@ static int calcMI(const VSFrameRef *src, const VSAPI *vsapi,
 // build a map over which pixels differ a lot/a little
 static void buildDiffMap(const unsigned char *prvp, const unsigned char *nxtp,
     unsigned char *dstp,int src_pitch, int dst_pitch, int Height,
-    int Width, int tpitch, unsigned char *tbuffer, const VSAPI *vsapi)
+    int Width, int tpitch, unsigned char *tbuffer, const VFMData *vfm)
 {
     const unsigned char *dp = tbuffer+tpitch;
-    int x, y, u, diff, count;
+    int y;
 
     buildABSDiffMask(prvp-src_pitch, nxtp-src_pitch, src_pitch,
-        tpitch, tbuffer, Width, Height>>1, vsapi);
+        tpitch, tbuffer, Width, Height>>1, vfm);
 
     for (y=2; y<Height-2; y+=2) {
-        for (x=1; x<Width-1; ++x) {
-            diff = dp[x];
-            if (diff > 3) {
-                for (count=0,u=x-1; u<x+2 && count<2; ++u) {
-                    if (dp[u-tpitch] > 3) ++count;
-                    if (dp[u] > 3) ++count;
-                    if (dp[u+tpitch] > 3) ++count;
-                }
-                if (count > 1) {
-                    ++dstp[x];
-                    if (diff > 19) {
-                        int upper = 0, lower = 0;
-                        for (count=0, u=x-1; u<x+2 && count<6; ++u) {
-                            if (dp[u-tpitch] > 19) { ++count; upper = 1; }
-                            if (dp[u] > 19) ++count;
-                            if (dp[u+tpitch] > 19) { ++count; lower = 1; }
-                        }
-                        if (count > 3) {
-                            if (!upper || !lower) {
-                                int upper2 = 0, lower2 = 0;
-                                for (u=VSMAX(x-4,0); u<VSMIN(x+5,Width); ++u)
-                                {
-                                    if (y != 2 && dp[u-2*tpitch] > 19)
-                                        upper2 = 1;
-                                    if (dp[u-tpitch] > 19)
-                                        upper = 1;
-                                    if (dp[u+tpitch] > 19)
-                                        lower = 1;
-                                    if (y != Height-4 && dp[u+2*tpitch] > 19)
-                                        lower2 = 1;
-                                }
-                                if ((upper && (lower || upper2)) ||
-                                    (lower && (upper || lower2)))
-                                    dstp[x] += 2;
-                                else if (count > 5)
-                                    dstp[x] += 4;
-                            }
-                            else dstp[x] += 2;
-                        }
-                    }
-                }
-            }
-        }
+        vfm->diffMapRow(dp, tpitch, dstp, Width, y != 2, y != Height-4);
         dp += tpitch;
         dstp += dst_pitch;
     }
 }
 
 static int compareFieldsSlow(const VSFrameRef *prv, const VSFrameRef *src, const VSFrameRef *nxt, VSFrameRef *map, int match1,
-    int match2, int mchroma, int field, int y0, int y1, uint8_t *tbuffer, int tpitchy, int tpitchuv, const VSAPI *vsapi)
+    int match2, int mchroma, int field, int y0, int y1, uint8_t *tbuffer, int tpitch, const VFMData *vfm, const VSAPI *vsapi)
 {
     int plane, ret;
     const unsigned char *prvp = 0, *srcp = 0, *nxtp = 0;
@@ -381,10 +681,11 @@ static int compareFieldsSlow(const VSFrameRef *prv, const VSFrameRef *src, const
     unsigned char *mapp;
     int src_stride, Width, Height;
     int curf_pitch, stopx, map_pitch;
-    int x, y, temp1, temp2, startx, y0a, y1a, tp;
+    int y, startx, y0a, y1a;
     int stop = mchroma ? 3 : 1;
-    unsigned long accumPc = 0, accumNc = 0, accumPm = 0;
-    unsigned long accumNm = 0, accumPml = 0, accumNml = 0;
+    // Pc, Nc, Pm, Nm, Pml, Nml
+    unsigned long accum[6] = { 0, 0, 0, 0, 0, 0 };
+    unsigned long accumPc, accumNc, accumPm, accumNm, accumPml, accumNml;
     int norm1, norm2, mtn1, mtn2;
     float c1, c2, mr;
 
@@ -404,11 +705,9 @@ static int compareFieldsSlow(const VSFrameRef *prv, const VSFrameRef *src, const
         if (plane == 0) {
             y0a = y0;
             y1a = y1;
-            tp = tpitchy;
         } else {
             y0a = y0>>1;
             y1a = y1>>1;
-            tp = tpitchuv;
         }
         if (match1 < 3) {
             curf = srcp + ((3-field)*src_stride);
@@ -447,36 +746,13 @@ static int compareFieldsSlow(const VSFrameRef *prv, const VSFrameRef *src, const
         nxtnf = nxtpf + curf_pitch;
         map_pitch <<= 1;
         if ((match1 >= 3 && field == 1) || (match1 < 3 && field != 1))
-            buildDiffMap(prvpf,nxtpf,mapp,curf_pitch,map_pitch,Height,Width,tp,tbuffer,vsapi);
+            buildDiffMap(prvpf,nxtpf,mapp,curf_pitch,map_pitch,Height,Width,tpitch,tbuffer,vfm);
         else
-            buildDiffMap(prvnf,nxtnf,mapp + map_pitch,curf_pitch,map_pitch,Height,Width,tp,tbuffer,vsapi);
+            buildDiffMap(prvnf,nxtnf,mapp + map_pitch,curf_pitch,map_pitch,Height,Width,tpitch,tbuffer,vfm);
 
         for (y=2; y<Height-2; y+=2) {
-            if (y0a == y1a || y < y0a || y > y1a) {
-                for (x=startx; x<stopx; x++) {
-                    if (mapp[x] > 0 || mapp[x + map_pitch] > 0) {
-                        temp1 = curpf[x]+(curf[x]<<2)+curnf[x];
-                        temp2 = abs(3*(prvpf[x]+prvnf[x])-temp1);
-                        if (temp2 > 23 && ((mapp[x]&1) || (mapp[x + map_pitch]&1)))
-                            accumPc += temp2;
-                        if (temp2 > 42) {
-                            if ((mapp[x]&2) || (mapp[x + map_pitch]&2))
-                                accumPm += temp2;
-                            if ((mapp[x]&4) || (mapp[x + map_pitch]&4))
-                                accumPml += temp2;
-                        }
-                        temp2 = abs(3*(nxtpf[x]+nxtnf[x])-temp1);
-                        if (temp2 > 23 && ((mapp[x]&1) || (mapp[x + map_pitch]&1)))
-                            accumNc += temp2;
-                        if (temp2 > 42) {
-                            if ((mapp[x]&2) || (mapp[x + map_pitch]&2))
-                                accumNm += temp2;
-                            if ((mapp[x]&4) || (mapp[x + map_pitch]&4))
-                                accumNml += temp2;
-                        }
-                    }
-                }
-            }
+            if (y0a == y1a || y < y0a || y > y1a)
+                vfm->fieldDiffRow(prvpf, prvnf, curpf, curf, curnf, nxtpf, nxtnf, mapp, map_pitch, startx, stopx, accum);
             prvpf += curf_pitch;
             prvnf += curf_pitch;
             curpf += curf_pitch;
@@ -487,6 +763,12 @@ static int compareFieldsSlow(const VSFrameRef *prv, const VSFrameRef *src, const
             mapp += map_pitch;
         }
     }
+    accumPc = accum[0];
+    accumNc = accum[1];
+    accumPm = accum[2];
+    accumNm = accum[3];
+    accumPml = accum[4];
+    accumNml = accum[5];
     if (accumPm < 500 && accumNm < 500 && (accumPml >= 500 || accumNml >= 500) &&
         VSMAX(accumPml,accumNml) > 3*VSMIN(accumPml,accumNml))
     {
@@ -551,17 +833,17 @@ static const VSFrameRef *createWeaveFrame(const VSFrameRef *prv, const VSFrameRe
 
 
 static int checkmm(int m1, int m2, int *m1mic, int *m2mic, int *blockN, int MI, int field, int chroma, int cthresh, const VSFrameRef **genFrames,
-    const VSFrameRef *prv, const VSFrameRef *src, const VSFrameRef *nxt, VSFrameRef *cmask, int *cArray, int blockx, int blocky, const VSAPI *vsapi, VSCore *core) {
+    const VSFrameRef *prv, const VSFrameRef *src, const VSFrameRef *nxt, VSFrameRef *cmask, int *cArray, int blockx, int blocky, const VFMData *vfm, const VSAPI *vsapi, VSCore *core) {
     if (*m1mic < 0) {
         if (!genFrames[m1])
             genFrames[m1] = createWeaveFrame(prv, src, nxt, vsapi, core, m1, field);
-        *m1mic = calcMI(genFrames[m1], vsapi, blockN, chroma, cthresh, cmask, cArray, blockx, blocky);
+        *m1mic = calcMI(genFrames[m1], vsapi, blockN, chroma, cthresh, cmask, cArray, blockx, blocky, vfm);
     }
 
     if (*m2mic < 0) {
         if (!genFrames[m2])
             genFrames[m2] = createWeaveFrame(prv, src, nxt, vsapi, core, m2, field);
-        *m2mic = calcMI(genFrames[m2], vsapi, blockN, chroma, cthresh, cmask, cArray, blockx, blocky);
+        *m2mic = calcMI(genFrames[m2], vsapi, blockN, chroma, cthresh, cmask, cArray, blockx, blocky, vfm);
     }
 
     if (((*m2mic)*3 < *m1mic || ((*m2mic)*2 < *m1mic && *m1mic > MI)) &&
@@ -626,8 +908,14 @@ static const VSFrameRef *VS_CC vfmGetFrame(int n, int activationReason, void **i
         VSFrameRef *map = vsapi->newVideoFrame(format, width, height, NULL, core);
         VSFrameRef *cmask = vsapi->newVideoFrame(format, width, height, NULL, core);
 
-        uint8_t *tbuffer = (uint8_t *)malloc((height>>1)*vfm->tpitchy*sizeof(uint8_t));
-        int *cArray = (int *)malloc((((width+vfm->blockx/2)/vfm->blockx)+1)*(((height+vfm->blocky/2)/vfm->blocky)+1)*4*sizeof(int));
+        // the scratch frame holds tbuffer followed by the block counts and column sums for calcMI,
+        // it's recycled by the core like any other frame
+        const int arraysize = (((width+vfm->blockx/2)/vfm->blockx)+1)*(((height+vfm->blocky/2)/vfm->blocky)+1)*4;
+        const int scratchsize = (arraysize + width/8)*sizeof(int);
+        VSFrameRef *scratch = vsapi->newVideoFrame(vfm->scratchFormat, width, (height>>1) + (scratchsize + width - 1)/width, NULL, core);
+        const int tpitch = vsapi->getStride(scratch, 0);
+        uint8_t *tbuffer = vsapi->getWritePtr(scratch, 0);
+        int *cArray = (int *)(tbuffer + (height>>1)*tpitch);
 
         // check if it's a scenechange so micmatch can be used
         // only relevant for mm mode 1
@@ -642,18 +930,18 @@ static const VSFrameRef *VS_CC vfmGetFrame(int n, int activationReason, void **i
         }
 
         // p/c selection
-        match = compareFieldsSlow(prv, src, nxt, map, fxo[mC], fxo[mP], vfm->mchroma, vfm->field, vfm->y0, vfm->y1, tbuffer, vfm->tpitchy, vfm->tpitchuv, vsapi);
+        match = compareFieldsSlow(prv, src, nxt, map, fxo[mC], fxo[mP], vfm->mchroma, vfm->field, vfm->y0, vfm->y1, tbuffer, tpitch, vfm, vsapi);
         // the mode has 3-way p/c/n matches
         if (vfm->mode >= 4)
-            match = compareFieldsSlow(prv, src, nxt, map, match, fxo[mN], vfm->mchroma, vfm->field, vfm->y0, vfm->y1, tbuffer, vfm->tpitchy, vfm->tpitchuv, vsapi);
+            match = compareFieldsSlow(prv, src, nxt, map, match, fxo[mN], vfm->mchroma, vfm->field, vfm->y0, vfm->y1, tbuffer, tpitch, vfm, vsapi);
 
         genFrames[mC] = vsapi->cloneFrameRef(src);
 
         // calculate all values for mic output, checkmm calculates and prepares it for the two matches if not already done
         if (vfm->micout) {
-            checkmm(0, 1, &mics[0], &mics[1], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
-            checkmm(2, 3, &mics[2], &mics[3], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
-            checkmm(4, 0, &mics[4], &mics[0], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+            checkmm(0, 1, &mics[0], &mics[1], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
+            checkmm(2, 3, &mics[2], &mics[3], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
+            checkmm(4, 0, &mics[4], &mics[0], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
         }
 
         // check the micmatches to see if one of the options are better
@@ -663,21 +951,21 @@ static const VSFrameRef *VS_CC vfmGetFrame(int n, int activationReason, void **i
             // here comes the conditional hell to try to approximate mode 0-5 in tfm
             if (vfm->mode == 0) {
                 // maybe not completely appropriate but go back and see if the discarded match is less sucky
-                match = checkmm(match, match == fxo[mP] ? fxo[mC] : fxo[mP], &mics[match], &mics[match == fxo[mP] ? fxo[mC] : fxo[mP]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+                match = checkmm(match, match == fxo[mP] ? fxo[mC] : fxo[mP], &mics[match], &mics[match == fxo[mP] ? fxo[mC] : fxo[mP]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             } else if (vfm->mode == 1) {
-                match = checkmm(match, fxo[mN], &mics[match], &mics[fxo[mN]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+                match = checkmm(match, fxo[mN], &mics[match], &mics[fxo[mN]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             } else if (vfm->mode == 2) {
-                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             } else if (vfm->mode == 3) {
-                match = checkmm(match, fxo[mN], &mics[match], &mics[fxo[mN]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
-                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
-                match = checkmm(match, fxo[mB], &mics[match], &mics[fxo[mB]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+                match = checkmm(match, fxo[mN], &mics[match], &mics[fxo[mN]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
+                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
+                match = checkmm(match, fxo[mB], &mics[match], &mics[fxo[mB]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             } else if (vfm->mode == 4) {
                 // degenerate check because I'm lazy
-                match = checkmm(match, match == fxo[mP] ? fxo[mC] : fxo[mP], &mics[match], &mics[match == fxo[mP] ? fxo[mC] : fxo[mP]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky,vsapi, core);
+                match = checkmm(match, match == fxo[mP] ? fxo[mC] : fxo[mP], &mics[match], &mics[match == fxo[mP] ? fxo[mC] : fxo[mP]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             } else if (vfm->mode == 5) {
-                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
-                match = checkmm(match, fxo[mB], &mics[match], &mics[fxo[mB]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vsapi, core);
+                match = checkmm(match, fxo[mU], &mics[match], &mics[fxo[mU]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
+                match = checkmm(match, fxo[mB], &mics[match], &mics[fxo[mB]], &blockN, vfm->mi, vfm->field, vfm->chroma, vfm->cthresh, genFrames, prv, src, nxt, cmask, &cArray[0], vfm->blockx, vfm->blocky, vfm, vsapi, core);
             }
         }
 
@@ -702,8 +990,7 @@ static const VSFrameRef *VS_CC vfmGetFrame(int n, int activationReason, void **i
         for (i = 0; i < 5; i++)
             vsapi->freeFrame(genFrames[i]);
 
-        free(tbuffer);
-        free(cArray);
+        vsapi->freeFrame(scratch);
         vsapi->freeFrame(map);
         vsapi->freeFrame(cmask);
 
@@ -785,6 +1072,7 @@ static void VS_CC createVFM(const VSMap *in, VSMap *out, void *userData, VSCore
     int err;
     VFMData vfm;
     VFMData *vfmd ;
+    int opt;
     const VSVideoInfo *vi;
 
     vfm.order = !!vsapi->propGetInt(in, "order", 0, 0);
@@ -826,6 +1114,9 @@ static void VS_CC createVFM(const VSMap *in, VSMap *out, void *userData, VSCore
     if (err)
         vfm.micmatch = 1;
     vfm.micout = !!vsapi->propGetInt(in, "micout", 0, &err);
+    opt = int64ToIntS(vsapi->propGetInt(in, "opt", 0, &err));
+    if (err)
+        opt = 2;
 
     if (vfm.mode < 0 || vfm.mode > 5) {
         vsapi->setError(out, "VFM: Invalid mode specified, only 0-5 allowed");
@@ -857,6 +1148,11 @@ static void VS_CC createVFM(const VSMap *in, VSMap *out, void *userData, VSCore
         return;
     }
 
+    if (opt < 0 || opt > 2) {
+        vsapi->setError(out, "VFM: opt must be 0, 1 or 2");
+        return;
+    }
+
     vfm.node = vsapi->propGetNode(in, "clip", 0, 0);
     vfm.clip2 = vsapi->propGetNode(in, "clip2", 0, &err);
     vfm.vi = vsapi->getVideoInfo(vfm.clip2 ? vfm.clip2 : vfm.node);
@@ -894,8 +1190,32 @@ static void VS_CC createVFM(const VSMap *in, VSMap *out, void *userData, VSCore
         vsapi->freeMap(ret);
     }
 
-    vfm.tpitchy = (vi->width&15) ? vi->width+16-(vi->width&15) : vi->width;
-    vfm.tpitchuv = ((vi->width>>1)&15) ? (vi->width>>1)+16-((vi->width>>1)&15) : (vi->width>>1);
+    vfm.scratchFormat = vsapi->getFormatPreset(pfGray8, core);
+
+    vfm.absDiffRow = vfmAbsDiffRowC;
+    vfm.combRow = vfmCombRowC;
+    vfm.combCountRow = vfmCombCountRowC;
+    vfm.diffMapRow = vfmDiffMapRowC;
+    vfm.fieldDiffRow = vfmFieldDiffRowC;
+
+#ifdef VS_TARGET_CPU_X86
+    CPUFeatures cpu;
+    getCPUFeatures(&cpu);
+
+    if (opt >= 2 && cpu.avx2) {
+        vfm.absDiffRow = vfmAbsDiffRowAVX2;
+        vfm.combRow = vfmCombRowAVX2;
+        vfm.combCountRow = vfmCombCountRowAVX2;
+        vfm.diffMapRow = vfmDiffMapRowAVX2;
+        vfm.fieldDiffRow = vfmFieldDiffRowAVX2;
+    } else if (opt >= 1) {
+        vfm.absDiffRow = absDiffRowSSE2;
+        vfm.combRow = combRowSSE2;
+        vfm.combCountRow = combCountRowSSE2;
+        vfm.diffMapRow = diffMapRowSSE2;
+        vfm.fieldDiffRow = fieldDiffRowSSE2;
+    }
+#endif
 
     vfmd = (VFMData *)malloc(sizeof(vfm));
     *vfmd = vfm;
@@ -914,9 +1234,22 @@ typedef struct {
     int64_t totdiff;
 } VDInfo;
 
+// The metrics only depend on the current and previous frame so they're
+// calculated by a separate parallel filter and passed on as frame properties
+typedef struct {
+    VSNodeRef *node;
+    VSVideoInfo vi;
+    int chroma;
+    int blockx;
+    int blocky;
+    int nxblocks;
+    int nyblocks;
+} VDMetricsData;
+
 typedef struct {
     VSNodeRef *node;
     VSNodeRef *clip2;
+    VSNodeRef *metrics;
     VSVideoInfo vi;
     int inCycle;
     int outCycle;
@@ -927,25 +1260,25 @@ typedef struct {
     int64_t scthresh;
     int blockx;
     int blocky;
-    int nxblocks;
-    int nyblocks;
-    int bdiffsize;
-    int64_t *bdiffs;
     VDInfo *vmi;
     const char *ovrfile;
+    char *metricsfile;
+    int metricsChanged;
     int dryrun;
     char *drop;
     FrameDuration *durations;
 } VDecimateData;
 
-static int64_t calcMetric(const VSFrameRef *f1, const VSFrameRef *f2, int64_t *totdiff, VDecimateData *vdm, const VSAPI *vsapi) {
-    int64_t *bdiffs = vdm->bdiffs;
+// The 2x2 windows only ever span two rows of half blocks so the block columns are done in groups of this many,
+// which keeps the sums in a fixed buffer no matter how wide the clip is
+#define VDM_BLOCK_GROUP 64
+
+// sums the absolute differences of half block row y for numblocks half blocks starting at firstblock
+static void calcBlockRow(const VSFrameRef *f1, const VSFrameRef *f2, int y, int firstblock, int numblocks, int64_t *bdiffs, const VDMetricsData *md, const VSAPI *vsapi) {
     int plane;
-    int x, y, xl;
-    int i, j;
-    int numplanes = vdm->chroma ? 3 : 1;
-    int64_t maxdiff = -1;
-    memset(bdiffs, 0, vdm->bdiffsize * sizeof(int64_t));
+    int x, yl, xl;
+    int numplanes = md->chroma ? 3 : 1;
+    memset(bdiffs, 0, numblocks * sizeof(int64_t));
     for (plane = 0; plane < numplanes; plane++) {
         int stride = vsapi->getStride(f1, plane);
         const uint8_t *f1p = vsapi->getReadPtr(f1, plane);
@@ -954,35 +1287,40 @@ static int64_t calcMetric(const VSFrameRef *f1, const VSFrameRef *f2, int64_t *t
 
         int width = vsapi->getFrameWidth(f1, plane);
         int height = vsapi->getFrameHeight(f1, plane);
-        int hblockx = vdm->blockx/2;
-        int hblocky = vdm->blocky/2;
-        int nxblocks = vdm->nxblocks;
+        int hblockx = md->blockx/2;
+        int hblocky = md->blocky/2;
+        int xstart, xend, yend;
         // adjust for subsampling
         if (plane > 0) {
             hblockx /= 1 << fi->subSamplingW;
             hblocky /= 1 << fi->subSamplingH;
         }
 
-        for (y = 0; y < height; y++) {
-            int ydest = y / hblocky;
+        xstart = firstblock * hblockx;
+        xend = VSMIN(width, (firstblock + numblocks) * hblockx);
+        yend = VSMIN(height, (y + 1) * hblocky);
+        f1p += y * hblocky * stride;
+        f2p += y * hblocky * stride;
+
+        for (yl = y * hblocky; yl < yend; yl++) {
             int xdest = 0;
             // some slight code duplication to not put an if statement for 8/16 bit processing in the inner loop
             if (fi->bitsPerSample == 8) {
-                for (x = 0; x < width; x+= hblockx) {
+                for (x = xstart; x < xend; x+= hblockx) {
                     int acc = 0;
-                    int m = VSMIN(width, x + hblockx);
+                    int m = VSMIN(xend, x + hblockx);
                     for (xl = x; xl < m; xl++)
                         acc += abs(f1p[xl] - f2p[xl]);
-                    bdiffs[ydest * nxblocks + xdest] += acc;
+                    bdiffs[xdest] += acc;
                     xdest++;
                 }
             } else {
-                for (x = 0; x < width; x+= hblockx) {
+                for (x = xstart; x < xend; x+= hblockx) {
                     int acc = 0;
-                    int m = VSMIN(width, x + hblockx);
+                    int m = VSMIN(xend, x + hblockx);
                     for (xl = x; xl < m; xl++)
                         acc += abs(((const uint16_t *)f1p)[xl] - ((const uint16_t *)f2p)[xl]);
-                    bdiffs[ydest * nxblocks + xdest] += acc;
+                    bdiffs[xdest] += acc;
                     xdest++;
                 }
             }
@@ -990,40 +1328,103 @@ static int64_t calcMetric(const VSFrameRef *f1, const VSFrameRef *f2, int64_t *t
             f2p += stride;
         }
     }
+}
+
+static int64_t calcMetric(const VSFrameRef *f1, const VSFrameRef *f2, int64_t *totdiff, const VDMetricsData *md, const VSAPI *vsapi) {
+    // one extra column since the last window of a group reaches into the next one
+    int64_t rows[2][VDM_BLOCK_GROUP + 1];
+    int64_t maxdiff = -1;
+    int first, i, j;
 
-    for (i = 0; i  < vdm->nyblocks - 1; i++) {
-        for (j = 0; j  < vdm->nxblocks - 1; j++) {
-            int64_t tmp = bdiffs[i * vdm->nxblocks + j] + bdiffs[i * vdm->nxblocks + j + 1] + bdiffs[(i + 1) * vdm->nxblocks + j] + bdiffs[(i + 1) * vdm->nxblocks + j + 1];
-            if (tmp > maxdiff)
-                maxdiff = tmp;
+    *totdiff = 0;
+    for (first = 0; first < md->nxblocks; first += VDM_BLOCK_GROUP) {
+        int numblocks = VSMIN(VDM_BLOCK_GROUP, md->nxblocks - first);
+        int numcolumns = VSMIN(numblocks + 1, md->nxblocks - first);
+
+        for (i = 0; i < md->nyblocks; i++) {
+            int64_t *prv = rows[(i + 1) & 1];
+            int64_t *cur = rows[i & 1];
+            calcBlockRow(f1, f2, i, first, numcolumns, cur, md, vsapi);
+
+            for (j = 0; j < numblocks; j++)
+                *totdiff += cur[j];
+
+            if (i > 0) {
+                for (j = 0; j + 1 < numcolumns; j++) {
+                    int64_t tmp = prv[j] + prv[j + 1] + cur[j] + cur[j + 1];
+                    if (tmp > maxdiff)
+                        maxdiff = tmp;
+                }
+            }
         }
     }
 
-    *totdiff = 0;
-    for (i = 0; i  < vdm->bdiffsize; i++)
-        *totdiff += bdiffs[i];
     return maxdiff;
 }
 
-static int vdecimateLoadOVR(const char *ovrfile, char *drop, int cycle, int numFrames, char err[80]) {
-    int line = 0;
-    char buf[80];
-    char* pos;
+static void VS_CC vdmetricsInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
+    VDMetricsData *md = (VDMetricsData *)*instanceData;
+    vsapi->setVideoInfo(&md->vi, 1, node);
+}
+
+static const VSFrameRef *VS_CC vdmetricsGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
+    VDMetricsData *md = (VDMetricsData *)*instanceData;
+
+    if (activationReason == arInitial) {
+        if (n > 0)
+            vsapi->requestFrameFilter(n - 1, md->node, frameCtx);
+        vsapi->requestFrameFilter(n, md->node, frameCtx);
+    } else if (activationReason == arAllFramesReady) {
+        const VSFrameRef *prv = vsapi->getFrameFilter(VSMAX(n - 1, 0), md->node, frameCtx);
+        const VSFrameRef *cur = vsapi->getFrameFilter(n, md->node, frameCtx);
+        int64_t maxbdiff, totdiff;
+        VSFrameRef *dst;
+        VSMap *dstProps;
+
+        maxbdiff = calcMetric(prv, cur, &totdiff, md, vsapi);
+        vsapi->freeFrame(prv);
+
+        dst = vsapi->copyFrame(cur, core);
+        vsapi->freeFrame(cur);
+        dstProps = vsapi->getFramePropsRW(dst);
+        vsapi->propSetInt(dstProps, "VDecimateMaxBlockDiff", maxbdiff, paReplace);
+        vsapi->propSetInt(dstProps, "VDecimateTotalDiff", totdiff, paReplace);
+        return dst;
+    }
+
+    return NULL;
+}
+
+static void VS_CC vdmetricsFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
+    VDMetricsData *md = (VDMetricsData *)instanceData;
+    vsapi->freeNode(md->node);
+    free(md);
+}
+
+static FILE *vdecimateOpenFile(const char *filename, int write) {
 #ifdef _WIN32
-    FILE* moo = NULL;
+    FILE* f = NULL;
     int len, ret;
-    wchar_t *ovrfile_wc;
-    len = MultiByteToWideChar(CP_UTF8, 0, ovrfile, -1, NULL, 0);
-    ovrfile_wc = malloc(len * sizeof(wchar_t));
-    if (ovrfile_wc) {
-        ret = MultiByteToWideChar(CP_UTF8, 0, ovrfile, -1, ovrfile_wc, len);
+    wchar_t *filename_wc;
+    len = MultiByteToWideChar(CP_UTF8, 0, filename, -1, NULL, 0);
+    filename_wc = malloc(len * sizeof(wchar_t));
+    if (filename_wc) {
+        ret = MultiByteToWideChar(CP_UTF8, 0, filename, -1, filename_wc, len);
         if (ret == len)
-            moo = _wfopen(ovrfile_wc, L"rb");
-        free(ovrfile_wc);
+            f = _wfopen(filename_wc, write ? L"wb" : L"rb");
+        free(filename_wc);
     }
+    return f;
 #else
-    FILE* moo = fopen(ovrfile, "r");
+    return fopen(filename, write ? "w" : "r");
 #endif
+}
+
+static int vdecimateLoadOVR(const char *ovrfile, char *drop, int cycle, int numFrames, char err[80]) {
+    int line = 0;
+    char buf[80];
+    char* pos;
+    FILE* moo = vdecimateOpenFile(ovrfile, 0);
     if (!moo) {
         sprintf(err, "VDecimate: can't open ovr file");
         return 1;
@@ -1085,6 +1486,77 @@ static int vdecimateLoadOVR(const char *ovrfile, char *drop, int cycle, int numF
     return 0;
 }
 
+// The metrics file starts with a header line followed by a line with the
+// settings that affect the metrics and then one line per frame with known
+// metrics. A missing file or one made with different settings isn't an
+// error, the metrics are simply calculated again and the file is replaced.
+static const char vdecimateMetricsHeader[] = "# vdecimate metrics v1";
+
+static int vdecimateLoadMetrics(const char *metricsfile, VDInfo *vmi, int numFrames, int blockx, int blocky, int chroma, char err[80]) {
+    int line = 2;
+    char buf[80];
+    char* pos;
+    int fileFrames, fileBlockx, fileBlocky, fileChroma;
+    FILE* f = vdecimateOpenFile(metricsfile, 0);
+    if (!f)
+        return 0;
+
+    memset(buf, 0, sizeof(buf));
+    if (!fgets(buf, 80, f) || strncmp(buf, vdecimateMetricsHeader, sizeof(vdecimateMetricsHeader) - 1)) {
+        sprintf(err, "VDecimate: metricsfile exists but isn't a metrics file");
+        fclose(f);
+        return 1;
+    }
+
+    if (!fgets(buf, 80, f) || sscanf(buf, "frames %d blockx %d blocky %d chroma %d", &fileFrames, &fileBlockx, &fileBlocky, &fileChroma) != 4) {
+        sprintf(err, "VDecimate: failed to parse metrics at line %d", line);
+        fclose(f);
+        return 1;
+    }
+
+    if (fileFrames != numFrames || fileBlockx != blockx || fileBlocky != blocky || fileChroma != chroma) {
+        fclose(f);
+        return 0;
+    }
+
+    while (fgets(buf, 80, f)) {
+        int frame;
+        int64_t maxbdiff, totdiff;
+
+        line++;
+        pos = buf + strspn(buf, " \t\r\n");
+
+        if (pos[0] == 0)
+            continue;
+
+        if (sscanf(pos, "%d %" SCNd64 " %" SCNd64, &frame, &maxbdiff, &totdiff) != 3 || frame < 0 || frame >= numFrames || totdiff < 0) {
+            sprintf(err, "VDecimate: failed to parse metrics at line %d", line);
+            fclose(f);
+            return 1;
+        }
+
+        vmi[frame].maxbdiff = maxbdiff;
+        vmi[frame].totdiff = totdiff;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void vdecimateSaveMetrics(const VDecimateData *vdm) {
+    int i;
+    FILE* f = vdecimateOpenFile(vdm->metricsfile, 1);
+    if (!f)
+        return;
+
+    fprintf(f, "%s\nframes %d blockx %d blocky %d chroma %d\n", vdecimateMetricsHeader, vdm->inputNumFrames, vdm->blockx, vdm->blocky, vdm->chroma);
+    for (i = 0; i < vdm->inputNumFrames; i++)
+        if (vdm->vmi[i].totdiff >= 0)
+            fprintf(f, "%d %" PRId64 " %" PRId64 "\n", i, vdm->vmi[i].maxbdiff, vdm->vmi[i].totdiff);
+
+    fclose(f);
+}
+
 static void VS_CC vdecimateInit(VSMap *in, VSMap *out, void **instanceData, VSNode *node, VSCore *core, const VSAPI *vsapi) {
     VDecimateData *vdm = (VDecimateData *)*instanceData;
     vsapi->setVideoInfo(&vdm->vi, 1, node);
@@ -1174,6 +1646,16 @@ static void calculateNewDurations(const FrameDuration *oldDurations, FrameDurati
     }
 }
 
+// The first frame's metrics are always 0, thus it's always considered a duplicate.
+static VDInfo getFrameMetrics(const VDecimateData *vdm, int n) {
+    VDInfo info = vdm->vmi[n];
+    if (n == 0 && vdm->inputNumFrames > 1) {
+        info.maxbdiff = vdm->vmi[1].maxbdiff;
+        info.totdiff = vdm->scthresh + 1;
+    }
+    return info;
+}
+
 static const VSFrameRef *VS_CC vdecimateGetFrame(int n, int activationReason, void **instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
     VDecimateData *vdm = (VDecimateData *)*instanceData;
     int i;
@@ -1189,15 +1671,13 @@ static const VSFrameRef *VS_CC vdecimateGetFrame(int n, int activationReason, vo
 
         drop = vdm->drop[cyclestart / vdm->inCycle];
 
-        if (drop < 0 || (vdm->dryrun && vdm->vmi[cyclestart].totdiff < 0)) {
-            if (cyclestart > 0)
-                vsapi->requestFrameFilter(cyclestart - 1, vdm->node, frameCtx);
-
+        if (drop < 0 || vdm->dryrun) {
             for (i = cyclestart; i < cycleend; i++)
-                vsapi->requestFrameFilter(i, vdm->node, frameCtx);
+                if (vdm->vmi[i].totdiff < 0)
+                    vsapi->requestFrameFilter(i, vdm->metrics, frameCtx);
         }
 
-        if (drop > -1) {
+        if (drop > -1 || vdm->dryrun) {
             int outputFrame = findOutputFrame(n, cyclestart, vdm->outCycle, drop, vdm->dryrun);
 
             vsapi->requestFrameFilter(outputFrame, vdm->clip2 ? vdm->clip2 : vdm->node, frameCtx);
@@ -1226,24 +1706,27 @@ static const VSFrameRef *VS_CC vdecimateGetFrame(int n, int activationReason, vo
 
         drop = &vdm->drop[cyclestart / vdm->inCycle];
 
-        if (*drop < 0 || (vdm->dryrun && vdm->vmi[cyclestart].totdiff < 0)) {
-            // Calculate metrics
+        if (*drop < 0 || vdm->dryrun) {
+            // Collect the metrics, another request for the same cycle may already have done it
             for (i = cyclestart; i < cycleend; i++) {
-                const VSFrameRef *prv = vsapi->getFrameFilter(VSMAX(i - 1, 0), vdm->node, frameCtx);
-                const VSFrameRef *cur = vsapi->getFrameFilter(i, vdm->node, frameCtx);
-                vdm->vmi[i].maxbdiff = calcMetric(prv, cur, &vdm->vmi[i].totdiff, vdm, vsapi);
-                vsapi->freeFrame(prv);
-                vsapi->freeFrame(cur);
+                if (vdm->vmi[i].totdiff < 0) {
+                    const VSFrameRef *frame = vsapi->getFrameFilter(i, vdm->metrics, frameCtx);
+                    const VSMap *frameProps = vsapi->getFramePropsRO(frame);
+                    vdm->vmi[i].maxbdiff = vsapi->propGetInt(frameProps, "VDecimateMaxBlockDiff", 0, NULL);
+                    vdm->vmi[i].totdiff = vsapi->propGetInt(frameProps, "VDecimateTotalDiff", 0, NULL);
+                    vsapi->freeFrame(frame);
+                    vdm->metricsChanged = 1;
+                }
             }
 
-            // The first frame's metrics are always 0, thus it's always considered a duplicate.
-            if (cyclestart == 0) {
-                vdm->vmi[0].maxbdiff = vdm->vmi[1].maxbdiff;
-                vdm->vmi[0].totdiff = vdm->scthresh + 1;
-            }
+            if (*drop < 0) {
+                VDInfo metrics[25] = { { 0, 0 } };
+
+                for (i = cyclestart; i < cycleend; i++)
+                    metrics[i - cyclestart] = getFrameMetrics(vdm, i);
 
-            if (*drop < 0)
-                *drop = findDropFrame(&vdm->vmi[cyclestart], cycleend - cyclestart, vdm->scthresh, vdm->dupthresh);
+                *drop = findDropFrame(metrics, cycleend - cyclestart, vdm->scthresh, vdm->dupthresh);
+            }
         }
 
         if (!vdm->dryrun && vdm->durations[n].den == 0) {
@@ -1266,12 +1749,13 @@ static const VSFrameRef *VS_CC vdecimateGetFrame(int n, int activationReason, vo
         src = vsapi->getFrameFilter(outputFrame, vdm->clip2 ? vdm->clip2 : vdm->node, frameCtx);
 
         if (vdm->dryrun) {
+            VDInfo metrics = getFrameMetrics(vdm, outputFrame);
             dst = vsapi->copyFrame(src, core);
             vsapi->freeFrame(src);
             dstProps = vsapi->getFramePropsRW(dst);
             vsapi->propSetInt(dstProps, "VDecimateDrop", outputFrame % vdm->inCycle == vdm->drop[cyclestart / vdm->inCycle], paReplace);
-            vsapi->propSetInt(dstProps, "VDecimateTotalDiff", vdm->vmi[outputFrame].totdiff, paReplace);
-            vsapi->propSetInt(dstProps, "VDecimateMaxBlockDiff", vdm->vmi[outputFrame].maxbdiff, paReplace);
+            vsapi->propSetInt(dstProps, "VDecimateTotalDiff", metrics.totdiff, paReplace);
+            vsapi->propSetInt(dstProps, "VDecimateMaxBlockDiff", metrics.maxbdiff, paReplace);
             return dst;
         } else {
             if (vdm->durations[n].den > 0) {
@@ -1291,11 +1775,14 @@ static const VSFrameRef *VS_CC vdecimateGetFrame(int n, int activationReason, vo
 
 static void VS_CC vdecimateFree(void *instanceData, VSCore *core, const VSAPI *vsapi) {
     VDecimateData *vdm = (VDecimateData *)instanceData;
+    if (vdm->metricsfile && vdm->metricsChanged)
+        vdecimateSaveMetrics(vdm);
     vsapi->freeNode(vdm->node);
     vsapi->freeNode(vdm->clip2);
-    free(vdm->bdiffs);
+    vsapi->freeNode(vdm->metrics);
     free(vdm->vmi);
     free(vdm->drop);
+    free(vdm->metricsfile);
     if (!vdm->dryrun)
         free(vdm->durations);
     free(vdm);
@@ -1304,7 +1791,10 @@ static void VS_CC vdecimateFree(void *instanceData, VSCore *core, const VSAPI *v
 static void VS_CC createVDecimate(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
     VDecimateData vdm;
     VDecimateData *d;
+    VDMetricsData *md;
+    VSMap *args, *ret;
     const VSVideoInfo *vi;
+    const char *metricsfile;
     int i, err, max_value;
     double dupthresh, scthresh;
 
@@ -1389,10 +1879,6 @@ static void VS_CC createVDecimate(const VSMap *in, VSMap *out, void *userData, V
     vdm.scthresh = (int64_t)(((int64_t)max_value * vi->width * vi->height * scthresh)/100);
     vdm.dupthresh = (int64_t)((max_value * vdm.blockx * vdm.blocky * dupthresh)/100);
 
-    vdm.nxblocks = (vdm.vi.width + vdm.blockx/2 - 1)/(vdm.blockx/2);
-    vdm.nyblocks = (vdm.vi.height + vdm.blocky/2 - 1)/(vdm.blocky/2);
-    vdm.bdiffsize = vdm.nxblocks * vdm.nyblocks;
-    vdm.bdiffs = (int64_t *)malloc(vdm.bdiffsize * sizeof(int64_t));
     vdm.vmi = (VDInfo *)malloc(vdm.vi.numFrames * sizeof(VDInfo));
     for (i = 0; i < vdm.vi.numFrames; i++) {
         vdm.vmi[i].maxbdiff = -1;
@@ -1407,7 +1893,6 @@ static void VS_CC createVDecimate(const VSMap *in, VSMap *out, void *userData, V
 
         if (vdecimateLoadOVR(vdm.ovrfile, vdm.drop, vdm.inCycle, vdm.vi.numFrames, err)) {
             free(vdm.drop);
-            free(vdm.bdiffs);
             free(vdm.vmi);
             vsapi->freeNode(vdm.node);
             vsapi->freeNode(vdm.clip2);
@@ -1416,6 +1901,41 @@ static void VS_CC createVDecimate(const VSMap *in, VSMap *out, void *userData, V
         }
     }
 
+    vdm.metricsfile = NULL;
+    vdm.metricsChanged = 0;
+    metricsfile = vsapi->propGetData(in, "metricsfile", 0, &err);
+    if (metricsfile) {
+        char err[80];
+
+        if (vdecimateLoadMetrics(metricsfile, vdm.vmi, vdm.vi.numFrames, vdm.blockx, vdm.blocky, vdm.chroma, err)) {
+            free(vdm.drop);
+            free(vdm.vmi);
+            vsapi->freeNode(vdm.node);
+            vsapi->freeNode(vdm.clip2);
+            vsapi->setError(out, err);
+            return;
+        }
+
+        vdm.metricsfile = (char *)malloc(strlen(metricsfile) + 1);
+        strcpy(vdm.metricsfile, metricsfile);
+    }
+
+    md = (VDMetricsData *)malloc(sizeof(VDMetricsData));
+    md->node = vsapi->cloneNodeRef(vdm.node);
+    md->vi = *vi;
+    md->chroma = vdm.chroma;
+    md->blockx = vdm.blockx;
+    md->blocky = vdm.blocky;
+    md->nxblocks = (vdm.vi.width + vdm.blockx/2 - 1)/(vdm.blockx/2);
+    md->nyblocks = (vdm.vi.height + vdm.blocky/2 - 1)/(vdm.blocky/2);
+
+    args = vsapi->createMap();
+    ret = vsapi->createMap();
+    vsapi->createFilter(args, ret, "VDecimateMetrics", vdmetricsInit, vdmetricsGetFrame, vdmetricsFree, fmParallel, 0, md, core);
+    vdm.metrics = vsapi->propGetNode(ret, "clip", 0, 0);
+    vsapi->freeMap(ret);
+    vsapi->freeMap(args);
+
     if (vdm.dryrun)
         vdm.outCycle = vdm.inCycle;
     else
@@ -1441,7 +1961,7 @@ static void VS_CC createVDecimate(const VSMap *in, VSMap *out, void *userData, V
 
     d = (VDecimateData *)malloc(sizeof(vdm));
     *d = vdm;
-    vsapi->createFilter(in, out, "VDecimate", vdecimateInit, vdecimateGetFrame, vdecimateFree, fmSerial, 0, d, core);
+    vsapi->createFilter(in, out, "VDecimate", vdecimateInit, vdecimateGetFrame, vdecimateFree, fmUnordered, 0, d, core);
 }
 
 // Needed to silence warnings
@@ -1453,8 +1973,8 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
     registerFunc("VFM", "clip:clip;order:int;field:int:opt;mode:int:opt;" \
         "mchroma:int:opt;cthresh:int:opt;mi:int:opt;" \
         "chroma:int:opt;blockx:int:opt;blocky:int:opt;y0:int:opt;y1:int:opt;" \
-        "scthresh:float:opt;micmatch:int:opt;micout:int:opt;clip2:clip:opt;", createVFM, NULL, plugin);
+        "scthresh:float:opt;micmatch:int:opt;micout:int:opt;clip2:clip:opt;opt:int:opt;", createVFM, NULL, plugin);
     registerFunc("VDecimate", "clip:clip;cycle:int:opt;" \
         "chroma:int:opt;dupthresh:float:opt;scthresh:float:opt;" \
-        "blockx:int:opt;blocky:int:opt;clip2:clip:opt;ovr:data:opt;dryrun:int:opt;", createVDecimate, NULL, plugin);
+        "blockx:int:opt;blocky:int:opt;clip2:clip:opt;ovr:data:opt;dryrun:int:opt;metricsfile:data:opt;", createVDecimate, NULL, plugin);
 }
@@ -0,0 +1,70 @@
+/*
+* Copyright (c) 2012-2014 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef VIVTC_H
+#define VIVTC_H
+
+#include <stdint.h>
+
+// Absolute difference of two lines.
+typedef void (*AbsDiffRowFunc)(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width);
+
+// Combing mask of a line that has two lines above and below it.
+typedef void (*CombRowFunc)(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh);
+
+// Adds the number of pixels masked in all three lines to sums[i] for every
+// group of 8 pixels starting at 8*i.
+typedef void (*CombCountRowFunc)(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums);
+
+// One line of the field difference map. dp points to the absolute difference
+// line, upper2 and lower2 are set when the lines two steps away can be used.
+typedef void (*DiffMapRowFunc)(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2);
+
+// Accumulates the field matching metrics of one line in [startx, stopx).
+// accum holds the Pc, Nc, Pm, Nm, Pml and Nml sums in that order.
+typedef void (*FieldDiffRowFunc)(const uint8_t *prvpf, const uint8_t *prvnf,
+                                 const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+                                 const uint8_t *nxtpf, const uint8_t *nxtnf,
+                                 const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum);
+
+#ifdef VS_TARGET_CPU_X86
+void vfmAbsDiffRowAVX2(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width);
+void vfmCombRowAVX2(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh);
+void vfmCombCountRowAVX2(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums);
+void vfmDiffMapRowAVX2(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2);
+void vfmFieldDiffRowAVX2(const uint8_t *prvpf, const uint8_t *prvnf,
+                         const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+                         const uint8_t *nxtpf, const uint8_t *nxtnf,
+                         const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum);
+#endif
+
+void vfmAbsDiffRowC(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width);
+void vfmCombRowC(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh);
+void vfmCombCountRowC(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums);
+void vfmDiffMapRowC(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2);
+// The C version of the difference map for x in [x0, x1), used for the edges
+// of the SIMD versions.
+void vfmDiffMapPixelsC(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2, int x0, int x1);
+void vfmFieldDiffRowC(const uint8_t *prvpf, const uint8_t *prvnf,
+                      const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+                      const uint8_t *nxtpf, const uint8_t *nxtnf,
+                      const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum);
+
+#endif
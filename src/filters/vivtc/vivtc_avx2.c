@@ -0,0 +1,227 @@
+/*
+* Copyright (c) 2012-2014 Fredrik Mellbin
+*
+* This file is part of VapourSynth.
+*
+* VapourSynth is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* VapourSynth is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with VapourSynth; if not, write to the Free Software
+* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// This file is compiled with AVX2 enabled and must only be called after
+// checking for it. All kernels are integer only and give the same results
+// as the C versions.
+
+#ifdef VS_TARGET_CPU_X86
+#include <immintrin.h>
+
+#include "VSHelper.h"
+
+#include "vivtc.h"
+
+
+static inline __m256i absDiffU8(__m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+// unsigned a > b for bytes
+static inline __m256i cmpGtU8(__m256i a, __m256i b) {
+    return _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+}
+
+static inline int sumEpi32(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 8));
+    s = _mm_add_epi32(s, _mm_srli_si128(s, 4));
+    return _mm_cvtsi128_si32(s);
+}
+
+
+void vfmAbsDiffRowAVX2(const uint8_t *prvp, const uint8_t *nxtp, uint8_t *dstp, int width) {
+    int i;
+
+    if (width < 32) {
+        vfmAbsDiffRowC(prvp, nxtp, dstp, width);
+        return;
+    }
+
+    for (i=0; i<width; i+=32) {
+        const int j = VSMIN(i, width - 32);
+        _mm256_storeu_si256((__m256i *)(dstp + j), absDiffU8(_mm256_loadu_si256((const __m256i *)(prvp + j)), _mm256_loadu_si256((const __m256i *)(nxtp + j))));
+    }
+}
+
+
+static inline __m256i combMask(__m256i pp, __m256i p, __m256i c, __m256i n, __m256i nn, __m256i t, __m256i nt, __m256i t6) {
+    const __m256i s1 = _mm256_sub_epi16(c, p);
+    const __m256i s2 = _mm256_sub_epi16(c, n);
+    const __m256i pn = _mm256_add_epi16(p, n);
+    const __m256i d = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(pp, _mm256_slli_epi16(c, 2)), nn), _mm256_add_epi16(pn, _mm256_add_epi16(pn, pn)));
+    const __m256i ad = _mm256_abs_epi16(d);
+    const __m256i cond = _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi16(s1, t), _mm256_cmpgt_epi16(s2, t)),
+                                         _mm256_and_si256(_mm256_cmpgt_epi16(nt, s1), _mm256_cmpgt_epi16(nt, s2)));
+    return _mm256_and_si256(cond, _mm256_cmpgt_epi16(ad, t6));
+}
+
+void vfmCombRowAVX2(const uint8_t *srcp, int src_pitch, uint8_t *cmkp, int width, int cthresh) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i t = _mm256_set1_epi16(cthresh);
+    const __m256i nt = _mm256_set1_epi16(-cthresh);
+    const __m256i t6 = _mm256_set1_epi16(cthresh*6);
+    int i;
+
+    if (width < 32) {
+        vfmCombRowC(srcp, src_pitch, cmkp, width, cthresh);
+        return;
+    }
+
+    // unpacking and packing both work within 128 bit lanes so the order is kept
+    for (i=0; i<width; i+=32) {
+        const int j = VSMIN(i, width - 32);
+        const __m256i pp = _mm256_loadu_si256((const __m256i *)(srcp + j - 2*src_pitch));
+        const __m256i p = _mm256_loadu_si256((const __m256i *)(srcp + j - src_pitch));
+        const __m256i c = _mm256_loadu_si256((const __m256i *)(srcp + j));
+        const __m256i n = _mm256_loadu_si256((const __m256i *)(srcp + j + src_pitch));
+        const __m256i nn = _mm256_loadu_si256((const __m256i *)(srcp + j + 2*src_pitch));
+        const __m256i lo = combMask(_mm256_unpacklo_epi8(pp, zero), _mm256_unpacklo_epi8(p, zero), _mm256_unpacklo_epi8(c, zero),
+                                    _mm256_unpacklo_epi8(n, zero), _mm256_unpacklo_epi8(nn, zero), t, nt, t6);
+        const __m256i hi = combMask(_mm256_unpackhi_epi8(pp, zero), _mm256_unpackhi_epi8(p, zero), _mm256_unpackhi_epi8(c, zero),
+                                    _mm256_unpackhi_epi8(n, zero), _mm256_unpackhi_epi8(nn, zero), t, nt, t6);
+        _mm256_storeu_si256((__m256i *)(cmkp + j), _mm256_packs_epi16(lo, hi));
+    }
+}
+
+
+void vfmCombCountRowAVX2(const uint8_t *cmkpp, const uint8_t *cmkp, const uint8_t *cmkpn, int groups, int *sums) {
+    const __m256i ff = _mm256_set1_epi8(-1);
+    const __m256i one = _mm256_set1_epi8(1);
+    int i;
+
+    for (i=0; i+4<=groups; i+=4) {
+        const __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(cmkpp + i*8)), _mm256_loadu_si256((const __m256i *)(cmkp + i*8))),
+                                           _mm256_loadu_si256((const __m256i *)(cmkpn + i*8)));
+        const __m256i s = _mm256_sad_epu8(_mm256_and_si256(_mm256_cmpeq_epi8(m, ff), one), _mm256_setzero_si256());
+        const __m128i slo = _mm256_castsi256_si128(s);
+        const __m128i shi = _mm256_extracti128_si256(s, 1);
+        sums[i] += _mm_cvtsi128_si32(slo);
+        sums[i+1] += _mm_cvtsi128_si32(_mm_srli_si128(slo, 8));
+        sums[i+2] += _mm_cvtsi128_si32(shi);
+        sums[i+3] += _mm_cvtsi128_si32(_mm_srli_si128(shi, 8));
+    }
+
+    if (i < groups)
+        vfmCombCountRowC(cmkpp + i*8, cmkp + i*8, cmkpn + i*8, groups - i, sums + i);
+}
+
+
+// See diffMapRowSSE2 for how this relates to the C version.
+void vfmDiffMapRowAVX2(const uint8_t *dp, int tpitch, uint8_t *dstp, int width, int upper2, int lower2) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i four = _mm256_set1_epi8(4);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i t3 = _mm256_set1_epi8(3);
+    const __m256i t19 = _mm256_set1_epi8(19);
+    int x, k;
+
+    if (width < 40) {
+        vfmDiffMapRowC(dp, tpitch, dstp, width, upper2, lower2);
+        return;
+    }
+
+    vfmDiffMapPixelsC(dp, tpitch, dstp, width, upper2, lower2, 1, 4);
+
+    for (x=4; x+36<=width; x+=32) {
+        __m256i c3 = zero, c19 = zero;
+        __m256i up = zero, lo = zero, up2 = zero, lo2 = zero;
+        __m256i a, b, wide, inc;
+        const __m256i d = _mm256_loadu_si256((const __m256i *)(dp + x));
+
+        for (k=-1; k<=1; ++k) {
+            const __m256i vp = _mm256_loadu_si256((const __m256i *)(dp + x + k - tpitch));
+            const __m256i vc = _mm256_loadu_si256((const __m256i *)(dp + x + k));
+            const __m256i vn = _mm256_loadu_si256((const __m256i *)(dp + x + k + tpitch));
+            c3 = _mm256_sub_epi8(c3, _mm256_add_epi8(_mm256_add_epi8(cmpGtU8(vp, t3), cmpGtU8(vc, t3)), cmpGtU8(vn, t3)));
+            c19 = _mm256_sub_epi8(c19, _mm256_add_epi8(_mm256_add_epi8(cmpGtU8(vp, t19), cmpGtU8(vc, t19)), cmpGtU8(vn, t19)));
+        }
+
+        for (k=-4; k<=4; ++k) {
+            up = _mm256_or_si256(up, cmpGtU8(_mm256_loadu_si256((const __m256i *)(dp + x + k - tpitch)), t19));
+            lo = _mm256_or_si256(lo, cmpGtU8(_mm256_loadu_si256((const __m256i *)(dp + x + k + tpitch)), t19));
+            if (upper2)
+                up2 = _mm256_or_si256(up2, cmpGtU8(_mm256_loadu_si256((const __m256i *)(dp + x + k - 2*tpitch)), t19));
+            if (lower2)
+                lo2 = _mm256_or_si256(lo2, cmpGtU8(_mm256_loadu_si256((const __m256i *)(dp + x + k + 2*tpitch)), t19));
+        }
+
+        a = _mm256_and_si256(cmpGtU8(d, t3), _mm256_cmpgt_epi8(c3, one));
+        b = _mm256_and_si256(_mm256_and_si256(a, cmpGtU8(d, t19)), _mm256_cmpgt_epi8(c19, t3));
+        wide = _mm256_or_si256(_mm256_and_si256(up, _mm256_or_si256(lo, up2)), _mm256_and_si256(lo, _mm256_or_si256(up, lo2)));
+        inc = _mm256_or_si256(_mm256_and_si256(wide, two), _mm256_andnot_si256(wide, _mm256_and_si256(_mm256_cmpgt_epi8(c19, five), four)));
+        inc = _mm256_or_si256(_mm256_and_si256(a, one), _mm256_and_si256(b, inc));
+        _mm256_storeu_si256((__m256i *)(dstp + x), _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(dstp + x)), inc));
+    }
+
+    vfmDiffMapPixelsC(dp, tpitch, dstp, width, upper2, lower2, x, width-1);
+}
+
+
+void vfmFieldDiffRowAVX2(const uint8_t *prvpf, const uint8_t *prvnf,
+    const uint8_t *curpf, const uint8_t *curf, const uint8_t *curnf,
+    const uint8_t *nxtpf, const uint8_t *nxtnf,
+    const uint8_t *mapp, int map_pitch, int startx, int stopx, unsigned long *accum) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i bit2 = _mm256_set1_epi16(2);
+    const __m256i bit4 = _mm256_set1_epi16(4);
+    const __m256i t23 = _mm256_set1_epi16(23);
+    const __m256i t42 = _mm256_set1_epi16(42);
+    __m256i sums[6];
+    int x, i;
+
+    for (i=0; i<6; ++i)
+        sums[i] = _mm256_setzero_si256();
+
+    for (x=startx; x+16<=stopx; x+=16) {
+#define LOAD16(p) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)((p) + x)))
+        const __m256i m = _mm256_or_si256(LOAD16(mapp), LOAD16(mapp + map_pitch));
+        const __m256i m1 = _mm256_cmpeq_epi16(_mm256_and_si256(m, ones), ones);
+        const __m256i m2 = _mm256_cmpeq_epi16(_mm256_and_si256(m, bit2), bit2);
+        const __m256i m4 = _mm256_cmpeq_epi16(_mm256_and_si256(m, bit4), bit4);
+        const __m256i temp1 = _mm256_add_epi16(_mm256_add_epi16(LOAD16(curpf), _mm256_slli_epi16(LOAD16(curf), 2)), LOAD16(curnf));
+        const __m256i ps = _mm256_add_epi16(LOAD16(prvpf), LOAD16(prvnf));
+        const __m256i ns = _mm256_add_epi16(LOAD16(nxtpf), LOAD16(nxtnf));
+#undef LOAD16
+        const __m256i dp = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_add_epi16(ps, _mm256_add_epi16(ps, ps)), temp1));
+        const __m256i dn = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_add_epi16(ns, _mm256_add_epi16(ns, ns)), temp1));
+        __m256i gt;
+
+        gt = _mm256_and_si256(_mm256_cmpgt_epi16(dp, t23), m1);
+        sums[0] = _mm256_add_epi32(sums[0], _mm256_madd_epi16(_mm256_and_si256(dp, gt), ones));
+        gt = _mm256_cmpgt_epi16(dp, t42);
+        sums[2] = _mm256_add_epi32(sums[2], _mm256_madd_epi16(_mm256_and_si256(dp, _mm256_and_si256(gt, m2)), ones));
+        sums[4] = _mm256_add_epi32(sums[4], _mm256_madd_epi16(_mm256_and_si256(dp, _mm256_and_si256(gt, m4)), ones));
+
+        gt = _mm256_and_si256(_mm256_cmpgt_epi16(dn, t23), m1);
+        sums[1] = _mm256_add_epi32(sums[1], _mm256_madd_epi16(_mm256_and_si256(dn, gt), ones));
+        gt = _mm256_cmpgt_epi16(dn, t42);
+        sums[3] = _mm256_add_epi32(sums[3], _mm256_madd_epi16(_mm256_and_si256(dn, _mm256_and_si256(gt, m2)), ones));
+        sums[5] = _mm256_add_epi32(sums[5], _mm256_madd_epi16(_mm256_and_si256(dn, _mm256_and_si256(gt, m4)), ones));
+    }
+
+    for (i=0; i<6; ++i)
+        accum[i] += sumEpi32(sums[i]);
+
+    vfmFieldDiffRowC(prvpf, prvnf, curpf, curf, curnf, nxtpf, nxtnf, mapp, map_pitch, x, stopx, accum);
+}
+#endif
@@ -23,16 +23,23 @@
 #include "VSScript.h"
 #include <string>
 #include <map>
+#include <vector>
+#include <atomic>
+#include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <algorithm>
 #include <chrono>
 #include <locale>
 #include <sstream>
+#include <climits>
 #ifdef VS_TARGET_OS_WINDOWS
 #include <codecvt>
 #include <io.h>
 #include <fcntl.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
 #endif
 
 #define __STDC_FORMAT_MACROS
@@ -76,10 +83,14 @@ VSScript *se = nullptr;
 VSNodeRef *node = nullptr;
 FILE *outFile = nullptr;
 FILE *timecodesFile = nullptr;
+FILE *profileFile = nullptr;
 
 int requests = 0;
+int maxRequests = 0;
+int currentRequests = 0;
 int outputIndex = 0;
 int outputFrames = 0;
+int writtenFrames = 0;
 int requestedFrames = 0;
 int completedFrames = 0;
 int totalFrames = -1;
@@ -88,7 +99,8 @@ bool y4m = false;
 bool timecodes = false;
 int64_t currentTimecodeNum = 0;
 int64_t currentTimecodeDen = 1;
-bool outputError = false;
+std::atomic<bool> outputError(false);
+std::atomic<int> failedFrame(INT_MAX);
 bool showInfo = false;
 bool showVersion = false;
 bool printFrameNumber = false;
@@ -96,6 +108,50 @@ double fps = 0;
 bool hasMeaningfulFps = false;
 std::map<int, const VSFrameRef *> reorderMap;
 
+// Passes frames in output order to the writer thread. Frames are only pushed by queueReadyFrames() with the mutex
+// held, so it is the mutex and not the queue that keeps the producers apart. The writer is the only consumer and the
+// atomics just let it pop without taking the mutex for every frame.
+class FrameQueue {
+    std::vector<const VSFrameRef *> frames;
+    size_t mask;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+public:
+    FrameQueue() : mask(0), head(0), tail(0) {}
+
+    void setCapacity(size_t minCapacity) {
+        size_t capacity = 1;
+        while (capacity < minCapacity)
+            capacity *= 2;
+        frames.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    bool push(const VSFrameRef *f) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+            return false;
+        frames[t & mask] = f;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(const VSFrameRef *&f) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        f = frames[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
+
+FrameQueue outputQueue;
+
 std::string errorMessage;
 std::condition_variable condition;
 std::mutex mutex;
@@ -121,7 +177,45 @@ static inline void addRational(int64_t *num, int64_t *den, int64_t addnum, int64
     }
 }
 
+// All functions below that touch the frame counters or the reorder map have to be called with the mutex held
+
+// Frames before the failed one are still written
+static void setOutputError(const std::string &message, int n) {
+    if (errorMessage.empty())
+        errorMessage = message;
+    totalFrames = requestedFrames;
+    failedFrame = std::min<int>(failedFrame, n);
+    outputError = true;
+}
+
+// Moves the frames that are next in line from the reorder map to the writer
+static void queueReadyFrames() {
+    auto iter = reorderMap.find(outputFrames);
+    while (iter != reorderMap.end() && outputQueue.push(iter->second)) {
+        reorderMap.erase(iter);
+        outputFrames++;
+        iter = reorderMap.find(outputFrames);
+    }
+}
+
+// Frames that are waiting to be written count against the limit so a slow output can't make memory usage grow
+// without bound. The frames are requested by requestFrames() after the mutex has been released.
+static int reserveRequests(int &first) {
+    first = requestedFrames;
+    while (requestedFrames < totalFrames && requestedFrames - completedFrames < currentRequests && requestedFrames - writtenFrames < currentRequests + requests)
+        requestedFrames++;
+    return requestedFrames - first;
+}
+
+void VS_CC frameDoneCallback(void *userData, const VSFrameRef *f, int n, VSNodeRef *, const char *errorMsg);
+
+static void requestFrames(int first, int count) {
+    for (int i = 0; i < count; i++)
+        vsapi->getFrameAsync(first + i, node, frameDoneCallback, nullptr);
+}
+
 void VS_CC frameDoneCallback(void *userData, const VSFrameRef *f, int n, VSNodeRef *, const char *errorMsg) {
+    std::unique_lock<std::mutex> lock(mutex);
     completedFrames++;
 
     if (printFrameNumber) {
@@ -137,92 +231,16 @@ void VS_CC frameDoneCallback(void *userData, const VSFrameRef *f, int n, VSNodeR
 
     if (f) {
         reorderMap.insert(std::make_pair(n, f));
-        while (reorderMap.count(outputFrames)) {
-            const VSFrameRef *frame = reorderMap[outputFrames];
-            reorderMap.erase(outputFrames);
-            if (!outputError) {
-                if (y4m) {
-                    if (fwrite("FRAME\n", 1, 6, outFile) != 6) {
-                        if (errorMessage.empty())
-                            errorMessage = "Error: fwrite() call failed when writing header, errno: " + std::to_string(errno);
-                        totalFrames = requestedFrames;
-                        outputError = true;
-                    }
-                }
-
-                if (!outputError) {
-                    const VSFormat *fi = vsapi->getFrameFormat(frame);
-                    for (int p = 0; p < fi->numPlanes; p++) {
-                        int stride = vsapi->getStride(frame, p);
-                        const uint8_t *readPtr = vsapi->getReadPtr(frame, p);
-                        int rowSize = vsapi->getFrameWidth(frame, p) * fi->bytesPerSample;
-                        int height = vsapi->getFrameHeight(frame, p);
-                        for (int y = 0; y < height; y++) {
-                            if (fwrite(readPtr, 1, rowSize, outFile) != static_cast<size_t>(rowSize)) {
-                                if (errorMessage.empty())
-                                    errorMessage = "Error: fwrite() call failed when writing frame: " + std::to_string(outputFrames) + ", plane: " + std::to_string(p) +
-                                        ", line: " + std::to_string(y) + ", errno: " + std::to_string(errno);
-                                totalFrames = requestedFrames;
-                                outputError = true;
-                                p = 100; // break out of the outer loop
-                                break;
-                            }
-                            readPtr += stride;
-                        }
-                    }
-                }
-
-                if (timecodes && !outputError) {
-                    std::ostringstream stream;
-                    stream.imbue(std::locale("C"));
-                    stream.setf(std::ios::fixed, std::ios::floatfield);
-                    stream << (currentTimecodeNum * 1000 / static_cast<double>(currentTimecodeDen));
-                    if (fprintf(timecodesFile, "%s\n", stream.str().c_str()) < 0) {
-                        if (errorMessage.empty())
-                            errorMessage = "Error: failed to write timecode for frame " + std::to_string(outputFrames) + ". errno: " + std::to_string(errno);
-                        totalFrames = requestedFrames;
-                        outputError = true;
-                    } else {
-                        const VSMap *props = vsapi->getFramePropsRO(frame);
-                        int err_num, err_den;
-                        int64_t duration_num = vsapi->propGetInt(props, "_DurationNum", 0, &err_num);
-                        int64_t duration_den = vsapi->propGetInt(props, "_DurationDen", 0, &err_den);
-
-                        if (err_num || err_den || !duration_den) {
-                            if (errorMessage.empty()) {
-                                if (err_num || err_den)
-                                    errorMessage = "Error: missing duration at frame ";
-                                else if (!duration_den)
-                                    errorMessage = "Error: duration denominator is zero at frame ";
-                                errorMessage += std::to_string(outputFrames);
-                            }
-
-                            totalFrames = requestedFrames;
-                            outputError = true;
-                        } else {
-                            addRational(&currentTimecodeNum, &currentTimecodeDen, duration_num, duration_den);
-                        }
-                    }
-                }
-            }
-            vsapi->freeFrame(frame);
-            outputFrames++;
-        }
+        queueReadyFrames();
     } else {
-        outputError = true;
-        totalFrames = requestedFrames;
-        if (errorMessage.empty()) {
-            if (errorMsg)
-                errorMessage = "Error: Failed to retrieve frame " + std::to_string(n) + " with error: " + errorMsg;
-            else
-                errorMessage = "Error: Failed to retrieve frame " + std::to_string(n);
-        }
+        if (errorMsg)
+            setOutputError("Error: Failed to retrieve frame " + std::to_string(n) + " with error: " + errorMsg, n);
+        else
+            setOutputError("Error: Failed to retrieve frame " + std::to_string(n), n);
     }
 
-    if (requestedFrames < totalFrames) {
-        vsapi->getFrameAsync(requestedFrames, node, frameDoneCallback, nullptr);
-        requestedFrames++;
-    }
+    int first;
+    int count = reserveRequests(first);
 
     if (printFrameNumber && !outputError) {
         if (hasMeaningfulFps)
@@ -231,9 +249,164 @@ void VS_CC frameDoneCallback(void *userData, const VSFrameRef *f, int n, VSNodeR
             fprintf(stderr, "Frame: %d/%d\r", completedFrames, totalFrames);
     }
 
-    if (totalFrames == completedFrames) {
+    condition.notify_one();
+    lock.unlock();
+
+    requestFrames(first, count);
+}
+
+#ifndef VS_TARGET_OS_WINDOWS
+static bool writeVectors(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        while (count > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+#endif
+
+// Writes the frame header and all planes, planes without padding are written in a single piece
+static bool writeFrame(const VSFrameRef *frame) {
+    const VSFormat *fi = vsapi->getFrameFormat(frame);
+#ifdef VS_TARGET_OS_WINDOWS
+    if (y4m && fwrite("FRAME\n", 1, 6, outFile) != 6)
+        return false;
+
+    for (int p = 0; p < fi->numPlanes; p++) {
+        int stride = vsapi->getStride(frame, p);
+        const uint8_t *readPtr = vsapi->getReadPtr(frame, p);
+        size_t rowSize = vsapi->getFrameWidth(frame, p) * fi->bytesPerSample;
+        int height = vsapi->getFrameHeight(frame, p);
+        if (static_cast<size_t>(stride) == rowSize) {
+            if (fwrite(readPtr, 1, rowSize * height, outFile) != rowSize * height)
+                return false;
+        } else {
+            for (int y = 0; y < height; y++) {
+                if (fwrite(readPtr, 1, rowSize, outFile) != rowSize)
+                    return false;
+                readPtr += stride;
+            }
+        }
+    }
+#else
+    std::vector<struct iovec> iov;
+    if (y4m) {
+        struct iovec header = { const_cast<char *>("FRAME\n"), 6 };
+        iov.push_back(header);
+    }
+
+    for (int p = 0; p < fi->numPlanes; p++) {
+        int stride = vsapi->getStride(frame, p);
+        const uint8_t *readPtr = vsapi->getReadPtr(frame, p);
+        size_t rowSize = vsapi->getFrameWidth(frame, p) * fi->bytesPerSample;
+        int height = vsapi->getFrameHeight(frame, p);
+        if (static_cast<size_t>(stride) == rowSize) {
+            struct iovec plane = { const_cast<uint8_t *>(readPtr), rowSize * height };
+            iov.push_back(plane);
+        } else {
+            for (int y = 0; y < height; y++) {
+                struct iovec row = { const_cast<uint8_t *>(readPtr), rowSize };
+                iov.push_back(row);
+                readPtr += stride;
+            }
+        }
+    }
+
+    int fd = fileno(outFile);
+    for (size_t i = 0; i < iov.size(); i += IOV_MAX)
+        if (!writeVectors(fd, iov.data() + i, static_cast<int>(std::min<size_t>(IOV_MAX, iov.size() - i))))
+            return false;
+#endif
+    return true;
+}
+
+static bool writeTimecode(const VSFrameRef *frame, int n) {
+    std::ostringstream stream;
+    stream.imbue(std::locale("C"));
+    stream.setf(std::ios::fixed, std::ios::floatfield);
+    stream << (currentTimecodeNum * 1000 / static_cast<double>(currentTimecodeDen));
+    if (fprintf(timecodesFile, "%s\n", stream.str().c_str()) < 0) {
         std::lock_guard<std::mutex> lock(mutex);
-        condition.notify_one();
+        setOutputError("Error: failed to write timecode for frame " + std::to_string(n) + ". errno: " + std::to_string(errno), n);
+        return false;
+    }
+
+    const VSMap *props = vsapi->getFramePropsRO(frame);
+    int err_num, err_den;
+    int64_t duration_num = vsapi->propGetInt(props, "_DurationNum", 0, &err_num);
+    int64_t duration_den = vsapi->propGetInt(props, "_DurationDen", 0, &err_den);
+
+    if (err_num || err_den || !duration_den) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (err_num || err_den)
+            setOutputError("Error: missing duration at frame " + std::to_string(n), n);
+        else
+            setOutputError("Error: duration denominator is zero at frame " + std::to_string(n), n);
+        return false;
+    }
+
+    addRational(&currentTimecodeNum, &currentTimecodeDen, duration_num, duration_den);
+    return true;
+}
+
+// Does all the writing so a slow output never blocks the frame done callback and with it the core. The number of
+// requests is raised when the writer runs dry while later frames are done and lowered when it falls behind.
+static void writerThread() {
+    for (;;) {
+        const VSFrameRef *frame;
+        if (outputQueue.pop(frame)) {
+            int n = writtenFrames;
+            if (n < failedFrame) {
+                if (!writeFrame(frame)) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    setOutputError("Error: write call failed when writing frame: " + std::to_string(n) + ", errno: " + std::to_string(errno), n);
+                } else if (timecodes) {
+                    writeTimecode(frame, n);
+                }
+            }
+            vsapi->freeFrame(frame);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            writtenFrames++;
+            if (outputQueue.size() >= static_cast<size_t>(requests) && currentRequests > requests)
+                currentRequests--;
+            queueReadyFrames();
+            int first;
+            int count = reserveRequests(first);
+            lock.unlock();
+            requestFrames(first, count);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (outputQueue.size())
+            continue;
+        if (completedFrames == totalFrames)
+            break;
+        if (!reorderMap.empty() && currentRequests < maxRequests) {
+            currentRequests++;
+            int first;
+            int count = reserveRequests(first);
+            if (count) {
+                lock.unlock();
+                requestFrames(first, count);
+                continue;
+            }
+        }
+        condition.wait(lock);
     }
 }
 
@@ -242,6 +415,9 @@ bool outputNode() {
         const VSCoreInfo *info = vsapi->getCoreInfo(vsscript_getCore(se));
         requests = info->numThreads;
     }
+    currentRequests = requests;
+    maxRequests = requests * 2;
+    outputQueue.setCapacity(maxRequests + requests);
 
     const VSVideoInfo *vi = vsapi->getVideoInfo(node);
 
@@ -304,15 +480,23 @@ bool outputNode() {
         }
     }
 
+    // the frames are written directly to the file descriptor from now on
+    fflush(outFile);
+
+    std::thread writer(writerThread);
+
     std::unique_lock<std::mutex> lock(mutex);
+    int first;
+    int count = reserveRequests(first);
+    lock.unlock();
+    requestFrames(first, count);
 
-    int requestStart = completedFrames;
-    int intitalRequestSize = std::min(requests, totalFrames - requestStart);
-    requestedFrames = requestStart + intitalRequestSize;
-    for (int n = requestStart; n < requestStart + intitalRequestSize; n++)
-        vsapi->getFrameAsync(n, node, frameDoneCallback, nullptr);
+    writer.join();
 
-    condition.wait(lock);
+    // frames after a failed one never reach the writer
+    for (auto &iter : reorderMap)
+        vsapi->freeFrame(iter.second);
+    reorderMap.clear();
 
     if (outputError) {
         fprintf(stderr, "%s\n", errorMessage.c_str());
@@ -345,6 +529,50 @@ bool nstringToInt(const nstring &ns, int &result) {
     return pos == s.length();
 }
 
+static std::string escapeJSON(const char *s) {
+    std::string result;
+    for (; *s; s++) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            sprintf(buf, "\\u%04x", c);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static void writeProfile(FILE *f, VSCore *core) {
+    static const char *reasonNames[] = { "error", "initial", "frameready", "allframesready" };
+
+    VSMap *profile = vsapi->createMap();
+    vsapi->getProfile(profile, core);
+    int numEntries = vsapi->propNumElements(profile, "id");
+
+    fprintf(f, "[\n");
+    for (int i = 0; i < numEntries; i++) {
+        int reason = int64ToIntS(vsapi->propGetInt(profile, "reason", i, nullptr));
+        fprintf(f, "  {\"name\": \"%s\", \"id\": %" PRId64 ", \"reason\": \"%s\", \"walltime\": %.6f, \"cputime\": %.6f, \"calls\": %" PRId64 ", \"frames\": %" PRId64 ", \"bytes\": %" PRId64 "}%s\n",
+            escapeJSON(vsapi->propGetData(profile, "name", i, nullptr)).c_str(),
+            vsapi->propGetInt(profile, "id", i, nullptr),
+            (reason >= arError && reason <= arAllFramesReady) ? reasonNames[reason - arError] : "unknown",
+            vsapi->propGetFloat(profile, "walltime", i, nullptr),
+            vsapi->propGetFloat(profile, "cputime", i, nullptr),
+            vsapi->propGetInt(profile, "calls", i, nullptr),
+            vsapi->propGetInt(profile, "frames", i, nullptr),
+            vsapi->propGetInt(profile, "bytes", i, nullptr),
+            (i + 1 < numEntries) ? "," : "");
+    }
+    fprintf(f, "]\n");
+
+    vsapi->freeMap(profile);
+}
+
 bool printVersion() {
     if (!vsscript_init()) {
         fprintf(stderr, "Failed to initialize VapourSynth environment\n");
@@ -385,6 +613,7 @@ void printHelp() {
         "  -r, --requests N      Set number of concurrent frame requests\n"
         "  -y, --y4m             Add YUV4MPEG headers to output\n"
         "  -t, --timecodes FILE  Write timecodes v2 file\n"
+        "      --profile FILE    Write per filter timing and allocation statistics as JSON\n"
         "  -p, --progress        Print progress to stderr\n"
         "  -i, --info            Show video info and exit\n"
         "  -v, --version         Show version info and exit\n"
@@ -412,7 +641,7 @@ int wmain(int argc, wchar_t **argv) {
 #else
 int main(int argc, char **argv) {
 #endif
-    nstring outputFilename, scriptFilename, timecodesFilename;
+    nstring outputFilename, scriptFilename, timecodesFilename, profileFilename;
     bool showHelp = false;
     std::map<std::string, std::string> scriptArgs;
     int startFrame = 0;
@@ -447,6 +676,7 @@ int main(int argc, char **argv) {
 
             completedFrames = startFrame;
             outputFrames = startFrame;
+            writtenFrames = startFrame;
             requestedFrames = startFrame;
             lastFpsReportFrame = startFrame;
 
@@ -515,6 +745,15 @@ int main(int argc, char **argv) {
             timecodes = true;
             timecodesFilename = argv[arg + 1];
 
+            arg++;
+        } else if (argString == NSTRING("--profile")) {
+            if (argc <= arg + 1) {
+                fprintf(stderr, "No profile file specified\n");
+                return 1;
+            }
+
+            profileFilename = argv[arg + 1];
+
             arg++;
         } else if (scriptFilename.empty() && !argString.empty() && argString.substr(0, 1) != NSTRING("-")) {
             scriptFilename = argString;
@@ -568,6 +807,18 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (!profileFilename.empty()) {
+#ifdef VS_TARGET_OS_WINDOWS
+        profileFile = _wfopen(profileFilename.c_str(), L"wb");
+#else
+        profileFile = fopen(profileFilename.c_str(), "wb");
+#endif
+        if (!profileFile) {
+            fprintf(stderr, "Failed to open profile file for writing\n");
+            return 1;
+        }
+    }
+
     if (!vsscript_init()) {
         fprintf(stderr, "Failed to initialize VapourSynth environment\n");
         return 1;
@@ -658,13 +909,21 @@ int main(int argc, char **argv) {
             return 1;
         }
 
+        if (profileFile)
+            vsapi->setProfiling(1, vsscript_getCore(se));
+
         lastFpsReportTime = std::chrono::high_resolution_clock::now();;
         error = outputNode();
+
+        if (profileFile)
+            writeProfile(profileFile, vsscript_getCore(se));
     }
 
     fflush(outFile);
     if (timecodesFile)
         fclose(timecodesFile);
+    if (profileFile)
+        fclose(profileFile);
 
     if (!showInfo) {
         int totalFrames = outputFrames - startFrame;
@@ -1,3 +1,4 @@
+import struct
 import unittest
 import vapoursynth as vs
 
@@ -21,6 +22,35 @@ class FilterTestSequence(unittest.TestCase):
             self.assertEqual(frame.props.PlaneDifference1, 0)
             self.assertEqual(frame.props.PlaneDifference2, 0)
 
+    # A clip with a different value in every pixel so offsets and tails are noticed
+    def texture(self, format, width, height, seed=0):
+        clip = self.BlankClip(format=format, width=width, height=height, length=1)
+
+        def fill(n, f):
+            fout = f.copy()
+            for p in range(fout.format.num_planes):
+                arr = fout.get_write_array(p)
+                for y in range(arr.shape[0]):
+                    for x in range(arr.shape[1]):
+                        v = (x * 37 + y * 101 + (x * y) % 13 + p * 59 + seed * 71) % 256
+                        if fout.format.sample_type == vs.FLOAT:
+                            arr[y, x] = v / 255.0
+                        else:
+                            arr[y, x] = v << (fout.format.bits_per_sample - 8) | (x + y) % (1 << (fout.format.bits_per_sample - 8))
+            return fout
+
+        return self.core.std.ModifyFrame(clip, clip, fill)
+
+    def checkPixels(self, a, b):
+        fa = a.get_frame(0)
+        fb = b.get_frame(0)
+        for p in range(fa.format.num_planes):
+            arra = fa.get_read_array(p)
+            arrb = fb.get_read_array(p)
+            for y in range(arra.shape[0]):
+                for x in range(arra.shape[1]):
+                    self.assertEqual(arra[y, x], arrb[y, x], 'plane {} at {},{}'.format(p, x, y))
+
     def testLUT16Bit(self):
         clip = self.BlankClip(format=vs.YUV420P16, color=[69, 242, 115])
 
@@ -28,6 +58,19 @@ class FilterTestSequence(unittest.TestCase):
 
         self.checkDifference(clip, ret)
 
+    def testLUTFloat(self):
+        clip = self.BlankClip(format=vs.YUV444PS, color=[0.25, -0.125, 0.375])
+
+        ret = self.Lut(clip, planes=[0, 1, 2], function=lambda x: x * 2)
+        frame = ret.get_frame(0)
+        self.assertEqual(frame.get_read_array(0)[0, 0], 0.5)
+        self.assertEqual(frame.get_read_array(1)[0, 0], -0.25)
+        self.assertEqual(frame.get_read_array(2)[0, 0], 0.75)
+
+        # the lut covers the 0-1 range with 4 segments
+        ret = self.Lut(clip, planes=0, lutf=[0.0, 0.5, 0.5, 0.5, 1.0])
+        self.assertEqual(ret.get_frame(0).get_read_array(0)[0, 0], 0.5)
+
     def testLUT2_8Bit(self):
         clipx = self.BlankClip(format=vs.YUV420P8, color=[69, 242, 115])
         clipy = self.BlankClip(format=vs.YUV420P8, color=[115, 103, 205])
@@ -87,5 +130,190 @@ class FilterTestSequence(unittest.TestCase):
         comp = self.BlankClip(format=vs.YUV420P8, color=[128, 10, 244])
         self.checkDifference(comp, ret)
 
+    def testLUT2_16Bit(self):
+        # The rows of big tables are only made for the values that are used.
+        clipx = self.BlankClip(format=vs.YUV420P16, color=[6900, 24200, 11500])
+        clipy = self.BlankClip(format=vs.YUV420P16, color=[1500, 60000, 44200])
+
+        ret = self.Lut2(clipa=clipx, clipb=clipy, planes=[0, 1, 2], function=lambda x, y: max(x, y))
+        comp = self.BlankClip(format=vs.YUV420P16, color=[6900, 60000, 44200])
+        self.checkDifference(comp, ret)
+
+    def testMerge16Bit(self):
+        clipa = self.BlankClip(format=vs.YUV444P16, color=[1000, 60000, 30000])
+        clipb = self.BlankClip(format=vs.YUV444P16, color=[65535, 0, 30001])
+
+        ret = self.core.std.Merge(clipa, clipb, weight=0.3)
+        comp = self.BlankClip(format=vs.YUV444P16, color=[20360, 42001, 30000])
+        self.checkDifference(comp, ret)
+
+    def testMaskedMerge16Bit(self):
+        clipa = self.BlankClip(format=vs.YUV444P16, color=[1000, 60000, 30000])
+        clipb = self.BlankClip(format=vs.YUV444P16, color=[65535, 0, 30001])
+        mask = self.BlankClip(format=vs.YUV444P16, color=[65535, 2, 32768])
+
+        ret = self.core.std.MaskedMerge(clipa, clipb, mask)
+        comp = self.BlankClip(format=vs.YUV444P16, color=[65535, 59998, 30001])
+        self.checkDifference(comp, ret)
+
+    def testMakeDiffMergeDiff10Bit(self):
+        clipa = self.BlankClip(format=vs.YUV444P10, color=[0, 1023, 700])
+        clipb = self.BlankClip(format=vs.YUV444P10, color=[1023, 0, 200])
+
+        ret = self.core.std.MakeDiff(clipa, clipb)
+        comp = self.BlankClip(format=vs.YUV444P10, color=[0, 1023, 1012])
+        self.checkDifference(comp, ret)
+
+        ret = self.core.std.MergeDiff(clipa, clipb)
+        comp = self.BlankClip(format=vs.YUV444P10, color=[511, 511, 388])
+        self.checkDifference(comp, ret)
+
+    def testMakeDiffFloat(self):
+        # Chroma differences are centered on 0 instead of 0.5.
+        clipa = self.BlankClip(format=vs.YUV444PS, color=[0.25, 0.25, -0.5])
+        clipb = self.BlankClip(format=vs.YUV444PS, color=[0.5, -0.125, 0.25])
+
+        frame = self.core.std.MakeDiff(clipa, clipb).get_frame(0)
+        self.assertEqual(frame.get_read_array(0)[0, 0], 0.25)
+        self.assertEqual(frame.get_read_array(1)[0, 0], 0.375)
+        self.assertEqual(frame.get_read_array(2)[0, 0], -0.5)
+
+    # Compares every pixel of frame 0 with op applied to the same pixel of the sources
+    def checkPerPixel(self, ret, clips, op):
+        fout = ret.get_frame(0)
+        fin = [c.get_frame(0) for c in clips]
+        for p in range(fout.format.num_planes):
+            arr = fout.get_read_array(p)
+            src = [f.get_read_array(p) for f in fin]
+            for y in range(arr.shape[0]):
+                for x in range(arr.shape[1]):
+                    self.assertEqual(arr[y, x], op(p, *[s[y, x] for s in src]), 'plane {} at {},{}'.format(p, x, y))
+
+    def testMergeFiltersTexture(self):
+        # The references follow the C versions, including their wraparound and float rounding
+        f32 = lambda v: struct.unpack('f', struct.pack('f', v))[0]
+        wrap32 = lambda v: (v + (1 << 31)) % (1 << 32) - (1 << 31)
+        clamp = lambda v, lower, upper: min(max(v, lower), upper)
+
+        for format in [vs.YUV444P8, vs.YUV444P10, vs.YUV444P16, vs.YUV444PS]:
+            clipa = self.texture(format, 77, 5, seed=0)
+            clipb = self.texture(format, 77, 5, seed=1)
+            mask = self.texture(format, 77, 5, seed=2)
+            fmt = clipa.format
+            bits = fmt.bits_per_sample
+
+            if fmt.sample_type == vs.FLOAT:
+                weight = f32(0.3)
+                self.checkPerPixel(self.core.std.Merge(clipa, clipb, weight=0.3), [clipa, clipb],
+                    lambda p, a, b: f32(a + f32(f32(b - a) * weight)))
+                self.checkPerPixel(self.core.std.MaskedMerge(clipa, clipb, mask), [clipa, clipb, mask],
+                    lambda p, a, b, m: f32(a + f32(f32(b - a) * m)))
+                self.checkPerPixel(self.core.std.MakeDiff(clipa, clipb), [clipa, clipb],
+                    lambda p, a, b: clamp(f32(a - b), -0.5, 0.5) if p else clamp(f32(f32(a - b) + 0.5), 0, 1))
+                self.checkPerPixel(self.core.std.MergeDiff(clipa, clipb), [clipa, clipb],
+                    lambda p, a, b: clamp(f32(a + b), -0.5, 0.5) if p else clamp(f32(f32(a + b) - 0.5), 0, 1))
+            else:
+                weight = int(f32(0.3) * (1 << 15) + 0.5)
+                maxvalue = (1 << bits) - 1
+                half = 1 << (bits - 1)
+                shift = 8 if bits == 8 else bits
+                self.checkPerPixel(self.core.std.Merge(clipa, clipb, weight=0.3), [clipa, clipb],
+                    lambda p, a, b: (a + (((b - a) * weight + (1 << 14)) >> 15)) & maxvalue)
+                self.checkPerPixel(self.core.std.MaskedMerge(clipa, clipb, mask), [clipa, clipb, mask],
+                    lambda p, a, b, m: (a + (wrap32((b - a) * (m + 1 if m > 2 else m) + (1 << (shift - 1))) >> shift)) & 0xFFFF)
+                self.checkPerPixel(self.core.std.MakeDiff(clipa, clipb), [clipa, clipb],
+                    lambda p, a, b: clamp(a - b + half, 0, maxvalue))
+                self.checkPerPixel(self.core.std.MergeDiff(clipa, clipb), [clipa, clipb],
+                    lambda p, a, b: clamp(a + b - half, 0, maxvalue))
+
+    def testFilterChain(self):
+        clip = self.BlankClip(format=vs.YUV420P16, color=[6900, 24200, 11500], width=64, height=48)
+        clip = self.core.std.AddBorders(clip, left=10, top=6, color=[60000, 1000, 40000])
+
+        ret = self.core.std.FilterChain(clip, ["Maximum", "Minimum threshold=20 planes=0,2", "Convolution matrix=1,2,1,2,4,2,1,2,1"])
+        comp = self.core.std.Maximum(clip)
+        comp = self.core.std.Minimum(comp, threshold=20, planes=[0, 2])
+        comp = self.core.std.Convolution(comp, matrix=[1, 2, 1, 2, 4, 2, 1, 2, 1])
+        self.checkDifference(comp, ret)
+
+        ret = self.core.std.FilterChain(clip, ["Median planes=1", "Sobel min=100 rshift=1", "Deflate"])
+        comp = self.core.std.Median(clip, planes=1)
+        comp = self.core.std.Sobel(comp, min=100, rshift=1)
+        comp = self.core.std.Deflate(comp)
+        self.checkDifference(comp, ret)
+
+    # The whole matrix applied at every pixel with mirrored edges, as the 2D convolution does
+    def checkConvolution(self, clip, ret, rows, saturate=True):
+        fc = clip.get_frame(0)
+        fr = ret.get_frame(0)
+        divisor = sum(sum(row) for row in rows) or 1
+        max_value = (1 << fc.format.bits_per_sample) - 1
+        mirror = lambda i, size: max(0, min(2 * (size - 1) - abs(i) if abs(i) >= size else abs(i), size - 1))
+        for p in range(fc.format.num_planes):
+            src = fc.get_read_array(p)
+            dst = fr.get_read_array(p)
+            height, width = src.shape[0], src.shape[1]
+            for y in range(height):
+                for x in range(width):
+                    total = 0
+                    for j, row in enumerate(rows):
+                        for i, c in enumerate(row):
+                            total += c * src[mirror(y + j - len(rows) // 2, height), mirror(x + i - len(row) // 2, width)]
+                    value = int(total / divisor + 0.5)
+                    if not saturate:
+                        value = abs(value)
+                    self.assertEqual(dst[y, x], min(max_value, max(value, 0)), 'plane {} at {},{}'.format(p, x, y))
+
+    def testConvolutionSeparable(self):
+        # A binomial 5x5 matrix is split into two passes internally, the widths aren't a multiple of any vector size
+        matrix = [1, 4, 6, 4, 1, 4, 16, 24, 16, 4, 6, 24, 36, 24, 6, 4, 16, 24, 16, 4, 1, 4, 6, 4, 1]
+        taps = list(range(-12, 13))
+        for format, width in [(vs.YUV444P8, 77), (vs.GRAY16, 45)]:
+            clip = self.texture(format, width, 11)
+
+            ret = self.core.std.Convolution(clip, matrix=matrix)
+            self.checkConvolution(clip, ret, [matrix[i:i + 5] for i in range(0, 25, 5)])
+
+            ret = self.core.std.Convolution(clip, matrix=taps, mode="h", saturate=False)
+            self.checkConvolution(clip, ret, [taps], saturate=False)
+
+            ret = self.core.std.Convolution(clip, matrix=taps[:7], mode="v", saturate=False)
+            self.checkConvolution(clip, ret, [[c] for c in taps[:7]], saturate=False)
+
+        clip = self.texture(vs.YUV444P8, 77, 11)
+        ret = self.core.std.FilterChain(clip, ["Convolution matrix=1,1,1,1,1,1,1,1,1,1,1 mode=v", "Maximum"])
+        comp = self.core.std.Maximum(self.core.std.Convolution(clip, matrix=[1] * 11, mode="v"))
+        self.checkDifference(comp, ret)
+
+    def testExprDeepStack(self):
+        # Strips narrower than a vector are done by the interpreter only so they
+        # are a reference for the compiled code, which spills stack positions below the fifth
+        exprs = ['x y z x y z x y z + + + + + + + +', 'x 2 * y 3 * z 4 * x 5 * y 6 * z 7 * + + + + +']
+        for format in [vs.GRAY8, vs.GRAY16]:
+            clips = [self.texture(format, 77, 6, seed) for seed in range(3)]
+            for expr in exprs:
+                expr += ' 8 /'
+                ret = self.core.std.Expr(clips, expr)
+                strips = []
+                for left in range(0, 77, 7):
+                    strips.append(self.core.std.Expr([self.core.std.CropAbs(c, width=7, height=6, left=left) for c in clips], expr))
+                self.checkPixels(self.core.std.StackHorizontal(strips), ret)
+
+    def testFrameEvalKey(self):
+        clip = self.BlankClip(format=vs.GRAY8, length=30, color=[20])
+        calls = []
+
+        def evaluate(n):
+            calls.append(n)
+            return self.core.std.Expr(clip, 'x {} +'.format(n % 3))
+
+        ret = self.core.std.FrameEval(clip, evaluate, key=lambda n: n % 3)
+        for n in range(ret.num_frames):
+            self.assertEqual(ret.get_frame(n).get_read_array(0)[0, 0], 20 + n % 3)
+        self.assertEqual(len(calls), 3)
+
+        with self.assertRaises(vs.Error):
+            self.core.std.FrameEval(clip, evaluate, key=lambda n: 'a').get_frame(0)
+
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,33 @@
+import os
+import sys
+import time
+import vapoursynth as vs
+
+# Measures the per request overhead of the frame scheduler. The clips are tiny so
+# almost all of the time is spent queueing, tracking and propagating frame contexts.
+# usage: python scheduler_benchmark.py [depth] [frames] [threads]
+
+depth = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+frames = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+threads = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+
+core = vs.get_core(threads=threads if threads > 0 else None)
+
+clip = core.std.BlankClip(format=vs.GRAY8, width=16, height=16, length=frames)
+src = clip
+for i in range(depth):
+    # every other node has two dependencies to exercise frame tracking as well
+    if i % 2:
+        clip = core.std.Merge(clip, src)
+    else:
+        clip = core.std.Invert(clip)
+
+with open(os.devnull, 'wb') as f:
+    start = time.perf_counter()
+    clip.output(f)
+    elapsed = time.perf_counter() - start
+
+# every node requests one frame and the merges request a second one from src
+requests = frames * (depth + depth // 2)
+print('depth {}, {} frames, {} threads'.format(depth, frames, core.num_threads))
+print('{:.3f}s, {:.0f} frames/s, {:.2f} us per request'.format(elapsed, frames / elapsed, elapsed * 1e6 / requests))
@@ -1,3 +1,5 @@
+import io
+import tempfile
 import unittest
 import vapoursynth as vs
 
@@ -186,5 +188,62 @@ class CoreTestSequence(unittest.TestCase):
         with self.assertRaises(vs.Error):
             self.core.std.ShufflePlanes([clip1, clip2, clip1], planes=[0, 1, 2], colorfamily=vs.RGB)
 
+    # files with a descriptor are written natively, everything else through write()
+    def test_output_file(self):
+        clip = self.core.std.BlankClip(format=vs.YUV420P8, width=102, height=48, length=30, color=[69, 242, 115])
+        clip = self.core.std.AddBorders(clip, left=2, color=[16, 128, 128])
+
+        ref = io.BytesIO()
+        clip.output(ref, y4m=True)
+
+        progress = []
+        with tempfile.TemporaryFile() as f:
+            clip.output(f, y4m=True, progress_update=lambda n, total: progress.append((n, total)))
+            f.seek(0)
+            self.assertEqual(f.read(), ref.getvalue())
+        self.assertEqual(progress[-1], (30, 30))
+
+    def test_output_progress_error(self):
+        def progress(n, total):
+            if n == 5:
+                raise ValueError('stop')
+
+        clip = self.core.std.BlankClip(length=100)
+        with tempfile.TemporaryFile() as f:
+            with self.assertRaises(vs.Error):
+                clip.output(f, progress_update=progress)
+
+    # a view of a writable frame has to see later writes to it instead of the plane it shared before
+    def test_frame_buffer_after_write(self):
+        frame = self.core.std.BlankClip(format=vs.GRAY8, width=4, height=2, color=[7]).get_frame(0)
+        copy = frame.copy()
+        view = memoryview(copy.get_plane(0))
+        copy.get_write_array(0)[0, 0] = 1
+        self.assertEqual(view[0, 0], 1)
+        self.assertEqual(frame.get_read_array(0)[0, 0], 7)
+
+    # planes of existing frames are aligned and used without copying
+    def test_create_video_frame(self):
+        frame = self.core.std.BlankClip(format=vs.YUV420P16, width=64, height=48, color=[6900, 24200, 11500]).get_frame(0)
+        self.assertEqual(memoryview(frame.get_plane(1)).shape, (24, 32))
+        self.assertEqual(memoryview(frame.get_plane(1)).format, 'H')
+
+        planes = [frame.get_plane(p) for p in range(3)]
+        new = self.core.create_video_frame(vs.YUV420P16, 64, 48, planes, prop_src=frame)
+        self.assertEqual(new.get_read_array(2)[23, 31], 11500)
+        self.assertEqual(new.props._DurationNum, frame.props._DurationNum)
+
+        copy = new.copy()
+        copy.get_write_array(0)[0, 0] = 1
+        self.assertEqual(copy.get_read_array(0)[0, 0], 1)
+        self.assertEqual(new.get_read_array(0)[0, 0], 6900)
+        self.assertEqual(frame.get_read_array(0)[0, 0], 6900)
+
+        gray = self.core.create_video_frame(vs.GRAY8, 3, 2, [memoryview(bytes(range(6))).cast('B', (2, 3))])
+        self.assertEqual(memoryview(gray).tolist(), [[0, 1, 2], [3, 4, 5]])
+
+        with self.assertRaises(vs.Error):
+            self.core.create_video_frame(vs.GRAY8, 4, 2, [memoryview(bytes(range(6))).cast('B', (2, 3))])
+
 if __name__ == '__main__':
     unittest.main()
@@ -0,0 +1,98 @@
+import os
+import sys
+import time
+import vapoursynth as vs
+
+# Times VFM on a synthetic telecined clip and records the chosen matches and
+# combing metrics of every frame. If the results file already exists the run is
+# compared against it instead, which makes it easy to check that different
+# builds or cpu feature levels give identical results. Pass opt to pick the
+# optimizations VFM uses, or "check" to compare every opt level against the C
+# code.
+# usage: python vfm_benchmark.py [frames] [threads] [results file] [opt|check]
+
+frames = int(sys.argv[1]) if len(sys.argv) > 1 else 500
+threads = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+results = sys.argv[3] if len(sys.argv) > 3 and sys.argv[3] else None
+check = len(sys.argv) > 4 and sys.argv[4] == 'check'
+opt = int(sys.argv[4]) if len(sys.argv) > 4 and not check else 2
+
+core = vs.get_core(threads=threads if threads > 0 else None)
+
+width = 1920
+height = 1080
+band = 120
+progressive = frames * 4 // 5 + 4
+
+# bands of vertical stripes that move horizontally at different speeds
+def stripes(seed):
+    clips = []
+    x = 0
+    i = 0
+    while x < width + 256:
+        w = 8 + 2 * ((seed * 7 + i * 13) % 20)
+        v = (seed * 31 + i * 57) % 256
+        clips.append(core.std.BlankClip(format=vs.YUV420P8, width=w, height=band, length=progressive, color=[v, (v * 3) % 256, 255 - v]))
+        x += w
+        i += 1
+    return core.std.StackHorizontal(clips)
+
+base = core.std.BlankClip(format=vs.YUV420P8, width=width, height=band, length=progressive)
+rows = []
+for r in range(height // band):
+    row = stripes(r)
+    speed = 2 * (r + 1)
+    rows.append(core.std.FrameEval(base, lambda n, row=row, speed=speed: row.std.CropAbs(width=width, height=band, left=(n * speed) % 256)))
+clip = core.std.StackVertical(rows)
+
+# 3:2 pulldown, AA BB BC CD DD
+clip = core.std.SeparateFields(clip, tff=True)
+clip = core.std.SelectEvery(clip, cycle=8, offsets=[0, 1, 2, 3, 2, 5, 4, 7, 6, 7])
+clip = core.std.DoubleWeave(clip, tff=True)
+clip = core.std.SelectEvery(clip, cycle=2, offsets=0)
+clip = clip[:frames]
+telecined = clip
+
+clip = core.vivtc.VFM(telecined, order=1, micout=1, opt=opt)
+
+with open(os.devnull, 'wb') as f:
+    start = time.perf_counter()
+    clip.output(f)
+    elapsed = time.perf_counter() - start
+
+print('{} frames, {} threads'.format(clip.num_frames, core.num_threads))
+print('{:.3f}s, {:.2f} frames/s'.format(elapsed, clip.num_frames / elapsed))
+
+if results:
+    lines = []
+    for n in range(clip.num_frames):
+        props = clip.get_frame(n).props
+        lines.append('{} {} {}\n'.format(n, props.VFMMatch, ' '.join(str(m) for m in props.VFMMics)))
+
+    if os.path.exists(results):
+        with open(results, 'r') as f:
+            expected = f.readlines()
+        mismatches = [n for n in range(max(len(lines), len(expected))) if n >= len(lines) or n >= len(expected) or lines[n] != expected[n]]
+        if mismatches:
+            print('{} frames differ from {}, first is frame {}'.format(len(mismatches), results, mismatches[0]))
+            sys.exit(1)
+        print('results match {}'.format(results))
+    else:
+        with open(results, 'w') as f:
+            f.writelines(lines)
+        print('results written to {}'.format(results))
+
+if check:
+    reference = core.vivtc.VFM(telecined, order=1, micout=1, opt=0)
+    for level in (1, 2):
+        test = core.vivtc.VFM(telecined, order=1, micout=1, opt=level)
+        for n in range(reference.num_frames):
+            a = reference.get_frame(n)
+            b = test.get_frame(n)
+            same = a.props.VFMMatch == b.props.VFMMatch and list(a.props.VFMMics) == list(b.props.VFMMics)
+            for p in range(a.format.num_planes):
+                same = same and bytes(a.get_read_array(p)) == bytes(b.get_read_array(p))
+            if not same:
+                print('opt={} differs from the C code at frame {}'.format(level, n))
+                sys.exit(1)
+    print('opt=1 and opt=2 match the C code')